@@ -54,6 +54,7 @@ class Dumpsys {
     enum class Type {
         DUMP,  // dump using `dump` function
         PID,   // dump pid of server only
+        THREAD_POOL,  // dump binder thread pool statistics of server only
     };
 
     /**
@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 
 #include <android-base/file.h>
+#include <binder/ProcessState.h>
 #include <serviceutils/PriorityDumper.h>
 #include <utils/String16.h>
 #include <utils/String8.h>
@@ -561,6 +562,16 @@ TEST_F(DumpsysTest, ListServiceWithPid) {
     AssertOutput(std::to_string(getpid()) + "\n");
 }
 
+// Tests 'dumpsys --thread-pool service_name'
+TEST_F(DumpsysTest, ListServiceWithThreadPool) {
+    ProcessState::self();
+    ExpectCheckService("Locksmith");
+
+    CallMain({"--thread-pool", "Locksmith"});
+
+    AssertOutputContains("Binder thread pool of pid " + std::to_string(getpid()));
+}
+
 TEST_F(DumpsysTest, GetBytesWritten) {
     const char* serviceName = "service2";
     const char* dumpContents = "dump1";
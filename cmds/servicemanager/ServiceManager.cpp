@@ -24,7 +24,9 @@
 #include <binder/Stability.h>
 #include <cutils/android_filesystem_config.h>
 #include <cutils/multiuser.h>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 
 #ifndef VENDORSERVICEMANAGER
 #include <vintf/VintfObject.h>
@@ -37,6 +39,35 @@ using ::android::internal::Stability;
 namespace android {
 
 #ifndef VENDORSERVICEMANAGER
+// Every AIDL instance declared by the VINTF manifests, as "package.IFoo/instance",
+// mapped to the description of the manifest declaring it. Built on first use and
+// rebuilt whenever libvintf hands out a different manifest, so lookups no longer
+// walk the manifests; names missing from the index are known not to be declared.
+struct DeclaredInstanceIndex {
+    std::shared_ptr<const vintf::HalManifest> deviceManifest;
+    std::shared_ptr<const vintf::HalManifest> frameworkManifest;
+    std::unordered_map<std::string, const char*> instances;
+    bool built = false;
+};
+
+static void indexManifest(const std::shared_ptr<const vintf::HalManifest>& manifest,
+                          const char* description, DeclaredInstanceIndex* index) {
+    if (manifest == nullptr) {
+        LOG(ERROR) << "NULL VINTF MANIFEST!: " << description;
+        // note, we explicitly do not retry here, so that we can detect VINTF
+        // or other bugs (b/151696835)
+        return;
+    }
+    manifest->forEachInstance([&](const vintf::ManifestInstance& instance) {
+        if (instance.format() == vintf::HalFormat::AIDL) {
+            index->instances.emplace(
+                    instance.package() + "." + instance.interface() + "/" + instance.instance(),
+                    description);
+        }
+        return true;  // continue
+    });
+}
+
 static bool isVintfDeclared(const std::string& name) {
     size_t firstSlash = name.find('/');
     size_t lastDot = name.rfind('.', firstSlash);
@@ -45,34 +76,33 @@ static bool isVintfDeclared(const std::string& name) {
                    << "some.package.foo.IFoo/default) but got: " << name;
         return false;
     }
-    const std::string package = name.substr(0, lastDot);
-    const std::string iface = name.substr(lastDot+1, firstSlash-lastDot-1);
-    const std::string instance = name.substr(firstSlash+1);
 
-    struct ManifestWithDescription {
-        std::shared_ptr<const vintf::HalManifest> manifest;
-        const char* description;
-    };
-    for (const ManifestWithDescription& mwd : {
-            ManifestWithDescription{ vintf::VintfObject::GetDeviceHalManifest(), "device" },
-            ManifestWithDescription{ vintf::VintfObject::GetFrameworkHalManifest(), "framework" },
-        }) {
-        if (mwd.manifest == nullptr) {
-          LOG(ERROR) << "NULL VINTF MANIFEST!: " << mwd.description;
-          // note, we explicitly do not retry here, so that we can detect VINTF
-          // or other bugs (b/151696835)
-          continue;
-        }
-        if (mwd.manifest->hasAidlInstance(package, iface, instance)) {
-            LOG(INFO) << "Found " << name << " in " << mwd.description << " VINTF manifest.";
-            return true;
-        }
+    static std::mutex indexLock;
+    static DeclaredInstanceIndex index;
+
+    std::lock_guard<std::mutex> lock(indexLock);
+    auto deviceManifest = vintf::VintfObject::GetDeviceHalManifest();
+    auto frameworkManifest = vintf::VintfObject::GetFrameworkHalManifest();
+    // A missing manifest is indexed as empty too. Should libvintf hand one
+    // out later, it is a different object and the index is rebuilt.
+    if (!index.built || deviceManifest != index.deviceManifest ||
+        frameworkManifest != index.frameworkManifest) {
+        index.instances.clear();
+        // The device manifest is indexed first so it is the one reported
+        // for instances both manifests declare.
+        indexManifest(deviceManifest, "device", &index);
+        indexManifest(frameworkManifest, "framework", &index);
+        index.deviceManifest = deviceManifest;
+        index.frameworkManifest = frameworkManifest;
+        index.built = true;
+    }
+
+    if (auto it = index.instances.find(name); it != index.instances.end()) {
+        LOG(INFO) << "Found " << name << " in " << it->second << " VINTF manifest.";
+        return true;
     }
 
-    // Although it is tested, explicitly rebuilding qualified name, in case it
-    // becomes something unexpected.
-    LOG(ERROR) << "Could not find " << package << "." << iface << "/" << instance
-               << " in the VINTF manifest.";
+    LOG(ERROR) << "Could not find " << name << " in the VINTF manifest.";
     return false;
 }
 
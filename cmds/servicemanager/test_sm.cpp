@@ -255,6 +255,25 @@ TEST(GetService, NotAllowedFromIsolated) {
     EXPECT_EQ(nullptr, out.get());
 }
 
+TEST(IsDeclared, MalformedName) {
+    auto sm = getPermissiveServiceManager();
+
+    bool declared = true;
+    EXPECT_TRUE(sm->isDeclared("foo", &declared).isOk());
+    EXPECT_FALSE(declared);
+}
+
+TEST(IsDeclared, UndeclaredInstanceStaysUndeclared) {
+    auto sm = getPermissiveServiceManager();
+
+    // The second lookup is answered from the declared instance index.
+    for (int i = 0; i < 2; i++) {
+        bool declared = true;
+        EXPECT_TRUE(sm->isDeclared("android.hardware.doesnotexist.IFoo/default", &declared).isOk());
+        EXPECT_FALSE(declared);
+    }
+}
+
 TEST(ListServices, NoPermissions) {
     std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
 
@@ -30,6 +30,8 @@
 #include <utils/Unicode.h>
 #include <utils/RefBase.h>
 
+#include <vector>
+
 // Maximum number of keys supported by KeyCharacterMaps
 #define MAX_KEYS 8192
 
@@ -40,6 +42,10 @@ namespace android {
  * Also specifies other functions of the keyboard such as the keyboard type
  * and key modifier semantics.
  *
+ * The map is stored in a flat binary representation, which contains no pointers and is queried in
+ * place. It can be written to a file once, then memory mapped by any number of processes with
+ * loadBinary() or mapBinary(), instead of parsing the text file in each of them.
+ *
  * This object is immutable after it has been loaded.
  */
 class KeyCharacterMap : public RefBase {
@@ -80,6 +86,21 @@ public:
     static status_t loadContents(const std::string& filename,
             const char* contents, Format format, sp<KeyCharacterMap>* outMap);
 
+    /* Loads a key character map from a file written by writeBinary(). The file is mapped in memory
+     * if it is on a read-only system partition, and read otherwise. */
+    static status_t loadBinary(const std::string& filename, sp<KeyCharacterMap>* outMap);
+
+    /* Loads the first size bytes of a file descriptor, such as a file or memfd that was written by
+     * writeBinary(), as a key character map. The fd may be closed afterwards.
+     *
+     * The data is only mapped, rather than copied, if no other process can change it once it has
+     * been validated: that is, for a memfd sealed with F_SEAL_WRITE and F_SEAL_SHRINK, or a file
+     * on a read-only system partition such as /system or /vendor. */
+    static status_t mapBinary(int fd, size_t size, sp<KeyCharacterMap>* outMap);
+
+    /* Writes the binary representation of the key character map to a file descriptor. */
+    status_t writeBinary(int fd) const;
+
     /* Combines a base key character map and an overlay. */
     static sp<KeyCharacterMap> combine(const sp<KeyCharacterMap>& base,
             const sp<KeyCharacterMap>& overlay);
@@ -168,7 +189,6 @@ private:
 
     struct Key {
         Key();
-        Key(const Key& other);
         ~Key();
 
         /* The single character label printed on the key, or 0 if none. */
@@ -182,6 +202,20 @@ private:
         Behavior* firstBehavior;
     };
 
+    /* The keys and code mappings of a map being parsed, before it is flattened. */
+    struct Builder {
+        Builder();
+        ~Builder();
+
+        sp<KeyCharacterMap> build() const;
+
+        KeyedVector<int32_t, Key*> mKeys;
+        int mType;
+
+        KeyedVector<int32_t, int32_t> mKeysByScanCode;
+        KeyedVector<int32_t, int32_t> mKeysByUsageCode;
+    };
+
     class Parser {
         enum State {
             STATE_TOP = 0,
@@ -202,14 +236,14 @@ private:
             int32_t metaState;
         };
 
-        KeyCharacterMap* mMap;
+        Builder* mMap;
         Tokenizer* mTokenizer;
         Format mFormat;
         State mState;
         int32_t mKeyCode;
 
     public:
-        Parser(KeyCharacterMap* map, Tokenizer* tokenizer, Format format);
+        Parser(Builder* map, Tokenizer* tokenizer, Format format);
         ~Parser();
         status_t parse();
 
@@ -224,20 +258,55 @@ private:
         status_t parseCharacterLiteral(char16_t* outCharacter);
     };
 
-    static sp<KeyCharacterMap> sEmpty;
+    /* The binary representation, which is defined in KeyCharacterMap.cpp. */
+    struct BinaryHeader;
+    struct BinaryKey;
+    struct BinaryBehavior;
+    struct BinaryCodeMapping;
 
-    KeyedVector<int32_t, Key*> mKeys;
-    int mType;
+    static sp<KeyCharacterMap> sEmpty;
 
-    KeyedVector<int32_t, int32_t> mKeysByScanCode;
-    KeyedVector<int32_t, int32_t> mKeysByUsageCode;
+    /* The type and table sizes, copied from the header once it has been validated, so that they
+     * are never read again from memory that could be shared. */
+    const int32_t mType;
+    const uint32_t mKeyCount;
+    const uint32_t mBehaviorCount;
+    const uint32_t mScanCodeMappingCount;
+    const uint32_t mUsageCodeMappingCount;
+
+    /* Holds the binary representation, unless it is memory mapped. */
+    std::vector<uint32_t> mStorage;
+    void* mMappedData;
+    size_t mMappedSize;
+
+    /* The header and tables of the binary representation. */
+    const BinaryHeader* mHeader;
+    const BinaryKey* mKeys;
+    const BinaryBehavior* mBehaviors;
+    const BinaryCodeMapping* mKeysByScanCode;
+    const BinaryCodeMapping* mKeysByUsageCode;
 
     KeyCharacterMap();
-    KeyCharacterMap(const KeyCharacterMap& other);
-
-    bool getKey(int32_t keyCode, const Key** outKey) const;
+    explicit KeyCharacterMap(std::vector<uint32_t>&& storage);
+    KeyCharacterMap(const BinaryHeader& header, void* mappedData, size_t mappedSize);
+    KeyCharacterMap(const BinaryHeader& header, std::vector<uint32_t>&& storage, void* mappedData,
+            size_t mappedSize);
+    KeyCharacterMap(const KeyCharacterMap& other) = delete;
+    KeyCharacterMap& operator=(const KeyCharacterMap& other) = delete;
+
+    static uint64_t getBinarySize(const BinaryHeader& header);
+    uint64_t getBinarySize() const;
+    void setData(const void* data);
+    static bool isValidBinary(const void* data, size_t size);
+    static bool isImmutable(int fd);
+    static sp<KeyCharacterMap> create(int32_t type, const std::vector<BinaryKey>& keys,
+            const std::vector<BinaryBehavior>& behaviors,
+            const std::vector<BinaryCodeMapping>& keysByScanCode,
+            const std::vector<BinaryCodeMapping>& keysByUsageCode);
+
+    bool getKey(int32_t keyCode, const BinaryKey** outKey) const;
     bool getKeyBehavior(int32_t keyCode, int32_t metaState,
-            const Key** outKey, const Behavior** outBehavior) const;
+            const BinaryKey** outKey, const BinaryBehavior** outBehavior) const;
     static bool matchesMetaState(int32_t eventMetaState, int32_t behaviorMetaState);
 
     bool findKey(char16_t ch, int32_t* outKeyCode, int32_t* outMetaState) const;
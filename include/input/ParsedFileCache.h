@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBINPUT_PARSED_FILE_CACHE_H
+#define _LIBINPUT_PARSED_FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <utils/Errors.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace android {
+
+/**
+ * Caches the objects parsed from input configuration files, such as key layout maps and key
+ * character maps, by path. Many input devices share the same files, which then only need to be
+ * parsed once.
+ *
+ * A cached object is returned for as long as its file keeps the same inode, size and
+ * modification time; otherwise the file is parsed again. Failures to load a file are not cached.
+ * The cached objects are shared, so they must be immutable, or copied by T's copy constructor.
+ *
+ * The cache is thread-safe. Files are parsed outside of its lock, so that several of them can be
+ * parsed concurrently.
+ */
+template <typename T>
+class ParsedFileCache {
+public:
+    using Loader = std::function<status_t(const std::string& path, T* outValue)>;
+
+    /**
+     * Sets outValue to the object parsed from the file at path, calling loader to parse it
+     * unless it is already cached. Returns the status of the loader.
+     */
+    status_t load(const std::string& path, const Loader& loader, T* outValue) {
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat)) {
+            // Let the loader report the error.
+            return loader(path, outValue);
+        }
+        const FileVersion version = {fileStat.st_dev, fileStat.st_ino, fileStat.st_size,
+                                     fileStat.st_mtim};
+        {
+            std::scoped_lock _l(mLock);
+            auto it = mEntries.find(path);
+            if (it != mEntries.end() && it->second.version == version) {
+                *outValue = it->second.value;
+                return OK;
+            }
+        }
+
+        T value;
+        status_t status = loader(path, &value);
+        if (status != OK) {
+            return status;
+        }
+        std::scoped_lock _l(mLock);
+        mEntries[path] = {version, value};
+        *outValue = std::move(value);
+        return OK;
+    }
+
+    void clear() {
+        std::scoped_lock _l(mLock);
+        mEntries.clear();
+    }
+
+    size_t size() const {
+        std::scoped_lock _l(mLock);
+        return mEntries.size();
+    }
+
+private:
+    struct FileVersion {
+        dev_t device;
+        ino_t inode;
+        off_t size;
+        // With nanoseconds, as a file can be rewritten with the same size within a second.
+        timespec modificationTime;
+
+        bool operator==(const FileVersion& other) const {
+            return device == other.device && inode == other.inode && size == other.size &&
+                    modificationTime.tv_sec == other.modificationTime.tv_sec &&
+                    modificationTime.tv_nsec == other.modificationTime.tv_nsec;
+        }
+    };
+
+    struct Entry {
+        FileVersion version;
+        T value;
+    };
+
+    mutable std::mutex mLock;
+    std::unordered_map<std::string, Entry> mEntries;
+};
+
+} // namespace android
+
+#endif // _LIBINPUT_PARSED_FILE_CACHE_H
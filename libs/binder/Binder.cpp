@@ -20,12 +20,17 @@
 #include <utils/misc.h>
 #include <binder/BpBinder.h>
 #include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
 #include <binder/IResultReceiver.h>
+#include <binder/IServiceManager.h>
 #include <binder/IShellCallback.h>
 #include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include <private/android_filesystem_config.h>
 
 #include <linux/sched.h>
 #include <stdio.h>
+#include <unistd.h>
 
 namespace android {
 
@@ -126,6 +131,39 @@ status_t IBinder::getDebugPid(pid_t* out) {
     return OK;
 }
 
+status_t IBinder::getThreadPoolStats(String8* out) {
+    BBinder* local = this->localBinder();
+    if (local != nullptr) {
+        sp<ProcessState> proc = ProcessState::selfOrNull();
+        *out = proc != nullptr ? proc->dumpThreadPoolStats() : String8();
+        return OK;
+    }
+
+    Parcel data;
+    Parcel reply;
+    status_t status = transact(THREAD_POOL_STATS_TRANSACTION, data, &reply);
+    if (status != OK) return status;
+
+    return reply.readString8(out);
+}
+
+// Thread pool stats describe the process rather than one object, so they
+// are only served to the callers that could dump the process: root, shell,
+// system, the process's own uid, and holders of android.permission.DUMP.
+static bool canReadThreadPoolStats()
+{
+    const uid_t uid = IPCThreadState::self()->getCallingUid();
+    if (uid == AID_ROOT || uid == AID_SHELL || uid == AID_SYSTEM || uid == getuid()) {
+        return true;
+    }
+#if !defined(__ANDROID_VNDK__) && defined(__ANDROID__)
+    static const String16 sDump("android.permission.DUMP");
+    return checkCallingPermission(sDump);
+#else
+    return false;
+#endif
+}
+
 // ---------------------------------------------------------------------------
 
 class BBinder::Extras
@@ -184,6 +222,15 @@ status_t BBinder::transact(
         case DEBUG_PID_TRANSACTION:
             err = reply->writeInt32(getDebugPid());
             break;
+        case THREAD_POOL_STATS_TRANSACTION: {
+            if (!canReadThreadPoolStats()) {
+                err = PERMISSION_DENIED;
+                break;
+            }
+            sp<ProcessState> proc = ProcessState::selfOrNull();
+            err = reply->writeString8(proc != nullptr ? proc->dumpThreadPoolStats() : String8());
+            break;
+        }
         default:
             err = onTransact(code, data, reply, flags);
             break;
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BinderTransport"
+
+#include <binder/BinderTransport.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+class KernelBinderTransport : public BinderTransport
+{
+public:
+    int open(const char* driver) override {
+        return ::open(driver, O_RDWR | O_CLOEXEC);
+    }
+
+    int ioctl(int fd, unsigned long request, void* arg) override {
+        return ::ioctl(fd, request, arg);
+    }
+
+    void* mmap(int fd, size_t size) override {
+        return ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    }
+
+    int munmap(void* addr, size_t size) override {
+        return ::munmap(addr, size);
+    }
+
+    int close(int fd) override {
+        return ::close(fd);
+    }
+};
+
+sp<BinderTransport> BinderTransport::kernel()
+{
+    static sp<BinderTransport> transport = new KernelBinderTransport();
+    return transport;
+}
+
+} // namespace android
@@ -19,6 +19,7 @@
 #include <binder/IPCThreadState.h>
 
 #include <binder/Binder.h>
+#include <binder/BinderTransport.h>
 #include <binder/BpBinder.h>
 #include <binder/TextOutput.h>
 
@@ -31,6 +32,7 @@
 
 #include <private/binder/binder_module.h>
 
+#include <algorithm>
 #include <atomic>
 #include <errno.h>
 #include <inttypes.h>
@@ -114,6 +116,8 @@ static const char *kCommandStrings[] = {
 };
 
 static const int64_t kWorkSourcePropagatedBitIndex = 32;
+// Queued oneway calls that force a flush, however deeply batches nest.
+static const size_t kMaxOnewayBatchSize = 32;
 
 static const char* getReturnString(uint32_t cmd)
 {
@@ -495,6 +499,7 @@ status_t IPCThreadState::getAndExecuteCommand()
     status_t result;
     int32_t cmd;
 
+    const nsecs_t waitStart = systemTime();
     result = talkWithDriver();
     if (result >= NO_ERROR) {
         size_t IN = mIn.dataAvail();
@@ -505,18 +510,30 @@ status_t IPCThreadState::getAndExecuteCommand()
                  << getReturnString(cmd) << endl;
         }
 
+        const nsecs_t busyStart = systemTime();
+        ProcessState::ThreadPoolStats& stats = mProcess->mThreadPoolStats;
+
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount++;
         if (mProcess->mExecutingThreadsCount >= mProcess->mMaxThreads &&
                 mProcess->mStarvationStartTimeMs == 0) {
             mProcess->mStarvationStartTimeMs = uptimeMillis();
         }
+        stats.waitTime += busyStart - waitStart;
+        stats.busyHistogram[std::min<size_t>(mProcess->mExecutingThreadsCount,
+                                             ProcessState::THREAD_POOL_BUSY_BUCKETS) - 1]++;
+        if (mProcess->mExecutingThreadsCount > mProcess->mWindowPeakBusy) {
+            mProcess->mWindowPeakBusy = mProcess->mExecutingThreadsCount;
+        }
         pthread_mutex_unlock(&mProcess->mThreadCountLock);
 
         result = executeCommand(cmd);
 
         pthread_mutex_lock(&mProcess->mThreadCountLock);
+        const nsecs_t busyEnd = systemTime();
         mProcess->mExecutingThreadsCount--;
+        stats.busyTime += busyEnd - busyStart;
+        mProcess->updateThreadPoolWindowLocked(busyEnd);
         if (mProcess->mExecutingThreadsCount < mProcess->mMaxThreads &&
                 mProcess->mStarvationStartTimeMs != 0) {
             int64_t starvationTimeMs = uptimeMillis() - mProcess->mStarvationStartTimeMs;
@@ -524,6 +541,7 @@ status_t IPCThreadState::getAndExecuteCommand()
                 ALOGE("binder thread pool (%zu threads) starved for %" PRId64 " ms",
                       mProcess->mMaxThreads, starvationTimeMs);
             }
+            mProcess->noteThreadPoolStarvedLocked(starvationTimeMs);
             mProcess->mStarvationStartTimeMs = 0;
         }
         pthread_cond_broadcast(&mProcess->mThreadCountDecrement);
@@ -589,6 +607,10 @@ void IPCThreadState::joinThreadPool(bool isMain)
 
     mOut.writeInt32(isMain ? BC_ENTER_LOOPER : BC_REGISTER_LOOPER);
 
+    pthread_mutex_lock(&mProcess->mThreadCountLock);
+    mProcess->mPooledThreadCount++;
+    pthread_mutex_unlock(&mProcess->mThreadCountLock);
+
     status_t result;
     do {
         processPendingDerefs();
@@ -607,6 +629,15 @@ void IPCThreadState::joinThreadPool(bool isMain)
         }
     } while (result != -ECONNREFUSED && result != -EBADF);
 
+    pthread_mutex_lock(&mProcess->mThreadCountLock);
+    mProcess->mPooledThreadCount--;
+    if (result == TIMED_OUT) {
+        // The driver finished this idle thread with BR_FINISHED and no
+        // longer counts it against the pool limit.
+        mProcess->mThreadPoolStats.retired++;
+    }
+    pthread_mutex_unlock(&mProcess->mThreadCountLock);
+
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS LEAVING THE THREAD POOL err=%d\n",
         (void*)pthread_self(), getpid(), result);
 
@@ -644,7 +675,7 @@ void IPCThreadState::stopProcess(bool /*immediate*/)
     flushCommands();
     int fd = mProcess->mDriverFD;
     mProcess->mDriverFD = -1;
-    close(fd);
+    mProcess->mTransport->close(fd);
     //kill(getpid(), SIGKILL);
 }
 
@@ -665,6 +696,16 @@ status_t IPCThreadState::transact(int32_t handle,
 
     LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
         (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
+
+    if (mOnewayBatchDepth > 0 && (flags & TF_ONE_WAY) != 0) {
+        return queueOnewayTransaction(handle, code, data, flags);
+    }
+    if (mOnewayBatch.size() > 0) {
+        // Keep queued calls ahead of this one, and keep their errors out of
+        // its reply.
+        flushOnewayBatch();
+    }
+
     err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, nullptr);
 
     if (err != NO_ERROR) {
@@ -718,6 +759,160 @@ status_t IPCThreadState::transact(int32_t handle,
     return err;
 }
 
+void IPCThreadState::beginOnewayBatch()
+{
+    mOnewayBatchDepth++;
+}
+
+status_t IPCThreadState::endOnewayBatch()
+{
+    LOG_ALWAYS_FATAL_IF(mOnewayBatchDepth <= 0, "endOnewayBatch() without beginOnewayBatch()");
+    if (--mOnewayBatchDepth > 0) {
+        return NO_ERROR;
+    }
+    return flushOnewayBatch();
+}
+
+status_t IPCThreadState::queueOnewayTransaction(int32_t handle, uint32_t code,
+                                                const Parcel& data, uint32_t flags)
+{
+    status_t err = data.errorCheck();
+    if (err != NO_ERROR) {
+        return (mLastError = err);
+    }
+
+    // The driver reads the transaction data when the batch is flushed, by
+    // which time the caller's Parcel may be gone; keep a copy until then.
+    // transact() only borrows the caller's Parcel, so the copy goes into a
+    // Parcel recycled from an earlier batch, whose buffers are already sized.
+    std::unique_ptr<Parcel> copy;
+    if (!mSpareOnewayParcels.empty()) {
+        copy = std::move(mSpareOnewayParcels.back());
+        mSpareOnewayParcels.pop_back();
+    } else {
+        copy = std::make_unique<Parcel>();
+    }
+    err = copy->appendFrom(&data, 0, data.dataSize());
+    if (err == NO_ERROR) {
+        err = writeTransactionData(BC_TRANSACTION, flags, handle, code, *copy, nullptr);
+    }
+    if (err != NO_ERROR) {
+        recycleOnewayParcel(std::move(copy));
+        return (mLastError = err);
+    }
+    mOnewayBatch.push_back(std::move(copy));
+    mOnewayRepliesExpected++;
+
+    if (mOnewayBatch.size() >= kMaxOnewayBatchSize) {
+        err = flushOnewayBatch();
+    }
+    return err;
+}
+
+void IPCThreadState::recycleOnewayParcel(std::unique_ptr<Parcel> parcel)
+{
+    if (mSpareOnewayParcels.size() >= kMaxOnewayBatchSize) {
+        return;
+    }
+    parcel->setDataSize(0);
+    parcel->setDataPosition(0);
+    mSpareOnewayParcels.push_back(std::move(parcel));
+}
+
+bool IPCThreadState::consumeOnewayReply(uint32_t cmd)
+{
+    // The driver answers commands in the order they were written, and
+    // queued oneway calls are always written ahead of anything else that
+    // expects an answer, so they own the first answers that come back.
+    if (mOnewayRepliesReceived == mOnewayRepliesExpected) {
+        return false;
+    }
+    status_t err;
+    switch (cmd) {
+        case BR_TRANSACTION_COMPLETE:
+            err = NO_ERROR;
+            break;
+        case BR_DEAD_REPLY:
+            err = DEAD_OBJECT;
+            break;
+        case BR_FAILED_REPLY:
+        case BR_FROZEN_REPLY:
+            err = FAILED_TRANSACTION;
+            break;
+        default:
+            return false;
+    }
+    recordOnewayReply(err);
+    return true;
+}
+
+void IPCThreadState::recordOnewayReply(status_t err)
+{
+    if (err != NO_ERROR) {
+        mOnewayErrors.emplace_back(mOnewayRepliesReceived, err);
+    }
+    mOnewayRepliesReceived++;
+}
+
+status_t IPCThreadState::flushOnewayBatch()
+{
+    // Take the batch before talking to the driver. Commands executed while
+    // waiting, such as death notifications, may make calls of their own;
+    // those queue and flush a batch of their own, and may collect some of
+    // this batch's answers, which are counted for it all the same.
+    std::vector<std::unique_ptr<Parcel>> batch;
+    batch.swap(mOnewayBatch);
+    const uint64_t end = mOnewayRepliesExpected;
+    const uint64_t first = end - batch.size();
+
+    status_t err = NO_ERROR;
+    while (mOnewayRepliesReceived < end) {
+        err = talkWithDriver();
+        if (err >= NO_ERROR) err = mIn.errorCheck();
+        if (err < NO_ERROR) break;
+        if (mIn.dataAvail() == 0) continue;
+
+        const int32_t cmd = mIn.readInt32();
+        IF_LOG_COMMANDS() {
+            alog << "Processing flushOnewayBatch Command: " << getReturnString(cmd) << endl;
+        }
+        const status_t cmdErr = executeCommand(cmd);
+        if (cmdErr != NO_ERROR) {
+            ALOGW("Command %s failed while flushing oneway transactions: %d",
+                  getReturnString(cmd), cmdErr);
+        }
+    }
+
+    if (err < NO_ERROR) {
+        // The driver is unusable, so the answers still owed to this batch
+        // will not come: fail those calls, and drop the unsent commands,
+        // which point into the Parcels released below.
+        ALOGE("Failed to flush %zu oneway transactions: %d", batch.size(), err);
+        while (mOnewayRepliesReceived < end) {
+            recordOnewayReply(err);
+        }
+        mOut.setDataSize(0);
+    }
+
+    status_t result = NO_ERROR;
+    for (auto it = mOnewayErrors.begin(); it != mOnewayErrors.end();) {
+        if (it->first >= first && it->first < end) {
+            if (result == NO_ERROR) result = it->second;
+            it = mOnewayErrors.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (std::unique_ptr<Parcel>& parcel : batch) {
+        recycleOnewayParcel(std::move(parcel));
+    }
+
+    if (result != NO_ERROR) {
+        mLastError = result;
+    }
+    return result;
+}
+
 void IPCThreadState::incStrongHandle(int32_t handle, BpBinder *proxy)
 {
     LOG_REMOTEREFS("IPCThreadState::incStrongHandle(%d)\n", handle);
@@ -807,6 +1002,9 @@ IPCThreadState::IPCThreadState()
       mPropagateWorkSource(false),
       mStrictModePolicy(0),
       mLastTransactionBinderFlags(0),
+      mOnewayBatchDepth(0),
+      mOnewayRepliesExpected(0),
+      mOnewayRepliesReceived(0),
       mCallRestriction(mProcess->mCallRestriction)
 {
     pthread_setspecific(gTLS, this);
@@ -823,6 +1021,9 @@ status_t IPCThreadState::sendReply(const Parcel& reply, uint32_t flags)
 {
     status_t err;
     status_t statusBuffer;
+    if (mOnewayBatch.size() > 0) {
+        flushOnewayBatch();
+    }
     err = writeTransactionData(BC_REPLY, flags, -1, 0, reply, &statusBuffer);
     if (err < NO_ERROR) return err;
 
@@ -847,6 +1048,9 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
                 << getReturnString(cmd) << endl;
         }
 
+        // Answers owed to flushed oneway calls come before this one.
+        if (consumeOnewayReply(cmd)) continue;
+
         switch (cmd) {
         case BR_TRANSACTION_COMPLETE:
             if (!reply && !acquireResult) goto finish;
@@ -976,14 +1180,10 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
         IF_LOG_COMMANDS() {
             alog << "About to read/write, write size = " << mOut.dataSize() << endl;
         }
-#if defined(__ANDROID__)
-        if (ioctl(mProcess->mDriverFD, BINDER_WRITE_READ, &bwr) >= 0)
+        if (mProcess->mTransport->ioctl(mProcess->mDriverFD, BINDER_WRITE_READ, &bwr) >= 0)
             err = NO_ERROR;
         else
             err = -errno;
-#else
-        err = INVALID_OPERATION;
-#endif
         if (mProcess->mDriverFD < 0) {
             err = -EBADF;
         }
@@ -1080,6 +1280,10 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
     RefBase::weakref_type* refs;
     status_t result = NO_ERROR;
 
+    if (consumeOnewayReply(cmd)) {
+        return NO_ERROR;
+    }
+
     switch ((uint32_t)cmd) {
     case BR_ERROR:
         result = mIn.readInt32();
@@ -1187,6 +1391,10 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
             const int32_t origTransactionBinderFlags = mLastTransactionBinderFlags;
             const int32_t origWorkSource = mWorkSource;
             const bool origPropagateWorkSet = mPropagateWorkSource;
+            // A batch opened by an outgoing call we are nested in does not
+            // extend into the incoming one.
+            const int32_t origOnewayBatchDepth = mOnewayBatchDepth;
+            mOnewayBatchDepth = 0;
             // Calling work source will be set by Parcel#enforceInterface. Parcel#enforceInterface
             // is only guaranteed to be called for AIDL-generated stubs so we reset the work source
             // here to never propagate it.
@@ -1230,6 +1438,14 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                 error = the_context_object->transact(tr.code, buffer, &reply, tr.flags);
             }
 
+            if (mOnewayBatchDepth > 0) {
+                ALOGW("Oneway batch left open by transaction %u, flushing it", tr.code);
+            }
+            if (mOnewayBatch.size() > 0) {
+                flushOnewayBatch();
+            }
+            mOnewayBatchDepth = origOnewayBatchDepth;
+
             //ALOGI("<<<< TRANSACT from pid %d restore pid %d sid %s uid %d\n",
             //     mCallingPid, origPid, (origSid ? origSid : "<N/A>"), origUid);
 
@@ -1311,11 +1527,10 @@ void IPCThreadState::threadDestructor(void *st)
         IPCThreadState* const self = static_cast<IPCThreadState*>(st);
         if (self) {
                 self->flushCommands();
-#if defined(__ANDROID__)
         if (self->mProcess->mDriverFD >= 0) {
-            ioctl(self->mProcess->mDriverFD, BINDER_THREAD_EXIT, 0);
+            self->mProcess->mTransport->ioctl(self->mProcess->mDriverFD, BINDER_THREAD_EXIT,
+                                              nullptr);
         }
-#endif
                 delete self;
         }
 }
@@ -1327,7 +1542,8 @@ status_t IPCThreadState::getProcessFreezeInfo(pid_t pid, bool *sync_received, bo
     info.pid = pid;
 
 #if defined(__ANDROID__)
-    if (ioctl(self()->mProcess->mDriverFD, BINDER_GET_FROZEN_INFO, &info) < 0)
+    const sp<ProcessState>& proc = self()->mProcess;
+    if (proc->mTransport->ioctl(proc->mDriverFD, BINDER_GET_FROZEN_INFO, &info) < 0)
         ret = -errno;
 #endif
     *sync_received = info.sync_recv;
@@ -1346,7 +1562,8 @@ status_t IPCThreadState::freeze(pid_t pid, bool enable, uint32_t timeout_ms) {
 
 
 #if defined(__ANDROID__)
-    if (ioctl(self()->mProcess->mDriverFD, BINDER_FREEZE, &info) < 0)
+    const sp<ProcessState>& proc = self()->mProcess;
+    if (proc->mTransport->ioctl(proc->mDriverFD, BINDER_FREEZE, &info) < 0)
         ret = -errno;
 #endif
 
@@ -38,6 +38,10 @@
 
 #include <unistd.h>
 
+#include <map>
+#include <mutex>
+#include <set>
+
 namespace android {
 
 using AidlServiceManager = android::os::IServiceManager;
@@ -82,7 +86,48 @@ public:
         return IInterface::asBinder(mTheRealServiceManager).get();
     }
 private:
+    // Services this process has resolved, by name. Entries are weak so the
+    // cache never keeps a lazy service alive by itself: a hit needs some
+    // other part of the process to still hold the service. Each remote
+    // entry is linked to death once, when it is inserted, and dropped when
+    // the service dies or its proxy has seen it die.
+    //
+    // The cache also registers for notifications of each name it holds, and
+    // drops the entry when the name is registered again with another
+    // binder. Both kinds of notification only arrive on binder threads, so a
+    // process without a thread pool does not cache at all.
+    class ServiceCache : public IBinder::DeathRecipient {
+    public:
+        explicit ServiceCache(const sp<AidlServiceManager>& sm);
+
+        sp<IBinder> lookup(const std::string& name);
+        void add(const std::string& name, const sp<IBinder>& service);
+
+        void binderDied(const wp<IBinder>& who) override;
+
+    private:
+        class RegistrationCallback : public os::BnServiceCallback {
+        public:
+            explicit RegistrationCallback(const wp<ServiceCache>& cache) : mCache(cache) {}
+            Status onRegistration(const std::string& name, const sp<IBinder>& binder) override;
+
+        private:
+            wp<ServiceCache> mCache;
+        };
+
+        bool watch(const std::string& name);
+        void registered(const std::string& name, const sp<IBinder>& binder);
+
+        sp<AidlServiceManager> mServiceManager;
+        std::mutex mLock;
+        std::map<std::string, wp<IBinder>> mServices;
+        // Names mCallback is registered for.
+        std::set<std::string> mWatched;
+        sp<RegistrationCallback> mCallback;
+    };
+
     sp<AidlServiceManager> mTheRealServiceManager;
+    sp<ServiceCache> mCache;
 };
 
 [[clang::no_destroy]] static std::once_flag gSmOnce;
@@ -203,9 +248,143 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 // ----------------------------------------------------------------------
 
 ServiceManagerShim::ServiceManagerShim(const sp<AidlServiceManager>& impl)
- : mTheRealServiceManager(impl)
+ : mTheRealServiceManager(impl),
+   mCache(new ServiceCache(impl))
 {}
 
+ServiceManagerShim::ServiceCache::ServiceCache(const sp<AidlServiceManager>& sm)
+ : mServiceManager(sm)
+{}
+
+sp<IBinder> ServiceManagerShim::ServiceCache::lookup(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mServices.find(name);
+    if (it == mServices.end()) return nullptr;
+
+    // Death notifications only arrive on binder threads, so a process
+    // without a thread pool may never get one. A proxy that got
+    // DEAD_OBJECT knows it is dead all the same: drop it, so that the
+    // caller fetches the service again.
+    sp<IBinder> service = it->second.promote();
+    if (service == nullptr || !service->isBinderAlive()) {
+        mServices.erase(it);
+        return nullptr;
+    }
+    return service;
+}
+
+void ServiceManagerShim::ServiceCache::add(const std::string& name, const sp<IBinder>& service)
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mServices.find(name);
+        if (it != mServices.end() && it->second.promote() == service) {
+            // A concurrent miss already cached, and linked to, this service.
+            return;
+        }
+    }
+
+    if (!watch(name)) {
+        return;
+    }
+
+    // Local services cannot die while we run; remote ones are only cached
+    // if we will hear about their death. Linking talks to the driver, so it
+    // happens outside mLock.
+    const bool remote = service->localBinder() == nullptr;
+    if (remote && service->linkToDeath(this) != OK) {
+        return;
+    }
+
+    sp<IBinder> replaced;
+    bool raced = false;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        wp<IBinder>& entry = mServices[name];
+        replaced = entry.promote();
+        if (replaced == service) {
+            raced = true;
+        } else {
+            entry = service;
+        }
+    }
+
+    if (raced) {
+        // Another miss cached the service while we were linking; its link
+        // is the one the entry relies on.
+        if (remote) service->unlinkToDeath(this);
+    } else if (replaced != nullptr && replaced->localBinder() == nullptr) {
+        replaced->unlinkToDeath(this);
+    }
+}
+
+bool ServiceManagerShim::ServiceCache::watch(const std::string& name)
+{
+    if (ProcessState::self()->getThreadPoolStats().threads == 0) {
+        return false;
+    }
+
+    sp<RegistrationCallback> callback;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mWatched.insert(name).second) return true;
+        if (mCallback == nullptr) {
+            mCallback = new RegistrationCallback(this);
+        }
+        callback = mCallback;
+    }
+
+    // servicemanager answers with the binder currently registered, so an
+    // entry added by a concurrent miss before this returns is checked too.
+    if (!mServiceManager->registerForNotifications(name, callback).isOk()) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mWatched.erase(name);
+        return false;
+    }
+    return true;
+}
+
+void ServiceManagerShim::ServiceCache::registered(const std::string& name,
+                                                  const sp<IBinder>& binder)
+{
+    sp<IBinder> replaced;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mServices.find(name);
+        if (it == mServices.end()) return;
+        replaced = it->second.promote();
+        if (replaced == binder) return;
+        mServices.erase(it);
+    }
+
+    if (replaced != nullptr && replaced->localBinder() == nullptr) {
+        replaced->unlinkToDeath(this);
+    }
+}
+
+Status ServiceManagerShim::ServiceCache::RegistrationCallback::onRegistration(
+        const std::string& name, const sp<IBinder>& binder)
+{
+    sp<ServiceCache> cache = mCache.promote();
+    if (cache != nullptr) {
+        cache->registered(name, binder);
+    }
+    return Status::ok();
+}
+
+void ServiceManagerShim::ServiceCache::binderDied(const wp<IBinder>& who)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto it = mServices.begin(); it != mServices.end();) {
+        if (it->second == who) {
+            it = mServices.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 sp<IBinder> ServiceManagerShim::getService(const String16& name) const
 {
     static bool gSystemBootCompleted = false;
@@ -244,12 +423,18 @@ sp<IBinder> ServiceManagerShim::getService(const String16& name) const
     return nullptr;
 }
 
-sp<IBinder> ServiceManagerShim::checkService(const String16& name) const
+sp<IBinder> ServiceManagerShim::checkService(const String16& name16) const
 {
-    sp<IBinder> ret;
-    if (!mTheRealServiceManager->checkService(String8(name).c_str(), &ret).isOk()) {
+    const std::string name = String8(name16).c_str();
+    sp<IBinder> ret = mCache->lookup(name);
+    if (ret != nullptr) return ret;
+
+    if (!mTheRealServiceManager->checkService(name, &ret).isOk()) {
         return nullptr;
     }
+    if (ret != nullptr) {
+        mCache->add(name, ret);
+    }
     return ret;
 }
 
@@ -306,11 +491,16 @@ sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
 
     const std::string name = String8(name16).c_str();
 
-    sp<IBinder> out;
+    sp<IBinder> out = mCache->lookup(name);
+    if (out != nullptr) return out;
+
     if (!mTheRealServiceManager->getService(name, &out).isOk()) {
         return nullptr;
     }
-    if (out != nullptr) return out;
+    if (out != nullptr) {
+        mCache->add(name, out);
+        return out;
+    }
 
     sp<Waiter> waiter = new Waiter;
     if (!mTheRealServiceManager->registerForNotifications(
@@ -0,0 +1,1180 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LoopbackBinderTransport"
+
+#include <binder/LoopbackBinderTransport.h>
+
+#include <binder/Binder.h>
+#include <utils/Log.h>
+
+#include <private/binder/binder_module.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+// A single-process model of the binder driver. All state is protected by one
+// lock; threads block on their own condition variable, and idle looper
+// threads additionally register themselves as waiting for process work.
+//
+// Names and behaviour follow drivers/android/binder.c wherever the loopback
+// setting allows it, so that differences stay easy to spot.
+class LoopbackDriver
+{
+public:
+                        LoopbackDriver();
+                        ~LoopbackDriver();
+
+    int                 open();
+    int                 ioctl(int fd, unsigned long request, void* arg);
+    int                 close(int fd);
+    status_t            killNode(binder_uintptr_t ptr, binder_uintptr_t cookie);
+
+private:
+    struct Thread;
+    struct Transaction;
+
+    struct Node {
+        binder_uintptr_t ptr = 0;
+        binder_uintptr_t cookie = 0;
+        bool isContextManager = false;
+        size_t strongRefs = 0;      // refs holding a strong count
+        size_t refs = 0;            // refs of any kind
+        size_t tmpRefs = 0;         // transactions and buffers pointing here
+        bool hasStrong = false;     // owner was sent BR_ACQUIRE
+        bool hasWeak = false;       // owner was sent BR_INCREFS
+        bool dead = false;
+        bool hasAsync = false;      // a oneway transaction is outstanding
+        std::deque<Transaction*> asyncTodo;
+    };
+
+    struct Ref {
+        uint32_t handle = 0;
+        Node* node = nullptr;
+        uint32_t strong = 0;
+        uint32_t weak = 0;
+        std::vector<binder_uintptr_t> deathCookies;
+    };
+
+    struct Buffer {
+        std::vector<uint32_t> strongHandles;    // references held until freed
+        Node* asyncNode = nullptr;
+    };
+
+    struct Transaction {
+        Thread* from = nullptr;
+        Thread* to = nullptr;
+        Transaction* fromParent = nullptr;
+        Transaction* toParent = nullptr;
+        Node* node = nullptr;       // nullptr for replies
+        binder_transaction_data tr;
+    };
+
+    struct Work {
+        uint32_t cmd;
+        Transaction* t = nullptr;   // BR_TRANSACTION and BR_REPLY
+        binder_uintptr_t ptr = 0;
+        binder_uintptr_t cookie = 0;
+    };
+
+    enum {
+        LOOPER_REGISTERED = 0x01,
+        LOOPER_ENTERED = 0x02,
+        LOOPER_EXITED = 0x04,
+    };
+
+    struct Thread {
+        uint32_t looper = 0;
+        Transaction* stack = nullptr;
+        std::deque<Work> todo;
+        std::condition_variable cv;
+    };
+
+    Thread*             getThreadLocked(bool create);
+    void                releaseThreadLocked(Thread* thread);
+    bool                availableForProcWork(const Thread* thread) const;
+    bool                canFinishLooperLocked(const Thread* thread) const;
+    void                wakeWaitingThreadsLocked();
+
+    void                queueThreadLocked(Thread* thread, const Work& work);
+    void                queueProcLocked(const Work& work);
+    void                queueForThreadOrProcLocked(Thread* thread, const Work& work);
+
+    int                 writeLocked(Thread* thread, binder_write_read* bwr);
+    int                 readLocked(std::unique_lock<std::mutex>& lock, Thread* thread,
+                                   binder_write_read* bwr);
+    bool                deliverLocked(Thread* thread, const Work& work, uint8_t* buffer,
+                                      binder_size_t* pos);
+
+    void                transactionLocked(Thread* thread, const binder_transaction_data& tr,
+                                          bool reply);
+    status_t            copyBufferLocked(Thread* thread, const binder_transaction_data& in,
+                                         binder_transaction_data* out);
+    status_t            translateObjectLocked(Thread* thread, flat_binder_object* fp,
+                                              Buffer* buffer, std::vector<int>* fds);
+    void                freeBufferLocked(binder_uintptr_t data);
+    void                dropTransactionLocked(Transaction* t);
+    void                failTransactionLocked(Transaction* t, uint32_t returnError);
+
+    Node*               getNodeLocked(binder_uintptr_t ptr, binder_uintptr_t cookie);
+    void                updateNodeLocked(Node* node, Thread* target);
+    void                maybeDeleteNodeLocked(Node* node);
+
+    Ref*                lookupRefLocked(uint32_t handle);
+    Ref*                getRefForNodeLocked(Node* node);
+    void                incRefLocked(Ref* ref, bool strong, Thread* target);
+    void                decRefLocked(Ref* ref, bool strong);
+
+    std::mutex          mLock;
+    int                 mEventFd;
+
+    std::map<pthread_t, Thread*> mThreads;
+    std::vector<Thread*> mWaitingThreads;
+    std::deque<Work>    mProcTodo;
+    size_t              mMaxThreads;
+    size_t              mRequestedThreads;
+    size_t              mRequestedThreadsStarted;
+    int64_t             mIdleTimeout;   // nanoseconds, 0 when loopers never time out
+
+    Node*               mContextManager;
+    std::map<binder_uintptr_t, Node*> mNodes;
+    std::map<uint32_t, Ref*> mRefs;
+    std::map<Node*, Ref*> mNodeRefs;
+    std::map<binder_uintptr_t, Buffer> mBuffers;
+};
+
+LoopbackDriver::LoopbackDriver()
+    : mEventFd(-1)
+    , mMaxThreads(0)
+    , mRequestedThreads(0)
+    , mRequestedThreadsStarted(0)
+    , mIdleTimeout(0)
+    , mContextManager(nullptr)
+{
+}
+
+LoopbackDriver::~LoopbackDriver()
+{
+    for (auto& entry : mBuffers) {
+        free(reinterpret_cast<void*>(entry.first));
+    }
+    for (auto& entry : mRefs) {
+        delete entry.second;
+    }
+    for (auto& entry : mNodes) {
+        delete entry.second;
+    }
+    delete mContextManager;
+    for (auto& entry : mThreads) {
+        delete entry.second;
+    }
+    if (mEventFd >= 0) {
+        ::close(mEventFd);
+    }
+}
+
+int LoopbackDriver::open()
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mEventFd >= 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    // The descriptor stands in for the device node. It becomes readable
+    // whenever process work is queued, so IPCThreadState::setupPolling()
+    // users can poll it as they would poll /dev/binder.
+    mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return mEventFd;
+}
+
+int LoopbackDriver::close(int fd)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    if (fd < 0 || fd != mEventFd) {
+        errno = EBADF;
+        return -1;
+    }
+    ::close(mEventFd);
+    mEventFd = -1;
+    return 0;
+}
+
+int LoopbackDriver::ioctl(int fd, unsigned long request, void* arg)
+{
+    std::unique_lock<std::mutex> lock(mLock);
+    if (fd < 0 || fd != mEventFd) {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch (request) {
+        case BINDER_WRITE_READ: {
+            binder_write_read* bwr = static_cast<binder_write_read*>(arg);
+            Thread* thread = getThreadLocked(true);
+            if (bwr->write_size > 0) {
+                int ret = writeLocked(thread, bwr);
+                if (ret < 0) {
+                    errno = -ret;
+                    return -1;
+                }
+            }
+            if (bwr->read_size > 0) {
+                int ret = readLocked(lock, thread, bwr);
+                if (ret < 0) {
+                    errno = -ret;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+        case BINDER_VERSION:
+            static_cast<binder_version*>(arg)->protocol_version = BINDER_CURRENT_PROTOCOL_VERSION;
+            return 0;
+        case BINDER_SET_MAX_THREADS: {
+            uint32_t maxThreads;
+            memcpy(&maxThreads, arg, sizeof(maxThreads));
+            mMaxThreads = maxThreads;
+            wakeWaitingThreadsLocked();
+            return 0;
+        }
+        case BINDER_SET_IDLE_TIMEOUT: {
+            int64_t idleTimeout;
+            memcpy(&idleTimeout, arg, sizeof(idleTimeout));
+            if (idleTimeout < 0) {
+                errno = EINVAL;
+                return -1;
+            }
+            mIdleTimeout = idleTimeout;
+            wakeWaitingThreadsLocked();
+            return 0;
+        }
+        case BINDER_SET_CONTEXT_MGR_EXT:
+        case BINDER_SET_CONTEXT_MGR:
+            if (mContextManager != nullptr) {
+                errno = EBUSY;
+                return -1;
+            }
+            mContextManager = new Node();
+            mContextManager->isContextManager = true;
+            return 0;
+        case BINDER_THREAD_EXIT: {
+            Thread* thread = getThreadLocked(false);
+            if (thread != nullptr) {
+                releaseThreadLocked(thread);
+            }
+            return 0;
+        }
+        case BINDER_GET_NODE_INFO_FOR_REF: {
+            binder_node_info_for_ref* info = static_cast<binder_node_info_for_ref*>(arg);
+            Ref* ref = lookupRefLocked(info->handle);
+            if (ref == nullptr) {
+                errno = EINVAL;
+                return -1;
+            }
+            info->strong_count = ref->node->strongRefs;
+            info->weak_count = ref->node->refs;
+            return 0;
+        }
+        case BINDER_GET_NODE_DEBUG_INFO: {
+            binder_node_debug_info* info = static_cast<binder_node_debug_info*>(arg);
+            auto it = mNodes.upper_bound(info->ptr);
+            if (it == mNodes.end()) {
+                info->ptr = 0;
+                return 0;
+            }
+            const Node* node = it->second;
+            info->ptr = node->ptr;
+            info->cookie = node->cookie;
+            info->has_strong_ref = node->hasStrong;
+            info->has_weak_ref = node->hasWeak;
+            return 0;
+        }
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+status_t LoopbackDriver::killNode(binder_uintptr_t ptr, binder_uintptr_t cookie)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mNodes.find(ptr);
+    if (it == mNodes.end() || it->second->cookie != cookie || it->second->dead) {
+        return NAME_NOT_FOUND;
+    }
+    Node* node = it->second;
+    node->tmpRefs++;
+
+    // The owner is gone: anything still queued for it fails, and the
+    // references it held on behalf of remote handles go away with it.
+    while (!node->asyncTodo.empty()) {
+        Transaction* t = node->asyncTodo.front();
+        node->asyncTodo.pop_front();
+        // Queued calls do not own the async slot; keep freeing them from
+        // promoting the next one.
+        mBuffers[t->tr.data.ptr.buffer].asyncNode = nullptr;
+        node->tmpRefs--;
+        failTransactionLocked(t, BR_DEAD_REPLY);
+    }
+    auto failQueued = [&](std::deque<Work>* todo) {
+        for (auto w = todo->begin(); w != todo->end();) {
+            if (w->cmd == BR_TRANSACTION && w->t->node == node) {
+                Transaction* t = w->t;
+                w = todo->erase(w);
+                failTransactionLocked(t, BR_DEAD_REPLY);
+            } else {
+                ++w;
+            }
+        }
+    };
+    failQueued(&mProcTodo);
+    for (auto& entry : mThreads) {
+        failQueued(&entry.second->todo);
+    }
+
+    if (node->hasStrong) {
+        queueProcLocked({BR_RELEASE, nullptr, node->ptr, node->cookie});
+        node->hasStrong = false;
+    }
+    if (node->hasWeak) {
+        queueProcLocked({BR_DECREFS, nullptr, node->ptr, node->cookie});
+        node->hasWeak = false;
+    }
+    node->dead = true;
+
+    auto ref = mNodeRefs.find(node);
+    if (ref != mNodeRefs.end()) {
+        for (binder_uintptr_t deathCookie : ref->second->deathCookies) {
+            queueProcLocked({BR_DEAD_BINDER, nullptr, 0, deathCookie});
+        }
+    }
+
+    node->tmpRefs--;
+    maybeDeleteNodeLocked(node);
+    return NO_ERROR;
+}
+
+// --- threads and work queues ---
+
+LoopbackDriver::Thread* LoopbackDriver::getThreadLocked(bool create)
+{
+    const pthread_t self = pthread_self();
+    auto it = mThreads.find(self);
+    if (it != mThreads.end()) return it->second;
+    if (!create) return nullptr;
+    Thread* thread = new Thread();
+    mThreads[self] = thread;
+    return thread;
+}
+
+void LoopbackDriver::releaseThreadLocked(Thread* thread)
+{
+    // Unwind the transaction stack: callers waiting on this thread get a dead
+    // reply, and threads serving its calls will find nobody to reply to.
+    Transaction* t = thread->stack;
+    while (t != nullptr) {
+        if (t->to == thread) {
+            Transaction* next = t->toParent;
+            Thread* from = t->from;
+            if (from != nullptr) {
+                from->stack = t->fromParent;
+                queueThreadLocked(from, {BR_DEAD_REPLY});
+            }
+            dropTransactionLocked(t);
+            t = next;
+        } else {
+            t->from = nullptr;
+            t = t->fromParent;
+        }
+    }
+
+    for (const Work& work : thread->todo) {
+        if (work.cmd == BR_TRANSACTION) {
+            failTransactionLocked(work.t, BR_DEAD_REPLY);
+        } else if (work.cmd == BR_REPLY) {
+            freeBufferLocked(work.t->tr.data.ptr.buffer);
+            delete work.t;
+        }
+    }
+
+    mWaitingThreads.erase(std::remove(mWaitingThreads.begin(), mWaitingThreads.end(), thread),
+                          mWaitingThreads.end());
+    mThreads.erase(pthread_self());
+    delete thread;
+}
+
+bool LoopbackDriver::availableForProcWork(const Thread* thread) const
+{
+    return thread->stack == nullptr && thread->todo.empty()
+            && (thread->looper & (LOOPER_REGISTERED | LOOPER_ENTERED)) != 0;
+}
+
+bool LoopbackDriver::canFinishLooperLocked(const Thread* thread) const
+{
+    return mIdleTimeout > 0 && mRequestedThreadsStarted > mMaxThreads
+            && (thread->looper & (LOOPER_REGISTERED | LOOPER_ENTERED | LOOPER_EXITED))
+                    == LOOPER_REGISTERED;
+}
+
+void LoopbackDriver::wakeWaitingThreadsLocked()
+{
+    // Lets idle loopers recheck whether they are over the limit.
+    for (Thread* thread : mWaitingThreads) {
+        thread->cv.notify_one();
+    }
+}
+
+void LoopbackDriver::queueThreadLocked(Thread* thread, const Work& work)
+{
+    thread->todo.push_back(work);
+    thread->cv.notify_one();
+}
+
+void LoopbackDriver::queueProcLocked(const Work& work)
+{
+    mProcTodo.push_back(work);
+    if (!mWaitingThreads.empty()) {
+        Thread* thread = mWaitingThreads.back();
+        mWaitingThreads.pop_back();
+        thread->cv.notify_one();
+    }
+    if (mEventFd >= 0) {
+        uint64_t one = 1;
+        (void)::write(mEventFd, &one, sizeof(one));
+    }
+}
+
+void LoopbackDriver::queueForThreadOrProcLocked(Thread* thread, const Work& work)
+{
+    if (thread->looper & (LOOPER_REGISTERED | LOOPER_ENTERED)) {
+        queueThreadLocked(thread, work);
+    } else {
+        queueProcLocked(work);
+    }
+}
+
+// --- BINDER_WRITE_READ ---
+
+template <typename T>
+static bool readCommandData(const uint8_t* buffer, binder_size_t size, binder_size_t* pos, T* out)
+{
+    if (size - *pos < sizeof(T)) return false;
+    memcpy(out, buffer + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return true;
+}
+
+int LoopbackDriver::writeLocked(Thread* thread, binder_write_read* bwr)
+{
+    const uint8_t* buffer = reinterpret_cast<const uint8_t*>(bwr->write_buffer);
+    const binder_size_t size = bwr->write_size;
+    binder_size_t pos = bwr->write_consumed;
+
+    while (pos < size) {
+        uint32_t cmd;
+        if (!readCommandData(buffer, size, &pos, &cmd)) return -EFAULT;
+
+        switch (cmd) {
+            case BC_INCREFS:
+            case BC_ACQUIRE:
+            case BC_RELEASE:
+            case BC_DECREFS: {
+                uint32_t handle;
+                if (!readCommandData(buffer, size, &pos, &handle)) return -EFAULT;
+                Ref* ref = lookupRefLocked(handle);
+                if (ref == nullptr) {
+                    ALOGW("%s: refcount command %#x on invalid handle %u", __func__, cmd, handle);
+                    break;
+                }
+                const bool strong = cmd == BC_ACQUIRE || cmd == BC_RELEASE;
+                if (cmd == BC_INCREFS || cmd == BC_ACQUIRE) {
+                    incRefLocked(ref, strong, nullptr);
+                } else {
+                    decRefLocked(ref, strong);
+                }
+                break;
+            }
+            case BC_INCREFS_DONE:
+            case BC_ACQUIRE_DONE: {
+                binder_ptr_cookie done;
+                if (!readCommandData(buffer, size, &pos, &done)) return -EFAULT;
+                break;
+            }
+            case BC_FREE_BUFFER: {
+                binder_uintptr_t data;
+                if (!readCommandData(buffer, size, &pos, &data)) return -EFAULT;
+                freeBufferLocked(data);
+                break;
+            }
+            case BC_TRANSACTION:
+            case BC_REPLY: {
+                binder_transaction_data tr;
+                if (!readCommandData(buffer, size, &pos, &tr)) return -EFAULT;
+                transactionLocked(thread, tr, cmd == BC_REPLY);
+                break;
+            }
+            case BC_REGISTER_LOOPER:
+                if (mRequestedThreads == 0) {
+                    ALOGW("%s: BC_REGISTER_LOOPER called without request", __func__);
+                } else {
+                    mRequestedThreads--;
+                    mRequestedThreadsStarted++;
+                }
+                thread->looper |= LOOPER_REGISTERED;
+                break;
+            case BC_ENTER_LOOPER:
+                thread->looper |= LOOPER_ENTERED;
+                break;
+            case BC_EXIT_LOOPER:
+                thread->looper |= LOOPER_EXITED;
+                break;
+            case BC_REQUEST_DEATH_NOTIFICATION:
+            case BC_CLEAR_DEATH_NOTIFICATION: {
+                uint32_t handle;
+                binder_uintptr_t cookie;
+                if (!readCommandData(buffer, size, &pos, &handle)) return -EFAULT;
+                if (!readCommandData(buffer, size, &pos, &cookie)) return -EFAULT;
+                Ref* ref = lookupRefLocked(handle);
+                if (cmd == BC_CLEAR_DEATH_NOTIFICATION) {
+                    if (ref != nullptr) {
+                        auto& cookies = ref->deathCookies;
+                        cookies.erase(std::remove(cookies.begin(), cookies.end(), cookie),
+                                      cookies.end());
+                    }
+                    // The proxy holds a weak reference until it hears back.
+                    queueForThreadOrProcLocked(thread,
+                            {BR_CLEAR_DEATH_NOTIFICATION_DONE, nullptr, 0, cookie});
+                    break;
+                }
+                if (ref == nullptr) {
+                    ALOGW("%s: death notification on invalid handle %u", __func__, handle);
+                    break;
+                }
+                ref->deathCookies.push_back(cookie);
+                if (ref->node->dead) {
+                    queueForThreadOrProcLocked(thread, {BR_DEAD_BINDER, nullptr, 0, cookie});
+                }
+                break;
+            }
+            case BC_DEAD_BINDER_DONE: {
+                binder_uintptr_t cookie;
+                if (!readCommandData(buffer, size, &pos, &cookie)) return -EFAULT;
+                break;
+            }
+            default:
+                ALOGE("%s: unsupported command %#x", __func__, cmd);
+                return -EINVAL;
+        }
+        bwr->write_consumed = pos;
+    }
+    return 0;
+}
+
+static size_t returnPayloadSize(uint32_t cmd)
+{
+    switch (cmd) {
+        case BR_TRANSACTION:
+        case BR_REPLY:
+            return sizeof(binder_transaction_data);
+        case BR_INCREFS:
+        case BR_ACQUIRE:
+        case BR_RELEASE:
+        case BR_DECREFS:
+            return sizeof(binder_ptr_cookie);
+        case BR_DEAD_BINDER:
+        case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+            return sizeof(binder_uintptr_t);
+        default:
+            return 0;
+    }
+}
+
+int LoopbackDriver::readLocked(std::unique_lock<std::mutex>& lock, Thread* thread,
+                               binder_write_read* bwr)
+{
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(bwr->read_buffer);
+    const binder_size_t size = bwr->read_size;
+    binder_size_t pos = bwr->read_consumed;
+    const binder_size_t start = pos;
+
+    if (pos == 0) {
+        if (size < sizeof(uint32_t)) return -EINVAL;
+        const uint32_t noop = BR_NOOP;
+        memcpy(buffer, &noop, sizeof(noop));
+        pos += sizeof(noop);
+    }
+
+    // binder.c defines BINDER_SET_IDLE_TIMEOUT and BR_FINISHED without ever
+    // using them. Here a looper the driver asked for is finished once it has
+    // waited for process work that long while more loopers were started than
+    // the limit allows. The driver then forgets it, so the limit bounds the
+    // loopers alive rather than those ever started.
+    const auto waitStart = std::chrono::steady_clock::now();
+    bool procWork = availableForProcWork(thread);
+    while (thread->todo.empty() && !(procWork && !mProcTodo.empty())) {
+        const bool mayFinish = start == 0 && procWork && canFinishLooperLocked(thread);
+        const auto deadline = waitStart + std::chrono::nanoseconds(mIdleTimeout);
+        if (mayFinish && std::chrono::steady_clock::now() >= deadline) {
+            mRequestedThreadsStarted--;
+            thread->looper |= LOOPER_EXITED;
+            const uint32_t finished = BR_FINISHED;
+            memcpy(buffer, &finished, sizeof(finished));
+            bwr->read_consumed = pos;
+            return 0;
+        }
+        if (procWork) {
+            mWaitingThreads.push_back(thread);
+        }
+        if (mayFinish) {
+            thread->cv.wait_until(lock, deadline);
+        } else {
+            thread->cv.wait(lock);
+        }
+        mWaitingThreads.erase(
+                std::remove(mWaitingThreads.begin(), mWaitingThreads.end(), thread),
+                mWaitingThreads.end());
+        procWork = availableForProcWork(thread);
+    }
+
+    while (true) {
+        std::deque<Work>* todo = nullptr;
+        if (!thread->todo.empty()) {
+            todo = &thread->todo;
+        } else if (procWork && !mProcTodo.empty()) {
+            todo = &mProcTodo;
+        }
+        if (todo == nullptr) break;
+
+        const Work work = todo->front();
+        if (size - pos < sizeof(uint32_t) + returnPayloadSize(work.cmd)) break;
+        todo->pop_front();
+        if (deliverLocked(thread, work, buffer, &pos)) break;
+    }
+
+    if (mProcTodo.empty() && mEventFd >= 0) {
+        uint64_t count;
+        (void)::read(mEventFd, &count, sizeof(count));
+    }
+
+    if (start == 0 && mRequestedThreads == 0 && mWaitingThreads.empty()
+            && mRequestedThreadsStarted < mMaxThreads
+            && (thread->looper & (LOOPER_REGISTERED | LOOPER_ENTERED)) != 0
+            && (thread->looper & LOOPER_EXITED) == 0) {
+        mRequestedThreads++;
+        const uint32_t spawn = BR_SPAWN_LOOPER;
+        memcpy(buffer, &spawn, sizeof(spawn));
+    }
+
+    bwr->read_consumed = pos;
+    return 0;
+}
+
+bool LoopbackDriver::deliverLocked(Thread* thread, const Work& work, uint8_t* buffer,
+                                   binder_size_t* pos)
+{
+    memcpy(buffer + *pos, &work.cmd, sizeof(work.cmd));
+    *pos += sizeof(work.cmd);
+
+    switch (work.cmd) {
+        case BR_TRANSACTION: {
+            Transaction* t = work.t;
+            memcpy(buffer + *pos, &t->tr, sizeof(t->tr));
+            *pos += sizeof(t->tr);
+            if (t->tr.flags & TF_ONE_WAY) {
+                t->node->tmpRefs--;
+                maybeDeleteNodeLocked(t->node);
+                delete t;
+            } else {
+                t->to = thread;
+                t->toParent = thread->stack;
+                thread->stack = t;
+            }
+            return true;
+        }
+        case BR_REPLY:
+            memcpy(buffer + *pos, &work.t->tr, sizeof(work.t->tr));
+            *pos += sizeof(work.t->tr);
+            delete work.t;
+            return true;
+        case BR_INCREFS:
+        case BR_ACQUIRE:
+        case BR_RELEASE:
+        case BR_DECREFS: {
+            binder_ptr_cookie pc;
+            pc.ptr = work.ptr;
+            pc.cookie = work.cookie;
+            memcpy(buffer + *pos, &pc, sizeof(pc));
+            *pos += sizeof(pc);
+            return false;
+        }
+        case BR_DEAD_BINDER:
+        case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+            memcpy(buffer + *pos, &work.cookie, sizeof(work.cookie));
+            *pos += sizeof(work.cookie);
+            return false;
+        case BR_DEAD_REPLY:
+        case BR_FAILED_REPLY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// --- transactions ---
+
+void LoopbackDriver::transactionLocked(Thread* thread, const binder_transaction_data& tr,
+                                       bool reply)
+{
+    Node* node = nullptr;
+    Thread* target = nullptr;
+    Transaction* inReplyTo = nullptr;
+
+    if (reply) {
+        inReplyTo = thread->stack;
+        if (inReplyTo == nullptr || inReplyTo->to != thread) {
+            ALOGE("%s: reply with no transaction to reply to", __func__);
+            queueThreadLocked(thread, {BR_FAILED_REPLY});
+            return;
+        }
+        thread->stack = inReplyTo->toParent;
+        target = inReplyTo->from;
+        if (target == nullptr) {
+            dropTransactionLocked(inReplyTo);
+            queueThreadLocked(thread, {BR_DEAD_REPLY});
+            return;
+        }
+        target->stack = inReplyTo->fromParent;
+    } else {
+        if (tr.target.handle == 0) {
+            node = mContextManager;
+        } else {
+            Ref* ref = lookupRefLocked(tr.target.handle);
+            if (ref == nullptr) {
+                ALOGE("%s: transaction to invalid handle %u", __func__, tr.target.handle);
+                queueThreadLocked(thread, {BR_FAILED_REPLY});
+                return;
+            }
+            node = ref->node;
+        }
+        if (node == nullptr || node->dead) {
+            queueThreadLocked(thread, {BR_DEAD_REPLY});
+            return;
+        }
+        // A synchronous call made while serving another one goes back to the
+        // thread that is blocked waiting for us, as the kernel driver does.
+        if (!(tr.flags & TF_ONE_WAY) && thread->stack != nullptr && thread->stack->to == thread) {
+            target = thread->stack->from;
+        }
+    }
+
+    Transaction* t = new Transaction();
+    memset(&t->tr, 0, sizeof(t->tr));
+    status_t status = copyBufferLocked(thread, tr, &t->tr);
+    if (status != NO_ERROR) {
+        delete t;
+        queueThreadLocked(thread, {BR_FAILED_REPLY});
+        if (reply) {
+            queueThreadLocked(target, {BR_FAILED_REPLY});
+            dropTransactionLocked(inReplyTo);
+        }
+        return;
+    }
+    t->tr.code = tr.code;
+    t->tr.flags = tr.flags;
+    t->tr.sender_pid = (tr.flags & TF_ONE_WAY) ? 0 : getpid();
+    t->tr.sender_euid = geteuid();
+
+    queueThreadLocked(thread, {BR_TRANSACTION_COMPLETE});
+
+    if (reply) {
+        dropTransactionLocked(inReplyTo);
+        queueThreadLocked(target, {BR_REPLY, t});
+        return;
+    }
+
+    t->node = node;
+    node->tmpRefs++;
+    t->tr.target.ptr = node->ptr;
+    t->tr.cookie = node->cookie;
+
+    if (tr.flags & TF_ONE_WAY) {
+        mBuffers[t->tr.data.ptr.buffer].asyncNode = node;
+        node->tmpRefs++;
+        if (node->hasAsync) {
+            node->asyncTodo.push_back(t);
+        } else {
+            node->hasAsync = true;
+            queueProcLocked({BR_TRANSACTION, t});
+        }
+        return;
+    }
+
+    t->from = thread;
+    t->fromParent = thread->stack;
+    thread->stack = t;
+    if (target != nullptr) {
+        queueThreadLocked(target, {BR_TRANSACTION, t});
+    } else {
+        queueProcLocked({BR_TRANSACTION, t});
+    }
+}
+
+status_t LoopbackDriver::copyBufferLocked(Thread* thread, const binder_transaction_data& in,
+                                          binder_transaction_data* out)
+{
+    const size_t dataSize = in.data_size;
+    const size_t offsetsSize = in.offsets_size;
+    if (offsetsSize % sizeof(binder_size_t) != 0) return BAD_VALUE;
+
+    const size_t alignedDataSize = (dataSize + 7) & ~size_t(7);
+    uint8_t* data =
+            static_cast<uint8_t*>(malloc(std::max<size_t>(alignedDataSize + offsetsSize, 1)));
+    if (data == nullptr) return NO_MEMORY;
+    binder_size_t* offsets = reinterpret_cast<binder_size_t*>(data + alignedDataSize);
+    if (dataSize > 0) {
+        memcpy(data, reinterpret_cast<const void*>(in.data.ptr.buffer), dataSize);
+    }
+    if (offsetsSize > 0) {
+        memcpy(offsets, reinterpret_cast<const void*>(in.data.ptr.offsets), offsetsSize);
+    }
+
+    Buffer& buffer = mBuffers[reinterpret_cast<binder_uintptr_t>(data)];
+    std::vector<int> fds;
+    status_t status = NO_ERROR;
+    binder_size_t minOffset = 0;
+    for (size_t i = 0; i < offsetsSize / sizeof(binder_size_t); i++) {
+        const binder_size_t offset = offsets[i];
+        if (offset < minOffset || offset % sizeof(uint32_t) != 0
+                || dataSize < sizeof(flat_binder_object)
+                || offset > dataSize - sizeof(flat_binder_object)) {
+            status = BAD_VALUE;
+            break;
+        }
+        status = translateObjectLocked(thread,
+                reinterpret_cast<flat_binder_object*>(data + offset), &buffer, &fds);
+        if (status != NO_ERROR) break;
+        minOffset = offset + sizeof(flat_binder_object);
+    }
+
+    if (status != NO_ERROR) {
+        for (int fd : fds) {
+            ::close(fd);
+        }
+        freeBufferLocked(reinterpret_cast<binder_uintptr_t>(data));
+        return status;
+    }
+
+    out->data_size = dataSize;
+    out->offsets_size = offsetsSize;
+    out->data.ptr.buffer = reinterpret_cast<binder_uintptr_t>(data);
+    out->data.ptr.offsets = reinterpret_cast<binder_uintptr_t>(offsets);
+    return NO_ERROR;
+}
+
+status_t LoopbackDriver::translateObjectLocked(Thread* thread, flat_binder_object* fp,
+                                               Buffer* buffer, std::vector<int>* fds)
+{
+    switch (fp->hdr.type) {
+        case BINDER_TYPE_BINDER: {
+            // Local objects always arrive as handles, even though their owner
+            // is the receiving process; see LoopbackBinderTransport.h.
+            Node* node = getNodeLocked(fp->binder, fp->cookie);
+            if (node == nullptr || node->dead) return DEAD_OBJECT;
+            Ref* ref = getRefForNodeLocked(node);
+            incRefLocked(ref, true, thread);
+            buffer->strongHandles.push_back(ref->handle);
+            fp->hdr.type = BINDER_TYPE_HANDLE;
+            fp->binder = 0;
+            fp->handle = ref->handle;
+            fp->cookie = 0;
+            return NO_ERROR;
+        }
+        case BINDER_TYPE_HANDLE: {
+            Ref* ref = lookupRefLocked(fp->handle);
+            if (ref == nullptr) return BAD_VALUE;
+            incRefLocked(ref, true, thread);
+            buffer->strongHandles.push_back(ref->handle);
+            return NO_ERROR;
+        }
+        case BINDER_TYPE_FD: {
+            int fd = fcntl(fp->handle, F_DUPFD_CLOEXEC, 0);
+            if (fd < 0) return -errno;
+            fds->push_back(fd);
+            fp->pad_binder = 0;
+            fp->handle = fd;
+            return NO_ERROR;
+        }
+        default:
+            ALOGE("%s: unsupported object type %#x", __func__, fp->hdr.type);
+            return BAD_TYPE;
+    }
+}
+
+void LoopbackDriver::freeBufferLocked(binder_uintptr_t data)
+{
+    auto it = mBuffers.find(data);
+    if (it == mBuffers.end()) {
+        ALOGE("%s: freeing unknown buffer %#" PRIx64, __func__, static_cast<uint64_t>(data));
+        return;
+    }
+    // Detach the record before touching references, which may queue work.
+    Buffer buffer = std::move(it->second);
+    mBuffers.erase(it);
+    free(reinterpret_cast<void*>(data));
+
+    for (uint32_t handle : buffer.strongHandles) {
+        Ref* ref = lookupRefLocked(handle);
+        if (ref != nullptr) {
+            decRefLocked(ref, true);
+        }
+    }
+
+    if (Node* node = buffer.asyncNode) {
+        if (!node->asyncTodo.empty()) {
+            Transaction* next = node->asyncTodo.front();
+            node->asyncTodo.pop_front();
+            queueProcLocked({BR_TRANSACTION, next});
+        } else {
+            node->hasAsync = false;
+        }
+        node->tmpRefs--;
+        maybeDeleteNodeLocked(node);
+    }
+}
+
+void LoopbackDriver::dropTransactionLocked(Transaction* t)
+{
+    // |t| has been delivered, so its buffer belongs to the receiver.
+    t->node->tmpRefs--;
+    maybeDeleteNodeLocked(t->node);
+    delete t;
+}
+
+void LoopbackDriver::failTransactionLocked(Transaction* t, uint32_t returnError)
+{
+    // |t| was never delivered, so its buffer is still ours to free.
+    if (t->from != nullptr) {
+        t->from->stack = t->fromParent;
+        queueThreadLocked(t->from, {returnError});
+    }
+    freeBufferLocked(t->tr.data.ptr.buffer);
+    t->node->tmpRefs--;
+    maybeDeleteNodeLocked(t->node);
+    delete t;
+}
+
+// --- nodes and references ---
+
+LoopbackDriver::Node* LoopbackDriver::getNodeLocked(binder_uintptr_t ptr, binder_uintptr_t cookie)
+{
+    auto it = mNodes.find(ptr);
+    if (it != mNodes.end()) {
+        if (it->second->cookie != cookie) {
+            ALOGE("%s: node %#" PRIx64 " has cookie mismatch", __func__,
+                  static_cast<uint64_t>(ptr));
+            return nullptr;
+        }
+        return it->second;
+    }
+    Node* node = new Node();
+    node->ptr = ptr;
+    node->cookie = cookie;
+    mNodes[ptr] = node;
+    return node;
+}
+
+void LoopbackDriver::updateNodeLocked(Node* node, Thread* target)
+{
+    if (node->isContextManager) return;
+    if (node->dead) {
+        maybeDeleteNodeLocked(node);
+        return;
+    }
+
+    // New references are announced on the sending thread so the owner takes
+    // them before the transaction completes; releases can go to any looper.
+    auto queue = [&](uint32_t cmd) {
+        const Work work = {cmd, nullptr, node->ptr, node->cookie};
+        if (target != nullptr) {
+            queueThreadLocked(target, work);
+        } else {
+            queueProcLocked(work);
+        }
+    };
+    const bool wantStrong = node->strongRefs > 0;
+    const bool wantWeak = wantStrong || node->refs > 0;
+    if (wantWeak && !node->hasWeak) {
+        node->hasWeak = true;
+        queue(BR_INCREFS);
+    }
+    if (wantStrong && !node->hasStrong) {
+        node->hasStrong = true;
+        queue(BR_ACQUIRE);
+    }
+    target = nullptr;
+    if (!wantStrong && node->hasStrong) {
+        node->hasStrong = false;
+        queue(BR_RELEASE);
+    }
+    if (!wantWeak && node->hasWeak) {
+        node->hasWeak = false;
+        queue(BR_DECREFS);
+    }
+    maybeDeleteNodeLocked(node);
+}
+
+void LoopbackDriver::maybeDeleteNodeLocked(Node* node)
+{
+    if (node->isContextManager || node->refs > 0 || node->tmpRefs > 0
+            || node->hasStrong || node->hasWeak) {
+        return;
+    }
+    mNodes.erase(node->ptr);
+    delete node;
+}
+
+LoopbackDriver::Ref* LoopbackDriver::lookupRefLocked(uint32_t handle)
+{
+    auto it = mRefs.find(handle);
+    if (it != mRefs.end()) return it->second;
+    if (handle == 0 && mContextManager != nullptr) {
+        return getRefForNodeLocked(mContextManager);
+    }
+    return nullptr;
+}
+
+LoopbackDriver::Ref* LoopbackDriver::getRefForNodeLocked(Node* node)
+{
+    auto it = mNodeRefs.find(node);
+    if (it != mNodeRefs.end()) return it->second;
+
+    Ref* ref = new Ref();
+    ref->node = node;
+    if (!node->isContextManager) {
+        // Lowest free descriptor above the context manager's, like the kernel.
+        uint32_t handle = 1;
+        for (auto entry = mRefs.upper_bound(0); entry != mRefs.end(); ++entry) {
+            if (entry->first != handle) break;
+            handle++;
+        }
+        ref->handle = handle;
+    }
+    mRefs[ref->handle] = ref;
+    mNodeRefs[node] = ref;
+    node->refs++;
+    return ref;
+}
+
+void LoopbackDriver::incRefLocked(Ref* ref, bool strong, Thread* target)
+{
+    if (strong) {
+        if (ref->strong++ == 0) ref->node->strongRefs++;
+    } else {
+        ref->weak++;
+    }
+    updateNodeLocked(ref->node, target);
+}
+
+void LoopbackDriver::decRefLocked(Ref* ref, bool strong)
+{
+    Node* node = ref->node;
+    if (strong) {
+        if (ref->strong == 0) {
+            ALOGE("%s: strong count underflow on handle %u", __func__, ref->handle);
+            return;
+        }
+        if (--ref->strong == 0) node->strongRefs--;
+    } else {
+        if (ref->weak == 0) {
+            ALOGE("%s: weak count underflow on handle %u", __func__, ref->handle);
+            return;
+        }
+        ref->weak--;
+    }
+
+    if (ref->strong == 0 && ref->weak == 0) {
+        mRefs.erase(ref->handle);
+        mNodeRefs.erase(node);
+        node->refs--;
+        delete ref;
+    }
+    updateNodeLocked(node, nullptr);
+}
+
+// --- LoopbackBinderTransport ---
+
+LoopbackBinderTransport::LoopbackBinderTransport()
+    : mDriver(new LoopbackDriver())
+{
+}
+
+LoopbackBinderTransport::~LoopbackBinderTransport()
+{
+}
+
+int LoopbackBinderTransport::open(const char* /*driver*/)
+{
+    return mDriver->open();
+}
+
+int LoopbackBinderTransport::ioctl(int fd, unsigned long request, void* arg)
+{
+    return mDriver->ioctl(fd, request, arg);
+}
+
+void* LoopbackBinderTransport::mmap(int /*fd*/, size_t size)
+{
+    // Transaction buffers live on the heap; the mapping only reserves the
+    // address range ProcessState expects to own.
+    return ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+}
+
+int LoopbackBinderTransport::munmap(void* addr, size_t size)
+{
+    return ::munmap(addr, size);
+}
+
+int LoopbackBinderTransport::close(int fd)
+{
+    return mDriver->close(fd);
+}
+
+status_t LoopbackBinderTransport::killNode(const sp<IBinder>& binder)
+{
+    BBinder* local = binder != nullptr ? binder->localBinder() : nullptr;
+    if (local == nullptr) return BAD_VALUE;
+    return mDriver->killNode(reinterpret_cast<binder_uintptr_t>(local->getWeakRefs()),
+                             reinterpret_cast<binder_uintptr_t>(local));
+}
+
+} // namespace android
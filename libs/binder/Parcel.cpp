@@ -49,6 +49,7 @@
 #include <utils/String16.h>
 
 #include <private/binder/binder_module.h>
+#include "ParcelBufferPool.h"
 #include "Static.h"
 
 #define LOG_REFS(...)
@@ -289,6 +290,14 @@ size_t Parcel::getGlobalAllocCount() {
     return count;
 }
 
+void Parcel::setThreadBufferPoolEnabled(bool enabled) {
+    ParcelBufferPool::setEnabled(enabled);
+}
+
+Parcel::BufferPoolStats Parcel::getThreadBufferPoolStats() {
+    return ParcelBufferPool::stats();
+}
+
 const uint8_t* Parcel::data() const
 {
     return mData;
@@ -438,13 +447,15 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
             if (mObjectsSize + numObjects > SIZE_MAX / 3) return NO_MEMORY; // overflow
             size_t newSize = ((mObjectsSize + numObjects)*3)/2;
             if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-            binder_size_t *objects =
-                (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
+            size_t newBytes = newSize*sizeof(binder_size_t);
+            binder_size_t *objects = (binder_size_t*)ParcelBufferPool::reallocate(mObjects,
+                    mObjectsCapacity*sizeof(binder_size_t), mObjectsSize*sizeof(binder_size_t),
+                    &newBytes);
             if (objects == (binder_size_t*)nullptr) {
                 return NO_MEMORY;
             }
             mObjects = objects;
-            mObjectsCapacity = newSize;
+            mObjectsCapacity = newBytes/sizeof(binder_size_t);
         }
 
         // append and acquire objects
@@ -1314,10 +1325,13 @@ restart_write:
         if ((mObjectsSize + 2) > SIZE_MAX / 3) return NO_MEMORY; // overflow
         size_t newSize = ((mObjectsSize+2)*3)/2;
         if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-        binder_size_t* objects = (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
+        size_t newBytes = newSize*sizeof(binder_size_t);
+        binder_size_t* objects = (binder_size_t*)ParcelBufferPool::reallocate(mObjects,
+                mObjectsCapacity*sizeof(binder_size_t), mObjectsSize*sizeof(binder_size_t),
+                &newBytes);
         if (objects == nullptr) return NO_MEMORY;
         mObjects = objects;
-        mObjectsCapacity = newSize;
+        mObjectsCapacity = newBytes/sizeof(binder_size_t);
     }
 
     goto restart_write;
@@ -2204,6 +2218,31 @@ status_t Parcel::read(FlattenableHelperInterface& val) const
 
     return err;
 }
+
+status_t Parcel::readGatheredSpans(
+        const std::function<status_t(const void* data, size_t len)>& visitor) const
+{
+    int32_t count;
+    status_t status = readInt32(&count);
+    if (status) return status;
+    if (count < 0) return BAD_VALUE;
+
+    for (int32_t i = 0; i < count; i++) {
+        int64_t len;
+        status = readInt64(&len);
+        if (status) return status;
+        if (len < 0 || len > INT32_MAX) return BAD_VALUE;
+
+        ReadableBlob blob;
+        status = readBlob(static_cast<size_t>(len), &blob);
+        if (status) return status;
+        status = visitor(blob.data(), blob.size());
+        blob.release();
+        if (status) return status;
+    }
+    return NO_ERROR;
+}
+
 const flat_binder_object* Parcel::readObject(bool nullMetaData) const
 {
     const size_t DPOS = mDataPos;
@@ -2437,9 +2476,11 @@ void Parcel::freeDataNoInit()
               gParcelGlobalAllocCount--;
             }
             pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-            free(mData);
+            ParcelBufferPool::release(mData, mDataCapacity);
+        }
+        if (mObjects) {
+            ParcelBufferPool::release(mObjects, mObjectsCapacity*sizeof(binder_size_t));
         }
-        if (mObjects) free(mObjects);
     }
 }
 
@@ -2472,7 +2513,8 @@ status_t Parcel::restartWrite(size_t desired)
         return continueWrite(desired);
     }
 
-    uint8_t* data = (uint8_t*)realloc(mData, desired);
+    size_t capacity = desired;
+    uint8_t* data = (uint8_t*)ParcelBufferPool::reallocate(mData, mDataCapacity, 0, &capacity);
     if (!data && desired > mDataCapacity) {
         mError = NO_MEMORY;
         return NO_MEMORY;
@@ -2481,23 +2523,23 @@ status_t Parcel::restartWrite(size_t desired)
     releaseObjects();
 
     if (data || desired == 0) {
-        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, desired);
+        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, capacity);
         pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocSize -= mDataCapacity;
         if (!mData) {
             gParcelGlobalAllocCount++;
         }
         pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
         mData = data;
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     mDataSize = mDataPos = 0;
     ALOGV("restartWrite Setting data size of %p to %zu", this, mDataSize);
     ALOGV("restartWrite Setting data pos of %p to %zu", this, mDataPos);
 
-    free(mObjects);
+    ParcelBufferPool::release(mObjects, mObjectsCapacity*sizeof(binder_size_t));
     mObjects = nullptr;
     mObjectsSize = mObjectsCapacity = 0;
     mNextObjectHint = 0;
@@ -2541,17 +2583,20 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = (uint8_t*)ParcelBufferPool::allocate(&capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
         }
         binder_size_t* objects = nullptr;
+        size_t objectsCapacity = 0;
 
         if (objectsSize) {
-            objects = (binder_size_t*)calloc(objectsSize, sizeof(binder_size_t));
+            size_t objectsBytes = objectsSize*sizeof(binder_size_t);
+            objects = (binder_size_t*)ParcelBufferPool::allocate(&objectsBytes);
             if (!objects) {
-                free(data);
+                ParcelBufferPool::release(data, capacity);
 
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -2563,6 +2608,7 @@ status_t Parcel::continueWrite(size_t desired)
             mObjectsSize = objectsSize;
             acquireObjects();
             mObjectsSize = oldObjectsSize;
+            objectsCapacity = objectsBytes/sizeof(binder_size_t);
         }
 
         if (mData) {
@@ -2575,9 +2621,9 @@ status_t Parcel::continueWrite(size_t desired)
         mOwner(this, mData, mDataSize, mObjects, mObjectsSize, mOwnerCookie);
         mOwner = nullptr;
 
-        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, desired);
+        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, capacity);
         pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
         pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
 
@@ -2585,8 +2631,9 @@ status_t Parcel::continueWrite(size_t desired)
         mObjects = objects;
         mDataSize = (mDataSize < desired) ? mDataSize : desired;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
-        mDataCapacity = desired;
-        mObjectsSize = mObjectsCapacity = objectsSize;
+        mDataCapacity = capacity;
+        mObjectsSize = objectsSize;
+        mObjectsCapacity = objectsCapacity;
         mNextObjectHint = 0;
         mObjectsSorted = false;
 
@@ -2605,15 +2652,16 @@ status_t Parcel::continueWrite(size_t desired)
             }
 
             if (objectsSize == 0) {
-                free(mObjects);
+                ParcelBufferPool::release(mObjects, mObjectsCapacity*sizeof(binder_size_t));
                 mObjects = nullptr;
                 mObjectsCapacity = 0;
             } else {
-                binder_size_t* objects =
-                    (binder_size_t*)realloc(mObjects, objectsSize*sizeof(binder_size_t));
+                size_t objectsBytes = objectsSize*sizeof(binder_size_t);
+                binder_size_t* objects = (binder_size_t*)ParcelBufferPool::reallocate(mObjects,
+                        mObjectsCapacity*sizeof(binder_size_t), objectsBytes, &objectsBytes);
                 if (objects) {
                     mObjects = objects;
-                    mObjectsCapacity = objectsSize;
+                    mObjectsCapacity = objectsBytes/sizeof(binder_size_t);
                 }
             }
             mObjectsSize = objectsSize;
@@ -2623,16 +2671,18 @@ status_t Parcel::continueWrite(size_t desired)
 
         // We own the data, so we can just do a realloc().
         if (desired > mDataCapacity) {
-            uint8_t* data = (uint8_t*)realloc(mData, desired);
+            size_t capacity = desired;
+            uint8_t* data = (uint8_t*)ParcelBufferPool::reallocate(mData, mDataCapacity,
+                    std::min(ipcDataSize(), mDataCapacity), &capacity);
             if (data) {
                 LOG_ALLOC("Parcel %p: continue from %zu to %zu capacity", this, mDataCapacity,
-                        desired);
+                        capacity);
                 pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-                gParcelGlobalAllocSize += desired;
+                gParcelGlobalAllocSize += capacity;
                 gParcelGlobalAllocSize -= mDataCapacity;
                 pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
                 mData = data;
-                mDataCapacity = desired;
+                mDataCapacity = capacity;
             } else {
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -2650,7 +2700,8 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = (uint8_t*)ParcelBufferPool::allocate(&capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -2661,9 +2712,9 @@ status_t Parcel::continueWrite(size_t desired)
             ALOGE("continueWrite: %zu/%p/%zu/%zu", mDataCapacity, mObjects, mObjectsCapacity, desired);
         }
 
-        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, desired);
+        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, capacity);
         pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
         pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
 
@@ -2671,7 +2722,7 @@ status_t Parcel::continueWrite(size_t desired)
         mDataSize = mDataPos = 0;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
         ALOGV("continueWrite Setting data pos of %p to %zu", this, mDataPos);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     return NO_ERROR;
@@ -2772,4 +2823,75 @@ void Parcel::Blob::clear() {
     mMutable = false;
 }
 
+// --- Parcel::GatherWriter ---
+
+status_t Parcel::GatherWriter::add(const void* data, size_t len) {
+    if (len > INT32_MAX || (len > 0 && data == nullptr)) return BAD_VALUE;
+    if (len > SIZE_MAX - mTotalSize) return NO_MEMORY; // overflow
+    if (mSpans.size() >= INT32_MAX) return NO_MEMORY;
+    mSpans.push_back({data, len, -1});
+    mTotalSize += len;
+    return NO_ERROR;
+}
+
+status_t Parcel::GatherWriter::addFd(int fd, size_t len) {
+    // An empty region cannot be mapped by the receiver.
+    if (len == 0) return add(nullptr, 0);
+    // Fail here rather than in the receiver's readBlob().
+    if (len > INT32_MAX || !ashmem_valid(fd)) return BAD_VALUE;
+    const int size = ashmem_get_size_region(fd);
+    if (size < 0 || size_t(size) < len) return BAD_VALUE;
+    if (len > SIZE_MAX - mTotalSize) return NO_MEMORY; // overflow
+    if (mSpans.size() >= INT32_MAX) return NO_MEMORY;
+    mSpans.push_back({nullptr, len, fd});
+    mTotalSize += len;
+    return NO_ERROR;
+}
+
+void Parcel::GatherWriter::clear() {
+    mSpans.clear();
+    mTotalSize = 0;
+}
+
+status_t Parcel::GatherWriter::flattenTo(Parcel* parcel) const {
+    // Reserve room for every span up front so that writing them never goes
+    // through the growData() reallocation chain.
+    size_t needed = sizeof(int32_t);
+    for (const Span& span : mSpans) {
+        size_t spanSize = sizeof(int64_t) + sizeof(int32_t);
+        if (span.fd >= 0 && !parcel->allowFds()) return FDS_NOT_ALLOWED;
+        spanSize += (span.fd < 0 && (!parcel->allowFds() || span.len <= BLOB_INPLACE_LIMIT))
+                ? pad_size(span.len) : sizeof(flat_binder_object);
+        if (spanSize > SIZE_MAX - needed) return NO_MEMORY; // overflow
+        needed += spanSize;
+    }
+    if (needed > SIZE_MAX - parcel->dataPosition()) return NO_MEMORY; // overflow
+    const size_t capacity = parcel->dataPosition() + needed;
+    if (capacity > parcel->dataCapacity()) {
+        status_t status = parcel->setDataCapacity(capacity);
+        if (status) return status;
+    }
+
+    status_t status = parcel->writeInt32(static_cast<int32_t>(mSpans.size()));
+    for (size_t i = 0; i < mSpans.size() && status == NO_ERROR; i++) {
+        const Span& span = mSpans[i];
+        status = parcel->writeInt64(static_cast<int64_t>(span.len));
+        if (status) break;
+
+        if (span.fd >= 0) {
+            status = parcel->writeDupImmutableBlobFileDescriptor(span.fd);
+            continue;
+        }
+
+        WritableBlob blob;
+        status = parcel->writeBlob(span.len, false /*mutableCopy*/, &blob);
+        if (status) break;
+        if (span.len > 0) {
+            memcpy(blob.data(), span.data, span.len);
+        }
+        blob.release();
+    }
+    return status;
+}
+
 } // namespace android
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ParcelBufferPool"
+
+#include "ParcelBufferPool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <utils/Log.h>
+
+namespace android {
+
+static pthread_once_t gPoolKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gPoolKey;
+static bool gHavePoolKey = false;
+static std::atomic<size_t> gTotalBytesRetained(0);
+
+void ParcelBufferPool::createKey()
+{
+    gHavePoolKey = pthread_key_create(&gPoolKey, threadDestructor) == 0;
+    if (!gHavePoolKey) {
+        ALOGW("Unable to create Parcel buffer pool TLS key, pooling disabled");
+    }
+}
+
+ParcelBufferPool* ParcelBufferPool::self()
+{
+    // Pools are never created implicitly: a thread that has not opted in, or
+    // that is already running its TLS destructors, gets plain malloc/free.
+    pthread_once(&gPoolKeyOnce, createKey);
+    if (!gHavePoolKey) return nullptr;
+    return static_cast<ParcelBufferPool*>(pthread_getspecific(gPoolKey));
+}
+
+void ParcelBufferPool::threadDestructor(void* pool)
+{
+    delete static_cast<ParcelBufferPool*>(pool);
+}
+
+void ParcelBufferPool::setEnabled(bool enabled)
+{
+    pthread_once(&gPoolKeyOnce, createKey);
+    if (!gHavePoolKey) return;
+
+    ParcelBufferPool* pool = self();
+    if (enabled && pool == nullptr) {
+        pthread_setspecific(gPoolKey, new ParcelBufferPool);
+    } else if (!enabled && pool != nullptr) {
+        pthread_setspecific(gPoolKey, nullptr);
+        delete pool;
+    }
+}
+
+Parcel::BufferPoolStats ParcelBufferPool::stats()
+{
+    ParcelBufferPool* pool = self();
+    return pool ? pool->mStats : Parcel::BufferPoolStats();
+}
+
+size_t ParcelBufferPool::totalBytesRetained()
+{
+    return gTotalBytesRetained.load(std::memory_order_relaxed);
+}
+
+ParcelBufferPool::ParcelBufferPool()
+{
+    memset(mFree, 0, sizeof(mFree));
+    memset(mCount, 0, sizeof(mCount));
+}
+
+ParcelBufferPool::~ParcelBufferPool()
+{
+    for (size_t cls = 0; cls < kNumClasses; cls++) {
+        for (size_t i = 0; i < mCount[cls]; i++) {
+            free(mFree[cls][i]);
+        }
+    }
+    gTotalBytesRetained.fetch_sub(mStats.bytesRetained, std::memory_order_relaxed);
+}
+
+size_t ParcelBufferPool::classForSize(size_t size)
+{
+    size_t cls = 0;
+    while (cls < kNumClasses && classSize(cls) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+size_t ParcelBufferPool::classSize(size_t cls)
+{
+    return size_t(1) << (cls + kMinClassShift);
+}
+
+bool ParcelBufferPool::isClassSize(size_t size)
+{
+    const size_t cls = classForSize(size);
+    return cls < kNumClasses && classSize(cls) == size;
+}
+
+void* ParcelBufferPool::take(size_t cls)
+{
+    if (mCount[cls] == 0) {
+        mStats.misses++;
+        return malloc(classSize(cls));
+    }
+    mStats.hits++;
+    mStats.bytesRetained -= classSize(cls);
+    gTotalBytesRetained.fetch_sub(classSize(cls), std::memory_order_relaxed);
+    return mFree[cls][--mCount[cls]];
+}
+
+bool ParcelBufferPool::put(void* buffer, size_t capacity)
+{
+    if (!isClassSize(capacity)) return false;
+    const size_t cls = classForSize(capacity);
+    if (mCount[cls] >= kMaxBuffersPerClass
+            || mStats.bytesRetained + capacity > kMaxBytesRetained) {
+        return false;
+    }
+    mFree[cls][mCount[cls]++] = buffer;
+    mStats.bytesRetained += capacity;
+    gTotalBytesRetained.fetch_add(capacity, std::memory_order_relaxed);
+    mStats.returns++;
+    return true;
+}
+
+void* ParcelBufferPool::allocate(size_t* size)
+{
+    ParcelBufferPool* pool = self();
+    const size_t cls = classForSize(*size);
+    if (pool == nullptr || cls == kNumClasses) {
+        if (pool) pool->mStats.misses++;
+        return malloc(*size);
+    }
+
+    void* buffer = pool->take(cls);
+    if (buffer) {
+        *size = classSize(cls);
+    }
+    return buffer;
+}
+
+void* ParcelBufferPool::reallocate(void* buffer, size_t capacity, size_t used, size_t* size)
+{
+    ParcelBufferPool* pool = self();
+    if (pool == nullptr) {
+        return realloc(buffer, *size);
+    }
+
+    if (*size == 0) {
+        release(buffer, capacity);
+        return nullptr;
+    }
+
+    const size_t cls = classForSize(*size);
+    if (cls == kNumClasses && buffer != nullptr && !isClassSize(capacity)) {
+        // Neither the old nor the new buffer can be pooled; let the allocator
+        // grow it in place if it can.
+        return realloc(buffer, *size);
+    }
+    if (cls < kNumClasses && buffer != nullptr && capacity == classSize(cls)) {
+        *size = capacity;
+        return buffer;
+    }
+
+    size_t newCapacity = *size;
+    void* newBuffer = allocate(&newCapacity);
+    if (newBuffer == nullptr) {
+        return nullptr;
+    }
+    if (buffer != nullptr) {
+        memcpy(newBuffer, buffer, std::min(std::min(used, capacity), newCapacity));
+        release(buffer, capacity);
+    }
+    *size = newCapacity;
+    return newBuffer;
+}
+
+void ParcelBufferPool::release(void* buffer, size_t capacity)
+{
+    if (buffer == nullptr) return;
+
+    ParcelBufferPool* pool = self();
+    if (pool == nullptr) {
+        free(buffer);
+        return;
+    }
+    if (!pool->put(buffer, capacity)) {
+        pool->mStats.drops++;
+        free(buffer);
+    }
+}
+
+} // namespace android
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PARCEL_BUFFER_POOL_H
+#define ANDROID_PARCEL_BUFFER_POOL_H
+
+#include <binder/Parcel.h>
+
+#include <stddef.h>
+
+// ---------------------------------------------------------------------------
+namespace android {
+
+// Per-thread cache of Parcel data and object buffers, bucketed into
+// power-of-two size classes. A thread only owns a pool after it has called
+// Parcel::setThreadBufferPoolEnabled(true); on every other thread these
+// helpers behave exactly like malloc(), realloc() and free().
+//
+// Buffers are returned to the pool of the thread that releases them, so a
+// Parcel may safely be freed on a different thread than the one it was
+// written on.
+class ParcelBufferPool
+{
+public:
+    // Allocates at least *size bytes. On success *size is updated to the
+    // usable capacity of the returned buffer, which may be larger than
+    // requested.
+    static void*    allocate(size_t* size);
+
+    // Resizes |buffer| (of |capacity| bytes, of which the first |used| are
+    // meaningful) to hold at least *size bytes, updating *size as allocate()
+    // does. On failure nullptr is returned and |buffer| is left untouched.
+    static void*    reallocate(void* buffer, size_t capacity, size_t used, size_t* size);
+
+    // Hands a buffer of |capacity| bytes back to the calling thread's pool,
+    // or frees it if the pool cannot retain it.
+    static void     release(void* buffer, size_t capacity);
+
+    static void     setEnabled(bool enabled);
+    static Parcel::BufferPoolStats stats();
+
+    // Bytes retained by the pools of all threads. A pool frees what it
+    // retains when it is disabled or its thread exits.
+    static size_t   totalBytesRetained();
+
+private:
+    static constexpr size_t kMinClassShift = 6;     // 64 bytes
+    static constexpr size_t kMaxClassShift = 16;    // 64 KiB
+    static constexpr size_t kNumClasses = kMaxClassShift - kMinClassShift + 1;
+    static constexpr size_t kMaxBuffersPerClass = 8;
+    static constexpr size_t kMaxBytesRetained = 256 * 1024;
+
+                    ParcelBufferPool();
+                    ~ParcelBufferPool();
+
+    static void     createKey();
+    static ParcelBufferPool* self();
+    static void     threadDestructor(void* pool);
+
+    // Returns the index of the smallest class that fits |size| bytes, or
+    // kNumClasses if |size| is too large to be pooled.
+    static size_t   classForSize(size_t size);
+    static size_t   classSize(size_t cls);
+    static bool     isClassSize(size_t size);
+
+    void*           take(size_t cls);
+    bool            put(void* buffer, size_t capacity);
+
+    void*                   mFree[kNumClasses][kMaxBuffersPerClass];
+    size_t                  mCount[kNumClasses];
+    Parcel::BufferPoolStats mStats;
+};
+
+} // namespace android
+
+// ---------------------------------------------------------------------------
+
+#endif // ANDROID_PARCEL_BUFFER_POOL_H
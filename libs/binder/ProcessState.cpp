@@ -18,6 +18,7 @@
 
 #include <binder/ProcessState.h>
 
+#include <binder/BinderTransport.h>
 #include <binder/BpBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -32,6 +33,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -40,8 +42,12 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #define BINDER_VM_SIZE ((1 * 1024 * 1024) - sysconf(_SC_PAGE_SIZE) * 2)
 #define DEFAULT_MAX_BINDER_THREADS 15
+// Queueing delay behind a fully busy pool that makes an adaptive pool grow.
+#define ADAPTIVE_GROW_STARVATION_MS 10
 
 #ifdef __ANDROID_VNDK__
 const char* kDefaultDriver = "/dev/vndbinder";
@@ -77,7 +83,7 @@ sp<ProcessState> ProcessState::self()
     if (gProcess != nullptr) {
         return gProcess;
     }
-    gProcess = new ProcessState(kDefaultDriver);
+    gProcess = new ProcessState(kDefaultDriver, BinderTransport::kernel());
     return gProcess;
 }
 
@@ -98,7 +104,23 @@ sp<ProcessState> ProcessState::initWithDriver(const char* driver)
         driver = "/dev/binder";
     }
 
-    gProcess = new ProcessState(driver);
+    gProcess = new ProcessState(driver, BinderTransport::kernel());
+    return gProcess;
+}
+
+sp<ProcessState> ProcessState::initWithTransport(const char* driver,
+                                                 const sp<BinderTransport>& transport)
+{
+    Mutex::Autolock _l(gProcessMutex);
+    if (gProcess != nullptr) {
+        if (gProcess->mTransport == transport
+                && !strcmp(gProcess->getDriverName().c_str(), driver)) {
+            return gProcess;
+        }
+        LOG_ALWAYS_FATAL("ProcessState was already initialized.");
+    }
+
+    gProcess = new ProcessState(driver, transport);
     return gProcess;
 }
 
@@ -142,14 +164,14 @@ bool ProcessState::becomeContextManager(context_check_func checkFunc, void* user
         .flags = FLAT_BINDER_FLAG_TXN_SECURITY_CTX,
     };
 
-    int result = ioctl(mDriverFD, BINDER_SET_CONTEXT_MGR_EXT, &obj);
+    int result = mTransport->ioctl(mDriverFD, BINDER_SET_CONTEXT_MGR_EXT, &obj);
 
     // fallback to original method
     if (result != 0) {
         android_errorWriteLog(0x534e4554, "121035042");
 
         int dummy = 0;
-        result = ioctl(mDriverFD, BINDER_SET_CONTEXT_MGR, &dummy);
+        result = mTransport->ioctl(mDriverFD, BINDER_SET_CONTEXT_MGR, &dummy);
     }
 
     if (result == -1) {
@@ -175,7 +197,7 @@ ssize_t ProcessState::getKernelReferences(size_t buf_count, uintptr_t* buf)
     size_t count = 0;
 
     do {
-        status_t result = ioctl(mDriverFD, BINDER_GET_NODE_DEBUG_INFO, &info);
+        status_t result = mTransport->ioctl(mDriverFD, BINDER_GET_NODE_DEBUG_INFO, &info);
         if (result < 0) {
             return -1;
         }
@@ -202,7 +224,7 @@ ssize_t ProcessState::getStrongRefCountForNodeByHandle(int32_t handle) {
 
     info.handle = handle;
 
-    status_t result = ioctl(mDriverFD, BINDER_GET_NODE_INFO_FOR_REF, &info);
+    status_t result = mTransport->ioctl(mDriverFD, BINDER_GET_NODE_INFO_FOR_REF, &info);
 
     if (result != OK) {
         static bool logged = false;
@@ -324,20 +346,146 @@ void ProcessState::spawnPooledThread(bool isMain)
         ALOGV("Spawning new pooled thread, name=%s\n", name.string());
         sp<Thread> t = new PoolThread(isMain);
         t->run(name.string());
+
+        pthread_mutex_lock(&mThreadCountLock);
+        mThreadPoolStats.spawned++;
+        pthread_mutex_unlock(&mThreadCountLock);
     }
 }
 
 status_t ProcessState::setThreadPoolMaxThreadCount(size_t maxThreads) {
-    status_t result = NO_ERROR;
-    if (ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &maxThreads) != -1) {
-        mMaxThreads = maxThreads;
+    pthread_mutex_lock(&mThreadCountLock);
+    const size_t previous = mMaxThreads;
+    mMaxThreads = maxThreads;
+    status_t result = syncDriverMaxThreadsLocked();
+    if (result != NO_ERROR) {
+        mMaxThreads = previous;
+    } else if (mThreadPoolAdaptive) {
+        mThreadPoolAdaptive = false;
+        setDriverIdleTimeoutLocked(0);
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return result;
+}
+
+status_t ProcessState::setThreadPoolAdaptive(size_t minThreads, size_t maxThreads,
+                                             int64_t idleWindowMs) {
+    if (minThreads > maxThreads || idleWindowMs <= 0) {
+        return BAD_VALUE;
+    }
+
+    pthread_mutex_lock(&mThreadCountLock);
+    const size_t previous = mMaxThreads;
+    mMaxThreads = minThreads;
+    status_t result = syncDriverMaxThreadsLocked();
+    if (result == NO_ERROR) {
+        mThreadPoolAdaptive = true;
+        mMinThreads = minThreads;
+        mAdaptiveMaxThreads = maxThreads;
+        mIdleWindow = milliseconds_to_nanoseconds(idleWindowMs);
+        mWindowStart = systemTime();
+        mWindowPeakBusy = mExecutingThreadsCount;
+        mWindowStarved = false;
+        setDriverIdleTimeoutLocked(mIdleWindow);
     } else {
-        result = -errno;
-        ALOGE("Binder ioctl to set max threads failed: %s", strerror(-result));
+        mMaxThreads = previous;
     }
+    pthread_mutex_unlock(&mThreadCountLock);
     return result;
 }
 
+status_t ProcessState::syncDriverMaxThreadsLocked() {
+    size_t maxThreads = mMaxThreads;
+    if (mTransport->ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &maxThreads) == -1) {
+        status_t result = -errno;
+        ALOGE("Binder ioctl to set max threads failed: %s", strerror(-result));
+        return result;
+    }
+    return NO_ERROR;
+}
+
+void ProcessState::setDriverIdleTimeoutLocked(nsecs_t idleTimeout) {
+    // Lets the driver finish pooled threads that stay idle while the pool is
+    // over its limit. Drivers that do not support this keep them instead.
+    int64_t timeout = idleTimeout;
+    if (mTransport->ioctl(mDriverFD, BINDER_SET_IDLE_TIMEOUT, &timeout) == -1) {
+        ALOGI("Binder driver does not time out idle threads: %s", strerror(errno));
+    }
+}
+
+void ProcessState::noteThreadPoolStarvedLocked(int64_t starvationTimeMs) {
+    mThreadPoolStats.starvedTime += milliseconds_to_nanoseconds(starvationTimeMs);
+    if (!mThreadPoolAdaptive) return;
+
+    mWindowStarved = true;
+    if (starvationTimeMs >= ADAPTIVE_GROW_STARVATION_MS && mMaxThreads < mAdaptiveMaxThreads) {
+        mMaxThreads++;
+        if (syncDriverMaxThreadsLocked() != NO_ERROR) {
+            mMaxThreads--;
+        }
+    }
+}
+
+void ProcessState::updateThreadPoolWindowLocked(nsecs_t now) {
+    if (!mThreadPoolAdaptive || now - mWindowStart < mIdleWindow) return;
+
+    // Keep one idle thread on top of the busiest moment of the window that
+    // just ended. The driver finishes pooled threads beyond that once they
+    // have been idle for a window.
+    const size_t needed = std::max(mWindowPeakBusy + 1, mMinThreads);
+    if (!mWindowStarved && mMaxThreads > needed) {
+        const size_t previous = mMaxThreads;
+        mMaxThreads = needed;
+        if (syncDriverMaxThreadsLocked() != NO_ERROR) {
+            mMaxThreads = previous;
+        }
+    }
+    mWindowStart = now;
+    mWindowPeakBusy = mExecutingThreadsCount;
+    mWindowStarved = false;
+}
+
+ProcessState::ThreadPoolStats ProcessState::getThreadPoolStats() {
+    pthread_mutex_lock(&mThreadCountLock);
+    ThreadPoolStats stats = mThreadPoolStats;
+    stats.threads = mPooledThreadCount;
+    stats.maxThreads = mMaxThreads;
+    pthread_mutex_unlock(&mThreadCountLock);
+    return stats;
+}
+
+String8 ProcessState::dumpThreadPoolStats() {
+    const ThreadPoolStats stats = getThreadPoolStats();
+    bool adaptive;
+    size_t minThreads, maxThreads;
+    pthread_mutex_lock(&mThreadCountLock);
+    adaptive = mThreadPoolAdaptive;
+    minThreads = mMinThreads;
+    maxThreads = mAdaptiveMaxThreads;
+    pthread_mutex_unlock(&mThreadCountLock);
+
+    String8 out;
+    out.appendFormat("Binder thread pool of pid %d: %zu threads, limit %zu", getpid(),
+                     stats.threads, stats.maxThreads);
+    if (adaptive) {
+        out.appendFormat(" (adaptive %zu-%zu)", minThreads, maxThreads);
+    }
+    out.appendFormat("\n  spawned %" PRIu64 ", retired %" PRIu64 "\n", stats.spawned,
+                     stats.retired);
+    out.appendFormat("  busy %" PRId64 " ms, waiting %" PRId64 " ms, starved %" PRId64 " ms\n",
+                     nanoseconds_to_milliseconds(stats.busyTime),
+                     nanoseconds_to_milliseconds(stats.waitTime),
+                     nanoseconds_to_milliseconds(stats.starvedTime));
+    out.append("  commands by busy threads:");
+    for (size_t i = 0; i < THREAD_POOL_BUSY_BUCKETS; i++) {
+        if (stats.busyHistogram[i] == 0) continue;
+        out.appendFormat(" %zu%s:%" PRIu64, i + 1,
+                         i + 1 == THREAD_POOL_BUSY_BUCKETS ? "+" : "", stats.busyHistogram[i]);
+    }
+    out.append("\n");
+    return out;
+}
+
 void ProcessState::giveThreadPoolName() {
     androidSetThreadName( makeBinderThreadName().string() );
 }
@@ -346,25 +494,25 @@ String8 ProcessState::getDriverName() {
     return mDriverName;
 }
 
-static int open_driver(const char *driver)
+static int open_driver(const sp<BinderTransport>& transport, const char *driver)
 {
-    int fd = open(driver, O_RDWR | O_CLOEXEC);
+    int fd = transport->open(driver);
     if (fd >= 0) {
         int vers = 0;
-        status_t result = ioctl(fd, BINDER_VERSION, &vers);
+        status_t result = transport->ioctl(fd, BINDER_VERSION, &vers);
         if (result == -1) {
             ALOGE("Binder ioctl to obtain version failed: %s", strerror(errno));
-            close(fd);
+            transport->close(fd);
             fd = -1;
         }
         if (result != 0 || vers != BINDER_CURRENT_PROTOCOL_VERSION) {
           ALOGE("Binder driver protocol(%d) does not match user space protocol(%d)! ioctl() return value: %d",
                 vers, BINDER_CURRENT_PROTOCOL_VERSION, result);
-            close(fd);
+            transport->close(fd);
             fd = -1;
         }
         size_t maxThreads = DEFAULT_MAX_BINDER_THREADS;
-        result = ioctl(fd, BINDER_SET_MAX_THREADS, &maxThreads);
+        result = transport->ioctl(fd, BINDER_SET_MAX_THREADS, &maxThreads);
         if (result == -1) {
             ALOGE("Binder ioctl to set max threads failed: %s", strerror(errno));
         }
@@ -374,15 +522,25 @@ static int open_driver(const char *driver)
     return fd;
 }
 
-ProcessState::ProcessState(const char *driver)
-    : mDriverName(String8(driver))
-    , mDriverFD(open_driver(driver))
+ProcessState::ProcessState(const char *driver, const sp<BinderTransport>& transport)
+    : mTransport(transport)
+    , mDriverName(String8(driver))
+    , mDriverFD(open_driver(transport, driver))
     , mVMStart(MAP_FAILED)
     , mThreadCountLock(PTHREAD_MUTEX_INITIALIZER)
     , mThreadCountDecrement(PTHREAD_COND_INITIALIZER)
     , mExecutingThreadsCount(0)
     , mMaxThreads(DEFAULT_MAX_BINDER_THREADS)
     , mStarvationStartTimeMs(0)
+    , mPooledThreadCount(0)
+    , mThreadPoolStats()
+    , mThreadPoolAdaptive(false)
+    , mMinThreads(0)
+    , mAdaptiveMaxThreads(DEFAULT_MAX_BINDER_THREADS)
+    , mIdleWindow(0)
+    , mWindowStart(0)
+    , mWindowPeakBusy(0)
+    , mWindowStarved(false)
     , mBinderContextCheckFunc(nullptr)
     , mBinderContextUserData(nullptr)
     , mThreadPoolStarted(false)
@@ -397,11 +555,11 @@ ProcessState::ProcessState(const char *driver)
 
     if (mDriverFD >= 0) {
         // mmap the binder, providing a chunk of virtual address space to receive transactions.
-        mVMStart = mmap(nullptr, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, mDriverFD, 0);
+        mVMStart = mTransport->mmap(mDriverFD, BINDER_VM_SIZE);
         if (mVMStart == MAP_FAILED) {
             // *sigh*
             ALOGE("Using %s failed: unable to mmap transaction memory.\n", mDriverName.c_str());
-            close(mDriverFD);
+            mTransport->close(mDriverFD);
             mDriverFD = -1;
             mDriverName.clear();
         }
@@ -416,9 +574,9 @@ ProcessState::~ProcessState()
 {
     if (mDriverFD >= 0) {
         if (mVMStart != MAP_FAILED) {
-            munmap(mVMStart, BINDER_VM_SIZE);
+            mTransport->munmap(mVMStart, BINDER_VM_SIZE);
         }
-        close(mDriverFD);
+        mTransport->close(mDriverFD);
     }
     mDriverFD = -1;
 }
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <utils/RefBase.h>
+
+// ---------------------------------------------------------------------------
+namespace android {
+
+// The channel ProcessState and IPCThreadState use to reach the binder
+// driver. Every call mirrors the corresponding system call on a binder device
+// node: failures return -1 and leave the reason in errno.
+//
+// The default transport talks to the kernel driver. Tests and benchmarks can
+// install another one (see LoopbackBinderTransport) through
+// ProcessState::initWithTransport() before the first ProcessState::self().
+class BinderTransport : public virtual RefBase
+{
+public:
+    virtual int         open(const char* driver) = 0;
+    virtual int         ioctl(int fd, unsigned long request, void* arg) = 0;
+    virtual void*       mmap(int fd, size_t size) = 0;
+    virtual int         munmap(void* addr, size_t size) = 0;
+    virtual int         close(int fd) = 0;
+
+    // Transport backed by the kernel binder driver.
+    static sp<BinderTransport> kernel();
+
+protected:
+    virtual             ~BinderTransport() = default;
+};
+
+} // namespace android
+
+// ---------------------------------------------------------------------------
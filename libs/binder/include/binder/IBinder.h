@@ -38,6 +38,7 @@ class IInterface;
 class Parcel;
 class IResultReceiver;
 class IShellCallback;
+class String8;
 
 /**
  * Base class and low-level protocol for a remotable object.
@@ -60,6 +61,7 @@ public:
         SYSPROPS_TRANSACTION    = B_PACK_CHARS('_', 'S', 'P', 'R'),
         EXTENSION_TRANSACTION   = B_PACK_CHARS('_', 'E', 'X', 'T'),
         DEBUG_PID_TRANSACTION   = B_PACK_CHARS('_', 'P', 'I', 'D'),
+        THREAD_POOL_STATS_TRANSACTION = B_PACK_CHARS('_', 'T', 'P', 'S'),
 
         // Corresponds to TF_ONE_WAY -- an asynchronous call.
         FLAG_ONEWAY             = 0x00000001,
@@ -139,6 +141,16 @@ public:
      */
     status_t                getDebugPid(pid_t* outPid);
 
+    /**
+     * Dump binder thread pool statistics of the process hosting a binder,
+     * for debugging. See ProcessState::dumpThreadPoolStats().
+     *
+     * Remote processes only answer callers that are root, shell, system,
+     * their own uid, or that hold android.permission.DUMP; other callers
+     * get PERMISSION_DENIED.
+     */
+    status_t                getThreadPoolStats(String8* outStats);
+
     // NOLINTNEXTLINE(google-default-arguments)
     virtual status_t        transact(   uint32_t code,
                                         const Parcel& data,
@@ -22,6 +22,10 @@
 #include <binder/ProcessState.h>
 #include <utils/Vector.h>
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 #if defined(_WIN32)
 typedef  int  uid_t;
 #endif
@@ -102,6 +106,24 @@ public:
                                          uint32_t code, const Parcel& data,
                                          Parcel* reply, uint32_t flags);
 
+            // Oneway transactions this thread makes between
+            // beginOnewayBatch() and the matching endOnewayBatch() are
+            // queued in mOut and handed to the driver together, with a
+            // single BINDER_WRITE_READ, when the outermost batch ends.
+            // Batches nest; they are also flushed early when they grow
+            // large, before any synchronous transaction or reply this
+            // thread sends, and when an incoming call returns with one
+            // still open.
+            //
+            // Queued calls reach the driver in the order they were made,
+            // ahead of anything the thread sends later, so per-binder
+            // oneway ordering is unchanged. Calls made inside a batch copy
+            // their Parcel and report success from transact(); the first
+            // error the driver reports for any of them is returned by
+            // endOnewayBatch() instead.
+            void                beginOnewayBatch();
+            status_t            endOnewayBatch();
+
             void                incStrongHandle(int32_t handle, BpBinder *proxy);
             void                decStrongHandle(int32_t handle);
             void                incWeakHandle(int32_t handle, BpBinder *proxy);
@@ -158,6 +180,12 @@ private:
                                                      uint32_t code,
                                                      const Parcel& data,
                                                      status_t* statusBuffer);
+            status_t            queueOnewayTransaction(int32_t handle, uint32_t code,
+                                                   const Parcel& data, uint32_t flags);
+            status_t            flushOnewayBatch();
+            bool                consumeOnewayReply(uint32_t cmd);
+            void                recordOnewayReply(status_t err);
+            void                recycleOnewayParcel(std::unique_ptr<Parcel> parcel);
             status_t            getAndExecuteCommand();
             status_t            executeCommand(int32_t command);
             void                processPendingDerefs();
@@ -190,6 +218,19 @@ private:
             bool                mPropagateWorkSource;
             int32_t             mStrictModePolicy;
             int32_t             mLastTransactionBinderFlags;
+            // Nesting depth of beginOnewayBatch(), and the Parcels of the
+            // calls queued in mOut that the driver has not seen yet.
+            int32_t             mOnewayBatchDepth;
+            std::vector<std::unique_ptr<Parcel>> mOnewayBatch;
+            // Emptied Parcels kept to copy the next queued calls into.
+            std::vector<std::unique_ptr<Parcel>> mSpareOnewayParcels;
+            // Queued calls written so far, and driver answers received for
+            // them; the answer to the Nth queued call is the Nth received.
+            // Failed calls are kept in mOnewayErrors, by number, until the
+            // flush of their batch reports them.
+            uint64_t            mOnewayRepliesExpected;
+            uint64_t            mOnewayRepliesReceived;
+            std::vector<std::pair<uint64_t, status_t>> mOnewayErrors;
 
             ProcessState::CallRestriction mCallRestriction;
 };
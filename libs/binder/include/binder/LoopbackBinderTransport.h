@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <binder/BinderTransport.h>
+#include <binder/IBinder.h>
+
+#include <memory>
+
+// ---------------------------------------------------------------------------
+namespace android {
+
+class LoopbackDriver;
+
+// A user-space implementation of the binder driver's BC_/BR_ command
+// protocol, for running libbinder without /dev/binder. Install it with
+// ProcessState::initWithTransport() before anything else touches binder.
+//
+// The loopback driver serves a single process, but it never hands a local
+// binder back to its owner as a local object: every BBinder written into a
+// transaction reaches the receiver as a handle. Calls therefore take the full
+// BpBinder -> IPCThreadState -> BBinder::transact path, including Parcel
+// flattening, reference counting commands, thread pool spawning and death
+// notifications, just as they would between two processes.
+//
+// Handle 0 is served by the context manager, which a thread of the same
+// process registers through ProcessState::becomeContextManager() and
+// IPCThreadState::setTheContextObject().
+class LoopbackBinderTransport : public BinderTransport
+{
+public:
+                        LoopbackBinderTransport();
+
+    int                 open(const char* driver) override;
+    int                 ioctl(int fd, unsigned long request, void* arg) override;
+    void*               mmap(int fd, size_t size) override;
+    int                 munmap(void* addr, size_t size) override;
+    int                 close(int fd) override;
+
+    // Simulates the death of the process hosting |binder|, which must be a
+    // local binder that has been sent through this transport: every handle
+    // to it starts failing with DEAD_OBJECT and registered death recipients
+    // are notified.
+    status_t            killNode(const sp<IBinder>& binder);
+
+protected:
+                        ~LoopbackBinderTransport() override;
+
+private:
+    std::unique_ptr<LoopbackDriver> mDriver;
+};
+
+} // namespace android
+
+// ---------------------------------------------------------------------------
@@ -17,6 +17,7 @@
 #ifndef ANDROID_PARCEL_H
 #define ANDROID_PARCEL_H
 
+#include <functional>
 #include <map> // for legacy reasons
 #include <string>
 #include <type_traits>
@@ -407,6 +408,14 @@ public:
     // The caller should call release() on the blob after reading its contents.
     status_t            readBlob(size_t len, ReadableBlob* outBlob) const;
 
+    // Reads the spans written by GatherWriter::flattenTo(), in order, handing
+    // each one to |visitor| in place. Spans that travelled through ashmem are
+    // unmapped once the visitor returns. Stops at the first error, including
+    // one returned by the visitor.
+    status_t            readGatheredSpans(
+                            const std::function<status_t(const void* data, size_t len)>& visitor)
+                            const;
+
     const flat_binder_object* readObject(bool nullMetaData) const;
 
     // Explicitly close all file descriptors in the parcel.
@@ -416,6 +425,20 @@ public:
     static size_t       getGlobalAllocSize();
     static size_t       getGlobalAllocCount();
 
+    // Opt-in, per-thread pool of size-classed data and object buffers. Once
+    // enabled on a thread, buffers released by Parcels on that thread are
+    // kept for reuse by later Parcels instead of going back to malloc.
+    // Disabling the pool frees everything it retains.
+    struct BufferPoolStats {
+        size_t          hits = 0;           // allocations served from the pool
+        size_t          misses = 0;         // allocations that fell through to malloc
+        size_t          returns = 0;        // released buffers retained for reuse
+        size_t          drops = 0;          // released buffers freed instead
+        size_t          bytesRetained = 0;  // bytes currently held by the pool
+    };
+    static void         setThreadBufferPoolEnabled(bool enabled);
+    static BufferPoolStats getThreadBufferPoolStats();
+
     bool                replaceCallingWorkSourceUid(uid_t uid);
     // Returns the work source provided by the caller. This can only be trusted for trusted calling
     // uid.
@@ -617,6 +640,43 @@ public:
         inline void* data() { return mData; }
     };
 
+    // Records spans and writes them into a Parcel in one pass, sizing the
+    // Parcel once for all of them.
+    //
+    // Memory spans (add()) are copied once, as writeBlob() would: small ones
+    // in place, large ones into a new ashmem region. That is no fewer copies
+    // than writing each span yourself; the copy only happens in flattenTo(),
+    // so the caller needs no staging buffer. They must stay valid and
+    // unmodified until flattenTo() returns.
+    //
+    // Spans that already live in ashmem (addFd()) are not copied at all: the
+    // receiver maps the same region. Make it read-only first with
+    // ashmem_set_prot_region() if the receiver must not see later writes.
+    class GatherWriter {
+    public:
+        status_t add(const void* data, size_t len);
+        // Adds the first |len| bytes of the ashmem region |fd|, which is
+        // dup'ed when flattened. Needs a Parcel that allows fds.
+        status_t addFd(int fd, size_t len);
+        void clear();
+
+        inline size_t spanCount() const { return mSpans.size(); }
+        inline size_t totalSize() const { return mTotalSize; }
+
+        // Appends all recorded spans to |parcel| at its current position.
+        // Read them back with Parcel::readGatheredSpans().
+        status_t flattenTo(Parcel* parcel) const;
+
+    private:
+        struct Span {
+            const void* data;
+            size_t len;
+            int fd;             // -1 for memory spans
+        };
+        std::vector<Span> mSpans;
+        size_t mTotalSize = 0;
+    };
+
 private:
     size_t mOpenAshmemSize;
 
@@ -23,12 +23,14 @@
 #include <utils/String16.h>
 
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 #include <pthread.h>
 
 // ---------------------------------------------------------------------------
 namespace android {
 
+class BinderTransport;
 class IPCThreadState;
 
 class ProcessState : public virtual RefBase
@@ -45,6 +47,14 @@ public:
      */
     static  sp<ProcessState>    initWithDriver(const char *driver);
 
+    /* initWithTransport() routes all driver traffic for this process through
+     * |transport| instead of the kernel binder driver, for example an
+     * in-process LoopbackBinderTransport. Like initWithDriver(), it must be
+     * called *before* any call to ProcessState::self().
+     */
+    static  sp<ProcessState>    initWithTransport(const char *driver,
+                                                  const sp<BinderTransport>& transport);
+
             sp<IBinder>         getContextObject(const sp<IBinder>& caller);
 
             void                startThreadPool();
@@ -65,6 +75,35 @@ public:
             status_t            setThreadPoolMaxThreadCount(size_t maxThreads);
             void                giveThreadPoolName();
 
+            // Lets the thread pool size itself between |minThreads| and
+            // |maxThreads| instead of using a fixed limit. The limit handed
+            // to the driver starts at |minThreads| and grows whenever incoming
+            // calls queue behind a fully busy pool. Pooled threads beyond what
+            // the last |idleWindowMs| needed leave the pool once they have been
+            // idle for |idleWindowMs|, if the driver supports idle timeouts. A
+            // later setThreadPoolMaxThreadCount() turns the policy off again.
+            status_t            setThreadPoolAdaptive(size_t minThreads, size_t maxThreads,
+                                                      int64_t idleWindowMs);
+
+            enum { THREAD_POOL_BUSY_BUCKETS = 16 };
+
+            struct ThreadPoolStats {
+                size_t          threads;        // threads currently in the pool
+                size_t          maxThreads;     // current limit
+                uint64_t        spawned;        // threads started for the pool
+                uint64_t        retired;        // idle threads the driver finished
+                nsecs_t         busyTime;       // time spent executing commands
+                nsecs_t         waitTime;       // time spent waiting for them
+                nsecs_t         starvedTime;    // time the pool was at its limit
+                // Commands by the number of threads busy when they started,
+                // one-based; the last bucket also counts busier moments.
+                uint64_t        busyHistogram[THREAD_POOL_BUSY_BUCKETS];
+            };
+            ThreadPoolStats     getThreadPoolStats();
+            // Human readable form of getThreadPoolStats(), as shown by
+            // `dumpsys --thread-pool`.
+            String8             dumpThreadPoolStats();
+
             String8             getDriverName();
 
             ssize_t             getKernelReferences(size_t count, uintptr_t* buf);
@@ -92,7 +131,8 @@ public:
 private:
     friend class IPCThreadState;
     
-            explicit            ProcessState(const char* driver);
+                                ProcessState(const char* driver,
+                                             const sp<BinderTransport>& transport);
                                 ~ProcessState();
 
                                 ProcessState(const ProcessState& o);
@@ -106,6 +146,13 @@ private:
 
             handle_entry*       lookupHandleLocked(int32_t handle);
 
+            // These require mThreadCountLock.
+            status_t            syncDriverMaxThreadsLocked();
+            void                setDriverIdleTimeoutLocked(nsecs_t idleTimeout);
+            void                noteThreadPoolStarvedLocked(int64_t starvationTimeMs);
+            void                updateThreadPoolWindowLocked(nsecs_t now);
+
+            sp<BinderTransport> mTransport;
             String8             mDriverName;
             int                 mDriverFD;
             void*               mVMStart;
@@ -119,6 +166,17 @@ private:
             size_t              mMaxThreads;
             // Time when thread pool was emptied
             int64_t             mStarvationStartTimeMs;
+            // Number of threads currently in joinThreadPool().
+            size_t              mPooledThreadCount;
+            ThreadPoolStats     mThreadPoolStats;
+            // Adaptive sizing state, see setThreadPoolAdaptive().
+            bool                mThreadPoolAdaptive;
+            size_t              mMinThreads;
+            size_t              mAdaptiveMaxThreads;
+            nsecs_t             mIdleWindow;
+            nsecs_t             mWindowStart;
+            size_t              mWindowPeakBusy;
+            bool                mWindowStarved;
 
     mutable Mutex               mLock;  // protects everything below.
 
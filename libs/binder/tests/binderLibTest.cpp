@@ -21,6 +21,11 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/wait.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -84,6 +89,7 @@ enum BinderLibTestTranscationCode {
     BINDER_LIB_TEST_GETPID,
     BINDER_LIB_TEST_ECHO_VECTOR,
     BINDER_LIB_TEST_REJECT_OBJECTS,
+    BINDER_LIB_TEST_ECHO_GATHERED_SPANS,
 };
 
 pid_t start_server_process(int arg2, bool usePoll = false)
@@ -1096,6 +1102,38 @@ TEST_F(BinderLibTest, VectorSent) {
     EXPECT_EQ(readValue, testValue);
 }
 
+TEST_F(BinderLibTest, GatheredSpansSent) {
+    Parcel data, reply;
+    sp<IBinder> server = addServer();
+    ASSERT_TRUE(server != nullptr);
+
+    // One span small enough to be written in place, one that has to go
+    // through ashmem, and an empty one.
+    std::vector<uint8_t> small(100, 0x11);
+    std::vector<uint8_t> large(256 * 1024, 0x22);
+    Parcel::GatherWriter writer;
+    EXPECT_EQ(NO_ERROR, writer.add(small.data(), small.size()));
+    EXPECT_EQ(NO_ERROR, writer.add(large.data(), large.size()));
+    EXPECT_EQ(NO_ERROR, writer.add(nullptr, 0));
+    EXPECT_EQ(3u, writer.spanCount());
+    EXPECT_EQ(small.size() + large.size(), writer.totalSize());
+    ASSERT_EQ(NO_ERROR, writer.flattenTo(&data));
+
+    status_t ret = server->transact(BINDER_LIB_TEST_ECHO_GATHERED_SPANS, data, &reply);
+    EXPECT_EQ(NO_ERROR, ret);
+    std::vector<std::vector<uint8_t>> spans;
+    ret = reply.readGatheredSpans([&](const void* spanData, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+        spans.emplace_back(bytes, bytes + len);
+        return NO_ERROR;
+    });
+    EXPECT_EQ(NO_ERROR, ret);
+    ASSERT_EQ(3u, spans.size());
+    EXPECT_EQ(small, spans[0]);
+    EXPECT_EQ(large, spans[1]);
+    EXPECT_TRUE(spans[2].empty());
+}
+
 TEST_F(BinderLibTest, BufRejected) {
     Parcel data, reply;
     uint32_t buf;
@@ -1163,6 +1201,121 @@ TEST_F(BinderLibTest, WeakRejected) {
     EXPECT_EQ(NO_ERROR, server->pingBinder());
 }
 
+class BinderLibServiceCacheTest : public BinderLibTest {
+protected:
+    // Starts a server process that registers itself with servicemanager
+    // under mCacheServiceName.
+    pid_t startCacheServer() {
+        char* suffix = binderserversuffix;
+        binderserversuffix = mCacheServerSuffix;
+        pid_t pid = start_server_process(0);
+        binderserversuffix = suffix;
+        return pid;
+    }
+
+    void stopCacheServer(const sp<IBinder>& server, pid_t pid) {
+        Parcel data, reply;
+        EXPECT_EQ(NO_ERROR,
+                  server->transact(BINDER_LIB_TEST_EXIT_TRANSACTION, data, &reply, TF_ONE_WAY));
+        int exitStatus;
+        EXPECT_EQ(pid, waitpid(pid, &exitStatus, 0));
+    }
+
+    virtual void SetUp() {
+        BinderLibTest::SetUp();
+        snprintf(mCacheServerSuffix, sizeof(mCacheServerSuffix), "%d.cache", getpid());
+        mCacheServiceName = String16("test.binderLib");
+        mCacheServiceName += String16(mCacheServerSuffix);
+    }
+
+    char mCacheServerSuffix[32];
+    String16 mCacheServiceName;
+};
+
+TEST_F(BinderLibServiceCacheTest, RestartedServiceReturnedAfterDeath) {
+    sp<IServiceManager> sm = defaultServiceManager();
+    pid_t firstPid = startCacheServer();
+    ASSERT_GT(firstPid, 0);
+    sp<IBinder> first = sm->checkService(mCacheServiceName);
+    ASSERT_NE(nullptr, first);
+    EXPECT_EQ(first, sm->checkService(mCacheServiceName));
+
+    stopCacheServer(first, firstPid);
+    // The proxy learns of the death from the failed call, whether or not
+    // the death notification has been delivered yet.
+    EXPECT_EQ(DEAD_OBJECT, first->pingBinder());
+
+    pid_t secondPid = startCacheServer();
+    ASSERT_GT(secondPid, 0);
+    sp<IBinder> second = sm->checkService(mCacheServiceName);
+    ASSERT_NE(nullptr, second);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(NO_ERROR, second->pingBinder());
+    EXPECT_EQ(second, sm->getService(mCacheServiceName));
+
+    stopCacheServer(second, secondPid);
+}
+
+TEST_F(BinderLibServiceCacheTest, ReplacedServiceReturnedWhileOldOneAlive) {
+    sp<IServiceManager> sm = defaultServiceManager();
+    String16 name = mCacheServiceName;
+    name += String16(".replaced");
+    sp<IBinder> first = new BBinder();
+    ASSERT_EQ(NO_ERROR, sm->addService(name, first));
+    EXPECT_EQ(first, sm->checkService(name));
+
+    // |first| stays alive, so only the registration callback tells the
+    // cache that |second| replaced it.
+    sp<IBinder> second = new BBinder();
+    ASSERT_EQ(NO_ERROR, sm->addService(name, second));
+    sp<IBinder> service = sm->checkService(name);
+    for (int i = 0; i < 100 && service != second; i++) {
+        usleep(10000);
+        service = sm->checkService(name);
+    }
+    EXPECT_EQ(second, service);
+    EXPECT_EQ(second, sm->getService(name));
+}
+
+TEST_F(BinderLibServiceCacheTest, ConcurrentMissesReturnSameService) {
+    sp<IServiceManager> sm = defaultServiceManager();
+    pid_t pid = startCacheServer();
+    ASSERT_GT(pid, 0);
+
+    constexpr size_t kThreads = 8;
+    constexpr size_t kRounds = 20;
+    for (size_t round = 0; round < kRounds; round++) {
+        // Cache entries are weak: once the previous round dropped every
+        // reference to the proxy, all threads of this one miss together.
+        std::vector<sp<IBinder>> services(kThreads);
+        std::atomic<size_t> waiting = kThreads;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < kThreads; i++) {
+            threads.emplace_back([&, i]() {
+                waiting--;
+                while (waiting > 0) {
+                    std::this_thread::yield();
+                }
+                services[i] = sm->checkService(mCacheServiceName);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        ASSERT_NE(nullptr, services[0]);
+        for (const sp<IBinder>& service : services) {
+            EXPECT_EQ(services[0], service);
+        }
+        EXPECT_EQ(services[0], sm->checkService(mCacheServiceName));
+        EXPECT_EQ(NO_ERROR, services[0]->pingBinder());
+    }
+
+    sp<IBinder> service = sm->checkService(mCacheServiceName);
+    ASSERT_NE(nullptr, service);
+    stopCacheServer(service, pid);
+}
+
 class BinderLibTestService : public BBinder
 {
     public:
@@ -1464,6 +1617,21 @@ class BinderLibTestService : public BBinder
             case BINDER_LIB_TEST_REJECT_OBJECTS: {
                 return data.objectsCount() == 0 ? BAD_VALUE : NO_ERROR;
             }
+            case BINDER_LIB_TEST_ECHO_GATHERED_SPANS: {
+                std::vector<std::vector<uint8_t>> spans;
+                auto err = data.readGatheredSpans([&](const void* spanData, size_t len) {
+                    const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+                    spans.emplace_back(bytes, bytes + len);
+                    return NO_ERROR;
+                });
+                if (err != NO_ERROR)
+                    return err;
+                Parcel::GatherWriter writer;
+                for (const auto& span : spans) {
+                    writer.add(span.data(), span.size());
+                }
+                return writer.flattenTo(reply);
+            }
             default:
                 return UNKNOWN_TRANSACTION;
             };
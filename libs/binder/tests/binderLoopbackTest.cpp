@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <binder/Binder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/LoopbackBinderTransport.h>
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include <cutils/ashmem.h>
+
+#include <private/binder/binder_module.h>
+
+using namespace android;
+using namespace std::chrono_literals;
+
+namespace {
+
+enum LoopbackTestTransactionCode {
+    LOOPBACK_TEST_ECHO_INT = IBinder::FIRST_CALL_TRANSACTION,
+    LOOPBACK_TEST_ECHO_BINDER,
+    LOOPBACK_TEST_WRITE_FD,
+    LOOPBACK_TEST_RECORD_ONEWAY,
+    LOOPBACK_TEST_ECHO_GATHERED_SPANS,
+    LOOPBACK_TEST_SLEEP_MS,
+};
+
+// Counts the BINDER_WRITE_READ round trips each thread makes.
+class CountingLoopbackTransport : public LoopbackBinderTransport
+{
+public:
+    int ioctl(int fd, unsigned long request, void* arg) override {
+        if (request == BINDER_WRITE_READ) sWriteReads++;
+        return LoopbackBinderTransport::ioctl(fd, request, arg);
+    }
+
+    static thread_local size_t sWriteReads;
+};
+
+thread_local size_t CountingLoopbackTransport::sWriteReads = 0;
+
+sp<CountingLoopbackTransport> gTransport;
+
+class LoopbackTestService : public BBinder
+{
+public:
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                        uint32_t flags) override {
+        switch (code) {
+            case LOOPBACK_TEST_ECHO_INT:
+                return reply->writeInt32(data.readInt32());
+            case LOOPBACK_TEST_ECHO_BINDER:
+                return reply->writeStrongBinder(data.readStrongBinder());
+            case LOOPBACK_TEST_WRITE_FD: {
+                const int32_t value = data.readInt32();
+                const int fd = data.readFileDescriptor();
+                if (fd < 0) return BAD_VALUE;
+                return write(fd, &value, sizeof(value)) == sizeof(value) ? NO_ERROR : -errno;
+            }
+            case LOOPBACK_TEST_RECORD_ONEWAY: {
+                if (!(flags & FLAG_ONEWAY)) return BAD_VALUE;
+                std::lock_guard<std::mutex> lock(mLock);
+                if (data.readInt32() != mOnewayCount) {
+                    mOnewayOutOfOrder = true;
+                }
+                mOnewayCount++;
+                mOnewayCondition.notify_all();
+                return NO_ERROR;
+            }
+            case LOOPBACK_TEST_SLEEP_MS:
+                std::this_thread::sleep_for(std::chrono::milliseconds(data.readInt32()));
+                return NO_ERROR;
+            case LOOPBACK_TEST_ECHO_GATHERED_SPANS: {
+                std::vector<std::vector<uint8_t>> spans;
+                status_t err = data.readGatheredSpans([&](const void* spanData, size_t len) {
+                    const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+                    spans.emplace_back(bytes, bytes + len);
+                    return NO_ERROR;
+                });
+                if (err != NO_ERROR) return err;
+                Parcel::GatherWriter writer;
+                for (const auto& span : spans) {
+                    writer.add(span.data(), span.size());
+                }
+                return writer.flattenTo(reply);
+            }
+            default:
+                return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+
+    int32_t onewayCount() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mOnewayCount;
+    }
+
+    bool waitForOneway(int32_t count, bool* outOfOrder) {
+        std::unique_lock<std::mutex> lock(mLock);
+        bool done = mOnewayCondition.wait_for(lock, 5s, [&] { return mOnewayCount >= count; });
+        *outOfOrder = mOnewayOutOfOrder;
+        return done;
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mOnewayCondition;
+    int32_t mOnewayCount = 0;
+    bool mOnewayOutOfOrder = false;
+};
+
+sp<LoopbackTestService> gService;
+
+class TestDeathRecipient : public IBinder::DeathRecipient
+{
+public:
+    void binderDied(const wp<IBinder>& /*who*/) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        mDied = true;
+        mCondition.notify_all();
+    }
+
+    bool waitForDeath() {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCondition.wait_for(lock, 5s, [&] { return mDied; });
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    bool mDied = false;
+};
+
+class BinderLoopbackTest : public ::testing::Test
+{
+protected:
+    void SetUp() override {
+        mContext = ProcessState::self()->getContextObject(nullptr);
+        ASSERT_NE(nullptr, mContext);
+    }
+
+    sp<IBinder> mContext;
+};
+
+} // namespace
+
+TEST_F(BinderLoopbackTest, ContextObjectIsProxy)
+{
+    EXPECT_EQ(nullptr, mContext->localBinder());
+    EXPECT_NE(nullptr, mContext->remoteBinder());
+    EXPECT_EQ(NO_ERROR, mContext->pingBinder());
+}
+
+TEST_F(BinderLoopbackTest, Transaction)
+{
+    Parcel data, reply;
+    data.writeInt32(0x1234);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_INT, data, &reply));
+    EXPECT_EQ(0x1234, reply.readInt32());
+}
+
+TEST_F(BinderLoopbackTest, LocalBinderArrivesAsHandle)
+{
+    sp<IBinder> local = new BBinder();
+    Parcel data, reply;
+    data.writeStrongBinder(local);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_BINDER, data, &reply));
+
+    sp<IBinder> proxy = reply.readStrongBinder();
+    ASSERT_NE(nullptr, proxy);
+    EXPECT_EQ(nullptr, proxy->localBinder());
+    EXPECT_EQ(NO_ERROR, proxy->pingBinder());
+
+    // Handles are stable for the lifetime of the reference.
+    Parcel data2, reply2;
+    data2.writeStrongBinder(local);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_BINDER, data2, &reply2));
+    EXPECT_EQ(proxy, reply2.readStrongBinder());
+}
+
+TEST_F(BinderLoopbackTest, FileDescriptor)
+{
+    int fds[2];
+    ASSERT_EQ(0, pipe2(fds, O_CLOEXEC));
+
+    Parcel data, reply;
+    data.writeInt32(42);
+    data.writeFileDescriptor(fds[1]);
+    EXPECT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_WRITE_FD, data, &reply));
+    close(fds[1]);
+
+    int32_t value = 0;
+    EXPECT_EQ(static_cast<ssize_t>(sizeof(value)), read(fds[0], &value, sizeof(value)));
+    EXPECT_EQ(42, value);
+    close(fds[0]);
+}
+
+TEST_F(BinderLoopbackTest, OnewayCallsStayOrdered)
+{
+    constexpr int32_t kCalls = 100;
+    const int32_t first = gService->onewayCount();
+    for (int32_t i = first; i < first + kCalls; i++) {
+        Parcel data;
+        data.writeInt32(i);
+        ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_RECORD_ONEWAY, data, nullptr,
+                                               IBinder::FLAG_ONEWAY));
+    }
+    bool outOfOrder = true;
+    EXPECT_TRUE(gService->waitForOneway(first + kCalls, &outOfOrder));
+    EXPECT_FALSE(outOfOrder);
+}
+
+TEST_F(BinderLoopbackTest, OnewayBatchUsesOneWriteRead)
+{
+    constexpr int32_t kCalls = 8;
+    IPCThreadState* ipc = IPCThreadState::self();
+    ipc->flushCommands();
+
+    const int32_t first = gService->onewayCount();
+    const size_t writeReads = CountingLoopbackTransport::sWriteReads;
+    ipc->beginOnewayBatch();
+    for (int32_t i = first; i < first + kCalls; i++) {
+        // The Parcel goes away before the batch is flushed.
+        Parcel data;
+        data.writeInt32(i);
+        ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_RECORD_ONEWAY, data, nullptr,
+                                               IBinder::FLAG_ONEWAY));
+    }
+    EXPECT_EQ(writeReads, CountingLoopbackTransport::sWriteReads);
+    EXPECT_EQ(NO_ERROR, ipc->endOnewayBatch());
+    EXPECT_EQ(writeReads + 1, CountingLoopbackTransport::sWriteReads);
+
+    bool outOfOrder = true;
+    EXPECT_TRUE(gService->waitForOneway(first + kCalls, &outOfOrder));
+    EXPECT_FALSE(outOfOrder);
+}
+
+TEST_F(BinderLoopbackTest, OnewayBatchFlushesBeforeSyncCall)
+{
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t first = gService->onewayCount();
+    ipc->beginOnewayBatch();
+    Parcel data, reply;
+    data.writeInt32(first);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_RECORD_ONEWAY, data, nullptr,
+                                           IBinder::FLAG_ONEWAY));
+    Parcel echo;
+    echo.writeInt32(7);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_INT, echo, &reply));
+    EXPECT_EQ(7, reply.readInt32());
+    EXPECT_EQ(NO_ERROR, ipc->endOnewayBatch());
+
+    bool outOfOrder = true;
+    EXPECT_TRUE(gService->waitForOneway(first + 1, &outOfOrder));
+    EXPECT_FALSE(outOfOrder);
+}
+
+TEST_F(BinderLoopbackTest, GatheredSpans)
+{
+    // One span small enough to be written in place, one that has to go
+    // through ashmem, and an empty one.
+    std::vector<uint8_t> small(100, 0x11);
+    std::vector<uint8_t> large(256 * 1024, 0x22);
+    Parcel::GatherWriter writer;
+    EXPECT_EQ(NO_ERROR, writer.add(small.data(), small.size()));
+    EXPECT_EQ(NO_ERROR, writer.add(large.data(), large.size()));
+    EXPECT_EQ(NO_ERROR, writer.add(nullptr, 0));
+    EXPECT_EQ(BAD_VALUE, writer.add(nullptr, 1));
+    EXPECT_EQ(3u, writer.spanCount());
+    EXPECT_EQ(small.size() + large.size(), writer.totalSize());
+
+    Parcel data, reply;
+    ASSERT_EQ(NO_ERROR, writer.flattenTo(&data));
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_GATHERED_SPANS, data, &reply));
+
+    std::vector<std::vector<uint8_t>> spans;
+    ASSERT_EQ(NO_ERROR, reply.readGatheredSpans([&](const void* spanData, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+        spans.emplace_back(bytes, bytes + len);
+        return NO_ERROR;
+    }));
+    ASSERT_EQ(3u, spans.size());
+    EXPECT_EQ(small, spans[0]);
+    EXPECT_EQ(large, spans[1]);
+    EXPECT_TRUE(spans[2].empty());
+}
+
+TEST_F(BinderLoopbackTest, GatheredAshmemSpanIsNotCopied)
+{
+    constexpr size_t kSize = 256 * 1024;
+    int fd = ashmem_create_region("GatheredSpan", kSize);
+    ASSERT_GE(fd, 0);
+    uint8_t* region = static_cast<uint8_t*>(
+            mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    ASSERT_NE(MAP_FAILED, region);
+    memset(region, 0x44, kSize);
+
+    Parcel::GatherWriter writer;
+    EXPECT_EQ(BAD_VALUE, writer.addFd(fd, kSize + 1));
+    EXPECT_EQ(BAD_VALUE, writer.addFd(-1, 1));
+    ASSERT_EQ(NO_ERROR, writer.addFd(fd, kSize));
+    EXPECT_EQ(kSize, writer.totalSize());
+
+    Parcel noFds;
+    noFds.pushAllowFds(false);
+    EXPECT_EQ(FDS_NOT_ALLOWED, writer.flattenTo(&noFds));
+
+    Parcel data;
+    ASSERT_EQ(NO_ERROR, writer.flattenTo(&data));
+
+    // The reader maps the sender's region, so it sees a write made after
+    // flattenTo(). A copy would not.
+    region[0] = 0x55;
+    data.setDataPosition(0);
+    size_t visited = 0;
+    ASSERT_EQ(NO_ERROR, data.readGatheredSpans([&](const void* spanData, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+        visited++;
+        EXPECT_EQ(kSize, len);
+        EXPECT_EQ(0x55, bytes[0]);
+        EXPECT_EQ(0x44, bytes[kSize - 1]);
+        return NO_ERROR;
+    }));
+    EXPECT_EQ(1u, visited);
+
+    // The descriptor also makes it through a transaction.
+    data.setDataPosition(0);
+    Parcel reply;
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_GATHERED_SPANS, data, &reply));
+    std::vector<uint8_t> echoed;
+    ASSERT_EQ(NO_ERROR, reply.readGatheredSpans([&](const void* spanData, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(spanData);
+        echoed.assign(bytes, bytes + len);
+        return NO_ERROR;
+    }));
+    ASSERT_EQ(kSize, echoed.size());
+    EXPECT_EQ(0, memcmp(region, echoed.data(), kSize));
+
+    munmap(region, kSize);
+    close(fd);
+}
+
+TEST_F(BinderLoopbackTest, GatheredSpansVisitorErrorStopsRead)
+{
+    std::vector<uint8_t> bytes(8, 0x33);
+    Parcel::GatherWriter writer;
+    ASSERT_EQ(NO_ERROR, writer.add(bytes.data(), bytes.size()));
+    ASSERT_EQ(NO_ERROR, writer.add(bytes.data(), bytes.size()));
+
+    Parcel data;
+    ASSERT_EQ(NO_ERROR, writer.flattenTo(&data));
+    data.setDataPosition(0);
+    size_t visited = 0;
+    EXPECT_EQ(UNKNOWN_ERROR, data.readGatheredSpans([&](const void*, size_t) {
+        visited++;
+        return UNKNOWN_ERROR;
+    }));
+    EXPECT_EQ(1u, visited);
+}
+
+TEST_F(BinderLoopbackTest, DeathNotification)
+{
+    sp<IBinder> local = new BBinder();
+    Parcel data, reply;
+    data.writeStrongBinder(local);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_BINDER, data, &reply));
+    sp<IBinder> proxy = reply.readStrongBinder();
+    ASSERT_NE(nullptr, proxy);
+
+    sp<TestDeathRecipient> recipient = new TestDeathRecipient();
+    ASSERT_EQ(NO_ERROR, proxy->linkToDeath(recipient));
+    ASSERT_EQ(NO_ERROR, gTransport->killNode(local));
+    EXPECT_TRUE(recipient->waitForDeath());
+    EXPECT_EQ(DEAD_OBJECT, proxy->pingBinder());
+    EXPECT_EQ(NAME_NOT_FOUND, gTransport->killNode(local));
+}
+
+TEST_F(BinderLoopbackTest, ThreadPoolStats)
+{
+    Parcel data, reply;
+    data.writeInt32(1);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_INT, data, &reply));
+
+    ProcessState::ThreadPoolStats stats = ProcessState::self()->getThreadPoolStats();
+    EXPECT_GE(stats.threads, 1u);
+    EXPECT_GE(stats.spawned, 1u);
+    uint64_t commands = 0;
+    for (uint64_t count : stats.busyHistogram) {
+        commands += count;
+    }
+    EXPECT_GT(commands, 0u);
+
+    String8 dump;
+    ASSERT_EQ(NO_ERROR, mContext->getThreadPoolStats(&dump));
+    EXPECT_NE(-1, dump.find("Binder thread pool"));
+}
+
+TEST_F(BinderLoopbackTest, AdaptiveThreadPoolRejectsBadLimits)
+{
+    EXPECT_EQ(BAD_VALUE, ProcessState::self()->setThreadPoolAdaptive(4, 2, 100));
+    EXPECT_EQ(BAD_VALUE, ProcessState::self()->setThreadPoolAdaptive(1, 2, 0));
+}
+
+namespace {
+
+// Commands that started while at least two pooled threads were busy.
+uint64_t concurrentCommands(const ProcessState::ThreadPoolStats& stats)
+{
+    uint64_t commands = 0;
+    for (size_t i = 1; i < ProcessState::THREAD_POOL_BUSY_BUCKETS; i++) {
+        commands += stats.busyHistogram[i];
+    }
+    return commands;
+}
+
+// Makes |calls| concurrent calls that each keep a pooled thread busy.
+void runConcurrentSleeps(const sp<IBinder>& binder, size_t calls, int32_t sleepMs)
+{
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < calls; i++) {
+        clients.emplace_back([&binder, sleepMs] {
+            Parcel data, reply;
+            data.writeInt32(sleepMs);
+            EXPECT_EQ(NO_ERROR, binder->transact(LOOPBACK_TEST_SLEEP_MS, data, &reply));
+        });
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+}
+
+} // namespace
+
+TEST_F(BinderLoopbackTest, AdaptiveThreadPoolGrowsAndShrinks)
+{
+    constexpr size_t kMinThreads = 1;
+    constexpr size_t kMaxThreads = 4;
+    sp<ProcessState> proc = ProcessState::self();
+    ASSERT_EQ(NO_ERROR, proc->setThreadPoolAdaptive(kMinThreads, kMaxThreads, 100));
+    const ProcessState::ThreadPoolStats initial = proc->getThreadPoolStats();
+    EXPECT_EQ(kMinThreads, initial.maxThreads);
+
+    // Concurrent slow calls queue behind the pool, which grows until they
+    // run side by side.
+    ProcessState::ThreadPoolStats stats = initial;
+    for (int round = 0; round < 20; round++) {
+        runConcurrentSleeps(mContext, kMaxThreads, 30);
+        stats = proc->getThreadPoolStats();
+        if (stats.maxThreads == kMaxThreads && stats.threads >= kMaxThreads &&
+                concurrentCommands(stats) > concurrentCommands(initial)) {
+            break;
+        }
+    }
+    EXPECT_EQ(kMaxThreads, stats.maxThreads);
+    EXPECT_GE(stats.threads, kMaxThreads);
+    EXPECT_GT(stats.starvedTime, initial.starvedTime);
+    EXPECT_GT(concurrentCommands(stats), concurrentCommands(initial));
+    const ProcessState::ThreadPoolStats grown = stats;
+
+    // A quiet window lowers the limit, and the driver then finishes the
+    // threads that stay idle beyond it.
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (stats.retired == grown.retired && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(150ms);
+        Parcel data, reply;
+        data.writeInt32(0);
+        EXPECT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_INT, data, &reply));
+        stats = proc->getThreadPoolStats();
+    }
+    EXPECT_LT(stats.maxThreads, grown.maxThreads);
+    EXPECT_GT(stats.retired, grown.retired);
+    EXPECT_LT(stats.threads, grown.threads);
+
+    // The pool still serves calls after shrinking.
+    Parcel data, reply;
+    data.writeInt32(0x5678);
+    ASSERT_EQ(NO_ERROR, mContext->transact(LOOPBACK_TEST_ECHO_INT, data, &reply));
+    EXPECT_EQ(0x5678, reply.readInt32());
+
+    EXPECT_EQ(NO_ERROR, proc->setThreadPoolMaxThreadCount(15));
+}
+
+TEST_F(BinderLoopbackTest, AdaptiveThreadPoolSpawnsBoundedAcrossBursts)
+{
+    constexpr size_t kMaxThreads = 4;
+    sp<ProcessState> proc = ProcessState::self();
+    ASSERT_EQ(NO_ERROR, proc->setThreadPoolAdaptive(1, kMaxThreads, 50));
+    for (int round = 0; round < 20 && proc->getThreadPoolStats().maxThreads < kMaxThreads;
+            round++) {
+        runConcurrentSleeps(mContext, kMaxThreads, 20);
+    }
+    const ProcessState::ThreadPoolStats warm = proc->getThreadPoolStats();
+    ASSERT_EQ(kMaxThreads, warm.maxThreads);
+
+    // Threads wait in the driver between bursts for longer than the idle
+    // window. The driver counts them as available, so the bursts reuse them
+    // instead of making it spawn new ones.
+    for (int round = 0; round < 10; round++) {
+        std::this_thread::sleep_for(100ms);
+        runConcurrentSleeps(mContext, kMaxThreads, 20);
+    }
+    const ProcessState::ThreadPoolStats stats = proc->getThreadPoolStats();
+    EXPECT_LE(stats.spawned - warm.spawned, kMaxThreads);
+    EXPECT_LE(stats.threads, kMaxThreads + 1);  // the main thread is not spawned
+
+    EXPECT_EQ(NO_ERROR, proc->setThreadPoolMaxThreadCount(15));
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    gTransport = new CountingLoopbackTransport();
+    sp<ProcessState> proc = ProcessState::initWithTransport("loopback", gTransport);
+    if (!proc->becomeContextManager(nullptr, nullptr)) {
+        return EXIT_FAILURE;
+    }
+    gService = new LoopbackTestService();
+    IPCThreadState::self()->setTheContextObject(gService);
+    proc->startThreadPool();
+
+    return RUN_ALL_TESTS();
+}
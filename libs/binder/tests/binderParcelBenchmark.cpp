@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+#include <utils/String16.h>
+
+#include <vector>
+
+using namespace android;
+
+static const String16 kInterfaceToken("android.os.IBinderParcelBenchmark");
+
+// Marshals a request and a reply the way a typical AIDL call does: the
+// request carries the interface token, a payload of |payloadBytes| and a
+// binder object, the reply a status and a small result. Both Parcels are
+// destroyed at the end of every iteration, as they are after a transaction.
+static void marshalTransaction(const sp<IBinder>& binder, const std::vector<int8_t>& payload) {
+    Parcel data;
+    data.writeInterfaceToken(kInterfaceToken);
+    data.writeInt32(static_cast<int32_t>(payload.size()));
+    data.writeByteVector(payload);
+    data.writeStrongBinder(binder);
+
+    Parcel reply;
+    reply.writeNoException();
+    reply.writeInt64(static_cast<int64_t>(data.dataSize()));
+
+    benchmark::DoNotOptimize(data.data());
+    benchmark::DoNotOptimize(reply.data());
+}
+
+static void BM_marshalTransaction(benchmark::State& state) {
+    const bool pooled = state.range(1) != 0;
+    const std::vector<int8_t> payload(state.range(0), 0x5a);
+    const sp<IBinder> binder = new BBinder();
+
+    Parcel::setThreadBufferPoolEnabled(pooled);
+    for (auto _ : state) {
+        marshalTransaction(binder, payload);
+    }
+
+    const Parcel::BufferPoolStats stats = Parcel::getThreadBufferPoolStats();
+    const size_t lookups = stats.hits + stats.misses;
+    state.counters["hit_rate"] = lookups ? static_cast<double>(stats.hits) / lookups : 0;
+    state.counters["bytes_retained"] = stats.bytesRetained;
+    state.counters["drops"] = stats.drops;
+    Parcel::setThreadBufferPoolEnabled(false);
+}
+static void marshalTransactionArgs(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"payload", "pooled"});
+    for (int payload : {0, 64, 512, 4096, 32768}) {
+        b->Args({payload, 0});
+        b->Args({payload, 1});
+    }
+}
+BENCHMARK(BM_marshalTransaction)->Apply(marshalTransactionArgs);
+
+// Grows a single Parcel to |state.range(0)| bytes four bytes at a time, which
+// exercises the growData()/continueWrite() reallocation chain.
+static void BM_growParcel(benchmark::State& state) {
+    const bool pooled = state.range(1) != 0;
+    const size_t count = state.range(0) / sizeof(int32_t);
+
+    Parcel::setThreadBufferPoolEnabled(pooled);
+    for (auto _ : state) {
+        Parcel p;
+        for (size_t i = 0; i < count; i++) {
+            p.writeInt32(static_cast<int32_t>(i));
+        }
+        benchmark::DoNotOptimize(p.data());
+    }
+    Parcel::setThreadBufferPoolEnabled(false);
+}
+static void growParcelArgs(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"bytes", "pooled"});
+    for (int bytes : {256, 4096, 65536}) {
+        b->Args({bytes, 0});
+        b->Args({bytes, 1});
+    }
+}
+BENCHMARK(BM_growParcel)->Apply(growParcelArgs);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../ParcelBufferPool.h"
+
+#include <gtest/gtest.h>
+
+#include <binder/Parcel.h>
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+using namespace android;
+
+static constexpr size_t kMinClassSize = 64;
+static constexpr size_t kMaxClassSize = 64 * 1024;
+static constexpr size_t kMaxBuffersPerClass = 8;
+static constexpr size_t kMaxBytesRetained = 256 * 1024;
+
+class ParcelBufferPoolTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // Start every test with an empty pool.
+        ParcelBufferPool::setEnabled(false);
+        ParcelBufferPool::setEnabled(true);
+    }
+
+    void TearDown() override {
+        ParcelBufferPool::setEnabled(false);
+    }
+
+    // Allocates and then releases |count| buffers of |size| bytes at once.
+    static void allocateAndRelease(size_t size, size_t count) {
+        std::vector<std::pair<void*, size_t>> buffers;
+        for (size_t i = 0; i < count; i++) {
+            size_t capacity = size;
+            void* buffer = ParcelBufferPool::allocate(&capacity);
+            ASSERT_NE(nullptr, buffer);
+            buffers.emplace_back(buffer, capacity);
+        }
+        for (const auto& [buffer, capacity] : buffers) {
+            ParcelBufferPool::release(buffer, capacity);
+        }
+    }
+};
+
+TEST_F(ParcelBufferPoolTest, Allocate_RoundsUpToSizeClass) {
+    size_t size = 100;
+    void* buffer = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_EQ(128u, size);
+
+    size_t smallSize = 1;
+    void* smallBuffer = ParcelBufferPool::allocate(&smallSize);
+    ASSERT_NE(nullptr, smallBuffer);
+    EXPECT_EQ(kMinClassSize, smallSize);
+
+    ParcelBufferPool::release(buffer, size);
+    ParcelBufferPool::release(smallBuffer, smallSize);
+}
+
+TEST_F(ParcelBufferPoolTest, ReleasedBuffer_ReusedBySameSizeClass) {
+    size_t size = 100;
+    void* first = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, first);
+    ParcelBufferPool::release(first, size);
+
+    size_t secondSize = 120;
+    void* second = ParcelBufferPool::allocate(&secondSize);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(size, secondSize);
+
+    Parcel::BufferPoolStats stats = ParcelBufferPool::stats();
+    EXPECT_EQ(1u, stats.misses);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(1u, stats.returns);
+    EXPECT_EQ(0u, stats.bytesRetained);
+
+    ParcelBufferPool::release(second, secondSize);
+}
+
+TEST_F(ParcelBufferPoolTest, ReleasedBuffer_NotReusedByOtherSizeClass) {
+    allocateAndRelease(kMinClassSize, 1);
+
+    size_t size = 2 * kMinClassSize;
+    void* buffer = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_EQ(0u, ParcelBufferPool::stats().hits);
+    EXPECT_EQ(kMinClassSize, ParcelBufferPool::stats().bytesRetained);
+
+    ParcelBufferPool::release(buffer, size);
+}
+
+TEST_F(ParcelBufferPoolTest, BufferLargerThanLargestClass_NotPooled) {
+    size_t size = kMaxClassSize + 1;
+    void* buffer = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_EQ(kMaxClassSize + 1, size);
+    ParcelBufferPool::release(buffer, size);
+
+    Parcel::BufferPoolStats stats = ParcelBufferPool::stats();
+    EXPECT_EQ(1u, stats.misses);
+    EXPECT_EQ(0u, stats.returns);
+    EXPECT_EQ(1u, stats.drops);
+    EXPECT_EQ(0u, stats.bytesRetained);
+}
+
+TEST_F(ParcelBufferPoolTest, FullSizeClass_DropsExtraBuffers) {
+    allocateAndRelease(kMinClassSize, kMaxBuffersPerClass + 2);
+
+    Parcel::BufferPoolStats stats = ParcelBufferPool::stats();
+    EXPECT_EQ(kMaxBuffersPerClass, stats.returns);
+    EXPECT_EQ(2u, stats.drops);
+    EXPECT_EQ(kMaxBuffersPerClass * kMinClassSize, stats.bytesRetained);
+}
+
+TEST_F(ParcelBufferPoolTest, RetainedBytes_Capped) {
+    allocateAndRelease(kMaxClassSize, kMaxBuffersPerClass);
+
+    Parcel::BufferPoolStats stats = ParcelBufferPool::stats();
+    EXPECT_EQ(kMaxBytesRetained / kMaxClassSize, stats.returns);
+    EXPECT_EQ(kMaxBuffersPerClass - kMaxBytesRetained / kMaxClassSize, stats.drops);
+    EXPECT_EQ(kMaxBytesRetained, stats.bytesRetained);
+}
+
+TEST_F(ParcelBufferPoolTest, Reallocate_WithinSizeClass_KeepsBuffer) {
+    size_t size = 70;
+    void* buffer = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, buffer);
+    memset(buffer, 0x5a, size);
+
+    size_t newSize = 100;
+    void* sameBuffer = ParcelBufferPool::reallocate(buffer, size, size, &newSize);
+    EXPECT_EQ(buffer, sameBuffer);
+    EXPECT_EQ(size, newSize);
+
+    size_t grownSize = 1000;
+    void* grownBuffer = ParcelBufferPool::reallocate(sameBuffer, newSize, newSize, &grownSize);
+    ASSERT_NE(nullptr, grownBuffer);
+    EXPECT_EQ(1024u, grownSize);
+    EXPECT_EQ(0x5a, static_cast<uint8_t*>(grownBuffer)[size - 1]);
+    EXPECT_EQ(size, ParcelBufferPool::stats().bytesRetained);
+
+    ParcelBufferPool::release(grownBuffer, grownSize);
+}
+
+TEST_F(ParcelBufferPoolTest, DisabledThread_BypassesPool) {
+    ParcelBufferPool::setEnabled(false);
+
+    allocateAndRelease(kMinClassSize, 2);
+
+    Parcel::BufferPoolStats stats = ParcelBufferPool::stats();
+    EXPECT_EQ(0u, stats.misses);
+    EXPECT_EQ(0u, stats.returns);
+    EXPECT_EQ(0u, stats.bytesRetained);
+}
+
+TEST_F(ParcelBufferPoolTest, Parcel_ReusesBuffersOfDestroyedParcel) {
+    for (int i = 0; i < 2; i++) {
+        Parcel parcel;
+        parcel.writeInt32(i);
+        parcel.writeCString("buffer pool");
+    }
+
+    Parcel::BufferPoolStats stats = Parcel::getThreadBufferPoolStats();
+    EXPECT_EQ(1u, stats.misses);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(2u, stats.returns);
+}
+
+TEST_F(ParcelBufferPoolTest, ThreadExit_FreesRetainedBuffers) {
+    const size_t totalBefore = ParcelBufferPool::totalBytesRetained();
+
+    size_t retainedByThread = 0;
+    std::thread thread([&retainedByThread]() {
+        ParcelBufferPool::setEnabled(true);
+        allocateAndRelease(kMinClassSize, 4);
+        retainedByThread = ParcelBufferPool::stats().bytesRetained;
+    });
+    thread.join();
+
+    EXPECT_EQ(4 * kMinClassSize, retainedByThread);
+    EXPECT_EQ(totalBefore, ParcelBufferPool::totalBytesRetained());
+}
+
+TEST_F(ParcelBufferPoolTest, BufferReleasedOnOtherThread_ReturnedToThatThreadsPool) {
+    size_t size = kMinClassSize;
+    void* buffer = ParcelBufferPool::allocate(&size);
+    ASSERT_NE(nullptr, buffer);
+
+    Parcel::BufferPoolStats otherStats;
+    std::thread thread([&]() {
+        ParcelBufferPool::setEnabled(true);
+        ParcelBufferPool::release(buffer, size);
+        otherStats = ParcelBufferPool::stats();
+    });
+    thread.join();
+
+    EXPECT_EQ(1u, otherStats.returns);
+    EXPECT_EQ(0u, ParcelBufferPool::stats().returns);
+}
@@ -152,6 +152,135 @@ void FrameEvents::dump(std::string& outString) const {
 }
 
 
+// ============================================================================
+// FrameLatencyHistogram
+// ============================================================================
+
+size_t FrameLatencyHistogram::bucketIndex(uint64_t micros) {
+    if (micros < SUB_BUCKETS) {
+        return static_cast<size_t>(micros);
+    }
+    // The highest set bit picks the group, the next SUB_BUCKET_BITS bits the
+    // bucket within it.
+    const size_t msb = 63 - static_cast<size_t>(__builtin_clzll(micros));
+    const size_t shift = msb - SUB_BUCKET_BITS;
+    const size_t index = (shift + 1) * SUB_BUCKETS + ((micros >> shift) - SUB_BUCKETS);
+    return std::min(index, NUM_BUCKETS - 1);
+}
+
+uint64_t FrameLatencyHistogram::bucketLowerBound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const size_t shift = index / SUB_BUCKETS - 1;
+    return static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+void FrameLatencyHistogram::add(nsecs_t duration) {
+    const uint64_t micros = duration > 0 ? static_cast<uint64_t>(duration) / 1000 : 0;
+    mBuckets[bucketIndex(micros)]++;
+    mCount++;
+    mSumMicros += micros;
+    mMinMicros = std::min(mMinMicros, micros);
+    mMaxMicros = std::max(mMaxMicros, micros);
+}
+
+void FrameLatencyHistogram::clear() {
+    *this = FrameLatencyHistogram();
+}
+
+nsecs_t FrameLatencyHistogram::min() const {
+    return mCount == 0 ? 0 : static_cast<nsecs_t>(mMinMicros) * 1000;
+}
+
+nsecs_t FrameLatencyHistogram::max() const {
+    return static_cast<nsecs_t>(mMaxMicros) * 1000;
+}
+
+nsecs_t FrameLatencyHistogram::mean() const {
+    return mCount == 0 ? 0 : static_cast<nsecs_t>(mSumMicros / mCount) * 1000;
+}
+
+nsecs_t FrameLatencyHistogram::percentile(float percent) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    const float clamped = std::max(0.0f, std::min(100.0f, percent));
+    const uint64_t rank =
+            std::max<uint64_t>(1, static_cast<uint64_t>(clamped / 100.0f * mCount + 0.5f));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += mBuckets[i];
+        if (seen >= rank) {
+            return static_cast<nsecs_t>(bucketLowerBound(i)) * 1000;
+        }
+    }
+    return max();
+}
+
+void FrameLatencyHistogram::dump(std::string& outString) const {
+    StringAppendF(&outString,
+                  "count=%" PRIu64 " min=%.2fms mean=%.2fms p50=%.2fms p90=%.2fms p99=%.2fms "
+                  "max=%.2fms\n",
+                  mCount, ns2us(min()) / 1000.0, ns2us(mean()) / 1000.0,
+                  ns2us(percentile(50)) / 1000.0, ns2us(percentile(90)) / 1000.0,
+                  ns2us(percentile(99)) / 1000.0, ns2us(max()) / 1000.0);
+}
+
+// ============================================================================
+// FrameLatencyTracker
+// ============================================================================
+
+void FrameLatencyTracker::addDequeueWait(nsecs_t duration) {
+    mHistograms[static_cast<size_t>(FrameLatency::DEQUEUE_WAIT)].add(duration);
+}
+
+void FrameLatencyTracker::record(FrameEvents& frame, FrameLatency latency, nsecs_t start,
+                                 nsecs_t end) {
+    const uint32_t bit = 1u << static_cast<uint32_t>(latency);
+    if ((frame.latenciesRecorded & bit) || !Fence::isValidTimestamp(start) ||
+        !Fence::isValidTimestamp(end)) {
+        return;
+    }
+    frame.latenciesRecorded |= bit;
+    // The acquire fence may have signaled before the buffer was queued.
+    mHistograms[static_cast<size_t>(latency)].add(std::max<nsecs_t>(0, end - start));
+}
+
+void FrameLatencyTracker::update(FrameEvents& frame) {
+    if (!frame.valid || !frame.hasPostedInfo()) {
+        return;
+    }
+    // record ignores pending and invalid timestamps, so each latency is
+    // recorded once both of its ends are known.
+    if (frame.hasLatchInfo()) {
+        record(frame, FrameLatency::QUEUE_TO_LATCH, frame.postedTime, frame.latchTime);
+        record(frame, FrameLatency::LATCH_TO_PRESENT, frame.latchTime,
+               frame.displayPresentFence->getCachedSignalTime());
+    }
+    record(frame, FrameLatency::GPU_COMPLETION, frame.postedTime,
+           frame.acquireFence->getCachedSignalTime());
+}
+
+void FrameLatencyTracker::clear() {
+    for (auto& histogram : mHistograms) {
+        histogram.clear();
+    }
+}
+
+void FrameLatencyTracker::dump(std::string& outString) const {
+    static constexpr const char* kNames[LATENCY_COUNT] = {
+            "Dequeue wait    ",
+            "Queue to latch  ",
+            "Latch to present",
+            "GPU completion  ",
+    };
+    for (size_t i = 0; i < LATENCY_COUNT; i++) {
+        StringAppendF(&outString, "--- %s\t", kNames[i]);
+        mHistograms[i].dump(outString);
+    }
+}
+
 // ============================================================================
 // FrameEventHistory
 // ============================================================================
@@ -203,6 +332,12 @@ void FrameEventHistory::checkFencesForCompletion() {
     }
 }
 
+void FrameEventHistory::updateLatencies() {
+    for (auto& frame : mFrames) {
+        mLatencies.update(frame);
+    }
+}
+
 // Uses !|valid| as the MSB.
 static bool FrameNumberLessThan(
         const FrameEvents& lhs, const FrameEvents& rhs) {
@@ -267,6 +402,7 @@ void ProducerFrameEventHistory::updateAcquireFence(
         // ready for the consumer when posted.
         frame->acquireFence = std::make_shared<FenceTime>(frame->postedTime);
     }
+    mLatencies.update(*frame);
 }
 
 void ProducerFrameEventHistory::applyDelta(
@@ -299,6 +435,7 @@ void ProducerFrameEventHistory::applyDelta(
             frame.gpuCompositionDoneFence = FenceTime::NO_FENCE;
             frame.displayPresentFence = FenceTime::NO_FENCE;
             frame.releaseFence = FenceTime::NO_FENCE;
+            frame.latenciesRecorded = 0;
             // The consumer only sends valid frames.
             frame.valid = true;
         }
@@ -310,6 +447,8 @@ void ProducerFrameEventHistory::applyDelta(
         applyFenceDelta(&mReleaseTimeline,
                 &frame.releaseFence, d.mReleaseFence);
     }
+
+    updateLatencies();
 }
 
 void ProducerFrameEventHistory::updateSignalTimes() {
@@ -317,6 +456,7 @@ void ProducerFrameEventHistory::updateSignalTimes() {
     mGpuCompositionDoneTimeline.updateSignalTimes();
     mPresentTimeline.updateSignalTimes();
     mReleaseTimeline.updateSignalTimes();
+    updateLatencies();
 }
 
 void ProducerFrameEventHistory::applyFenceDelta(FenceTimeline* timeline,
@@ -441,6 +581,9 @@ void ConsumerFrameEventHistory::addPostComposition(uint64_t frameNumber,
             mFramesDirty[mCompositionOffset].setDirty<FrameEvent::DISPLAY_PRESENT>();
         }
     }
+
+    // By now the fences of earlier frames have usually signaled.
+    updateLatencies();
 }
 
 void ConsumerFrameEventHistory::addRelease(uint64_t frameNumber,
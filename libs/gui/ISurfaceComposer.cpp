@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <binder/IMemory.h>
 #include <binder/Parcel.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -1213,6 +1214,61 @@ public:
 
         return NO_ERROR;
     }
+    virtual status_t registerTransactionRing(const sp<IBinder>& applyToken,
+                                             const sp<IMemoryHeap>& heap) {
+        Parcel data, reply;
+        status_t err = data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        if (err != NO_ERROR) {
+            ALOGE("registerTransactionRing: failed writing interface token: %s (%d)",
+                  strerror(-err), -err);
+            return err;
+        }
+
+        err = data.writeStrongBinder(applyToken);
+        if (err != NO_ERROR) {
+            ALOGE("registerTransactionRing: failed writing apply token: %s (%d)", strerror(-err),
+                  -err);
+            return err;
+        }
+
+        err = data.writeStrongBinder(IInterface::asBinder(heap));
+        if (err != NO_ERROR) {
+            ALOGE("registerTransactionRing: failed writing heap: %s (%d)", strerror(-err), -err);
+            return err;
+        }
+
+        err = remote()->transact(BnSurfaceComposer::REGISTER_TRANSACTION_RING, data, &reply);
+        if (err != NO_ERROR) {
+            ALOGE("registerTransactionRing: failed to transact: %s (%d)", strerror(-err), err);
+            return err;
+        }
+
+        return reply.readInt32();
+    }
+
+    virtual status_t setTransactionStateFromRing(
+            const sp<IBinder>& applyToken, uint64_t begin, uint64_t end,
+            const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces, uint32_t flags,
+            int64_t desiredPresentTime) {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeStrongBinder(applyToken);
+        data.writeUint64(begin);
+        data.writeUint64(end);
+        data.writeUint32(static_cast<uint32_t>(newSurfaces.size()));
+        for (const auto& binding : newSurfaces) {
+            binding.write(data);
+        }
+        data.writeUint32(flags);
+        data.writeInt64(desiredPresentTime);
+
+        status_t err = remote()->transact(BnSurfaceComposer::SET_TRANSACTION_STATE_FROM_RING, data,
+                                          &reply);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        return reply.readInt32();
+    }
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
@@ -2058,6 +2114,48 @@ status_t BnSurfaceComposer::onTransact(
             }
             return NO_ERROR;
         }
+        case REGISTER_TRANSACTION_RING: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            sp<IBinder> applyToken;
+            status_t err = data.readStrongBinder(&applyToken);
+            if (err != NO_ERROR) {
+                ALOGE("registerTransactionRing: failed to read apply token: %s (%d)",
+                      strerror(-err), -err);
+                return err;
+            }
+            sp<IMemoryHeap> heap = interface_cast<IMemoryHeap>(data.readStrongBinder());
+            if (!applyToken || !heap) {
+                ALOGE("registerTransactionRing: missing apply token or heap");
+                return BAD_VALUE;
+            }
+            status_t result = registerTransactionRing(applyToken, heap);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
+        case SET_TRANSACTION_STATE_FROM_RING: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            sp<IBinder> applyToken = data.readStrongBinder();
+            uint64_t begin = data.readUint64();
+            uint64_t end = data.readUint64();
+
+            uint32_t count = data.readUint32();
+            if (count > data.dataSize()) {
+                return BAD_VALUE;
+            }
+            std::vector<SharedTransactionRing::SurfaceBinding> newSurfaces(count);
+            for (auto& binding : newSurfaces) {
+                if (binding.read(data) != NO_ERROR) {
+                    return BAD_VALUE;
+                }
+            }
+
+            uint32_t stateFlags = data.readUint32();
+            int64_t desiredPresentTime = data.readInt64();
+            status_t result = setTransactionStateFromRing(applyToken, begin, end, newSurfaces,
+                                                          stateFlags, desiredPresentTime);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
         default: {
             return BBinder::onTransact(code, data, reply, flags);
         }
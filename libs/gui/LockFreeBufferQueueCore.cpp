@@ -0,0 +1,386 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LockFreeBufferQueueCore"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+//#define LOG_NDEBUG 0
+
+#include <gui/LockFreeBufferQueueCore.h>
+
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+static constexpr uint64_t packCounter(uint32_t limit, uint32_t count) {
+    return (static_cast<uint64_t>(limit) << 32) | count;
+}
+
+LockFreeBufferQueueCore::BoundedCounter::BoundedCounter(uint32_t limit)
+      : mWord(packCounter(limit, 0)) {}
+
+bool LockFreeBufferQueueCore::BoundedCounter::tryIncrement() {
+    uint64_t word = mWord.load(std::memory_order_relaxed);
+    do {
+        if (static_cast<uint32_t>(word) >= static_cast<uint32_t>(word >> 32)) {
+            return false;
+        }
+    } while (!mWord.compare_exchange_weak(word, word + 1, std::memory_order_acq_rel,
+                                          std::memory_order_relaxed));
+    return true;
+}
+
+void LockFreeBufferQueueCore::BoundedCounter::decrement() {
+    // The count lives in the low word, which is never zero here.
+    mWord.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool LockFreeBufferQueueCore::BoundedCounter::setLimit(uint32_t limit) {
+    uint64_t word = mWord.load(std::memory_order_relaxed);
+    do {
+        if (static_cast<uint32_t>(word) > limit) {
+            return false;
+        }
+    } while (!mWord.compare_exchange_weak(word, packCounter(limit, static_cast<uint32_t>(word)),
+                                          std::memory_order_acq_rel, std::memory_order_relaxed));
+    return true;
+}
+
+uint32_t LockFreeBufferQueueCore::BoundedCounter::count() const {
+    return static_cast<uint32_t>(mWord.load(std::memory_order_acquire));
+}
+
+uint32_t LockFreeBufferQueueCore::BoundedCounter::limit() const {
+    return static_cast<uint32_t>(mWord.load(std::memory_order_acquire) >> 32);
+}
+
+// ---------------------------------------------------------------------------
+
+LockFreeBufferQueueCore::LockFreeBufferQueueCore()
+      : mDequeued(1), mAcquired(1 + 1), mSlotLimit(2) {
+    for (int32_t& entry : mRing) {
+        entry = INVALID_BUFFER_SLOT;
+    }
+}
+
+LockFreeBufferQueueCore::~LockFreeBufferQueueCore() = default;
+
+bool LockFreeBufferQueueCore::isValidSlot(int slot) const {
+    return slot >= 0 && slot < NUM_BUFFER_SLOTS;
+}
+
+bool LockFreeBufferQueueCore::transition(int slot, SlotState from, SlotState to) {
+    uint32_t expected = from;
+    return mSlots[slot].mState.compare_exchange_strong(expected, to, std::memory_order_acq_rel,
+                                                       std::memory_order_relaxed);
+}
+
+int LockFreeBufferQueueCore::tryClaimFreeSlot() {
+    const int limit = mSlotLimit.load(std::memory_order_acquire);
+
+    // Reuse an allocated buffer if there is one, the same preference
+    // BufferQueueProducer gives mFreeBuffers over mFreeSlots.
+    for (bool wantBuffer : {true, false}) {
+        for (int slot = 0; slot < limit; slot++) {
+            if (mSlots[slot].mHasBuffer.load(std::memory_order_relaxed) != wantBuffer) {
+                continue;
+            }
+            if (mSlots[slot].mState.load(std::memory_order_relaxed) == FREE &&
+                transition(slot, FREE, DEQUEUED)) {
+                return slot;
+            }
+        }
+    }
+    return INVALID_BUFFER_SLOT;
+}
+
+void LockFreeBufferQueueCore::notifySlotFreed() {
+    mFreeSequence.fetch_add(1, std::memory_order_seq_cst);
+    if (mWaiters.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDequeueCondition.notify_all();
+    }
+}
+
+bool LockFreeBufferQueueCore::ringPush(int slot) {
+    const uint32_t tail = mRingTail.load(std::memory_order_relaxed);
+    if (tail - mRingHead.load(std::memory_order_acquire) == RING_SIZE) {
+        return false;
+    }
+    mRing[tail & (RING_SIZE - 1)] = slot;
+    mRingTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool LockFreeBufferQueueCore::ringPop(int* outSlot) {
+    const uint32_t head = mRingHead.load(std::memory_order_relaxed);
+    if (head == mRingTail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *outSlot = mRing[head & (RING_SIZE - 1)];
+    mRingHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void LockFreeBufferQueueCore::updateSlotLimitLocked() {
+    const int limit = static_cast<int>(mDequeued.limit() + mAcquired.limit() - 1);
+    mSlotLimit.store(std::min(limit, static_cast<int>(NUM_BUFFER_SLOTS)),
+                     std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------
+
+status_t LockFreeBufferQueueCore::connect() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mAbandoned.load(std::memory_order_relaxed)) {
+        ALOGE("connect: queue has been abandoned");
+        return NO_INIT;
+    }
+    if (mConnected.load(std::memory_order_relaxed)) {
+        ALOGE("connect: already connected");
+        return BAD_VALUE;
+    }
+    mConnected.store(true, std::memory_order_release);
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::disconnect() {
+    ATRACE_CALL();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mConnected.load(std::memory_order_relaxed)) {
+            return NO_INIT;
+        }
+        mConnected.store(false, std::memory_order_release);
+        // Anything queued from now on belongs to the next connection.
+        mGeneration.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    for (int slot = 0; slot < NUM_BUFFER_SLOTS; slot++) {
+        if (transition(slot, DEQUEUED, FREE)) {
+            mDequeued.decrement();
+        }
+    }
+    notifySlotFreed();
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::dequeueBuffer(int* outSlot, sp<Fence>* outFence,
+                                                nsecs_t timeout) {
+    ATRACE_CALL();
+    if (outSlot == nullptr || outFence == nullptr) {
+        return BAD_VALUE;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout);
+
+    for (;;) {
+        if (mAbandoned.load(std::memory_order_acquire) ||
+            !mConnected.load(std::memory_order_acquire)) {
+            return NO_INIT;
+        }
+        const uint32_t sequence = mFreeSequence.load(std::memory_order_seq_cst);
+
+        if (!mDequeued.tryIncrement()) {
+            ALOGE("dequeueBuffer: attempting to exceed the max dequeued buffer count (%u)",
+                  mDequeued.limit());
+            return INVALID_OPERATION;
+        }
+        const int slot = tryClaimFreeSlot();
+        if (slot != INVALID_BUFFER_SLOT) {
+            Slot& s = mSlots[slot];
+            *outSlot = slot;
+            *outFence = s.mFence;
+            s.mFence = Fence::NO_FENCE;
+            return s.mGraphicBuffer == nullptr ? BUFFER_NEEDS_REALLOCATION : NO_ERROR;
+        }
+        mDequeued.decrement();
+
+        if (timeout == 0) {
+            return WOULD_BLOCK;
+        }
+
+        ATRACE_NAME("waitForFreeSlot");
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWaiters.fetch_add(1, std::memory_order_seq_cst);
+        auto wakeup = [&] {
+            return mFreeSequence.load(std::memory_order_seq_cst) != sequence ||
+                    mAbandoned.load(std::memory_order_relaxed);
+        };
+        bool woken = true;
+        if (timeout < 0) {
+            mDequeueCondition.wait(lock, wakeup);
+        } else {
+            woken = mDequeueCondition.wait_until(lock, deadline, wakeup);
+        }
+        mWaiters.fetch_sub(1, std::memory_order_seq_cst);
+        if (!woken) {
+            return TIMED_OUT;
+        }
+    }
+}
+
+status_t LockFreeBufferQueueCore::setBuffer(int slot, const sp<GraphicBuffer>& buffer) {
+    if (!isValidSlot(slot) || mSlots[slot].mState.load(std::memory_order_acquire) != DEQUEUED) {
+        ALOGE("setBuffer: slot %d is not dequeued", slot);
+        return BAD_VALUE;
+    }
+    mSlots[slot].mGraphicBuffer = buffer;
+    mSlots[slot].mHasBuffer.store(buffer != nullptr, std::memory_order_relaxed);
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::queueBuffer(int slot, const BufferItem& item) {
+    ATRACE_CALL();
+    if (mAbandoned.load(std::memory_order_acquire)) {
+        return NO_INIT;
+    }
+    if (!isValidSlot(slot) || mSlots[slot].mState.load(std::memory_order_acquire) != DEQUEUED) {
+        ALOGE("queueBuffer: slot %d is not dequeued", slot);
+        return BAD_VALUE;
+    }
+
+    Slot& s = mSlots[slot];
+    s.mItem = item;
+    s.mItem.mSlot = slot;
+    s.mItem.mGraphicBuffer = s.mGraphicBuffer;
+    s.mItem.mFrameNumber = mFrameCounter.fetch_add(1, std::memory_order_relaxed) + 1;
+    s.mItem.mQueuedBuffer = true;
+    s.mGeneration = mGeneration.load(std::memory_order_acquire);
+
+    transition(slot, DEQUEUED, QUEUED);
+    mDequeued.decrement();
+    LOG_ALWAYS_FATAL_IF(!ringPush(slot), "queueBuffer: ring overflow");
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::cancelBuffer(int slot, const sp<Fence>& fence) {
+    ATRACE_CALL();
+    if (!isValidSlot(slot) || mSlots[slot].mState.load(std::memory_order_acquire) != DEQUEUED) {
+        ALOGE("cancelBuffer: slot %d is not dequeued", slot);
+        return BAD_VALUE;
+    }
+    mSlots[slot].mFence = fence != nullptr ? fence : Fence::NO_FENCE;
+    transition(slot, DEQUEUED, FREE);
+    mDequeued.decrement();
+    notifySlotFreed();
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::setMaxDequeuedBufferCount(int maxDequeuedBuffers) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (maxDequeuedBuffers < 1 ||
+        maxDequeuedBuffers + static_cast<int>(mAcquired.limit() - 1) > NUM_BUFFER_SLOTS) {
+        ALOGE("setMaxDequeuedBufferCount: %d out of range", maxDequeuedBuffers);
+        return BAD_VALUE;
+    }
+    if (!mDequeued.setLimit(static_cast<uint32_t>(maxDequeuedBuffers))) {
+        ALOGE("setMaxDequeuedBufferCount: %u buffers are already dequeued", mDequeued.count());
+        return BAD_VALUE;
+    }
+    updateSlotLimitLocked();
+    mFreeSequence.fetch_add(1, std::memory_order_seq_cst);
+    mDequeueCondition.notify_all();
+    return NO_ERROR;
+}
+
+// ---------------------------------------------------------------------------
+
+status_t LockFreeBufferQueueCore::acquireBuffer(BufferItem* outItem) {
+    ATRACE_CALL();
+    if (outItem == nullptr) {
+        return BAD_VALUE;
+    }
+    if (!mAcquired.tryIncrement()) {
+        ALOGE("acquireBuffer: max acquired buffer count reached: %u", mAcquired.limit() - 1);
+        return INVALID_OPERATION;
+    }
+
+    int slot;
+    while (ringPop(&slot)) {
+        Slot& s = mSlots[slot];
+        if (s.mGeneration != mGeneration.load(std::memory_order_acquire)) {
+            // Queued before the producer disconnected.
+            s.mItem = BufferItem();
+            transition(slot, QUEUED, FREE);
+            notifySlotFreed();
+            continue;
+        }
+        transition(slot, QUEUED, ACQUIRED);
+        *outItem = s.mItem;
+        outItem->mAcquireCalled = true;
+        s.mItem.mFence = Fence::NO_FENCE;
+        return NO_ERROR;
+    }
+
+    mAcquired.decrement();
+    return NO_BUFFER_AVAILABLE;
+}
+
+status_t LockFreeBufferQueueCore::releaseBuffer(int slot, const sp<Fence>& releaseFence) {
+    ATRACE_CALL();
+    if (!isValidSlot(slot) || mSlots[slot].mState.load(std::memory_order_acquire) != ACQUIRED) {
+        ALOGE("releaseBuffer: slot %d is not acquired", slot);
+        return BAD_VALUE;
+    }
+    mSlots[slot].mFence = releaseFence != nullptr ? releaseFence : Fence::NO_FENCE;
+    transition(slot, ACQUIRED, FREE);
+    mAcquired.decrement();
+    notifySlotFreed();
+    return NO_ERROR;
+}
+
+status_t LockFreeBufferQueueCore::setMaxAcquiredBufferCount(int maxAcquiredBuffers) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (maxAcquiredBuffers < 1 || maxAcquiredBuffers > NUM_BUFFER_SLOTS - 2 ||
+        maxAcquiredBuffers + static_cast<int>(mDequeued.limit()) > NUM_BUFFER_SLOTS) {
+        ALOGE("setMaxAcquiredBufferCount: %d out of range", maxAcquiredBuffers);
+        return BAD_VALUE;
+    }
+    if (!mAcquired.setLimit(static_cast<uint32_t>(maxAcquiredBuffers) + 1)) {
+        ALOGE("setMaxAcquiredBufferCount: %u buffers are already acquired", mAcquired.count());
+        return BAD_VALUE;
+    }
+    updateSlotLimitLocked();
+    mFreeSequence.fetch_add(1, std::memory_order_seq_cst);
+    mDequeueCondition.notify_all();
+    return NO_ERROR;
+}
+
+void LockFreeBufferQueueCore::abandon() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAbandoned.store(true, std::memory_order_release);
+    mDequeueCondition.notify_all();
+}
+
+int LockFreeBufferQueueCore::getDequeuedCount() const {
+    return static_cast<int>(mDequeued.count());
+}
+
+int LockFreeBufferQueueCore::getAcquiredCount() const {
+    return static_cast<int>(mAcquired.count());
+}
+
+int LockFreeBufferQueueCore::getQueuedCount() const {
+    return static_cast<int>(mRingTail.load(std::memory_order_acquire) -
+                            mRingHead.load(std::memory_order_acquire));
+}
+
+} // namespace android
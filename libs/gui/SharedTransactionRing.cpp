@@ -0,0 +1,369 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SharedTransactionRing"
+//#define LOG_NDEBUG 0
+
+#include <gui/SharedTransactionRing.h>
+
+#include <binder/Parcel.h>
+#include <log/log.h>
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <type_traits>
+
+namespace android {
+
+// Everything but |sequence| is plain data, so that the entry can be copied
+// in and out of shared memory with memcpy.
+struct SharedTransactionRing::Entry {
+    // 0 if the entry was never written, the entry's sequence number plus one
+    // once the client has published it, with CONSUMED set once SurfaceFlinger
+    // has copied it out.
+    std::atomic<uint64_t> sequence;
+
+    struct Data {
+        uint32_t surfaceKey;
+        uint64_t what;
+        float x;
+        float y;
+        int32_t z;
+        uint32_t w;
+        uint32_t h;
+        uint32_t layerStack;
+        float alpha;
+        uint8_t flags;
+        uint8_t mask;
+        uint8_t transformToDisplayInverse;
+        uint8_t colorSpaceAgnostic;
+        layer_state_t::matrix22_t matrix;
+        int32_t cropLegacy[4];
+        int32_t crop[4];
+        int32_t frame[4];
+        float cornerRadius;
+        uint32_t backgroundBlurRadius;
+        int32_t overrideScalingMode;
+        float color[3];
+        uint32_t transform;
+        int32_t dataspace;
+        int32_t api;
+        float colorTransform[16];
+        float bgColorAlpha;
+        int32_t bgColorDataspace;
+        float shadowRadius;
+        int32_t frameRateSelectionPriority;
+        float frameRate;
+        int8_t frameRateCompatibility;
+        uint8_t isTrustedOverlay;
+        uint32_t fixedTransformHint;
+        uint32_t dropInputMode;
+    } data;
+
+    static constexpr uint64_t CONSUMED = 1ull << 63;
+};
+
+namespace {
+
+using Entry = SharedTransactionRing::Entry;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "ring entries are shared between processes");
+static_assert(std::is_trivially_copyable<Entry::Data>::value, "ring entries are copied raw");
+
+void writeRect(const Rect& rect, int32_t* out) {
+    out[0] = rect.left;
+    out[1] = rect.top;
+    out[2] = rect.right;
+    out[3] = rect.bottom;
+}
+
+Rect readRect(const int32_t* in) {
+    return Rect(in[0], in[1], in[2], in[3]);
+}
+
+void toEntryData(const layer_state_t& s, uint32_t surfaceKey, Entry::Data* d) {
+    d->surfaceKey = surfaceKey;
+    d->what = s.what;
+    d->x = s.x;
+    d->y = s.y;
+    d->z = s.z;
+    d->w = s.w;
+    d->h = s.h;
+    d->layerStack = s.layerStack;
+    d->alpha = s.alpha;
+    d->flags = s.flags;
+    d->mask = s.mask;
+    d->transformToDisplayInverse = s.transformToDisplayInverse;
+    d->colorSpaceAgnostic = s.colorSpaceAgnostic;
+    d->matrix = s.matrix;
+    writeRect(s.crop_legacy, d->cropLegacy);
+    writeRect(s.crop, d->crop);
+    writeRect(s.frame, d->frame);
+    d->cornerRadius = s.cornerRadius;
+    d->backgroundBlurRadius = s.backgroundBlurRadius;
+    d->overrideScalingMode = s.overrideScalingMode;
+    d->color[0] = s.color.r;
+    d->color[1] = s.color.g;
+    d->color[2] = s.color.b;
+    d->transform = s.transform;
+    d->dataspace = static_cast<int32_t>(s.dataspace);
+    d->api = s.api;
+    memcpy(d->colorTransform, s.colorTransform.asArray(), sizeof(d->colorTransform));
+    d->bgColorAlpha = s.bgColorAlpha;
+    d->bgColorDataspace = static_cast<int32_t>(s.bgColorDataspace);
+    d->shadowRadius = s.shadowRadius;
+    d->frameRateSelectionPriority = s.frameRateSelectionPriority;
+    d->frameRate = s.frameRate;
+    d->frameRateCompatibility = s.frameRateCompatibility;
+    d->isTrustedOverlay = s.isTrustedOverlay;
+    d->fixedTransformHint = static_cast<uint32_t>(s.fixedTransformHint);
+    d->dropInputMode = static_cast<uint32_t>(s.dropInputMode);
+}
+
+void fromEntryData(const Entry::Data& d, layer_state_t* s) {
+    // Never trust the client to have kept to the fast path.
+    s->what = d.what & SharedTransactionRing::FAST_PATH_MASK;
+    s->x = d.x;
+    s->y = d.y;
+    s->z = d.z;
+    s->w = d.w;
+    s->h = d.h;
+    s->layerStack = d.layerStack;
+    s->alpha = d.alpha;
+    s->flags = d.flags;
+    s->mask = d.mask;
+    s->transformToDisplayInverse = d.transformToDisplayInverse != 0;
+    s->colorSpaceAgnostic = d.colorSpaceAgnostic != 0;
+    s->matrix = d.matrix;
+    s->crop_legacy = readRect(d.cropLegacy);
+    s->crop = readRect(d.crop);
+    s->frame = readRect(d.frame);
+    s->cornerRadius = d.cornerRadius;
+    s->backgroundBlurRadius = d.backgroundBlurRadius;
+    s->overrideScalingMode = d.overrideScalingMode;
+    s->color.r = d.color[0];
+    s->color.g = d.color[1];
+    s->color.b = d.color[2];
+    s->transform = d.transform;
+    s->dataspace = static_cast<ui::Dataspace>(d.dataspace);
+    s->api = d.api;
+    s->colorTransform = mat4(d.colorTransform);
+    s->bgColorAlpha = d.bgColorAlpha;
+    s->bgColorDataspace = static_cast<ui::Dataspace>(d.bgColorDataspace);
+    s->shadowRadius = d.shadowRadius;
+    s->frameRateSelectionPriority = d.frameRateSelectionPriority;
+    s->frameRate = d.frameRate;
+    s->frameRateCompatibility = d.frameRateCompatibility;
+    s->isTrustedOverlay = d.isTrustedOverlay != 0;
+    s->fixedTransformHint = static_cast<ui::Transform::RotationFlags>(d.fixedTransformHint);
+    s->dropInputMode = static_cast<gui::DropInputMode>(d.dropInputMode);
+}
+
+Entry* mapEntries(const sp<IMemoryHeap>& heap) {
+    if (heap == nullptr || heap->getHeapID() < 0 ||
+        heap->getSize() < SharedTransactionRing::getHeapSize()) {
+        ALOGE("Transaction ring heap is too small");
+        return nullptr;
+    }
+    void* base = heap->getBase();
+    if (base == MAP_FAILED || base == nullptr) {
+        ALOGE("Failed to map transaction ring heap");
+        return nullptr;
+    }
+    return static_cast<Entry*>(base);
+}
+
+constexpr size_t MIN_PRUNE_THRESHOLD = 256;
+
+} // namespace
+
+status_t SharedTransactionRing::SurfaceBinding::write(Parcel& output) const {
+    status_t err = output.writeUint32(key);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    return output.writeStrongBinder(handle);
+}
+
+status_t SharedTransactionRing::SurfaceBinding::read(const Parcel& input) {
+    status_t err = input.readUint32(&key);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    handle = input.readStrongBinder();
+    return handle != nullptr ? NO_ERROR : BAD_VALUE;
+}
+
+size_t SharedTransactionRing::getHeapSize() {
+    return CAPACITY * sizeof(Entry);
+}
+
+// ----------------------------------------------------------------------------
+
+SharedTransactionRing::Writer::Writer(const sp<IMemoryHeap>& heap)
+      : mHeap(heap), mEntries(mapEntries(heap)), mPruneThreshold(MIN_PRUNE_THRESHOLD) {}
+
+status_t SharedTransactionRing::Writer::write(const Vector<ComposerState>& states,
+                                              uint64_t* outBegin, uint64_t* outEnd,
+                                              std::vector<SurfaceBinding>* outNewSurfaces) {
+    if (!isValid()) {
+        return NO_INIT;
+    }
+    const size_t count = states.size();
+    if (count == 0 || count > CAPACITY) {
+        return BAD_VALUE;
+    }
+
+    // Only reuse entries SurfaceFlinger has finished with.
+    for (uint64_t sequence = mNextSequence; sequence < mNextSequence + count; sequence++) {
+        const uint64_t word =
+                mEntries[sequence % CAPACITY].sequence.load(std::memory_order_acquire);
+        if (word != 0 && !(word & Entry::CONSUMED)) {
+            ALOGV("Transaction ring is full");
+            return NO_MEMORY;
+        }
+    }
+
+    uint64_t sequence = mNextSequence;
+    for (const ComposerState& state : states) {
+        const uint32_t key = getSurfaceKey(state.state.surface, outNewSurfaces);
+        Entry& entry = mEntries[sequence % CAPACITY];
+        Entry::Data data;
+        toEntryData(state.state, key, &data);
+        memcpy(&entry.data, &data, sizeof(data));
+        entry.sequence.store(sequence + 1, std::memory_order_release);
+        sequence++;
+    }
+
+    *outBegin = mNextSequence;
+    *outEnd = sequence;
+    mNextSequence = sequence;
+    return NO_ERROR;
+}
+
+void SharedTransactionRing::Writer::abandon(uint64_t begin, uint64_t end) {
+    if (!isValid()) {
+        return;
+    }
+    for (uint64_t sequence = begin; sequence < end; sequence++) {
+        mEntries[sequence % CAPACITY].sequence.store((sequence + 1) | Entry::CONSUMED,
+                                                     std::memory_order_release);
+    }
+    mSurfaceKeys.clear();
+}
+
+uint32_t SharedTransactionRing::Writer::getSurfaceKey(
+        const sp<IBinder>& handle, std::vector<SurfaceBinding>* outNewSurfaces) {
+    auto it = mSurfaceKeys.find(handle.get());
+    if (it != mSurfaceKeys.end() && it->second.first.promote() == handle) {
+        return it->second.second;
+    }
+
+    if (mSurfaceKeys.size() >= mPruneThreshold) {
+        for (auto pruneIt = mSurfaceKeys.begin(); pruneIt != mSurfaceKeys.end();) {
+            if (pruneIt->second.first.promote() == nullptr) {
+                pruneIt = mSurfaceKeys.erase(pruneIt);
+            } else {
+                pruneIt++;
+            }
+        }
+        mPruneThreshold = std::max(MIN_PRUNE_THRESHOLD, mSurfaceKeys.size() * 2);
+    }
+
+    const uint32_t key = mNextSurfaceKey++;
+    mSurfaceKeys[handle.get()] = {handle, key};
+    outNewSurfaces->push_back({key, handle});
+    return key;
+}
+
+// ----------------------------------------------------------------------------
+
+SharedTransactionRing::Reader::Reader(const sp<IMemoryHeap>& heap)
+      : mHeap(heap), mEntries(mapEntries(heap)) {}
+
+void SharedTransactionRing::Reader::bindSurface(const SurfaceBinding& binding) {
+    if (mSurfaces.size() >= MAX_SURFACES && mSurfaces.count(binding.key) == 0) {
+        for (auto it = mSurfaces.begin(); it != mSurfaces.end();) {
+            if (it->second.promote() == nullptr) {
+                it = mSurfaces.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (mSurfaces.size() >= MAX_SURFACES) {
+            ALOGW("Too many surfaces bound to the transaction ring");
+            return;
+        }
+    }
+    mSurfaces[binding.key] = binding.handle;
+}
+
+status_t SharedTransactionRing::Reader::read(uint64_t begin, uint64_t end,
+                                             const std::vector<SurfaceBinding>& newSurfaces,
+                                             Vector<ComposerState>* outStates) {
+    if (!isValid()) {
+        return NO_INIT;
+    }
+    if (end <= begin || end - begin > CAPACITY) {
+        ALOGE("Invalid transaction ring range [%" PRIu64 ", %" PRIu64 ")", begin, end);
+        return BAD_VALUE;
+    }
+
+    for (const SurfaceBinding& binding : newSurfaces) {
+        bindSurface(binding);
+    }
+
+    Vector<ComposerState> states;
+    states.setCapacity(end - begin);
+    for (uint64_t sequence = begin; sequence < end; sequence++) {
+        const Entry& entry = mEntries[sequence % CAPACITY];
+        if (entry.sequence.load(std::memory_order_acquire) != sequence + 1) {
+            ALOGE("Transaction ring entry %" PRIu64 " was not published", sequence);
+            return BAD_VALUE;
+        }
+        // The client can still write to the entry, so copy it out before
+        // looking at it.
+        Entry::Data data;
+        memcpy(&data, &entry.data, sizeof(data));
+
+        auto it = mSurfaces.find(data.surfaceKey);
+        sp<IBinder> handle = it != mSurfaces.end() ? it->second.promote() : nullptr;
+        if (handle == nullptr) {
+            ALOGE("Transaction ring entry %" PRIu64 " refers to unknown surface %" PRIu32,
+                  sequence, data.surfaceKey);
+            return BAD_VALUE;
+        }
+
+        ComposerState state;
+        state.state.surface = handle;
+        fromEntryData(data, &state.state);
+        states.add(state);
+    }
+
+    for (uint64_t sequence = begin; sequence < end; sequence++) {
+        mEntries[sequence % CAPACITY].sequence.store((sequence + 1) | Entry::CONSUMED,
+                                                     std::memory_order_release);
+    }
+    *outStates = states;
+    return NO_ERROR;
+}
+
+} // namespace android
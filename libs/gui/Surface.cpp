@@ -20,6 +20,7 @@
 
 #include <gui/Surface.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
@@ -63,6 +64,104 @@ bool isInterceptorRegistrationOp(int op) {
 
 } // namespace
 
+// Allocates the buffers requested through warmBuffers on a single worker
+// thread per Surface, started on the first request. Requests are served in
+// order, and each tops the pool up to its count when it runs, so repeated
+// requests for the same spec do not allocate twice.
+//
+// mMutex is always taken before the Surface's mMutex, never after it.
+class Surface::WarmPoolAllocator {
+public:
+    explicit WarmPoolAllocator(Surface* surface) : mSurface(surface) {}
+
+    ~WarmPoolAllocator() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mExiting = true;
+            mRequests.clear();
+        }
+        mCondition.notify_one();
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    void request(const BufferSpec& spec, uint64_t usage, size_t count) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.push_back({spec, usage, count});
+        if (!mThread.joinable()) {
+            mThread = std::thread(&WarmPoolAllocator::loop, this);
+            pthread_setname_np(mThread.native_handle(), "SurfaceWarmPool");
+        }
+        mCondition.notify_one();
+    }
+
+    // Drops every pending request and stops the one in progress after the
+    // buffer currently being allocated. Buffers already pooled are kept.
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.clear();
+        mGeneration++;
+    }
+
+private:
+    struct Request {
+        BufferSpec spec;
+        uint64_t usage;
+        size_t count;
+    };
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true) {
+            mCondition.wait(lock, [this] { return mExiting || !mRequests.empty(); });
+            if (mExiting) {
+                return;
+            }
+            const Request request = mRequests.front();
+            mRequests.pop_front();
+            const uint32_t generation = mGeneration;
+
+            ATRACE_NAME("Surface::warmBuffers allocation");
+            while (true) {
+                {
+                    Mutex::Autolock surfaceLock(mSurface->mMutex);
+                    if (mSurface->countWarmBuffersLocked(request.spec, request.usage) >=
+                        request.count) {
+                        break;
+                    }
+                }
+                lock.unlock();
+                sp<GraphicBuffer> buffer =
+                        new GraphicBuffer(request.spec.width, request.spec.height,
+                                          request.spec.format, 1, request.usage,
+                                          "Surface warm pool");
+                lock.lock();
+                if (mExiting || mGeneration != generation) {
+                    break;
+                }
+                if (buffer->initCheck() != NO_ERROR) {
+                    ALOGE("warmBuffers: failed to allocate buffer "
+                          "(%u x %u, format %d, usage %#" PRIx64 ")",
+                          request.spec.width, request.spec.height, request.spec.format,
+                          request.usage);
+                    break;
+                }
+                Mutex::Autolock surfaceLock(mSurface->mMutex);
+                mSurface->mWarmPool.push_back(buffer);
+            }
+        }
+    }
+
+    Surface* const mSurface;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<Request> mRequests;
+    uint32_t mGeneration = 0;
+    bool mExiting = false;
+    std::thread mThread;
+};
+
 Surface::Surface(const sp<IGraphicBufferProducer>& bufferProducer, bool controlledByApp)
       : mGraphicBufferProducer(bufferProducer),
         mCrop(Rect::EMPTY_RECT),
@@ -75,7 +174,8 @@ Surface::Surface(const sp<IGraphicBufferProducer>& bufferProducer, bool controll
         mQueriedSupportedTimestamps(false),
         mFrameTimestampsSupportsPresent(false),
         mEnableFrameTimestamps(false),
-        mFrameEventHistory(std::make_unique<ProducerFrameEventHistory>()) {
+        mFrameEventHistory(std::make_unique<ProducerFrameEventHistory>()),
+        mWarmPoolAllocator(std::make_unique<WarmPoolAllocator>(this)) {
     // Initialize the ANativeWindow function pointers.
     ANativeWindow::setSwapInterval  = hook_setSwapInterval;
     ANativeWindow::dequeueBuffer    = hook_dequeueBuffer;
@@ -117,6 +217,8 @@ Surface::~Surface() {
     if (mConnectedToCpu) {
         Surface::disconnect(NATIVE_WINDOW_API_CPU);
     }
+    // Join the allocation thread while the rest of the Surface is still alive.
+    mWarmPoolAllocator.reset();
 }
 
 sp<ISurfaceComposer> Surface::composerService() const {
@@ -142,6 +244,105 @@ void Surface::allocateBuffers() {
             mReqFormat, mReqUsage);
 }
 
+status_t Surface::warmBuffers(const BufferSpec& spec, size_t count) {
+    ATRACE_CALL();
+    if (spec.width == 0 || spec.height == 0 || spec.format == 0) {
+        ALOGE("warmBuffers: invalid spec %ux%u format %d", spec.width, spec.height, spec.format);
+        return BAD_VALUE;
+    }
+
+    uint64_t consumerUsage = 0;
+    status_t err = mGraphicBufferProducer->getConsumerUsage(&consumerUsage);
+    if (err != NO_ERROR) {
+        ALOGE("warmBuffers: getConsumerUsage failed: %d", err);
+        return err;
+    }
+    const uint64_t usage = spec.usage | consumerUsage;
+
+    {
+        Mutex::Autolock lock(mMutex);
+        mWarmPoolConsumerUsage = consumerUsage;
+        if (countWarmBuffersLocked(spec, usage) >= count) {
+            return NO_ERROR;
+        }
+    }
+
+    mWarmPoolAllocator->request(spec, usage, count);
+    return NO_ERROR;
+}
+
+size_t Surface::countWarmBuffersLocked(const BufferSpec& spec, uint64_t usage) const {
+    return std::count_if(mWarmPool.begin(), mWarmPool.end(), [&](const sp<GraphicBuffer>& buffer) {
+        return !buffer->needsReallocation(spec.width, spec.height, spec.format, 1, usage);
+    });
+}
+
+void Surface::clearWarmPool() {
+    Mutex::Autolock lock(mMutex);
+    mWarmPool.clear();
+}
+
+Surface::AllocationStats Surface::getAllocationStats() const {
+    Mutex::Autolock lock(mMutex);
+    AllocationStats stats = mAllocationStats;
+    stats.pooledBuffers = mWarmPool.size();
+    return stats;
+}
+
+status_t Surface::dequeueFromWarmPool(uint32_t width, uint32_t height, PixelFormat format,
+                                      uint64_t usage, int* outSlot) {
+    sp<GraphicBuffer> buffer;
+    {
+        Mutex::Autolock lock(mMutex);
+        usage |= mWarmPoolConsumerUsage;
+
+        // If every slot the queue may use already holds a suitable buffer,
+        // dequeueBuffer will not allocate, and attaching would only evict one.
+        int suitable = 0;
+        for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+            const sp<GraphicBuffer>& slotBuffer = mSlots[i].buffer;
+            if (slotBuffer != nullptr &&
+                !slotBuffer->needsReallocation(width, height, format, 1, usage)) {
+                suitable++;
+            }
+        }
+        if (suitable >= mMaxBufferCount) {
+            return NO_INIT;
+        }
+
+        auto it = std::find_if(mWarmPool.begin(), mWarmPool.end(),
+                               [&](const sp<GraphicBuffer>& pooled) {
+                                   return !pooled->needsReallocation(width, height, format, 1,
+                                                                     usage);
+                               });
+        if (it == mWarmPool.end()) {
+            return NO_INIT;
+        }
+        buffer = *it;
+        mWarmPool.erase(it);
+        buffer->mGenerationNumber = mGenerationNumber;
+    }
+
+    // Like IGBP::dequeueBuffer, this may block until a slot is free, so it is
+    // called without holding mMutex.
+    int slot = -1;
+    status_t result = mGraphicBufferProducer->attachBuffer(&slot, buffer);
+
+    Mutex::Autolock lock(mMutex);
+    if (result != NO_ERROR || slot < 0 || slot >= NUM_BUFFER_SLOTS) {
+        ALOGV("dequeueFromWarmPool: attachBuffer failed: %d", result);
+        mWarmPool.push_back(buffer);
+        return result != NO_ERROR ? result : FAILED_TRANSACTION;
+    }
+    if (mReportRemovedBuffers && mSlots[slot].buffer != nullptr) {
+        mRemovedBuffers.push_back(mSlots[slot].buffer);
+    }
+    mSlots[slot].buffer = buffer;
+    mAllocationStats.poolHits++;
+    *outSlot = slot;
+    return NO_ERROR;
+}
+
 status_t Surface::setGenerationNumber(uint32_t generation) {
     status_t result = mGraphicBufferProducer->setGenerationNumber(generation);
     if (result == NO_ERROR) {
@@ -195,6 +396,21 @@ void Surface::enableFrameTimestamps(bool enable) {
     mEnableFrameTimestamps = enable;
 }
 
+void Surface::getFrameLatencies(FrameLatencyTracker* outLatencies) {
+    ATRACE_CALL();
+    Mutex::Autolock lock(mMutex);
+    if (mEnableFrameTimestamps) {
+        // Picks up fences that signaled since the last queue or dequeue.
+        mFrameEventHistory->updateSignalTimes();
+    }
+    *outLatencies = mFrameEventHistory->getLatencies();
+}
+
+void Surface::clearFrameLatencies() {
+    Mutex::Autolock lock(mMutex);
+    mFrameEventHistory->clearLatencies();
+}
+
 status_t Surface::getCompositorTiming(
         nsecs_t* compositeDeadline, nsecs_t* compositeInterval,
         nsecs_t* compositeToPresentLatency) {
@@ -625,6 +841,9 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     PixelFormat reqFormat;
     uint64_t reqUsage;
     bool enableFrameTimestamps;
+    bool useWarmPool;
+    uint32_t warmWidth;
+    uint32_t warmHeight;
 
     {
         Mutex::Autolock lock(mMutex);
@@ -640,6 +859,13 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
 
         enableFrameTimestamps = mEnableFrameTimestamps;
 
+        // Pooled buffers only stand in for an allocation whose size and
+        // format the Surface can predict.
+        warmWidth = reqWidth ? reqWidth : mDefaultWidth;
+        warmHeight = reqHeight ? reqHeight : mDefaultHeight;
+        useWarmPool = !mWarmPool.empty() && !mSharedBufferMode && !mAutoPrerotation &&
+                reqFormat != 0 && warmWidth != 0 && warmHeight != 0;
+
         if (mSharedBufferMode && mAutoRefresh && mSharedBufferSlot !=
                 BufferItem::INVALID_BUFFER_SLOT) {
             sp<GraphicBuffer>& gbuf(mSlots[mSharedBufferSlot].buffer);
@@ -655,6 +881,25 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     sp<Fence> fence;
     nsecs_t startTime = systemTime();
 
+    if (useWarmPool &&
+        dequeueFromWarmPool(warmWidth, warmHeight, reqFormat, reqUsage, &buf) == NO_ERROR) {
+        mLastDequeueDuration = systemTime() - startTime;
+
+        Mutex::Autolock lock(mMutex);
+        mLastDequeueStartTime = startTime;
+        mFrameEventHistory->addDequeueWait(mLastDequeueDuration);
+        // The contents of an attached buffer are undefined.
+        mBufferAge = 0;
+        if (mSharedBufferSlot == buf) {
+            mSharedBufferSlot = BufferItem::INVALID_BUFFER_SLOT;
+            mSharedBufferHasBeenQueued = false;
+        }
+        mDequeuedSlots.insert(buf);
+        *buffer = mSlots[buf].buffer.get();
+        *fenceFd = -1;
+        return OK;
+    }
+
     FrameEventHistoryDelta frameTimestamps;
     status_t result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence, reqWidth, reqHeight,
                                                             reqFormat, reqUsage, &mBufferAge,
@@ -679,6 +924,7 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
 
     // Write this while holding the mutex
     mLastDequeueStartTime = startTime;
+    mFrameEventHistory->addDequeueWait(mLastDequeueDuration);
 
     sp<GraphicBuffer>& gbuf(mSlots[buf].buffer);
 
@@ -694,6 +940,14 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
         freeAllBuffers();
     }
 
+    if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+        ALOGV("dequeueBuffer: allocation stall of %" PRId64 " ns", mLastDequeueDuration);
+        mAllocationStats.allocationStalls++;
+        mAllocationStats.totalStallTime += mLastDequeueDuration;
+        mAllocationStats.lastStallFrameNumber = mNextFrameNumber;
+        mAllocationStats.lastStallDuration = mLastDequeueDuration;
+    }
+
     if (enableFrameTimestamps) {
          mFrameEventHistory->applyDelta(frameTimestamps);
     }
@@ -1574,6 +1828,9 @@ int Surface::connect(
 int Surface::disconnect(int api, IGraphicBufferProducer::DisconnectMode mode) {
     ATRACE_CALL();
     ALOGV("Surface::disconnect");
+    // Cancel before taking mMutex, which the allocation thread takes inside
+    // its own lock.
+    mWarmPoolAllocator->cancel();
     Mutex::Autolock lock(mMutex);
     mRemovedBuffers.clear();
     mSharedBufferSlot = BufferItem::INVALID_BUFFER_SLOT;
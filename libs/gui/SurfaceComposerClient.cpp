@@ -27,6 +27,7 @@
 
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
+#include <binder/MemoryHeapBase.h>
 #include <binder/ProcessState.h>
 
 #include <system/graphics.h>
@@ -37,6 +38,7 @@
 #include <gui/ISurfaceComposer.h>
 #include <gui/ISurfaceComposerClient.h>
 #include <gui/LayerState.h>
+#include <gui/SharedTransactionRing.h>
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
 #include <ui/DisplayConfig.h>
@@ -348,6 +350,84 @@ void removeDeadBufferCallback(void* /*context*/, uint64_t graphicBufferId) {
 
 // ---------------------------------------------------------------------------
 
+// Owns the process's SharedTransactionRing. The ring is registered with
+// SurfaceFlinger the first time a transaction can use it, and again, with new
+// memory, when SurfaceFlinger restarts.
+class TransactionRing : public Singleton<TransactionRing> {
+public:
+    // Sends |states| through the ring. Returns false, having applied nothing,
+    // if the transaction must go through setTransactionState instead.
+    bool apply(const sp<ISurfaceComposer>& sf, const sp<IBinder>& applyToken,
+               const Vector<ComposerState>& states, uint32_t flags, int64_t desiredPresentTime) {
+        if (states.empty()) {
+            return false;
+        }
+        for (const auto& s : states) {
+            if (!SharedTransactionRing::canUseFastPath(s.state)) {
+                return false;
+            }
+        }
+
+        uint64_t begin;
+        uint64_t end;
+        std::vector<SharedTransactionRing::SurfaceBinding> newSurfaces;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!connectLocked(sf, applyToken) ||
+                mWriter->write(states, &begin, &end, &newSurfaces) != NO_ERROR) {
+                return false;
+            }
+        }
+
+        status_t err = sf->setTransactionStateFromRing(applyToken, begin, end, newSurfaces, flags,
+                                                       desiredPresentTime);
+        if (err != NO_ERROR) {
+            ALOGW("Transaction ring rejected by SurfaceFlinger: %s (%d)", strerror(-err), err);
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mComposer.promote() == IInterface::asBinder(sf)) {
+                mWriter->abandon(begin, end);
+            }
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool connectLocked(const sp<ISurfaceComposer>& sf, const sp<IBinder>& applyToken)
+            REQUIRES(mMutex) {
+        const sp<IBinder> composer = IInterface::asBinder(sf);
+        if (mComposer.promote() == composer) {
+            return mWriter != nullptr;
+        }
+
+        mComposer = composer;
+        mWriter = nullptr;
+        sp<MemoryHeapBase> heap = new MemoryHeapBase(SharedTransactionRing::getHeapSize(), 0,
+                                                     "SurfaceComposerClient TransactionRing");
+        auto writer = std::make_unique<SharedTransactionRing::Writer>(heap);
+        if (!writer->isValid()) {
+            return false;
+        }
+        status_t err = sf->registerTransactionRing(applyToken, heap);
+        if (err != NO_ERROR) {
+            ALOGW("Failed to register transaction ring: %s (%d)", strerror(-err), err);
+            return false;
+        }
+        mWriter = std::move(writer);
+        return true;
+    }
+
+    std::mutex mMutex;
+    // The SurfaceFlinger instance the ring is registered with. A weak
+    // reference, so that a restarted SurfaceFlinger is told apart.
+    wp<IBinder> mComposer GUARDED_BY(mMutex);
+    std::unique_ptr<SharedTransactionRing::Writer> mWriter GUARDED_BY(mMutex);
+};
+
+ANDROID_SINGLETON_STATIC_INSTANCE(TransactionRing);
+
+// ---------------------------------------------------------------------------
+
 SurfaceComposerClient::Transaction::Transaction(const Transaction& other)
       : mForceSynchronous(other.mForceSynchronous),
         mTransactionNestCount(other.mTransactionNestCount),
@@ -710,10 +790,17 @@ status_t SurfaceComposerClient::Transaction::apply(bool synchronous) {
     mExplicitEarlyWakeupEnd = false;
 
     sp<IBinder> applyToken = IInterface::asBinder(TransactionCompletedListener::getIInstance());
-    sf->setTransactionState(composerStates, displayStates, flags, applyToken, mInputWindowCommands,
-                            mDesiredPresentTime,
-                            {} /*uncacheBuffer - only set in doUncacheBufferTransaction*/,
-                            hasListenerCallbacks, listenerCallbacks);
+    // Transactions that only change plain layer data skip flattening into a Parcel.
+    const bool sentThroughRing = displayStates.empty() && !hasListenerCallbacks &&
+            listenerCallbacks.empty() && !mInputWindowCommands.syncInputWindows &&
+            TransactionRing::getInstance().apply(sf, applyToken, composerStates, flags,
+                                                 mDesiredPresentTime);
+    if (!sentThroughRing) {
+        sf->setTransactionState(composerStates, displayStates, flags, applyToken,
+                                mInputWindowCommands, mDesiredPresentTime,
+                                {} /*uncacheBuffer - only set in doUncacheBufferTransaction*/,
+                                hasListenerCallbacks, listenerCallbacks);
+    }
     mInputWindowCommands.clear();
     mStatus = NO_ERROR;
     return NO_ERROR;
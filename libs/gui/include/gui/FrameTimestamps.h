@@ -24,6 +24,8 @@
 
 #include <array>
 #include <bitset>
+#include <limits>
+#include <string>
 #include <vector>
 
 namespace android {
@@ -83,6 +85,9 @@ struct FrameEvents {
     bool addPostCompositeCalled{false};
     bool addReleaseCalled{false};
 
+    // Bitmask of the FrameLatency deltas already recorded for this frame.
+    uint32_t latenciesRecorded{0};
+
     nsecs_t postedTime{TIMESTAMP_PENDING};
     nsecs_t requestedPresentTime{TIMESTAMP_PENDING};
     nsecs_t latchTime{TIMESTAMP_PENDING};
@@ -102,6 +107,78 @@ struct CompositorTiming {
     nsecs_t presentLatency{16666667};
 };
 
+// A fixed-size histogram of durations with log-linear buckets: every power of
+// two is split into SUB_BUCKETS equal buckets, so a reported percentile is
+// within 1/SUB_BUCKETS of the true value. Durations are kept in microseconds,
+// and anything over ~2 minutes lands in the last bucket.
+class FrameLatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = SUB_BUCKETS * 25;
+
+    void add(nsecs_t duration);
+    void clear();
+
+    uint64_t count() const { return mCount; }
+    nsecs_t min() const;
+    nsecs_t max() const;
+    nsecs_t mean() const;
+
+    // Returns the lower bound of the bucket holding the |percent|th
+    // percentile, or 0 if the histogram is empty.
+    nsecs_t percentile(float percent) const;
+
+    void dump(std::string& outString) const;
+
+    // Public for testing.
+    static size_t bucketIndex(uint64_t micros);
+    static uint64_t bucketLowerBound(size_t index);
+
+private:
+    std::array<uint32_t, NUM_BUCKETS> mBuckets{};
+    uint64_t mCount{0};
+    uint64_t mSumMicros{0};
+    uint64_t mMinMicros{std::numeric_limits<uint64_t>::max()};
+    uint64_t mMaxMicros{0};
+};
+
+// The per-frame latencies tracked by FrameLatencyTracker.
+enum class FrameLatency {
+    // Time the producer spent blocked in dequeueBuffer.
+    DEQUEUE_WAIT,
+    // From queueBuffer to the consumer latching the buffer.
+    QUEUE_TO_LATCH,
+    // From the consumer latching the buffer to the display presenting it.
+    LATCH_TO_PRESENT,
+    // From queueBuffer to the producer's GPU work signaling the acquire fence.
+    GPU_COMPLETION,
+    COUNT, // Not an actual latency.
+};
+
+// Aggregates the latencies of every frame that passes through a
+// FrameEventHistory. Deltas are recorded as soon as both of their timestamps
+// are known, and at most once per frame.
+class FrameLatencyTracker {
+public:
+    static constexpr auto LATENCY_COUNT = static_cast<size_t>(FrameLatency::COUNT);
+
+    void addDequeueWait(nsecs_t duration);
+    void update(FrameEvents& frame);
+    void clear();
+
+    const FrameLatencyHistogram& get(FrameLatency latency) const {
+        return mHistograms[static_cast<size_t>(latency)];
+    }
+
+    void dump(std::string& outString) const;
+
+private:
+    void record(FrameEvents& frame, FrameLatency latency, nsecs_t start, nsecs_t end);
+
+    std::array<FrameLatencyHistogram, LATENCY_COUNT> mHistograms;
+};
+
 // A short history of frames that are synchronized between the consumer and
 // producer via deltas.
 class FrameEventHistory {
@@ -114,12 +191,21 @@ public:
     void checkFencesForCompletion();
     void dump(std::string& outString) const;
 
+    const FrameLatencyTracker& getLatencies() const { return mLatencies; }
+    void clearLatencies() { mLatencies.clear(); }
+
     static const size_t MAX_FRAME_HISTORY;
 
 protected:
+    // Records the latencies that have become available since the last call,
+    // using the fence signal times cached so far.
+    void updateLatencies();
+
     std::vector<FrameEvents> mFrames;
 
     CompositorTiming mCompositorTiming;
+
+    FrameLatencyTracker mLatencies;
 };
 
 
@@ -145,6 +231,8 @@ public:
 
     void updateSignalTimes();
 
+    void addDequeueWait(nsecs_t duration) { mLatencies.addDequeueWait(duration); }
+
 protected:
     void applyFenceDelta(FenceTimeline* timeline,
             std::shared_ptr<FenceTime>* dst,
@@ -23,6 +23,7 @@
 #include <binder/IInterface.h>
 
 #include <gui/ITransactionCompletedListener.h>
+#include <gui/SharedTransactionRing.h>
 
 #include <math/vec4.h>
 
@@ -540,6 +541,26 @@ public:
      * for tests. Release the token by releasing the returned IBinder reference.
      */
     virtual status_t acquireFrameRateFlexibilityToken(sp<IBinder>* outToken) = 0;
+
+    /*
+     * Registers the shared memory through which the process identified by applyToken sends
+     * transactions with setTransactionStateFromRing. Replaces any ring the process registered
+     * before. See SharedTransactionRing.
+     */
+    virtual status_t registerTransactionRing(const sp<IBinder>& applyToken,
+                                             const sp<IMemoryHeap>& heap) = 0;
+
+    /*
+     * Applies the layer states the process published in its transaction ring with sequence
+     * numbers [begin, end), as setTransactionState would. newSurfaces binds the surface keys
+     * that SurfaceFlinger has not seen yet. Returns BAD_VALUE, without applying anything, if
+     * the range cannot be read back; the caller should then send the states through
+     * setTransactionState.
+     */
+    virtual status_t setTransactionStateFromRing(
+            const sp<IBinder>& applyToken, uint64_t begin, uint64_t end,
+            const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces, uint32_t flags,
+            int64_t desiredPresentTime) = 0;
 };
 
 // ----------------------------------------------------------------------------
@@ -599,6 +620,8 @@ public:
         SET_GAME_CONTENT_TYPE,
         SET_FRAME_RATE,
         ACQUIRE_FRAME_RATE_FLEXIBILITY_TOKEN,
+        REGISTER_TRANSACTION_RING,
+        SET_TRANSACTION_STATE_FROM_RING,
         // Always append new enum to the end.
     };
 
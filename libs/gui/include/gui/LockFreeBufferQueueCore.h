@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_LOCKFREEBUFFERQUEUECORE_H
+#define ANDROID_GUI_LOCKFREEBUFFERQUEUECORE_H
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueueDefs.h>
+
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace android {
+
+// LockFreeBufferQueueCore is an alternative to BufferQueueCore for a single
+// producer and a single consumer living in the same process, in which the
+// steady-state path (dequeue, queue, acquire, release) never takes a lock.
+//
+// Each slot's ownership (FREE, DEQUEUED, QUEUED or ACQUIRED, with the same
+// meaning as in BufferState) is an atomic state word, and a transition is a
+// compare-and-swap by the side that currently owns the slot. Queued slots
+// travel from the producer to the consumer through a bounded single-producer,
+// single-consumer ring. The dequeued and acquired buffer counts are packed
+// together with their limits in one atomic word each, so that a limit can be
+// lowered without racing a concurrent dequeue or acquire.
+//
+// mMutex is only taken for reconfiguration (setMaxDequeuedBufferCount,
+// setMaxAcquiredBufferCount, connect, disconnect and abandon) and, when a
+// producer actually has to block in dequeueBuffer, to sleep on
+// mDequeueCondition. Releasing a buffer only touches the condition when a
+// producer is known to be waiting.
+//
+// Producer calls (dequeueBuffer, queueBuffer, cancelBuffer, disconnect) must
+// be serialized by the caller, as they are for a connected
+// IGraphicBufferProducer, and so must consumer calls (acquireBuffer,
+// releaseBuffer). Shared buffer mode, async mode and buffer dropping are not
+// supported: every queued buffer is acquired in order.
+class LockFreeBufferQueueCore : public virtual RefBase {
+public:
+    enum { NUM_BUFFER_SLOTS = BufferQueueDefs::NUM_BUFFER_SLOTS };
+    enum { INVALID_BUFFER_SLOT = BufferItem::INVALID_BUFFER_SLOT };
+
+    // Returned by dequeueBuffer, as with IGraphicBufferProducer, when the
+    // slot has no buffer attached yet. The producer attaches one with
+    // setBuffer before queueing the slot.
+    enum { BUFFER_NEEDS_REALLOCATION = 0x1 };
+
+    // Returned by acquireBuffer when nothing is queued.
+    enum { NO_BUFFER_AVAILABLE = 2 };
+
+    LockFreeBufferQueueCore();
+    ~LockFreeBufferQueueCore() override;
+
+    // Producer side -------------------------------------------------------
+
+    // connect must be called before the first dequeueBuffer.
+    status_t connect();
+
+    // disconnect returns every DEQUEUED slot to FREE. Buffers already
+    // queued are discarded by the consumer instead of being acquired.
+    status_t disconnect();
+
+    // dequeueBuffer claims a FREE slot, preferring slots that already have a
+    // buffer attached. If none is available it waits up to |timeout|
+    // nanoseconds (forever if negative, not at all if zero) and returns
+    // WOULD_BLOCK or TIMED_OUT when it gives up. Returns INVALID_OPERATION
+    // if the producer already holds the maximum number of dequeued buffers,
+    // and NO_INIT if the queue has been abandoned or no producer is
+    // connected.
+    status_t dequeueBuffer(int* outSlot, sp<Fence>* outFence, nsecs_t timeout = -1);
+
+    // queueBuffer hands a DEQUEUED slot to the consumer. The fields of
+    // |item| describing the frame are copied; the slot, buffer and frame
+    // number are filled in by the queue.
+    status_t queueBuffer(int slot, const BufferItem& item);
+
+    // cancelBuffer returns a DEQUEUED slot to FREE without queueing it.
+    status_t cancelBuffer(int slot, const sp<Fence>& fence);
+
+    // setBuffer attaches |buffer| to a slot the producer has dequeued.
+    status_t setBuffer(int slot, const sp<GraphicBuffer>& buffer);
+
+    status_t setMaxDequeuedBufferCount(int maxDequeuedBuffers);
+
+    // Consumer side -------------------------------------------------------
+
+    // acquireBuffer never blocks; it returns NO_BUFFER_AVAILABLE when
+    // nothing is queued. As with BufferQueueConsumer, the consumer may hold
+    // one buffer more than its maximum so that it can latch the next buffer
+    // before releasing the current one.
+    status_t acquireBuffer(BufferItem* outItem);
+
+    status_t releaseBuffer(int slot, const sp<Fence>& releaseFence);
+
+    status_t setMaxAcquiredBufferCount(int maxAcquiredBuffers);
+
+    // abandon fails every subsequent producer call with NO_INIT and wakes
+    // any producer blocked in dequeueBuffer.
+    void abandon();
+
+    // Introspection, mostly for tests ----------------------------------------
+
+    int getDequeuedCount() const;
+    int getAcquiredCount() const;
+    int getQueuedCount() const;
+
+private:
+    enum SlotState : uint32_t {
+        FREE = 0,
+        DEQUEUED,
+        QUEUED,
+        ACQUIRED,
+    };
+
+    // A counter and its limit, packed as (limit << 32) | count so that both
+    // can be checked and updated with a single compare-and-swap.
+    class BoundedCounter {
+    public:
+        explicit BoundedCounter(uint32_t limit);
+
+        // Increments the count unless it has reached the limit.
+        bool tryIncrement();
+        void decrement();
+
+        // Sets the limit, unless the current count already exceeds it.
+        bool setLimit(uint32_t limit);
+
+        uint32_t count() const;
+        uint32_t limit() const;
+
+    private:
+        std::atomic<uint64_t> mWord;
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> mState{FREE};
+        // mHasBuffer mirrors mGraphicBuffer != nullptr so that dequeueBuffer
+        // can prefer slots with a buffer without reading slots it does not
+        // own.
+        std::atomic<bool> mHasBuffer{false};
+        // mGeneration is the producer connection the slot was queued under,
+        // so that the consumer can drop buffers queued before a disconnect.
+        uint32_t mGeneration = 0;
+        // The remaining fields are only touched by the current owner of the
+        // slot. Ownership changes are release/acquire ordered through mState
+        // and the ring.
+        sp<GraphicBuffer> mGraphicBuffer;
+        sp<Fence> mFence = Fence::NO_FENCE;
+        BufferItem mItem;
+    };
+
+    bool transition(int slot, SlotState from, SlotState to);
+    int tryClaimFreeSlot();
+    bool isValidSlot(int slot) const;
+    void updateSlotLimitLocked();
+    void notifySlotFreed();
+
+    // The FIFO of QUEUED slots. Every slot is in the ring at most once, so it
+    // can never hold more than NUM_BUFFER_SLOTS entries.
+    static constexpr uint32_t RING_SIZE = NUM_BUFFER_SLOTS;
+    static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
+    bool ringPush(int slot);
+    bool ringPop(int* outSlot);
+
+    Slot mSlots[NUM_BUFFER_SLOTS];
+
+    alignas(64) std::atomic<uint32_t> mRingHead{0};
+    alignas(64) std::atomic<uint32_t> mRingTail{0};
+    int32_t mRing[RING_SIZE];
+
+    BoundedCounter mDequeued;
+    // The limit of mAcquired is the max acquired buffer count plus one.
+    BoundedCounter mAcquired;
+
+    // mSlotLimit is the number of slots dequeueBuffer may use: the sum of the
+    // dequeued and acquired limits, as for a synchronous BufferQueue.
+    std::atomic<int> mSlotLimit;
+
+    std::atomic<uint32_t> mGeneration{0};
+    std::atomic<bool> mConnected{false};
+    std::atomic<bool> mAbandoned{false};
+    std::atomic<uint64_t> mFrameCounter{0};
+
+    // mWaiters counts producers sleeping in dequeueBuffer; mFreeSequence is
+    // bumped every time a slot becomes FREE so that a waiter can tell whether
+    // it missed a wakeup between its last attempt and going to sleep.
+    std::atomic<int> mWaiters{0};
+    std::atomic<uint32_t> mFreeSequence{0};
+
+    mutable std::mutex mMutex;
+    std::condition_variable mDequeueCondition;
+};
+
+} // namespace android
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <binder/IBinder.h>
+#include <binder/IMemory.h>
+#include <gui/LayerState.h>
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+
+class Parcel;
+
+// SharedTransactionRing lets a process send layer state changes that carry
+// only plain data (positions, sizes, alpha, matrices, crops, colors, ...) to
+// SurfaceFlinger through a shared memory ring instead of flattening them into
+// a Parcel. Only the range of sequence numbers the transaction occupies, and
+// the handles of surfaces SurfaceFlinger has not seen in the ring yet, cross
+// binder. States that carry buffers, fences, regions or binders always take
+// the Parcel path.
+//
+// The ring is CAPACITY entries long. Entry n % CAPACITY holds the state with
+// sequence number n; its sequence word is written last by the client, and
+// marked CONSUMED by SurfaceFlinger once it has copied the entry out. The
+// client only reuses consumed entries. Surfaces are identified by a key that
+// the client assigns and binds to the surface handle the first time the
+// surface is sent through the ring.
+//
+// The memory is writable by the client at any time, so the Reader copies
+// every entry before looking at it and rejects the whole range if any entry
+// does not carry the expected sequence number.
+class SharedTransactionRing {
+public:
+    // The layout of one ring entry; only defined in SharedTransactionRing.cpp.
+    struct Entry;
+
+    static constexpr uint32_t CAPACITY = 256;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+    // The layer_state_t changes that can be sent through the ring.
+    static constexpr uint64_t FAST_PATH_MASK = layer_state_t::ePositionChanged |
+            layer_state_t::eLayerChanged | layer_state_t::eSizeChanged |
+            layer_state_t::eAlphaChanged | layer_state_t::eMatrixChanged |
+            layer_state_t::eFlagsChanged | layer_state_t::eLayerStackChanged |
+            layer_state_t::eCropChanged_legacy | layer_state_t::eOverrideScalingModeChanged |
+            layer_state_t::eShadowRadiusChanged | layer_state_t::eColorChanged |
+            layer_state_t::eTransformChanged | layer_state_t::eTransformToDisplayInverseChanged |
+            layer_state_t::eCropChanged | layer_state_t::eDataspaceChanged |
+            layer_state_t::eApiChanged | layer_state_t::eColorTransformChanged |
+            layer_state_t::eCornerRadiusChanged | layer_state_t::eFrameChanged |
+            layer_state_t::eBackgroundColorChanged | layer_state_t::eColorSpaceAgnosticChanged |
+            layer_state_t::eFrameRateSelectionPriority | layer_state_t::eFrameRateChanged |
+            layer_state_t::eBackgroundBlurRadiusChanged |
+            layer_state_t::eFixedTransformHintChanged | layer_state_t::eTrustedOverlayChanged |
+            layer_state_t::eDropInputModeChanged;
+
+    // Binds a surface key to a surface handle. Sent over binder the first
+    // time a surface is used in the ring.
+    struct SurfaceBinding {
+        uint32_t key;
+        sp<IBinder> handle;
+
+        status_t write(Parcel& output) const;
+        status_t read(const Parcel& input);
+    };
+
+    static bool canUseFastPath(const layer_state_t& state) {
+        return state.surface != nullptr && (state.what & ~FAST_PATH_MASK) == 0;
+    }
+
+    // The size of the shared memory a ring needs.
+    static size_t getHeapSize();
+
+    // The client side of the ring. Not thread-safe; the caller must
+    // serialize write and abandon.
+    class Writer {
+    public:
+        explicit Writer(const sp<IMemoryHeap>& heap);
+
+        bool isValid() const { return mEntries != nullptr; }
+
+        // Copies |states| into the ring and returns the range of sequence
+        // numbers they occupy. Fails with NO_MEMORY, without writing
+        // anything, if not enough entries have been consumed yet.
+        // |outNewSurfaces| receives the bindings SurfaceFlinger needs to
+        // resolve the surfaces of |states|.
+        status_t write(const Vector<ComposerState>& states, uint64_t* outBegin,
+                       uint64_t* outEnd, std::vector<SurfaceBinding>* outNewSurfaces);
+
+        // Reclaims a range SurfaceFlinger refused, so that the entries can
+        // be reused. Every surface is bound again the next time it is sent.
+        void abandon(uint64_t begin, uint64_t end);
+
+    private:
+        uint32_t getSurfaceKey(const sp<IBinder>& handle,
+                               std::vector<SurfaceBinding>* outNewSurfaces);
+
+        sp<IMemoryHeap> mHeap;
+        Entry* mEntries = nullptr;
+        uint64_t mNextSequence = 0;
+        uint32_t mNextSurfaceKey = 0;
+        size_t mPruneThreshold;
+        // Keyed by the handle's address; the weak reference tells a live
+        // handle apart from a new one that was allocated at the same address.
+        std::unordered_map<IBinder*, std::pair<wp<IBinder>, uint32_t>> mSurfaceKeys;
+    };
+
+    // The SurfaceFlinger side of the ring. Not thread-safe.
+    class Reader {
+    public:
+        explicit Reader(const sp<IMemoryHeap>& heap);
+
+        bool isValid() const { return mEntries != nullptr; }
+
+        // Resolves |newSurfaces| and copies the states with sequence numbers
+        // [begin, end) out of the ring. Returns BAD_VALUE, and leaves the
+        // ring untouched, if the range is malformed, an entry does not hold
+        // the expected sequence number or refers to an unknown surface.
+        status_t read(uint64_t begin, uint64_t end,
+                      const std::vector<SurfaceBinding>& newSurfaces,
+                      Vector<ComposerState>* outStates);
+
+    private:
+        static constexpr size_t MAX_SURFACES = 4096;
+
+        void bindSurface(const SurfaceBinding& binding);
+
+        sp<IMemoryHeap> mHeap;
+        Entry* mEntries = nullptr;
+        std::unordered_map<uint32_t, wp<IBinder>> mSurfaces;
+    };
+};
+
+} // namespace android
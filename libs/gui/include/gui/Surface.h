@@ -29,6 +29,7 @@
 #include <utils/Mutex.h>
 #include <utils/RefBase.h>
 
+#include <memory>
 #include <shared_mutex>
 #include <unordered_set>
 
@@ -122,6 +123,52 @@ public:
      */
     void allocateBuffers();
 
+    /* The geometry, format and usage of buffers a producer expects to
+     * dequeue. See warmBuffers. */
+    struct BufferSpec {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        PixelFormat format = PIXEL_FORMAT_RGBA_8888;
+        uint64_t usage = 0;
+    };
+
+    /* Pre-allocates buffers into a producer-side warm pool.
+     *
+     * Unlike allocateBuffers, this allocates buffers for a predicted spec
+     * rather than the current one, and does so on a background thread so
+     * that the call returns immediately. Requests are served in order by one
+     * thread per Surface, and disconnect cancels the ones still pending. It
+     * can be called before connect, and for several specs, e.g. both
+     * orientations ahead of a rotation. Buffers are allocated with the
+     * consumer's usage bits added, and the pool is topped up to |count|
+     * buffers matching |spec|.
+     *
+     * When dequeueBuffer would have to allocate, it instead attaches a
+     * pooled buffer whose size and format match the request and whose usage
+     * covers it. Pooled buffers survive resizes and reconnects until they are
+     * used or clearWarmPool is called.
+     */
+    status_t warmBuffers(const BufferSpec& spec, size_t count);
+
+    /* Drops every buffer held in the warm pool. */
+    void clearWarmPool();
+
+    /* Counters describing how often dequeueBuffer had to wait for gralloc. */
+    struct AllocationStats {
+        // Buffers currently waiting in the warm pool.
+        size_t pooledBuffers = 0;
+        // Dequeues served from the warm pool.
+        uint64_t poolHits = 0;
+        // Dequeues during which the BufferQueue allocated a buffer.
+        uint64_t allocationStalls = 0;
+        // Time spent in dequeueBuffer across all allocation stalls.
+        nsecs_t totalStallTime = 0;
+        // Frame number and duration of the most recent allocation stall.
+        uint64_t lastStallFrameNumber = 0;
+        nsecs_t lastStallDuration = 0;
+    };
+    AllocationStats getAllocationStats() const;
+
     /* Sets the generation number on the IGraphicBufferProducer and updates the
      * generation number on any buffers attached to the Surface after this call.
      * See IGBP::setGenerationNumber for more information. */
@@ -165,6 +212,13 @@ public:
             nsecs_t* compositeDeadline, nsecs_t* compositeInterval,
             nsecs_t* compositeToPresentLatency);
 
+    /* Returns histograms of this Surface's per-frame latencies: time blocked
+     * in dequeueBuffer, queue to latch, latch to present and queue to GPU
+     * completion. Only the dequeue wait is recorded unless frame timestamps
+     * are enabled; see enableFrameTimestamps. */
+    void getFrameLatencies(FrameLatencyTracker* outLatencies);
+    void clearFrameLatencies();
+
     // See IGraphicBufferProducer::getFrameTimestamps
     status_t getFrameTimestamps(uint64_t frameNumber,
             nsecs_t* outRequestedPresentTime, nsecs_t* outAcquireTime,
@@ -553,6 +607,25 @@ protected:
 
     // Buffers that are successfully dequeued/attached and handed to clients
     std::unordered_set<int> mDequeuedSlots;
+
+    // Attaches a pooled buffer matching the next dequeue, if the Surface may
+    // otherwise have to allocate one. Returns NO_INIT if nothing was attached.
+    status_t dequeueFromWarmPool(uint32_t width, uint32_t height, PixelFormat format,
+                                 uint64_t usage, int* outSlot);
+
+    // Buffers allocated by warmBuffers that have not been attached yet, and
+    // the consumer usage bits added to them.
+    std::vector<sp<GraphicBuffer>> mWarmPool;
+    uint64_t mWarmPoolConsumerUsage = 0;
+    AllocationStats mAllocationStats;
+
+    // Returns how many pooled buffers can serve |spec| with |usage|.
+    size_t countWarmBuffersLocked(const BufferSpec& spec, uint64_t usage) const;
+
+    // The worker thread that fills mWarmPool. Declared last so that it is
+    // destroyed, and joined, before the state it writes to.
+    class WarmPoolAllocator;
+    std::unique_ptr<WarmPoolAllocator> mWarmPoolAllocator;
 };
 
 } // namespace android
@@ -0,0 +1,305 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures dequeueBuffer latency when several producers, each with its own
+// queue, render at 120 Hz while a single consumer thread latches one buffer
+// from every queue on each vsync, the way SurfaceFlinger does. Every run is
+// made once against BufferQueue and once against LockFreeBufferQueueCore,
+// and reports the median and 99th percentile dequeue latency as counters.
+//
+// BM_ContendedDequeueCancel drops the vsync pacing: one producer dequeues,
+// queues and cancels back to back while the consumer acquires and releases
+// as fast as it can, so that dequeueBuffer keeps racing releaseBuffer and
+// acquireBuffer for the same slots. Producer calls on a queue are serialized
+// by contract, so this is where the lock-free core's compare-and-swaps and
+// wakeup path actually contend.
+
+#include <benchmark/benchmark.h>
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/IConsumerListener.h>
+#include <gui/LockFreeBufferQueueCore.h>
+
+#include <system/window.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "DummyConsumer.h"
+
+using namespace android;
+using namespace std::chrono_literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kVsyncPeriod = std::chrono::nanoseconds(1s) / 120;
+constexpr int kFramesPerIteration = 120;
+constexpr int kMaxDequeuedBuffers = 2;
+constexpr int kContendedFramesPerIteration = 10000;
+
+// The operations the benchmark needs from either implementation.
+class Queue {
+public:
+    virtual ~Queue() = default;
+    virtual bool dequeue(int* outSlot) = 0;
+    virtual bool queue(int slot) = 0;
+    virtual bool cancel(int slot) = 0;
+    virtual bool acquire(int* outSlot) = 0;
+    virtual void release(int slot) = 0;
+};
+
+class BufferQueueAdapter : public Queue {
+public:
+    BufferQueueAdapter() {
+        BufferQueue::createBufferQueue(&mProducer, &mConsumer);
+        mConsumer->consumerConnect(new DummyConsumer, false);
+        IGraphicBufferProducer::QueueBufferOutput output;
+        mProducer->connect(nullptr, NATIVE_WINDOW_API_CPU, false, &output);
+        mProducer->setMaxDequeuedBufferCount(kMaxDequeuedBuffers);
+    }
+
+    bool dequeue(int* outSlot) override {
+        sp<Fence> fence;
+        status_t result = mProducer->dequeueBuffer(outSlot, &fence, 1, 1, PIXEL_FORMAT_RGBA_8888,
+                                                   GRALLOC_USAGE_SW_WRITE_OFTEN, nullptr, nullptr);
+        if (result < 0) {
+            return false;
+        }
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            return mProducer->requestBuffer(*outSlot, &buffer) == OK;
+        }
+        return true;
+    }
+
+    bool queue(int slot) override {
+        IGraphicBufferProducer::QueueBufferInput input(0, false, HAL_DATASPACE_UNKNOWN,
+                                                       Rect(0, 0, 1, 1),
+                                                       NATIVE_WINDOW_SCALING_MODE_FREEZE, 0,
+                                                       Fence::NO_FENCE);
+        IGraphicBufferProducer::QueueBufferOutput output;
+        return mProducer->queueBuffer(slot, input, &output) == OK;
+    }
+
+    bool cancel(int slot) override { return mProducer->cancelBuffer(slot, Fence::NO_FENCE) == OK; }
+
+    bool acquire(int* outSlot) override {
+        BufferItem item;
+        if (mConsumer->acquireBuffer(&item, 0) != OK) {
+            return false;
+        }
+        *outSlot = item.mSlot;
+        mFrameNumbers[item.mSlot] = item.mFrameNumber;
+        return true;
+    }
+
+    void release(int slot) override {
+        mConsumer->releaseBuffer(slot, mFrameNumbers[slot], EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                                 Fence::NO_FENCE);
+    }
+
+private:
+    sp<IGraphicBufferProducer> mProducer;
+    sp<IGraphicBufferConsumer> mConsumer;
+    uint64_t mFrameNumbers[BufferQueueDefs::NUM_BUFFER_SLOTS] = {};
+};
+
+class LockFreeAdapter : public Queue {
+public:
+    LockFreeAdapter() : mCore(new LockFreeBufferQueueCore()) {
+        mCore->setMaxDequeuedBufferCount(kMaxDequeuedBuffers);
+        mCore->connect();
+    }
+
+    bool dequeue(int* outSlot) override {
+        sp<Fence> fence;
+        status_t result = mCore->dequeueBuffer(outSlot, &fence);
+        if (result == LockFreeBufferQueueCore::BUFFER_NEEDS_REALLOCATION) {
+            return mCore->setBuffer(*outSlot,
+                                    new GraphicBuffer(1, 1, PIXEL_FORMAT_RGBA_8888,
+                                                      GRALLOC_USAGE_SW_WRITE_OFTEN)) == OK;
+        }
+        return result == OK;
+    }
+
+    bool queue(int slot) override { return mCore->queueBuffer(slot, BufferItem()) == OK; }
+
+    bool cancel(int slot) override { return mCore->cancelBuffer(slot, Fence::NO_FENCE) == OK; }
+
+    bool acquire(int* outSlot) override {
+        BufferItem item;
+        if (mCore->acquireBuffer(&item) != OK) {
+            return false;
+        }
+        *outSlot = item.mSlot;
+        return true;
+    }
+
+    void release(int slot) override { mCore->releaseBuffer(slot, Fence::NO_FENCE); }
+
+private:
+    sp<LockFreeBufferQueueCore> mCore;
+};
+
+// Reports the median and 99th percentile of |latencies|, in microseconds.
+void reportLatencies(benchmark::State& state, std::vector<int64_t>* latencies) {
+    if (latencies->empty()) {
+        state.SkipWithError("no buffers were dequeued");
+        return;
+    }
+    auto percentile = [&](size_t p) {
+        auto it = latencies->begin() + (latencies->size() - 1) * p / 100;
+        std::nth_element(latencies->begin(), it, latencies->end());
+        return static_cast<double>(*it) / 1000.0;
+    };
+    state.counters["p50_dequeue_us"] = percentile(50);
+    state.counters["p99_dequeue_us"] = percentile(99);
+}
+
+template <typename T>
+void BM_DequeueLatency(benchmark::State& state) {
+    const int producers = static_cast<int>(state.range(0));
+    std::vector<int64_t> latencies;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<std::unique_ptr<Queue>> queues;
+        for (int i = 0; i < producers; i++) {
+            queues.emplace_back(std::make_unique<T>());
+        }
+        std::vector<std::vector<int64_t>> samples(producers);
+        std::atomic<int> running{producers};
+        const auto start = Clock::now() + 10ms;
+        state.ResumeTiming();
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producers; i++) {
+            threads.emplace_back([&, i] {
+                Queue& queue = *queues[i];
+                auto vsync = start;
+                for (int frame = 0; frame < kFramesPerIteration; frame++) {
+                    vsync += kVsyncPeriod;
+                    std::this_thread::sleep_until(vsync);
+                    int slot;
+                    const auto before = Clock::now();
+                    if (!queue.dequeue(&slot)) break;
+                    samples[i].push_back((Clock::now() - before).count());
+                    if (!queue.queue(slot)) break;
+                }
+                running--;
+            });
+        }
+
+        // The consumer holds on to one buffer per queue until it latches the
+        // next one, as a compositor does for the frame on screen.
+        std::vector<int> held(producers, BufferItem::INVALID_BUFFER_SLOT);
+        for (auto vsync = start; running > 0;) {
+            vsync += kVsyncPeriod;
+            std::this_thread::sleep_until(vsync);
+            for (int i = 0; i < producers; i++) {
+                int slot;
+                if (!queues[i]->acquire(&slot)) continue;
+                if (held[i] != BufferItem::INVALID_BUFFER_SLOT) {
+                    queues[i]->release(held[i]);
+                }
+                held[i] = slot;
+            }
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        state.PauseTiming();
+        for (const auto& producerSamples : samples) {
+            latencies.insert(latencies.end(), producerSamples.begin(), producerSamples.end());
+        }
+        queues.clear();
+        state.ResumeTiming();
+    }
+
+    reportLatencies(state, &latencies);
+}
+
+template <typename T>
+void BM_ContendedDequeueCancel(benchmark::State& state) {
+    std::vector<int64_t> latencies;
+    latencies.reserve(kContendedFramesPerIteration);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        T queue;
+        std::atomic<bool> producing{true};
+        state.ResumeTiming();
+
+        // Every other frame is cancelled rather than queued, so that the
+        // producer also returns slots to FREE while the consumer does.
+        std::thread producer([&] {
+            for (int frame = 0; frame < kContendedFramesPerIteration; frame++) {
+                int slot;
+                const auto before = Clock::now();
+                if (!queue.dequeue(&slot)) break;
+                latencies.push_back((Clock::now() - before).count());
+                if (!(frame % 2 ? queue.cancel(slot) : queue.queue(slot))) break;
+            }
+            producing = false;
+        });
+
+        int held = BufferItem::INVALID_BUFFER_SLOT;
+        while (producing) {
+            int slot;
+            if (!queue.acquire(&slot)) continue;
+            if (held != BufferItem::INVALID_BUFFER_SLOT) {
+                queue.release(held);
+            }
+            held = slot;
+        }
+        producer.join();
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(latencies.size()));
+    reportLatencies(state, &latencies);
+}
+
+BENCHMARK_TEMPLATE(BM_DequeueLatency, BufferQueueAdapter)
+        ->Arg(1)
+        ->Arg(4)
+        ->Arg(8)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_DequeueLatency, LockFreeAdapter)
+        ->Arg(1)
+        ->Arg(4)
+        ->Arg(8)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ContendedDequeueCancel, BufferQueueAdapter)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ContendedDequeueCancel, LockFreeAdapter)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LockFreeBufferQueueCore_test"
+//#define LOG_NDEBUG 0
+
+#include <gui/LockFreeBufferQueueCore.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace android {
+
+class LockFreeBufferQueueCoreTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mCore = new LockFreeBufferQueueCore();
+        ASSERT_EQ(OK, mCore->connect());
+    }
+
+    // Dequeues a slot and, if it needs one, attaches a buffer to it.
+    int dequeue(nsecs_t timeout = 0) {
+        int slot = LockFreeBufferQueueCore::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        status_t result = mCore->dequeueBuffer(&slot, &fence, timeout);
+        if (result == LockFreeBufferQueueCore::BUFFER_NEEDS_REALLOCATION) {
+            EXPECT_EQ(OK, mCore->setBuffer(slot, new GraphicBuffer()));
+        } else if (result != OK) {
+            return LockFreeBufferQueueCore::INVALID_BUFFER_SLOT;
+        }
+        return slot;
+    }
+
+    sp<LockFreeBufferQueueCore> mCore;
+};
+
+TEST_F(LockFreeBufferQueueCoreTest, QueueAcquireRelease) {
+    int slot;
+    sp<Fence> fence;
+    ASSERT_EQ(LockFreeBufferQueueCore::BUFFER_NEEDS_REALLOCATION,
+              mCore->dequeueBuffer(&slot, &fence, 0));
+    sp<GraphicBuffer> buffer = new GraphicBuffer();
+    ASSERT_EQ(OK, mCore->setBuffer(slot, buffer));
+
+    BufferItem input;
+    input.mTimestamp = 42;
+    ASSERT_EQ(OK, mCore->queueBuffer(slot, input));
+    EXPECT_EQ(0, mCore->getDequeuedCount());
+    EXPECT_EQ(1, mCore->getQueuedCount());
+
+    BufferItem item;
+    ASSERT_EQ(OK, mCore->acquireBuffer(&item));
+    EXPECT_EQ(slot, item.mSlot);
+    EXPECT_EQ(buffer, item.mGraphicBuffer);
+    EXPECT_EQ(42, item.mTimestamp);
+    EXPECT_EQ(1u, item.mFrameNumber);
+    EXPECT_EQ(LockFreeBufferQueueCore::NO_BUFFER_AVAILABLE, mCore->acquireBuffer(&item));
+    ASSERT_EQ(OK, mCore->releaseBuffer(slot, Fence::NO_FENCE));
+
+    // The allocated buffer is handed out again.
+    EXPECT_EQ(OK, mCore->dequeueBuffer(&slot, &fence, 0));
+    EXPECT_EQ(slot, item.mSlot);
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, BuffersAreAcquiredInOrder) {
+    ASSERT_EQ(OK, mCore->setMaxDequeuedBufferCount(3));
+    ASSERT_EQ(OK, mCore->setMaxAcquiredBufferCount(3));
+
+    int slots[3];
+    for (int& slot : slots) {
+        slot = dequeue();
+        ASSERT_NE(LockFreeBufferQueueCore::INVALID_BUFFER_SLOT, slot);
+    }
+    for (int slot : slots) {
+        ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+    }
+    for (int i = 0; i < 3; i++) {
+        BufferItem item;
+        ASSERT_EQ(OK, mCore->acquireBuffer(&item));
+        EXPECT_EQ(slots[i], item.mSlot);
+        EXPECT_EQ(static_cast<uint64_t>(i + 1), item.mFrameNumber);
+    }
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, MaxDequeuedBufferCount) {
+    int slot = dequeue();
+    ASSERT_NE(LockFreeBufferQueueCore::INVALID_BUFFER_SLOT, slot);
+
+    int extra;
+    sp<Fence> fence;
+    EXPECT_EQ(INVALID_OPERATION, mCore->dequeueBuffer(&extra, &fence, 0));
+
+    ASSERT_EQ(OK, mCore->setMaxDequeuedBufferCount(2));
+    int second = dequeue();
+    ASSERT_NE(LockFreeBufferQueueCore::INVALID_BUFFER_SLOT, second);
+    EXPECT_NE(slot, second);
+
+    // The limit cannot drop below what the producer already holds.
+    EXPECT_EQ(BAD_VALUE, mCore->setMaxDequeuedBufferCount(1));
+    ASSERT_EQ(OK, mCore->cancelBuffer(second, Fence::NO_FENCE));
+    EXPECT_EQ(OK, mCore->setMaxDequeuedBufferCount(1));
+    EXPECT_EQ(BAD_VALUE, mCore->setMaxDequeuedBufferCount(0));
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, DequeueWaitsForRelease) {
+    // One dequeued and one acquired buffer use up both slots.
+    int slot = dequeue();
+    ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+    BufferItem item;
+    ASSERT_EQ(OK, mCore->acquireBuffer(&item));
+    slot = dequeue();
+    ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+
+    int blocked;
+    sp<Fence> fence;
+    EXPECT_EQ(WOULD_BLOCK, mCore->dequeueBuffer(&blocked, &fence, 0));
+    EXPECT_EQ(TIMED_OUT, mCore->dequeueBuffer(&blocked, &fence, ms2ns(10)));
+
+    std::thread consumer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mCore->releaseBuffer(item.mSlot, Fence::NO_FENCE);
+    });
+    EXPECT_EQ(OK, mCore->dequeueBuffer(&blocked, &fence, -1));
+    EXPECT_EQ(item.mSlot, blocked);
+    consumer.join();
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, DisconnectDropsQueuedBuffers) {
+    ASSERT_EQ(OK, mCore->setMaxDequeuedBufferCount(2));
+    int queued = dequeue();
+    ASSERT_EQ(OK, mCore->queueBuffer(queued, BufferItem()));
+    dequeue();
+    EXPECT_EQ(1, mCore->getDequeuedCount());
+
+    ASSERT_EQ(OK, mCore->disconnect());
+    EXPECT_EQ(0, mCore->getDequeuedCount());
+    int slot;
+    sp<Fence> fence;
+    EXPECT_EQ(NO_INIT, mCore->dequeueBuffer(&slot, &fence, 0));
+
+    BufferItem item;
+    EXPECT_EQ(LockFreeBufferQueueCore::NO_BUFFER_AVAILABLE, mCore->acquireBuffer(&item));
+    EXPECT_EQ(0, mCore->getQueuedCount());
+    EXPECT_EQ(0, mCore->getAcquiredCount());
+
+    ASSERT_EQ(OK, mCore->connect());
+    EXPECT_NE(LockFreeBufferQueueCore::INVALID_BUFFER_SLOT, dequeue());
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, AbandonWakesBlockedProducer) {
+    int slot = dequeue();
+    ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+    slot = dequeue();
+    ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+
+    std::thread consumer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mCore->abandon();
+    });
+    sp<Fence> fence;
+    EXPECT_EQ(NO_INIT, mCore->dequeueBuffer(&slot, &fence, -1));
+    consumer.join();
+}
+
+TEST_F(LockFreeBufferQueueCoreTest, ProducerAndConsumerThreads) {
+    constexpr uint64_t kFrames = 10000;
+    ASSERT_EQ(OK, mCore->setMaxDequeuedBufferCount(2));
+    ASSERT_EQ(OK, mCore->setMaxAcquiredBufferCount(2));
+
+    std::thread consumer([&] {
+        uint64_t expected = 1;
+        while (expected <= kFrames) {
+            BufferItem item;
+            if (mCore->acquireBuffer(&item) != OK) {
+                std::this_thread::yield();
+                continue;
+            }
+            EXPECT_EQ(expected++, item.mFrameNumber);
+            mCore->releaseBuffer(item.mSlot, Fence::NO_FENCE);
+        }
+    });
+    for (uint64_t i = 0; i < kFrames; i++) {
+        int slot = dequeue(-1);
+        ASSERT_NE(LockFreeBufferQueueCore::INVALID_BUFFER_SLOT, slot);
+        ASSERT_EQ(OK, mCore->queueBuffer(slot, BufferItem()));
+    }
+    consumer.join();
+}
+
+} // namespace android
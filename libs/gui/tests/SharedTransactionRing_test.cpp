@@ -0,0 +1,146 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SharedTransactionRing_test"
+
+#include <gui/SharedTransactionRing.h>
+
+#include <binder/Binder.h>
+#include <binder/MemoryHeapBase.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+class SharedTransactionRingTest : public ::testing::Test {
+protected:
+    SharedTransactionRingTest()
+          : mHeap(new MemoryHeapBase(SharedTransactionRing::getHeapSize(), 0,
+                                     "SharedTransactionRingTest")),
+            mWriter(mHeap),
+            mReader(mHeap) {}
+
+    ComposerState positionState(const sp<IBinder>& surface, float x, float y) {
+        ComposerState state;
+        state.state.surface = surface;
+        state.state.what = layer_state_t::ePositionChanged;
+        state.state.x = x;
+        state.state.y = y;
+        return state;
+    }
+
+    sp<MemoryHeapBase> mHeap;
+    SharedTransactionRing::Writer mWriter;
+    SharedTransactionRing::Reader mReader;
+};
+
+TEST_F(SharedTransactionRingTest, FastPathExcludesBinderAndBufferState) {
+    ComposerState state = positionState(new BBinder(), 1, 2);
+    EXPECT_TRUE(SharedTransactionRing::canUseFastPath(state.state));
+
+    state.state.what |= layer_state_t::eBufferChanged;
+    EXPECT_FALSE(SharedTransactionRing::canUseFastPath(state.state));
+
+    state.state.what = layer_state_t::eReparent;
+    EXPECT_FALSE(SharedTransactionRing::canUseFastPath(state.state));
+
+    state.state.what = layer_state_t::eAlphaChanged;
+    state.state.surface = nullptr;
+    EXPECT_FALSE(SharedTransactionRing::canUseFastPath(state.state));
+}
+
+TEST_F(SharedTransactionRingTest, RoundTrip) {
+    ASSERT_TRUE(mWriter.isValid());
+    ASSERT_TRUE(mReader.isValid());
+
+    sp<IBinder> surface = new BBinder();
+    Vector<ComposerState> states;
+    ComposerState state = positionState(surface, 10, 20);
+    state.state.what |= layer_state_t::eAlphaChanged | layer_state_t::eMatrixChanged;
+    state.state.alpha = 0.5f;
+    state.state.matrix.dsdx = 2.0f;
+    states.add(state);
+
+    uint64_t begin, end;
+    std::vector<SharedTransactionRing::SurfaceBinding> newSurfaces;
+    ASSERT_EQ(NO_ERROR, mWriter.write(states, &begin, &end, &newSurfaces));
+    EXPECT_EQ(1u, end - begin);
+    ASSERT_EQ(1u, newSurfaces.size());
+    EXPECT_EQ(surface, newSurfaces[0].handle);
+
+    Vector<ComposerState> read;
+    ASSERT_EQ(NO_ERROR, mReader.read(begin, end, newSurfaces, &read));
+    ASSERT_EQ(1u, read.size());
+    const layer_state_t& s = read[0].state;
+    EXPECT_EQ(surface, s.surface);
+    EXPECT_EQ(state.state.what, s.what);
+    EXPECT_EQ(10.0f, s.x);
+    EXPECT_EQ(20.0f, s.y);
+    EXPECT_EQ(0.5f, s.alpha);
+    EXPECT_EQ(2.0f, s.matrix.dsdx);
+
+    // The surface is only bound once.
+    states.clear();
+    states.add(positionState(surface, 30, 40));
+    newSurfaces.clear();
+    ASSERT_EQ(NO_ERROR, mWriter.write(states, &begin, &end, &newSurfaces));
+    EXPECT_TRUE(newSurfaces.empty());
+    ASSERT_EQ(NO_ERROR, mReader.read(begin, end, newSurfaces, &read));
+    EXPECT_EQ(30.0f, read[0].state.x);
+}
+
+TEST_F(SharedTransactionRingTest, ReaderRejectsUnpublishedRange) {
+    sp<IBinder> surface = new BBinder();
+    Vector<ComposerState> states;
+    states.add(positionState(surface, 1, 1));
+    uint64_t begin, end;
+    std::vector<SharedTransactionRing::SurfaceBinding> newSurfaces;
+    ASSERT_EQ(NO_ERROR, mWriter.write(states, &begin, &end, &newSurfaces));
+
+    Vector<ComposerState> read;
+    EXPECT_EQ(BAD_VALUE, mReader.read(begin, end + 1, newSurfaces, &read));
+    EXPECT_EQ(BAD_VALUE, mReader.read(end, begin, newSurfaces, &read));
+    // The surface was never bound.
+    EXPECT_EQ(BAD_VALUE, mReader.read(begin, end, {}, &read));
+    // A rejected range can still be read.
+    EXPECT_EQ(NO_ERROR, mReader.read(begin, end, newSurfaces, &read));
+    // But only once.
+    EXPECT_EQ(BAD_VALUE, mReader.read(begin, end, newSurfaces, &read));
+}
+
+TEST_F(SharedTransactionRingTest, WriterWaitsForConsumedEntries) {
+    sp<IBinder> surface = new BBinder();
+    Vector<ComposerState> states;
+    for (uint32_t i = 0; i < SharedTransactionRing::CAPACITY; i++) {
+        states.add(positionState(surface, i, i));
+    }
+    uint64_t begin, end;
+    std::vector<SharedTransactionRing::SurfaceBinding> newSurfaces;
+    ASSERT_EQ(NO_ERROR, mWriter.write(states, &begin, &end, &newSurfaces));
+
+    Vector<ComposerState> one;
+    one.add(positionState(surface, 0, 0));
+    uint64_t nextBegin, nextEnd;
+    std::vector<SharedTransactionRing::SurfaceBinding> noSurfaces;
+    EXPECT_EQ(NO_MEMORY, mWriter.write(one, &nextBegin, &nextEnd, &noSurfaces));
+
+    // An abandoned range frees its entries, and surfaces are bound again.
+    mWriter.abandon(begin, end);
+    ASSERT_EQ(NO_ERROR, mWriter.write(one, &nextBegin, &nextEnd, &noSurfaces));
+    EXPECT_EQ(end, nextBegin);
+    EXPECT_EQ(1u, noSurfaces.size());
+}
+
+} // namespace android
@@ -392,6 +392,85 @@ TEST_F(SurfaceTest, GetConsumerName) {
     EXPECT_STREQ("TestConsumer", surface->getConsumerName().string());
 }
 
+TEST_F(SurfaceTest, WarmPoolServesDequeueWithoutAllocation) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+
+    sp<DummyConsumer> dummyConsumer(new DummyConsumer);
+    consumer->consumerConnect(dummyConsumer, false);
+
+    sp<Surface> surface = new Surface(producer);
+    sp<ANativeWindow> window(surface);
+    ASSERT_EQ(NO_ERROR, native_window_api_connect(window.get(), NATIVE_WINDOW_API_CPU));
+    ASSERT_EQ(NO_ERROR, native_window_set_buffers_dimensions(window.get(), 64, 32));
+    ASSERT_EQ(NO_ERROR, native_window_set_buffers_format(window.get(), PIXEL_FORMAT_RGBA_8888));
+    ASSERT_EQ(NO_ERROR, native_window_set_usage(window.get(), GRALLOC_USAGE_SW_WRITE_OFTEN));
+
+    // The pooled buffer's usage is a superset of the requested usage.
+    Surface::BufferSpec spec;
+    spec.width = 64;
+    spec.height = 32;
+    spec.format = PIXEL_FORMAT_RGBA_8888;
+    spec.usage = GRALLOC_USAGE_SW_WRITE_OFTEN | GRALLOC_USAGE_SW_READ_OFTEN;
+    ASSERT_EQ(NO_ERROR, surface->warmBuffers(spec, 1));
+    for (int i = 0; i < 100 && surface->getAllocationStats().pooledBuffers == 0; i++) {
+        std::this_thread::sleep_for(10ms);
+    }
+    ASSERT_EQ(1u, surface->getAllocationStats().pooledBuffers);
+
+    ANativeWindowBuffer* buffer;
+    ASSERT_EQ(NO_ERROR, native_window_dequeue_buffer_and_wait(window.get(), &buffer));
+    Surface::AllocationStats stats = surface->getAllocationStats();
+    EXPECT_EQ(1u, stats.poolHits);
+    EXPECT_EQ(0u, stats.allocationStalls);
+    EXPECT_EQ(0u, stats.pooledBuffers);
+    ASSERT_EQ(NO_ERROR, window->cancelBuffer(window.get(), buffer, -1));
+
+    // Nothing was warmed for this size.
+    ASSERT_EQ(NO_ERROR, native_window_set_buffers_dimensions(window.get(), 32, 64));
+    ASSERT_EQ(NO_ERROR, native_window_dequeue_buffer_and_wait(window.get(), &buffer));
+    stats = surface->getAllocationStats();
+    EXPECT_EQ(1u, stats.poolHits);
+    EXPECT_EQ(1u, stats.allocationStalls);
+    EXPECT_GT(stats.lastStallDuration, 0);
+    ASSERT_EQ(NO_ERROR, window->cancelBuffer(window.get(), buffer, -1));
+}
+
+TEST_F(SurfaceTest, WarmPoolRequestsCancelledOnDisconnect) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+
+    sp<DummyConsumer> dummyConsumer(new DummyConsumer);
+    consumer->consumerConnect(dummyConsumer, false);
+
+    sp<Surface> surface = new Surface(producer);
+    sp<ANativeWindow> window(surface);
+    ASSERT_EQ(NO_ERROR, native_window_api_connect(window.get(), NATIVE_WINDOW_API_CPU));
+
+    Surface::BufferSpec spec;
+    spec.width = 64;
+    spec.height = 32;
+    spec.format = PIXEL_FORMAT_RGBA_8888;
+    spec.usage = GRALLOC_USAGE_SW_WRITE_OFTEN;
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(NO_ERROR, surface->warmBuffers(spec, 16));
+    }
+    ASSERT_EQ(NO_ERROR, native_window_api_disconnect(window.get(), NATIVE_WINDOW_API_CPU));
+
+    // At most the buffer being allocated when disconnect ran can still land.
+    const size_t pooled = surface->getAllocationStats().pooledBuffers;
+    std::this_thread::sleep_for(100ms);
+    EXPECT_LE(surface->getAllocationStats().pooledBuffers, pooled + 1);
+
+    // Destroying the Surface joins its allocation thread, even with a
+    // request still in flight.
+    ASSERT_EQ(NO_ERROR, surface->warmBuffers(spec, 16));
+    window.clear();
+    surface.clear();
+}
+
 TEST_F(SurfaceTest, GetWideColorSupport) {
     sp<IGraphicBufferProducer> producer;
     sp<IGraphicBufferConsumer> consumer;
@@ -690,6 +769,16 @@ public:
                              bool /*hasListenerCallbacks*/,
                              const std::vector<ListenerCallbacks>& /*listenerCallbacks*/) override {
     }
+    status_t registerTransactionRing(const sp<IBinder>& /*applyToken*/,
+                                     const sp<IMemoryHeap>& /*heap*/) override {
+        return NO_ERROR;
+    }
+    status_t setTransactionStateFromRing(
+            const sp<IBinder>& /*applyToken*/, uint64_t /*begin*/, uint64_t /*end*/,
+            const std::vector<SharedTransactionRing::SurfaceBinding>& /*newSurfaces*/,
+            uint32_t /*flags*/, int64_t /*desiredPresentTime*/) override {
+        return NO_ERROR;
+    }
 
     void bootFinished() override {}
     bool authenticateSurfaceTexture(
@@ -1761,6 +1850,78 @@ TEST_F(GetFrameTimestampsTest, FencesInProducerNoSync) {
     EXPECT_EQ(mFrames[0].kReleaseTime, outReleaseTime);
 }
 
+// This test verifies that frame latencies are recorded once per frame, as soon
+// as both of their timestamps are known.
+TEST_F(GetFrameTimestampsTest, FrameLatencies) {
+    enableFrameTimestamps();
+
+    // The acquire fence is still pending when the first frame is queued, so
+    // its GPU completion latency is not known yet.
+    const uint64_t fId1 = getNextFrameId();
+    dequeueAndQueue(0);
+    FrameLatencyTracker latencies;
+    mSurface->getFrameLatencies(&latencies);
+    EXPECT_EQ(1u, latencies.get(FrameLatency::DEQUEUE_WAIT).count());
+    EXPECT_EQ(0u, latencies.get(FrameLatency::GPU_COMPLETION).count());
+
+    mFrames[0].signalQueueFences();
+    dequeueAndQueue(1);
+    mFrames[1].signalQueueFences();
+
+    addFrameEvents(true, NO_FRAME_INDEX, 0);
+    addFrameEvents(true, 0, 1);
+    mFrames[0].signalRefreshFences();
+    mFrames[0].signalReleaseFences();
+
+    ASSERT_EQ(NO_ERROR, getAllFrameTimestamps(fId1));
+
+    mSurface->getFrameLatencies(&latencies);
+    EXPECT_EQ(2u, latencies.get(FrameLatency::DEQUEUE_WAIT).count());
+    EXPECT_EQ(2u, latencies.get(FrameLatency::QUEUE_TO_LATCH).count());
+    EXPECT_EQ(2u, latencies.get(FrameLatency::GPU_COMPLETION).count());
+    // Only the first frame has been presented.
+    EXPECT_EQ(1u, latencies.get(FrameLatency::LATCH_TO_PRESENT).count());
+
+    // The fake timestamps of a frame are less than a microsecond apart, so
+    // every latency lands in the first bucket. A pending fence recorded as
+    // a timestamp would land in the last one instead.
+    for (FrameLatency latency : {FrameLatency::QUEUE_TO_LATCH, FrameLatency::LATCH_TO_PRESENT,
+                                 FrameLatency::GPU_COMPLETION}) {
+        const FrameLatencyHistogram& histogram = latencies.get(latency);
+        EXPECT_EQ(0, histogram.min());
+        EXPECT_EQ(0, histogram.max());
+        EXPECT_EQ(0, histogram.percentile(100));
+    }
+
+    // Querying again does not record the same frames twice.
+    mSurface->getFrameLatencies(&latencies);
+    EXPECT_EQ(2u, latencies.get(FrameLatency::QUEUE_TO_LATCH).count());
+    EXPECT_EQ(2u, latencies.get(FrameLatency::GPU_COMPLETION).count());
+    EXPECT_EQ(1u, latencies.get(FrameLatency::LATCH_TO_PRESENT).count());
+
+    mSurface->clearFrameLatencies();
+    mSurface->getFrameLatencies(&latencies);
+    EXPECT_EQ(0u, latencies.get(FrameLatency::QUEUE_TO_LATCH).count());
+}
+
+TEST(FrameLatencyHistogramTest, Percentiles) {
+    FrameLatencyHistogram histogram;
+    EXPECT_EQ(0, histogram.percentile(50));
+    for (nsecs_t ms = 1; ms <= 100; ms++) {
+        histogram.add(ms2ns(ms));
+    }
+    EXPECT_EQ(100u, histogram.count());
+    EXPECT_EQ(ms2ns(1), histogram.min());
+    EXPECT_EQ(ms2ns(100), histogram.max());
+
+    // Buckets are at most 1/8th wide, so percentiles are within 12.5%.
+    EXPECT_NEAR(ms2ns(50), histogram.percentile(50), ms2ns(50) / 8);
+    EXPECT_NEAR(ms2ns(99), histogram.percentile(99), ms2ns(99) / 8);
+
+    histogram.clear();
+    EXPECT_EQ(0u, histogram.count());
+}
+
 // This test verifies that if the frame wasn't GPU composited but has a refresh
 // event a sync call isn't made to get the GPU composite done time since it will
 // never exist.
@@ -16,13 +16,21 @@
 
 #define LOG_TAG "KeyCharacterMap"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
 
 #ifdef __ANDROID__
 #include <binder/Parcel.h>
 #endif
 
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <android/keycodes.h>
 #include <input/InputEventLabels.h>
 #include <input/Keyboard.h>
@@ -33,6 +41,9 @@
 #include <utils/Tokenizer.h>
 #include <utils/Timers.h>
 
+#include <algorithm>
+#include <iterator>
+
 // Enables debug output for the parser.
 #define DEBUG_PARSER 0
 
@@ -45,6 +56,11 @@
 
 namespace android {
 
+// Partitions that are mounted read-only from verified images, so that their files never change.
+static const char* const IMMUTABLE_PARTITIONS[] = {
+    "/system/", "/system_ext/", "/product/", "/vendor/", "/odm/",
+};
+
 static const char* WHITESPACE = " \t\r";
 static const char* WHITESPACE_OR_PROPERTY_DELIMITER = " \t\r,:";
 
@@ -83,29 +99,218 @@ static String8 toString(const char16_t* chars, size_t numChars) {
 #endif
 
 
+// --- KeyCharacterMap binary representation ---
+
+/*
+ * The binary representation of a key character map is a header, followed by the tables of keys,
+ * behaviors, keys by scan code and keys by usage code, in this order. It holds indexes rather
+ * than pointers, so that it can be mapped at any address and queried in place. Its values are in
+ * the byte order of the device.
+ */
+struct KeyCharacterMap::BinaryHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t type;
+    uint32_t keyCount;
+    uint32_t behaviorCount;
+    uint32_t scanCodeMappingCount;
+    uint32_t usageCodeMappingCount;
+    uint32_t reserved;
+};
+
+/* Keys are sorted by key code. The behaviors of a key are consecutive in the behavior table,
+ * sorted from most specific to least specific meta key binding. */
+struct KeyCharacterMap::BinaryKey {
+    int32_t keyCode;
+    char16_t label;
+    char16_t number;
+    uint32_t firstBehavior;
+    uint32_t behaviorCount;
+};
+
+struct KeyCharacterMap::BinaryBehavior {
+    int32_t metaState;
+    char16_t character;
+    uint16_t reserved;
+    int32_t fallbackKeyCode;
+    int32_t replacementKeyCode;
+};
+
+/* Code mappings are sorted by scan code or usage code. */
+struct KeyCharacterMap::BinaryCodeMapping {
+    int32_t code;
+    int32_t keyCode;
+};
+
+static constexpr uint32_t BINARY_MAGIC = 0x424d434b; // "KCMB"
+static constexpr uint32_t BINARY_VERSION = 1;
+
+template <typename T>
+static uint8_t* appendTable(uint8_t* data, const std::vector<T>& table) {
+    if (!table.empty()) {
+        memcpy(data, table.data(), table.size() * sizeof(T));
+    }
+    return data + table.size() * sizeof(T);
+}
+
+template <typename T>
+static const T* findByCode(const T* begin, const T* end, int32_t code) {
+    const T* it = std::lower_bound(begin, end, code,
+            [](const T& entry, int32_t value) { return entry.code < value; });
+    return it != end && it->code == code ? it : nullptr;
+}
+
+
 // --- KeyCharacterMap ---
 
 sp<KeyCharacterMap> KeyCharacterMap::sEmpty = new KeyCharacterMap();
 
 KeyCharacterMap::KeyCharacterMap() :
-    mType(KEYBOARD_TYPE_UNKNOWN) {
+        KeyCharacterMap(std::vector<uint32_t>(sizeof(BinaryHeader) / sizeof(uint32_t))) {
+    // The zeroed header already has the type KEYBOARD_TYPE_UNKNOWN and no tables.
+    BinaryHeader* header = reinterpret_cast<BinaryHeader*>(mStorage.data());
+    header->magic = BINARY_MAGIC;
+    header->version = BINARY_VERSION;
 }
 
-KeyCharacterMap::KeyCharacterMap(const KeyCharacterMap& other) :
-    RefBase(), mType(other.mType), mKeysByScanCode(other.mKeysByScanCode),
-    mKeysByUsageCode(other.mKeysByUsageCode) {
-    for (size_t i = 0; i < other.mKeys.size(); i++) {
-        mKeys.add(other.mKeys.keyAt(i), new Key(*other.mKeys.valueAt(i)));
-    }
+// The storage is private to this object, so its header can be read directly. Moving the vector
+// does not move its contents, so the header remains valid while the members are initialized.
+KeyCharacterMap::KeyCharacterMap(std::vector<uint32_t>&& storage) :
+        KeyCharacterMap(*reinterpret_cast<const BinaryHeader*>(storage.data()),
+                std::move(storage), nullptr, 0) {
+}
+
+KeyCharacterMap::KeyCharacterMap(const BinaryHeader& header, void* mappedData,
+        size_t mappedSize) :
+        KeyCharacterMap(header, std::vector<uint32_t>(), mappedData, mappedSize) {
+}
+
+KeyCharacterMap::KeyCharacterMap(const BinaryHeader& header, std::vector<uint32_t>&& storage,
+        void* mappedData, size_t mappedSize) :
+        mType(header.type), mKeyCount(header.keyCount), mBehaviorCount(header.behaviorCount),
+        mScanCodeMappingCount(header.scanCodeMappingCount),
+        mUsageCodeMappingCount(header.usageCodeMappingCount), mStorage(std::move(storage)),
+        mMappedData(mappedData), mMappedSize(mappedSize) {
+    setData(mMappedData ? mMappedData : mStorage.data());
 }
 
 KeyCharacterMap::~KeyCharacterMap() {
-    for (size_t i = 0; i < mKeys.size(); i++) {
-        Key* key = mKeys.editValueAt(i);
-        delete key;
+    if (mMappedData) {
+        munmap(mMappedData, mMappedSize);
     }
 }
 
+uint64_t KeyCharacterMap::getBinarySize(const BinaryHeader& header) {
+    return sizeof(BinaryHeader) + uint64_t(header.keyCount) * sizeof(BinaryKey)
+            + uint64_t(header.behaviorCount) * sizeof(BinaryBehavior)
+            + (uint64_t(header.scanCodeMappingCount) + header.usageCodeMappingCount)
+                    * sizeof(BinaryCodeMapping);
+}
+
+uint64_t KeyCharacterMap::getBinarySize() const {
+    return sizeof(BinaryHeader) + uint64_t(mKeyCount) * sizeof(BinaryKey)
+            + uint64_t(mBehaviorCount) * sizeof(BinaryBehavior)
+            + (uint64_t(mScanCodeMappingCount) + mUsageCodeMappingCount)
+                    * sizeof(BinaryCodeMapping);
+}
+
+void KeyCharacterMap::setData(const void* data) {
+    mHeader = static_cast<const BinaryHeader*>(data);
+    mKeys = reinterpret_cast<const BinaryKey*>(mHeader + 1);
+    mBehaviors = reinterpret_cast<const BinaryBehavior*>(mKeys + mKeyCount);
+    mKeysByScanCode = reinterpret_cast<const BinaryCodeMapping*>(mBehaviors + mBehaviorCount);
+    mKeysByUsageCode = mKeysByScanCode + mScanCodeMappingCount;
+}
+
+bool KeyCharacterMap::isValidBinary(const void* data, size_t size) {
+    static_assert(sizeof(BinaryHeader) == 32);
+    static_assert(sizeof(BinaryKey) == 16);
+    static_assert(sizeof(BinaryBehavior) == 16);
+    static_assert(sizeof(BinaryCodeMapping) == 8);
+
+    if (size < sizeof(BinaryHeader)) {
+        return false;
+    }
+    const BinaryHeader* header = static_cast<const BinaryHeader*>(data);
+    if (header->magic != BINARY_MAGIC || header->version != BINARY_VERSION
+            || header->keyCount > MAX_KEYS || getBinarySize(*header) != size) {
+        return false;
+    }
+
+    const BinaryKey* keys = reinterpret_cast<const BinaryKey*>(header + 1);
+    for (uint32_t i = 0; i < header->keyCount; i++) {
+        if ((i > 0 && keys[i - 1].keyCode >= keys[i].keyCode)
+                || keys[i].firstBehavior > header->behaviorCount
+                || keys[i].behaviorCount > header->behaviorCount - keys[i].firstBehavior) {
+            return false;
+        }
+    }
+    const BinaryCodeMapping* mappings = reinterpret_cast<const BinaryCodeMapping*>(
+            reinterpret_cast<const BinaryBehavior*>(keys + header->keyCount)
+                    + header->behaviorCount);
+    for (uint32_t i = 1; i < header->scanCodeMappingCount; i++) {
+        if (mappings[i - 1].code >= mappings[i].code) {
+            return false;
+        }
+    }
+    mappings += header->scanCodeMappingCount;
+    for (uint32_t i = 1; i < header->usageCodeMappingCount; i++) {
+        if (mappings[i - 1].code >= mappings[i].code) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KeyCharacterMap::isImmutable(int fd) {
+#ifdef F_GET_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals >= 0 && (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) == (F_SEAL_WRITE | F_SEAL_SHRINK)) {
+        return true;
+    }
+#endif
+
+    // A read-only mount alone proves nothing: it may be a read-only bind mount of a writable file
+    // system, where the file can still be rewritten or truncated. Only trust regular files on the
+    // partitions that are always mounted read-only, and only while they are.
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) || !S_ISREG(fileStat.st_mode)) {
+        return false;
+    }
+    std::string path;
+    if (!base::Readlink(base::StringPrintf("/proc/self/fd/%d", fd), &path)) {
+        return false;
+    }
+    bool onImmutablePartition = std::any_of(std::begin(IMMUTABLE_PARTITIONS),
+            std::end(IMMUTABLE_PARTITIONS),
+            [&path](const char* partition) { return base::StartsWith(path, partition); });
+    struct statvfs fsStat;
+    return onImmutablePartition && !fstatvfs(fd, &fsStat) && (fsStat.f_flag & ST_RDONLY);
+}
+
+sp<KeyCharacterMap> KeyCharacterMap::create(int32_t type, const std::vector<BinaryKey>& keys,
+        const std::vector<BinaryBehavior>& behaviors,
+        const std::vector<BinaryCodeMapping>& keysByScanCode,
+        const std::vector<BinaryCodeMapping>& keysByUsageCode) {
+    BinaryHeader header = {};
+    header.magic = BINARY_MAGIC;
+    header.version = BINARY_VERSION;
+    header.type = type;
+    header.keyCount = keys.size();
+    header.behaviorCount = behaviors.size();
+    header.scanCodeMappingCount = keysByScanCode.size();
+    header.usageCodeMappingCount = keysByUsageCode.size();
+
+    std::vector<uint32_t> storage(getBinarySize(header) / sizeof(uint32_t));
+    uint8_t* data = reinterpret_cast<uint8_t*>(storage.data());
+    memcpy(data, &header, sizeof(header));
+    data = appendTable(data + sizeof(header), keys);
+    data = appendTable(data, behaviors);
+    data = appendTable(data, keysByScanCode);
+    appendTable(data, keysByUsageCode);
+    return new KeyCharacterMap(std::move(storage));
+}
+
 status_t KeyCharacterMap::load(const std::string& filename,
         Format format, sp<KeyCharacterMap>* outMap) {
     outMap->clear();
@@ -138,30 +343,93 @@ status_t KeyCharacterMap::loadContents(const std::string& filename, const char*
 
 status_t KeyCharacterMap::load(Tokenizer* tokenizer,
         Format format, sp<KeyCharacterMap>* outMap) {
-    status_t status = OK;
-    sp<KeyCharacterMap> map = new KeyCharacterMap();
-    if (!map.get()) {
-        ALOGE("Error allocating key character map.");
-        status = NO_MEMORY;
-    } else {
 #if DEBUG_PARSER_PERFORMANCE
-        nsecs_t startTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t startTime = systemTime(SYSTEM_TIME_MONOTONIC);
 #endif
-        Parser parser(map.get(), tokenizer, format);
-        status = parser.parse();
+    Builder builder;
+    Parser parser(&builder, tokenizer, format);
+    status_t status = parser.parse();
 #if DEBUG_PARSER_PERFORMANCE
-        nsecs_t elapsedTime = systemTime(SYSTEM_TIME_MONOTONIC) - startTime;
-        ALOGD("Parsed key character map file '%s' %d lines in %0.3fms.",
-                tokenizer->getFilename().string(), tokenizer->getLineNumber(),
-                elapsedTime / 1000000.0);
+    nsecs_t elapsedTime = systemTime(SYSTEM_TIME_MONOTONIC) - startTime;
+    ALOGD("Parsed key character map file '%s' %d lines in %0.3fms.",
+            tokenizer->getFilename().string(), tokenizer->getLineNumber(),
+            elapsedTime / 1000000.0);
 #endif
-        if (!status) {
-            *outMap = map;
-        }
+    if (!status) {
+        *outMap = builder.build();
     }
     return status;
 }
 
+status_t KeyCharacterMap::loadBinary(const std::string& filename, sp<KeyCharacterMap>* outMap) {
+    outMap->clear();
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Error %d opening key character map file %s.", errno, filename.c_str());
+        return -errno;
+    }
+    struct stat fileStat;
+    status_t status;
+    if (fstat(fd, &fileStat)) {
+        status = -errno;
+    } else {
+        status = mapBinary(fd, size_t(fileStat.st_size), outMap);
+    }
+    close(fd);
+    if (status) {
+        ALOGE("Error %d loading binary key character map file %s.", status, filename.c_str());
+    }
+    return status;
+}
+
+status_t KeyCharacterMap::mapBinary(int fd, size_t size, sp<KeyCharacterMap>* outMap) {
+    outMap->clear();
+
+    if (size < sizeof(BinaryHeader) || size % sizeof(uint32_t)) {
+        return BAD_VALUE;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat)) {
+        return -errno;
+    }
+    if (S_ISREG(fileStat.st_mode) && uint64_t(fileStat.st_size) < size) {
+        return BAD_VALUE;
+    }
+
+    // Validating data that another process can still write to would not prove anything, so it
+    // is copied instead.
+    if (!isImmutable(fd)) {
+        std::vector<uint32_t> storage(size / sizeof(uint32_t));
+        if (!base::ReadFullyAtOffset(fd, storage.data(), size, 0)) {
+            return errno ? -errno : BAD_VALUE;
+        }
+        if (!isValidBinary(storage.data(), size)) {
+            return BAD_VALUE;
+        }
+        *outMap = new KeyCharacterMap(std::move(storage));
+        return OK;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return -errno;
+    }
+    if (!isValidBinary(data, size)) {
+        munmap(data, size);
+        return BAD_VALUE;
+    }
+    *outMap = new KeyCharacterMap(*static_cast<const BinaryHeader*>(data), data, size);
+    return OK;
+}
+
+status_t KeyCharacterMap::writeBinary(int fd) const {
+    if (!base::WriteFully(fd, mHeader, getBinarySize())) {
+        return -errno;
+    }
+    return OK;
+}
+
 sp<KeyCharacterMap> KeyCharacterMap::combine(const sp<KeyCharacterMap>& base,
         const sp<KeyCharacterMap>& overlay) {
     if (overlay == nullptr) {
@@ -171,29 +439,56 @@ sp<KeyCharacterMap> KeyCharacterMap::combine(const sp<KeyCharacterMap>& base,
         return overlay;
     }
 
-    sp<KeyCharacterMap> map = new KeyCharacterMap(*base.get());
-    for (size_t i = 0; i < overlay->mKeys.size(); i++) {
-        int32_t keyCode = overlay->mKeys.keyAt(i);
-        Key* key = overlay->mKeys.valueAt(i);
-        ssize_t oldIndex = map->mKeys.indexOfKey(keyCode);
-        if (oldIndex >= 0) {
-            delete map->mKeys.valueAt(oldIndex);
-            map->mKeys.editValueAt(oldIndex) = new Key(*key);
+    // Merge the keys and code mappings, which are sorted, preferring those of the overlay.
+    std::vector<BinaryKey> keys;
+    std::vector<BinaryBehavior> behaviors;
+    const BinaryKey* baseKey = base->mKeys;
+    const BinaryKey* baseKeysEnd = base->mKeys + base->mKeyCount;
+    const BinaryKey* overlayKey = overlay->mKeys;
+    const BinaryKey* overlayKeysEnd = overlay->mKeys + overlay->mKeyCount;
+    while (baseKey != baseKeysEnd || overlayKey != overlayKeysEnd) {
+        const KeyCharacterMap* map;
+        const BinaryKey* key;
+        if (overlayKey == overlayKeysEnd
+                || (baseKey != baseKeysEnd && baseKey->keyCode < overlayKey->keyCode)) {
+            map = base.get();
+            key = baseKey++;
         } else {
-            map->mKeys.add(keyCode, new Key(*key));
+            if (baseKey != baseKeysEnd && baseKey->keyCode == overlayKey->keyCode) {
+                baseKey++;
+            }
+            map = overlay.get();
+            key = overlayKey++;
         }
+        keys.push_back(*key);
+        keys.back().firstBehavior = behaviors.size();
+        behaviors.insert(behaviors.end(), map->mBehaviors + key->firstBehavior,
+                map->mBehaviors + key->firstBehavior + key->behaviorCount);
     }
 
-    for (size_t i = 0; i < overlay->mKeysByScanCode.size(); i++) {
-        map->mKeysByScanCode.replaceValueFor(overlay->mKeysByScanCode.keyAt(i),
-                overlay->mKeysByScanCode.valueAt(i));
-    }
-
-    for (size_t i = 0; i < overlay->mKeysByUsageCode.size(); i++) {
-        map->mKeysByUsageCode.replaceValueFor(overlay->mKeysByUsageCode.keyAt(i),
-                overlay->mKeysByUsageCode.valueAt(i));
-    }
-    return map;
+    auto mergeCodeMappings = [](const BinaryCodeMapping* baseBegin,
+            const BinaryCodeMapping* baseEnd, const BinaryCodeMapping* overlayBegin,
+            const BinaryCodeMapping* overlayEnd) {
+        std::vector<BinaryCodeMapping> mappings(overlayBegin, overlayEnd);
+        for (const BinaryCodeMapping* mapping = baseBegin; mapping != baseEnd; mapping++) {
+            if (!findByCode(overlayBegin, overlayEnd, mapping->code)) {
+                mappings.push_back(*mapping);
+            }
+        }
+        std::sort(mappings.begin(), mappings.end(),
+                [](const BinaryCodeMapping& a, const BinaryCodeMapping& b) {
+                    return a.code < b.code;
+                });
+        return mappings;
+    };
+    std::vector<BinaryCodeMapping> keysByScanCode = mergeCodeMappings(base->mKeysByScanCode,
+            base->mKeysByScanCode + base->mScanCodeMappingCount, overlay->mKeysByScanCode,
+            overlay->mKeysByScanCode + overlay->mScanCodeMappingCount);
+    std::vector<BinaryCodeMapping> keysByUsageCode = mergeCodeMappings(base->mKeysByUsageCode,
+            base->mKeysByUsageCode + base->mUsageCodeMappingCount, overlay->mKeysByUsageCode,
+            overlay->mKeysByUsageCode + overlay->mUsageCodeMappingCount);
+
+    return create(base->mType, keys, behaviors, keysByScanCode, keysByUsageCode);
 }
 
 sp<KeyCharacterMap> KeyCharacterMap::empty() {
@@ -206,7 +501,7 @@ int32_t KeyCharacterMap::getKeyboardType() const {
 
 char16_t KeyCharacterMap::getDisplayLabel(int32_t keyCode) const {
     char16_t result = 0;
-    const Key* key;
+    const BinaryKey* key;
     if (getKey(keyCode, &key)) {
         result = key->label;
     }
@@ -218,7 +513,7 @@ char16_t KeyCharacterMap::getDisplayLabel(int32_t keyCode) const {
 
 char16_t KeyCharacterMap::getNumber(int32_t keyCode) const {
     char16_t result = 0;
-    const Key* key;
+    const BinaryKey* key;
     if (getKey(keyCode, &key)) {
         result = key->number;
     }
@@ -230,8 +525,8 @@ char16_t KeyCharacterMap::getNumber(int32_t keyCode) const {
 
 char16_t KeyCharacterMap::getCharacter(int32_t keyCode, int32_t metaState) const {
     char16_t result = 0;
-    const Key* key;
-    const Behavior* behavior;
+    const BinaryKey* key;
+    const BinaryBehavior* behavior;
     if (getKeyBehavior(keyCode, metaState, &key, &behavior)) {
         result = behavior->character;
     }
@@ -247,8 +542,8 @@ bool KeyCharacterMap::getFallbackAction(int32_t keyCode, int32_t metaState,
     outFallbackAction->metaState = 0;
 
     bool result = false;
-    const Key* key;
-    const Behavior* behavior;
+    const BinaryKey* key;
+    const BinaryBehavior* behavior;
     if (getKeyBehavior(keyCode, metaState, &key, &behavior)) {
         if (behavior->fallbackKeyCode) {
             outFallbackAction->keyCode = behavior->fallbackKeyCode;
@@ -268,12 +563,15 @@ bool KeyCharacterMap::getFallbackAction(int32_t keyCode, int32_t metaState,
 char16_t KeyCharacterMap::getMatch(int32_t keyCode, const char16_t* chars, size_t numChars,
         int32_t metaState) const {
     char16_t result = 0;
-    const Key* key;
+    const BinaryKey* key;
     if (getKey(keyCode, &key)) {
         // Try to find the most general behavior that maps to this character.
         // For example, the base key behavior will usually be last in the list.
         // However, if we find a perfect meta state match for one behavior then use that one.
-        for (const Behavior* behavior = key->firstBehavior; behavior; behavior = behavior->next) {
+        const BinaryBehavior* behaviorsEnd =
+                mBehaviors + key->firstBehavior + key->behaviorCount;
+        for (const BinaryBehavior* behavior = mBehaviors + key->firstBehavior;
+                behavior != behaviorsEnd; behavior++) {
             if (behavior->character) {
                 for (size_t i = 0; i < numChars; i++) {
                     if (behavior->character == chars[i]) {
@@ -330,9 +628,10 @@ bool KeyCharacterMap::getEvents(int32_t deviceId, const char16_t* chars, size_t
 
 status_t KeyCharacterMap::mapKey(int32_t scanCode, int32_t usageCode, int32_t* outKeyCode) const {
     if (usageCode) {
-        ssize_t index = mKeysByUsageCode.indexOfKey(usageCode);
-        if (index >= 0) {
-            *outKeyCode = mKeysByUsageCode.valueAt(index);
+        const BinaryCodeMapping* mapping = findByCode(mKeysByUsageCode,
+                mKeysByUsageCode + mUsageCodeMappingCount, usageCode);
+        if (mapping) {
+            *outKeyCode = mapping->keyCode;
 #if DEBUG_MAPPING
             ALOGD("mapKey: scanCode=%d, usageCode=0x%08x ~ Result keyCode=%d.",
                     scanCode, usageCode, *outKeyCode);
@@ -341,9 +640,10 @@ status_t KeyCharacterMap::mapKey(int32_t scanCode, int32_t usageCode, int32_t* o
         }
     }
     if (scanCode) {
-        ssize_t index = mKeysByScanCode.indexOfKey(scanCode);
-        if (index >= 0) {
-            *outKeyCode = mKeysByScanCode.valueAt(index);
+        const BinaryCodeMapping* mapping = findByCode(mKeysByScanCode,
+                mKeysByScanCode + mScanCodeMappingCount, scanCode);
+        if (mapping) {
+            *outKeyCode = mapping->keyCode;
 #if DEBUG_MAPPING
             ALOGD("mapKey: scanCode=%d, usageCode=0x%08x ~ Result keyCode=%d.",
                     scanCode, usageCode, *outKeyCode);
@@ -364,8 +664,8 @@ void KeyCharacterMap::tryRemapKey(int32_t keyCode, int32_t metaState,
     *outKeyCode = keyCode;
     *outMetaState = metaState;
 
-    const Key* key;
-    const Behavior* behavior;
+    const BinaryKey* key;
+    const BinaryBehavior* behavior;
     if (getKeyBehavior(keyCode, metaState, &key, &behavior)) {
         if (behavior->replacementKeyCode) {
             *outKeyCode = behavior->replacementKeyCode;
@@ -401,27 +701,30 @@ void KeyCharacterMap::tryRemapKey(int32_t keyCode, int32_t metaState,
 #endif
 }
 
-bool KeyCharacterMap::getKey(int32_t keyCode, const Key** outKey) const {
-    ssize_t index = mKeys.indexOfKey(keyCode);
-    if (index >= 0) {
-        *outKey = mKeys.valueAt(index);
+bool KeyCharacterMap::getKey(int32_t keyCode, const BinaryKey** outKey) const {
+    const BinaryKey* keysEnd = mKeys + mKeyCount;
+    const BinaryKey* key = std::lower_bound(mKeys, keysEnd, keyCode,
+            [](const BinaryKey& entry, int32_t value) { return entry.keyCode < value; });
+    if (key != keysEnd && key->keyCode == keyCode) {
+        *outKey = key;
         return true;
     }
     return false;
 }
 
 bool KeyCharacterMap::getKeyBehavior(int32_t keyCode, int32_t metaState,
-        const Key** outKey, const Behavior** outBehavior) const {
-    const Key* key;
+        const BinaryKey** outKey, const BinaryBehavior** outBehavior) const {
+    const BinaryKey* key;
     if (getKey(keyCode, &key)) {
-        const Behavior* behavior = key->firstBehavior;
-        while (behavior) {
+        const BinaryBehavior* behaviorsEnd =
+                mBehaviors + key->firstBehavior + key->behaviorCount;
+        for (const BinaryBehavior* behavior = mBehaviors + key->firstBehavior;
+                behavior != behaviorsEnd; behavior++) {
             if (matchesMetaState(metaState, behavior->metaState)) {
                 *outKey = key;
                 *outBehavior = behavior;
                 return true;
             }
-            behavior = behavior->next;
         }
     }
     return false;
@@ -463,19 +766,22 @@ bool KeyCharacterMap::findKey(char16_t ch, int32_t* outKeyCode, int32_t* outMeta
         return false;
     }
 
-    for (size_t i = 0; i < mKeys.size(); i++) {
-        const Key* key = mKeys.valueAt(i);
+    for (uint32_t i = 0; i < mKeyCount; i++) {
+        const BinaryKey* key = &mKeys[i];
 
         // Try to find the most general behavior that maps to this character.
         // For example, the base key behavior will usually be last in the list.
-        const Behavior* found = nullptr;
-        for (const Behavior* behavior = key->firstBehavior; behavior; behavior = behavior->next) {
+        const BinaryBehavior* found = nullptr;
+        const BinaryBehavior* behaviorsEnd =
+                mBehaviors + key->firstBehavior + key->behaviorCount;
+        for (const BinaryBehavior* behavior = mBehaviors + key->firstBehavior;
+                behavior != behaviorsEnd; behavior++) {
             if (behavior->character == ch) {
                 found = behavior;
             }
         }
         if (found) {
-            *outKeyCode = mKeys.keyAt(i);
+            *outKeyCode = key->keyCode;
             *outMetaState = found->metaState;
             return true;
         }
@@ -601,8 +907,7 @@ void KeyCharacterMap::addLockedMetaKey(Vector<KeyEvent>& outEvents,
 
 #ifdef __ANDROID__
 sp<KeyCharacterMap> KeyCharacterMap::readFromParcel(Parcel* parcel) {
-    sp<KeyCharacterMap> map = new KeyCharacterMap();
-    map->mType = parcel->readInt32();
+    int32_t type = parcel->readInt32();
     size_t numKeys = parcel->readInt32();
     if (parcel->errorCheck()) {
         return nullptr;
@@ -612,67 +917,61 @@ sp<KeyCharacterMap> KeyCharacterMap::readFromParcel(Parcel* parcel) {
         return nullptr;
     }
 
+    std::vector<BinaryKey> keys;
+    std::vector<BinaryBehavior> behaviors;
+    keys.reserve(numKeys);
     for (size_t i = 0; i < numKeys; i++) {
-        int32_t keyCode = parcel->readInt32();
-        char16_t label = parcel->readInt32();
-        char16_t number = parcel->readInt32();
+        BinaryKey key = {};
+        key.keyCode = parcel->readInt32();
+        key.label = parcel->readInt32();
+        key.number = parcel->readInt32();
+        key.firstBehavior = behaviors.size();
         if (parcel->errorCheck()) {
             return nullptr;
         }
+        if (!keys.empty() && keys.back().keyCode >= key.keyCode) {
+            ALOGE("Keys in KeyCharacterMap are not sorted by key code");
+            return nullptr;
+        }
 
-        Key* key = new Key();
-        key->label = label;
-        key->number = number;
-        map->mKeys.add(keyCode, key);
-
-        Behavior* lastBehavior = nullptr;
         while (parcel->readInt32()) {
-            int32_t metaState = parcel->readInt32();
-            char16_t character = parcel->readInt32();
-            int32_t fallbackKeyCode = parcel->readInt32();
-            int32_t replacementKeyCode = parcel->readInt32();
+            BinaryBehavior behavior = {};
+            behavior.metaState = parcel->readInt32();
+            behavior.character = parcel->readInt32();
+            behavior.fallbackKeyCode = parcel->readInt32();
+            behavior.replacementKeyCode = parcel->readInt32();
             if (parcel->errorCheck()) {
                 return nullptr;
             }
-
-            Behavior* behavior = new Behavior();
-            behavior->metaState = metaState;
-            behavior->character = character;
-            behavior->fallbackKeyCode = fallbackKeyCode;
-            behavior->replacementKeyCode = replacementKeyCode;
-            if (lastBehavior) {
-                lastBehavior->next = behavior;
-            } else {
-                key->firstBehavior = behavior;
-            }
-            lastBehavior = behavior;
+            behaviors.push_back(behavior);
         }
 
         if (parcel->errorCheck()) {
             return nullptr;
         }
+        key.behaviorCount = behaviors.size() - key.firstBehavior;
+        keys.push_back(key);
     }
-    return map;
+    return create(type, keys, behaviors, {}, {});
 }
 
 void KeyCharacterMap::writeToParcel(Parcel* parcel) const {
     parcel->writeInt32(mType);
 
-    size_t numKeys = mKeys.size();
+    size_t numKeys = mKeyCount;
     parcel->writeInt32(numKeys);
     for (size_t i = 0; i < numKeys; i++) {
-        int32_t keyCode = mKeys.keyAt(i);
-        const Key* key = mKeys.valueAt(i);
-        parcel->writeInt32(keyCode);
-        parcel->writeInt32(key->label);
-        parcel->writeInt32(key->number);
-        for (const Behavior* behavior = key->firstBehavior; behavior != nullptr;
-                behavior = behavior->next) {
+        const BinaryKey& key = mKeys[i];
+        parcel->writeInt32(key.keyCode);
+        parcel->writeInt32(key.label);
+        parcel->writeInt32(key.number);
+        for (uint32_t j = 0; j < key.behaviorCount; j++) {
+            const BinaryBehavior& behavior = mBehaviors[key.firstBehavior + j];
             parcel->writeInt32(1);
-            parcel->writeInt32(behavior->metaState);
-            parcel->writeInt32(behavior->character);
-            parcel->writeInt32(behavior->fallbackKeyCode);
-            parcel->writeInt32(behavior->replacementKeyCode);
+            parcel->writeInt32(behavior.metaState);
+            parcel->writeInt32(behavior.character);
+            parcel->writeInt32(behavior.fallbackKeyCode);
+            parcel->writeInt32(behavior.replacementKeyCode);
         }
         parcel->writeInt32(0);
     }
@@ -686,11 +985,6 @@ KeyCharacterMap::Key::Key() :
         label(0), number(0), firstBehavior(nullptr) {
 }
 
-KeyCharacterMap::Key::Key(const Key& other) :
-        label(other.label), number(other.number),
-        firstBehavior(other.firstBehavior ? new Behavior(*other.firstBehavior) : nullptr) {
-}
-
 KeyCharacterMap::Key::~Key() {
     Behavior* behavior = firstBehavior;
     while (behavior) {
@@ -715,9 +1009,57 @@ KeyCharacterMap::Behavior::Behavior(const Behavior& other) :
 }
 
 
+// --- KeyCharacterMap::Builder ---
+
+KeyCharacterMap::Builder::Builder() :
+        mType(KEYBOARD_TYPE_UNKNOWN) {
+}
+
+KeyCharacterMap::Builder::~Builder() {
+    for (size_t i = 0; i < mKeys.size(); i++) {
+        delete mKeys.valueAt(i);
+    }
+}
+
+sp<KeyCharacterMap> KeyCharacterMap::Builder::build() const {
+    std::vector<BinaryKey> keys;
+    std::vector<BinaryBehavior> behaviors;
+    keys.reserve(mKeys.size());
+    for (size_t i = 0; i < mKeys.size(); i++) {
+        const Key* key = mKeys.valueAt(i);
+        BinaryKey binaryKey = {};
+        binaryKey.keyCode = mKeys.keyAt(i);
+        binaryKey.label = key->label;
+        binaryKey.number = key->number;
+        binaryKey.firstBehavior = behaviors.size();
+        for (const Behavior* behavior = key->firstBehavior; behavior; behavior = behavior->next) {
+            BinaryBehavior binaryBehavior = {};
+            binaryBehavior.metaState = behavior->metaState;
+            binaryBehavior.character = behavior->character;
+            binaryBehavior.fallbackKeyCode = behavior->fallbackKeyCode;
+            binaryBehavior.replacementKeyCode = behavior->replacementKeyCode;
+            behaviors.push_back(binaryBehavior);
+        }
+        binaryKey.behaviorCount = behaviors.size() - binaryKey.firstBehavior;
+        keys.push_back(binaryKey);
+    }
+
+    auto toCodeMappings = [](const KeyedVector<int32_t, int32_t>& keysByCode) {
+        std::vector<BinaryCodeMapping> mappings;
+        mappings.reserve(keysByCode.size());
+        for (size_t i = 0; i < keysByCode.size(); i++) {
+            mappings.push_back({keysByCode.keyAt(i), keysByCode.valueAt(i)});
+        }
+        return mappings;
+    };
+    return create(mType, keys, behaviors, toCodeMappings(mKeysByScanCode),
+            toCodeMappings(mKeysByUsageCode));
+}
+
+
 // --- KeyCharacterMap::Parser ---
 
-KeyCharacterMap::Parser::Parser(KeyCharacterMap* map, Tokenizer* tokenizer, Format format) :
+KeyCharacterMap::Parser::Parser(Builder* map, Tokenizer* tokenizer, Format format) :
         mMap(map), mTokenizer(tokenizer), mFormat(format), mState(STATE_TOP) {
 }
 
@@ -25,11 +25,24 @@
 #include <input/KeyLayoutMap.h>
 #include <input/KeyCharacterMap.h>
 #include <input/InputDevice.h>
+#include <input/ParsedFileCache.h>
 #include <utils/Errors.h>
 #include <utils/Log.h>
 
 namespace android {
 
+// The key layout and key character maps that have been loaded, which are shared by all the key
+// maps that use the same files. They are leaked on purpose, to outlive any static KeyMap.
+static ParsedFileCache<sp<KeyLayoutMap>>& getKeyLayoutMapCache() {
+    static auto* cache = new ParsedFileCache<sp<KeyLayoutMap>>();
+    return *cache;
+}
+
+static ParsedFileCache<sp<KeyCharacterMap>>& getKeyCharacterMapCache() {
+    static auto* cache = new ParsedFileCache<sp<KeyCharacterMap>>();
+    return *cache;
+}
+
 // --- KeyMap ---
 
 KeyMap::KeyMap() {
@@ -111,7 +124,7 @@ status_t KeyMap::loadKeyLayout(const InputDeviceIdentifier& deviceIdentifier,
         return NAME_NOT_FOUND;
     }
 
-    status_t status = KeyLayoutMap::load(path, &keyLayoutMap);
+    status_t status = getKeyLayoutMapCache().load(path, KeyLayoutMap::load, &keyLayoutMap);
     if (status) {
         return status;
     }
@@ -128,8 +141,11 @@ status_t KeyMap::loadKeyCharacterMap(const InputDeviceIdentifier& deviceIdentifi
         return NAME_NOT_FOUND;
     }
 
-    status_t status = KeyCharacterMap::load(path,
-            KeyCharacterMap::FORMAT_BASE, &keyCharacterMap);
+    status_t status = getKeyCharacterMapCache().load(path,
+            [](const std::string& filename, sp<KeyCharacterMap>* outMap) {
+                return KeyCharacterMap::load(filename, KeyCharacterMap::FORMAT_BASE, outMap);
+            },
+            &keyCharacterMap);
     if (status) {
         return status;
     }
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <binder/Parcel.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <input/KeyCharacterMap.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace android {
+
+static const char* KEY_CHARACTER_MAP = R"(
+type FULL
+
+key A {
+    label:                              'A'
+    base:                               'a'
+    shift, capslock:                    'A'
+    ctrl, alt, meta:                    none
+}
+
+key 1 {
+    label:                              '1'
+    number:                             '1'
+    base:                               '1'
+    shift:                              '!'
+}
+
+key ESCAPE {
+    base:                               fallback BACK
+    alt, meta:                          fallback HOME
+    ctrl:                               fallback MENU
+}
+
+map key 86 PLUS
+map key usage 0x0c0067 EQUALS
+)";
+
+static const char* OVERLAY = R"(
+type OVERLAY
+
+key A {
+    label:                              'A'
+    base:                               'q'
+    shift, capslock:                    'Q'
+}
+
+map key 86 MINUS
+)";
+
+// --- KeyCharacterMapTest ---
+
+class KeyCharacterMapTest : public testing::Test {
+protected:
+    sp<KeyCharacterMap> loadMap(const char* contents, KeyCharacterMap::Format format) {
+        sp<KeyCharacterMap> map;
+        EXPECT_EQ(OK, KeyCharacterMap::loadContents("test.kcm", contents, format, &map));
+        return map;
+    }
+
+    sp<KeyCharacterMap> writeAndLoadBinary(const sp<KeyCharacterMap>& map) {
+        EXPECT_EQ(OK, map->writeBinary(mFile.fd));
+        sp<KeyCharacterMap> binaryMap;
+        EXPECT_EQ(OK, KeyCharacterMap::loadBinary(mFile.path, &binaryMap));
+        return binaryMap;
+    }
+
+    static void assertBaseMap(const sp<KeyCharacterMap>& map) {
+        ASSERT_NE(nullptr, map);
+        ASSERT_EQ(KeyCharacterMap::KEYBOARD_TYPE_FULL, map->getKeyboardType());
+
+        ASSERT_EQ(u'A', map->getDisplayLabel(AKEYCODE_A));
+        ASSERT_EQ(u'a', map->getCharacter(AKEYCODE_A, 0));
+        ASSERT_EQ(u'A', map->getCharacter(AKEYCODE_A, AMETA_SHIFT_ON));
+        ASSERT_EQ(u'A', map->getCharacter(AKEYCODE_A, AMETA_CAPS_LOCK_ON));
+        ASSERT_EQ(0, map->getCharacter(AKEYCODE_A, AMETA_CTRL_ON));
+        ASSERT_EQ(0, map->getCharacter(AKEYCODE_B, 0));
+        ASSERT_EQ(u'1', map->getNumber(AKEYCODE_1));
+        ASSERT_EQ(u'!', map->getCharacter(AKEYCODE_1, AMETA_SHIFT_ON));
+
+        KeyCharacterMap::FallbackAction action;
+        ASSERT_TRUE(map->getFallbackAction(AKEYCODE_ESCAPE, 0, &action));
+        ASSERT_EQ(AKEYCODE_BACK, action.keyCode);
+        ASSERT_TRUE(map->getFallbackAction(AKEYCODE_ESCAPE, AMETA_ALT_ON, &action));
+        ASSERT_EQ(AKEYCODE_HOME, action.keyCode);
+        ASSERT_FALSE(map->getFallbackAction(AKEYCODE_A, 0, &action));
+
+        int32_t keyCode;
+        ASSERT_EQ(OK, map->mapKey(86, 0, &keyCode));
+        ASSERT_EQ(AKEYCODE_PLUS, keyCode);
+        ASSERT_EQ(OK, map->mapKey(0, 0x0c0067, &keyCode));
+        ASSERT_EQ(AKEYCODE_EQUALS, keyCode);
+        ASSERT_EQ(NAME_NOT_FOUND, map->mapKey(87, 0, &keyCode));
+    }
+
+    TemporaryFile mFile;
+};
+
+TEST_F(KeyCharacterMapTest, LoadContents_QueriesMatchFile) {
+    assertBaseMap(loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE));
+}
+
+TEST_F(KeyCharacterMapTest, WriteAndLoadBinary_QueriesMatchFile) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+
+    assertBaseMap(writeAndLoadBinary(map));
+}
+
+TEST_F(KeyCharacterMapTest, LoadCorruptBinary_Fails) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+    ASSERT_EQ(OK, map->writeBinary(mFile.fd));
+
+    // Truncate the file, so that its tables no longer fit.
+    std::string contents;
+    ASSERT_TRUE(base::ReadFileToString(mFile.path, &contents));
+    ASSERT_TRUE(base::WriteStringToFile(contents.substr(0, contents.size() - 4), mFile.path));
+    sp<KeyCharacterMap> binaryMap;
+    ASSERT_EQ(BAD_VALUE, KeyCharacterMap::loadBinary(mFile.path, &binaryMap));
+    ASSERT_EQ(nullptr, binaryMap);
+
+    ASSERT_TRUE(base::WriteStringToFile("not a key character map", mFile.path));
+    ASSERT_EQ(BAD_VALUE, KeyCharacterMap::loadBinary(mFile.path, &binaryMap));
+}
+
+// Writes the binary form of the base map to a new memfd, and returns its size.
+static size_t writeBinaryToMemfd(const sp<KeyCharacterMap>& map, base::unique_fd* outFd) {
+    outFd->reset(memfd_create("KeyCharacterMapTest", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    EXPECT_GE(outFd->get(), 0);
+    EXPECT_EQ(OK, map->writeBinary(outFd->get()));
+    return size_t(lseek(outFd->get(), 0, SEEK_CUR));
+}
+
+TEST_F(KeyCharacterMapTest, MapBinary_UnsealedMemfdModifiedAfterwards_QueriesUnchanged) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+    base::unique_fd fd;
+    const size_t size = writeBinaryToMemfd(map, &fd);
+
+    sp<KeyCharacterMap> binaryMap;
+    ASSERT_EQ(OK, KeyCharacterMap::mapBinary(fd.get(), size, &binaryMap));
+
+    // Another process holding the fd could rewrite every table and count after validation; the
+    // map must not see any of it.
+    const std::string garbage(size, '\xff');
+    ASSERT_EQ(ssize_t(size), pwrite(fd.get(), garbage.data(), size, 0));
+    assertBaseMap(binaryMap);
+}
+
+TEST_F(KeyCharacterMapTest, MapBinary_SealedMemfd_CannotBeModified) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+    base::unique_fd fd;
+    const size_t size = writeBinaryToMemfd(map, &fd);
+    ASSERT_EQ(0, fcntl(fd.get(), F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_SEAL));
+
+    sp<KeyCharacterMap> binaryMap;
+    ASSERT_EQ(OK, KeyCharacterMap::mapBinary(fd.get(), size, &binaryMap));
+
+    const std::string garbage(size, '\xff');
+    ASSERT_EQ(-1, pwrite(fd.get(), garbage.data(), size, 0));
+    ASSERT_EQ(EPERM, errno);
+    ASSERT_EQ(-1, ftruncate(fd.get(), 0));
+    assertBaseMap(binaryMap);
+}
+
+TEST_F(KeyCharacterMapTest, MapBinary_TemporaryFile_QueriesMatchFile) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+    ASSERT_EQ(OK, map->writeBinary(mFile.fd));
+    const size_t size = size_t(lseek(mFile.fd, 0, SEEK_CUR));
+
+    // The file is on a writable partition, so it is copied rather than mapped; truncating it
+    // afterwards must not affect the map.
+    sp<KeyCharacterMap> binaryMap;
+    ASSERT_EQ(OK, KeyCharacterMap::mapBinary(mFile.fd, size, &binaryMap));
+    ASSERT_EQ(0, ftruncate(mFile.fd, 0));
+    assertBaseMap(binaryMap);
+}
+
+TEST_F(KeyCharacterMapTest, Parcel_RoundTrip_QueriesMatch) {
+    sp<KeyCharacterMap> map = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    ASSERT_NE(nullptr, map);
+
+    Parcel parcel;
+    map->writeToParcel(&parcel);
+    parcel.setDataPosition(0);
+    sp<KeyCharacterMap> parceledMap = KeyCharacterMap::readFromParcel(&parcel);
+    ASSERT_NE(nullptr, parceledMap);
+
+    // The parcel only holds the keys, not the scan and usage code mappings.
+    ASSERT_EQ(KeyCharacterMap::KEYBOARD_TYPE_FULL, parceledMap->getKeyboardType());
+    ASSERT_EQ(u'A', parceledMap->getDisplayLabel(AKEYCODE_A));
+    ASSERT_EQ(u'a', parceledMap->getCharacter(AKEYCODE_A, 0));
+    ASSERT_EQ(u'A', parceledMap->getCharacter(AKEYCODE_A, AMETA_SHIFT_ON));
+    ASSERT_EQ(u'A', parceledMap->getCharacter(AKEYCODE_A, AMETA_CAPS_LOCK_ON));
+    ASSERT_EQ(0, parceledMap->getCharacter(AKEYCODE_A, AMETA_CTRL_ON));
+    ASSERT_EQ(u'1', parceledMap->getNumber(AKEYCODE_1));
+    ASSERT_EQ(u'!', parceledMap->getCharacter(AKEYCODE_1, AMETA_SHIFT_ON));
+
+    KeyCharacterMap::FallbackAction action;
+    ASSERT_TRUE(parceledMap->getFallbackAction(AKEYCODE_ESCAPE, AMETA_ALT_ON, &action));
+    ASSERT_EQ(AKEYCODE_HOME, action.keyCode);
+
+    // Writing the parceled map again gives the same parcel.
+    Parcel reparceled;
+    parceledMap->writeToParcel(&reparceled);
+    ASSERT_EQ(parcel.dataSize(), reparceled.dataSize());
+    ASSERT_EQ(0, memcmp(parcel.data(), reparceled.data(), parcel.dataSize()));
+}
+
+// Writes a key without behaviors the way writeToParcel does.
+static void writeKeyToParcel(Parcel* parcel, int32_t keyCode) {
+    parcel->writeInt32(keyCode);
+    parcel->writeInt32(0); // label
+    parcel->writeInt32(0); // number
+    parcel->writeInt32(0); // no more behaviors
+}
+
+TEST_F(KeyCharacterMapTest, Parcel_UnsortedKeyCodes_Rejected) {
+    Parcel parcel;
+    parcel.writeInt32(KeyCharacterMap::KEYBOARD_TYPE_FULL);
+    parcel.writeInt32(2);
+    writeKeyToParcel(&parcel, AKEYCODE_B);
+    writeKeyToParcel(&parcel, AKEYCODE_A);
+    parcel.setDataPosition(0);
+    ASSERT_EQ(nullptr, KeyCharacterMap::readFromParcel(&parcel));
+
+    Parcel duplicateParcel;
+    duplicateParcel.writeInt32(KeyCharacterMap::KEYBOARD_TYPE_FULL);
+    duplicateParcel.writeInt32(2);
+    writeKeyToParcel(&duplicateParcel, AKEYCODE_A);
+    writeKeyToParcel(&duplicateParcel, AKEYCODE_A);
+    duplicateParcel.setDataPosition(0);
+    ASSERT_EQ(nullptr, KeyCharacterMap::readFromParcel(&duplicateParcel));
+}
+
+TEST_F(KeyCharacterMapTest, Combine_OverlayTakesPrecedence) {
+    sp<KeyCharacterMap> base = loadMap(KEY_CHARACTER_MAP, KeyCharacterMap::FORMAT_BASE);
+    sp<KeyCharacterMap> overlay = loadMap(OVERLAY, KeyCharacterMap::FORMAT_OVERLAY);
+    ASSERT_NE(nullptr, base);
+    ASSERT_NE(nullptr, overlay);
+
+    sp<KeyCharacterMap> map = writeAndLoadBinary(KeyCharacterMap::combine(base, overlay));
+    ASSERT_NE(nullptr, map);
+    ASSERT_EQ(KeyCharacterMap::KEYBOARD_TYPE_FULL, map->getKeyboardType());
+    ASSERT_EQ(u'q', map->getCharacter(AKEYCODE_A, 0));
+    ASSERT_EQ(u'Q', map->getCharacter(AKEYCODE_A, AMETA_SHIFT_ON));
+    ASSERT_EQ(u'!', map->getCharacter(AKEYCODE_1, AMETA_SHIFT_ON));
+
+    int32_t keyCode;
+    ASSERT_EQ(OK, map->mapKey(86, 0, &keyCode));
+    ASSERT_EQ(AKEYCODE_MINUS, keyCode);
+    ASSERT_EQ(OK, map->mapKey(0, 0x0c0067, &keyCode));
+    ASSERT_EQ(AKEYCODE_EQUALS, keyCode);
+}
+
+} // namespace android
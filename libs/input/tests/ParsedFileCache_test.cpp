@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <input/ParsedFileCache.h>
+#include <sys/stat.h>
+
+namespace android {
+
+// --- ParsedFileCacheTest ---
+
+class ParsedFileCacheTest : public testing::Test {
+protected:
+    TemporaryFile mFile;
+    size_t mLoadCount = 0;
+
+    ParsedFileCache<std::string>::Loader getLoader() {
+        return [this](const std::string& path, std::string* outValue) {
+            mLoadCount++;
+            return base::ReadFileToString(path, outValue) ? OK : NAME_NOT_FOUND;
+        };
+    }
+};
+
+TEST_F(ParsedFileCacheTest, LoadSameFile_ParsedOnce) {
+    ASSERT_TRUE(base::WriteStringToFile("contents", mFile.path));
+    ParsedFileCache<std::string> cache;
+
+    std::string first;
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &first));
+    std::string second;
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &second));
+
+    ASSERT_EQ("contents", first);
+    ASSERT_EQ("contents", second);
+    ASSERT_EQ(1u, mLoadCount);
+    ASSERT_EQ(1u, cache.size());
+}
+
+TEST_F(ParsedFileCacheTest, LoadModifiedFile_ParsedAgain) {
+    ASSERT_TRUE(base::WriteStringToFile("contents", mFile.path));
+    ParsedFileCache<std::string> cache;
+    std::string value;
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &value));
+
+    ASSERT_TRUE(base::WriteStringToFile("new contents", mFile.path));
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &value));
+
+    ASSERT_EQ("new contents", value);
+    ASSERT_EQ(2u, mLoadCount);
+}
+
+TEST_F(ParsedFileCacheTest, LoadFileRewrittenWithinSameSecond_ParsedAgain) {
+    ASSERT_TRUE(base::WriteStringToFile("contents", mFile.path));
+    ParsedFileCache<std::string> cache;
+    std::string value;
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &value));
+    struct stat before;
+    ASSERT_EQ(0, stat(mFile.path, &before));
+
+    // Same size, and a modification time that only differs in its nanoseconds.
+    ASSERT_TRUE(base::WriteStringToFile("CONTENTS", mFile.path));
+    timespec times[2] = {before.st_atim, before.st_mtim};
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    ASSERT_EQ(0, utimensat(AT_FDCWD, mFile.path, times, 0));
+    ASSERT_EQ(OK, cache.load(mFile.path, getLoader(), &value));
+
+    ASSERT_EQ("CONTENTS", value);
+    ASSERT_EQ(2u, mLoadCount);
+}
+
+TEST_F(ParsedFileCacheTest, LoadMissingFile_NotCached) {
+    const std::string path = std::string(mFile.path) + ".missing";
+    ParsedFileCache<std::string> cache;
+    std::string value;
+
+    ASSERT_EQ(NAME_NOT_FOUND, cache.load(path, getLoader(), &value));
+    ASSERT_EQ(NAME_NOT_FOUND, cache.load(path, getLoader(), &value));
+
+    ASSERT_EQ(2u, mLoadCount);
+    ASSERT_EQ(0u, cache.size());
+}
+
+} // namespace android
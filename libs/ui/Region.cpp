@@ -19,6 +19,8 @@
 #include <inttypes.h>
 #include <limits.h>
 
+#include <algorithm>
+
 #include <android-base/stringprintf.h>
 
 #include <utils/Log.h>
@@ -535,15 +537,14 @@ void Region::rasterizer::flushSpan()
         Rect const* p = span.data();
         Rect const* q = head;
         if (p->top == q->bottom) {
-            merge = true;
-            while (q != tail) {
-                if ((p->left != q->left) || (p->right != q->right)) {
-                    merge = false;
-                    break;
-                }
-                p++;
-                q++;
+            // Compare every x-extent without exiting early, so that the loop
+            // has no data-dependent branch and can be vectorized.
+            int32_t diff = 0;
+            const size_t count = span.size();
+            for (size_t i = 0; i < count; i++) {
+                diff |= (p[i].left ^ q[i].left) | (p[i].right ^ q[i].right);
             }
+            merge = (diff == 0);
         }
     }
     if (merge) {
@@ -643,6 +644,134 @@ bool Region::validate(const Region& reg, const char* name, bool silent)
     return result;
 }
 
+// Returns the union of two rects if it is itself a rect, that is if they
+// share a band or a column and overlap or touch.
+static bool merge_rects(const Rect& a, const Rect& b, Rect* result)
+{
+    const bool same_band = a.top == b.top && a.bottom == b.bottom &&
+            a.left <= b.right && b.left <= a.right;
+    const bool same_column = a.left == b.left && a.right == b.right &&
+            a.top <= b.bottom && b.top <= a.bottom;
+    if (!same_band && !same_column) {
+        return false;
+    }
+    *result = Rect(std::min(a.left, b.left), std::min(a.top, b.top),
+            std::max(a.right, b.right), std::max(a.bottom, b.bottom));
+    return true;
+}
+
+bool Region::fast_boolean_operation(uint32_t op, Region& dst,
+        const Region& lhs, const Rect* rhs_rects, size_t rhs_count,
+        const Rect& rhs_bounds, int dx, int dy)
+{
+    const Rect lb(lhs.getBounds());
+    Rect rb(rhs_bounds);
+    rb.offsetBy(dx, dy);
+    if (!lb.isValid() || !rb.isValid()) {
+        return false;
+    }
+
+    enum { GENERAL, EMPTY, LHS, RHS, RECT } result = GENERAL;
+    Rect rect;
+
+    if (lb.isEmpty() && rb.isEmpty()) {
+        result = EMPTY;
+    } else if (lb.isEmpty()) {
+        result = (op == op_and || op == op_nand) ? EMPTY : RHS;
+    } else if (rb.isEmpty()) {
+        result = (op == op_and) ? EMPTY : LHS;
+    } else if (!lb.intersect(rb, &rect)) {
+        if (op == op_and) result = EMPTY;
+        else if (op == op_nand) result = LHS;
+        else if (op == op_or && lhs.isRect() && rhs_count == 1 && merge_rects(lb, rb, &rect)) {
+            result = RECT;
+        }
+    } else if (rhs_count == 1 && rb.left <= lb.left && rb.top <= lb.top &&
+            rb.right >= lb.right && rb.bottom >= lb.bottom) {
+        // rhs is a rect covering lhs
+        if (op == op_and) result = LHS;
+        else if (op == op_nand) result = EMPTY;
+        else if (op == op_or) { result = RECT; rect = rb; }
+    } else if (lhs.isRect() && lb.left <= rb.left && lb.top <= rb.top &&
+            lb.right >= rb.right && lb.bottom >= rb.bottom) {
+        // lhs is a rect covering rhs
+        if (op == op_and) result = RHS;
+        else if (op == op_or) result = LHS;
+        else if (op == op_nand && rhs_count == 1) {
+            // rhs cuts lhs into two rects, or into one if it touches an edge
+            Rect first, second;
+            if (rb.left == lb.left && rb.right == lb.right) {
+                first = Rect(lb.left, lb.top, lb.right, rb.top);
+                second = Rect(lb.left, rb.bottom, lb.right, lb.bottom);
+            } else if (rb.top == lb.top && rb.bottom == lb.bottom) {
+                first = Rect(lb.left, lb.top, rb.left, lb.bottom);
+                second = Rect(rb.right, lb.top, lb.right, lb.bottom);
+            } else {
+                return false;
+            }
+            if (first.isEmpty()) {
+                dst.set(second);
+            } else if (second.isEmpty()) {
+                dst.set(first);
+            } else {
+                dst.mStorage.clear();
+                dst.mStorage.push_back(first);
+                dst.mStorage.push_back(second);
+                dst.mStorage.push_back(lb);
+            }
+            return true;
+        }
+    } else if (lhs.isRect() && rhs_count == 1) {
+        if (op == op_and) {
+            // rect already holds the intersection
+            result = RECT;
+        } else if (op == op_or) {
+            if (merge_rects(lb, rb, &rect)) result = RECT;
+        } else if (op == op_nand) {
+            // rhs spans lhs horizontally or vertically and covers one edge
+            if (rb.left <= lb.left && rb.right >= lb.right) {
+                result = RECT;
+                rect = (rb.top <= lb.top) ? Rect(lb.left, rb.bottom, lb.right, lb.bottom)
+                                          : Rect(lb.left, lb.top, lb.right, rb.top);
+                if (rb.top > lb.top && rb.bottom < lb.bottom) result = GENERAL;
+            } else if (rb.top <= lb.top && rb.bottom >= lb.bottom) {
+                result = RECT;
+                rect = (rb.left <= lb.left) ? Rect(rb.right, lb.top, lb.right, lb.bottom)
+                                            : Rect(lb.left, lb.top, rb.left, lb.bottom);
+                if (rb.left > lb.left && rb.right < lb.right) result = GENERAL;
+            }
+        }
+    }
+
+    switch (result) {
+        case GENERAL:
+            return false;
+        case EMPTY:
+            dst.clear();
+            break;
+        case LHS:
+            dst = lhs;
+            break;
+        case RHS: {
+            // rhs_rects may point into dst when a region is combined with
+            // itself, so build the copy on the side.
+            Region copy;
+            copy.mStorage.clear();
+            copy.mStorage.insert(copy.mStorage.end(), rhs_rects, rhs_rects + rhs_count);
+            if (rhs_count > 1) {
+                copy.mStorage.push_back(rhs_bounds);
+            }
+            translate(copy, dx, dy);
+            dst = copy;
+            break;
+        }
+        case RECT:
+            dst.set(rect);
+            break;
+    }
+    return true;
+}
+
 void Region::boolean_operation(uint32_t op, Region& dst,
         const Region& lhs,
         const Region& rhs, int dx, int dy)
@@ -659,6 +788,13 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     size_t rhs_count;
     Rect const * const rhs_rects = rhs.getArray(&rhs_count);
 
+    if (fast_boolean_operation(op, dst, lhs, rhs_rects, rhs_count, rhs.getBounds(), dx, dy)) {
+#if defined(VALIDATE_REGIONS)
+        validate(dst, "boolean_operation (fast): dst");
+#endif
+        return;
+    }
+
     region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
     region_operator<Rect>::region rhs_region(rhs_rects, rhs_count, dx, dy);
     region_operator<Rect> operation(op, lhs_region, rhs_region);
@@ -767,6 +903,10 @@ void Region::boolean_operation(uint32_t op, Region& dst,
 #if VALIDATE_WITH_CORECG || defined(VALIDATE_REGIONS)
     boolean_operation(op, dst, lhs, Region(rhs), dx, dy);
 #else
+    if (fast_boolean_operation(op, dst, lhs, &rhs, 1, rhs, dx, dy)) {
+        return;
+    }
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -170,6 +170,14 @@ private:
     static void boolean_operation(uint32_t op, Region& dst,
             const Region& lhs, const Rect& rhs);
 
+    // Computes the operations whose result follows from the bounds of the
+    // operands alone (empty or disjoint operands, containment, two rects)
+    // without running the rasterizer. Returns false if the general path is
+    // needed.
+    static bool fast_boolean_operation(uint32_t op, Region& dst,
+            const Region& lhs, const Rect* rhs_rects, size_t rhs_count,
+            const Rect& rhs_bounds, int dx, int dy);
+
     static void translate(Region& reg, int dx, int dy);
     static void translate(Region& dst, const Region& reg, int dx, int dy);
 
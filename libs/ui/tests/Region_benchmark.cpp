@@ -0,0 +1,100 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the Region operations SurfaceFlinger performs on every frame:
+// clipping layers to the display and subtracting the opaque layers above
+// them when computing visibility, accumulating dirty regions, and checking
+// touchable regions against window frames.
+
+#include <benchmark/benchmark.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <vector>
+
+using namespace android;
+
+namespace {
+
+const Rect kDisplay(0, 0, 1080, 2340);
+
+// A typical stack of layers, bottom to top: wallpaper, a launcher or app
+// window, a dialog, the status and navigation bars.
+const std::vector<Rect> kLayers = {
+        Rect(0, 0, 1080, 2340), Rect(0, 0, 1080, 2340), Rect(90, 800, 990, 1500),
+        Rect(0, 0, 1080, 80),   Rect(0, 2214, 1080, 2340),
+};
+
+void BM_Visibility(benchmark::State& state) {
+    for (auto _ : state) {
+        Region aboveOpaque;
+        for (auto it = kLayers.rbegin(); it != kLayers.rend(); ++it) {
+            Region visible = Region(*it).intersect(kDisplay);
+            visible.subtractSelf(aboveOpaque);
+            aboveOpaque.orSelf(visible);
+            benchmark::DoNotOptimize(visible);
+        }
+    }
+}
+BENCHMARK(BM_Visibility);
+
+void BM_DamageAccumulation(benchmark::State& state) {
+    // Full-width damage from a scrolling list, one band per frame.
+    std::vector<Rect> damage;
+    for (int y = 200; y < 2200; y += 100) {
+        damage.emplace_back(0, y, 1080, y + 100);
+    }
+    for (auto _ : state) {
+        Region dirty;
+        for (const Rect& rect : damage) {
+            dirty.orSelf(rect);
+        }
+        benchmark::DoNotOptimize(dirty);
+    }
+}
+BENCHMARK(BM_DamageAccumulation);
+
+void BM_TouchableRegion(benchmark::State& state) {
+    const Region touchable(Rect(90, 800, 990, 1500));
+    const Rect frame(0, 0, 1080, 2340);
+    for (auto _ : state) {
+        Region clipped = touchable.intersect(frame);
+        benchmark::DoNotOptimize(clipped);
+        Region outside = touchable.subtract(frame);
+        benchmark::DoNotOptimize(outside);
+    }
+}
+BENCHMARK(BM_TouchableRegion);
+
+void BM_ComplexRegionSubtract(benchmark::State& state) {
+    // A region with many bands, e.g. rounded corners approximated by rects,
+    // that no fast path applies to.
+    Region complex;
+    for (int i = 0; i < 32; i++) {
+        complex.orSelf(Rect(32 - i, i, 1048 + i, i + 1));
+    }
+    const Rect cut(0, 8, 540, 24);
+    for (auto _ : state) {
+        Region result = complex.subtract(cut);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_ComplexRegionSubtract);
+
+} // namespace
+
+BENCHMARK_MAIN();
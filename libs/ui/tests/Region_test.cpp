@@ -17,6 +17,7 @@
 #define LOG_TAG "RegionTest"
 
 #include <stdlib.h>
+#include <algorithm>
 #include <ui/Region.h>
 #include <ui/Rect.h>
 #include <gtest/gtest.h>
@@ -167,5 +168,102 @@ TEST_F(RegionTest, EqualsToSelf) {
     ASSERT_TRUE(touchableRegion.contains(50, 50));
 }
 
+TEST_F(RegionTest, EmptyOperands) {
+    const Region empty;
+    const Region rect(Rect(10, 10, 20, 20));
+
+    EXPECT_TRUE(empty.intersect(rect).isEmpty());
+    EXPECT_TRUE(rect.intersect(empty).isEmpty());
+    EXPECT_TRUE(empty.subtract(rect).isEmpty());
+    EXPECT_TRUE(rect.subtract(empty).hasSameRects(rect));
+    EXPECT_TRUE(empty.merge(rect).hasSameRects(rect));
+    EXPECT_TRUE(empty.mergeExclusive(rect).hasSameRects(rect));
+    EXPECT_TRUE(empty.merge(rect, 5, 5).hasSameRects(Region(Rect(15, 15, 25, 25))));
+    EXPECT_TRUE(empty.intersect(Rect(0, 0)).isEmpty());
+    EXPECT_EQ(Rect(0, 0), rect.intersect(Rect(0, 0)).getBounds());
+}
+
+TEST_F(RegionTest, DisjointOperands) {
+    const Region lhs(Rect(0, 0, 10, 10));
+    const Rect rhs(10, 0, 20, 10);
+
+    Region result = lhs.intersect(rhs);
+    EXPECT_TRUE(result.isEmpty());
+    EXPECT_EQ(Rect(0, 0), result.getBounds());
+    EXPECT_TRUE(lhs.subtract(rhs).hasSameRects(lhs));
+    // Rects that only touch are still merged into one.
+    EXPECT_TRUE(lhs.merge(rhs).hasSameRects(Region(Rect(0, 0, 20, 10))));
+}
+
+TEST_F(RegionTest, ContainedOperands) {
+    Region lhs(Rect(10, 10, 20, 20));
+    lhs.orSelf(Rect(30, 10, 40, 20));
+    const Rect cover(0, 0, 50, 50);
+
+    EXPECT_TRUE(lhs.intersect(cover).hasSameRects(lhs));
+    EXPECT_TRUE(lhs.subtract(cover).isEmpty());
+    EXPECT_TRUE(lhs.merge(cover).hasSameRects(Region(cover)));
+    EXPECT_TRUE(Region(cover).intersect(lhs).hasSameRects(lhs));
+    EXPECT_TRUE(Region(cover).merge(lhs).hasSameRects(Region(cover)));
+}
+
+TEST_F(RegionTest, SubtractRectCuts) {
+    const Region lhs(Rect(0, 0, 100, 100));
+
+    EXPECT_TRUE(lhs.subtract(Rect(0, 0, 100, 30)).hasSameRects(Region(Rect(0, 30, 100, 100))));
+    EXPECT_TRUE(lhs.subtract(Rect(-10, 70, 110, 120)).hasSameRects(Region(Rect(0, 0, 100, 70))));
+    EXPECT_TRUE(lhs.subtract(Rect(0, 0, 30, 100)).hasSameRects(Region(Rect(30, 0, 100, 100))));
+    EXPECT_TRUE(lhs.subtract(Rect(70, -10, 120, 110)).hasSameRects(Region(Rect(0, 0, 70, 100))));
+
+    Region expected(Rect(0, 0, 100, 30));
+    expected.orSelf(Rect(0, 70, 100, 100));
+    Region result = lhs.subtract(Rect(0, 30, 100, 70));
+    EXPECT_TRUE(result.hasSameRects(expected));
+    EXPECT_EQ(Rect(0, 0, 100, 100), result.getBounds());
+
+    expected.set(Rect(0, 0, 30, 100));
+    expected.orSelf(Rect(70, 0, 100, 100));
+    result = lhs.subtract(Rect(30, 0, 70, 100));
+    EXPECT_TRUE(result.hasSameRects(expected));
+    EXPECT_EQ(Rect(0, 0, 100, 100), result.getBounds());
+}
+
+TEST_F(RegionTest, RandomRectOperations) {
+    srandom(54321);
+
+    auto randomRect = [] {
+        const int x0 = random() % X_MAX, x1 = random() % X_MAX;
+        const int y0 = random() % Y_MAX, y1 = random() % Y_MAX;
+        return Rect(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1));
+    };
+    auto inside = [](const Rect& r, int x, int y) {
+        return x >= r.left && x < r.right && y >= r.top && y < r.bottom;
+    };
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        const Rect a = randomRect();
+        const Rect b = randomRect();
+        const Region lhs(a);
+
+        const Region results[] = {lhs.merge(b), lhs.mergeExclusive(b), lhs.intersect(b),
+                                  lhs.subtract(b)};
+        for (int x = 0; x < X_MAX; x++) {
+            for (int y = 0; y < Y_MAX; y++) {
+                const bool inA = inside(a, x, y);
+                const bool inB = inside(b, x, y);
+                EXPECT_EQ(inA || inB, results[0].contains(x, y));
+                EXPECT_EQ(inA != inB, results[1].contains(x, y));
+                EXPECT_EQ(inA && inB, results[2].contains(x, y));
+                EXPECT_EQ(inA && !inB, results[3].contains(x, y));
+            }
+        }
+        for (const Region& result : results) {
+            if (result.isEmpty()) {
+                EXPECT_EQ(Rect(0, 0), result.getBounds());
+            }
+        }
+    }
+}
+
 }; // namespace android
 
@@ -22,6 +22,8 @@
 
 #include "InputListener.h"
 
+#include "ObjectPool.h"
+
 #include <android-base/stringprintf.h>
 #include <android/log.h>
 #include <math.h>
@@ -189,6 +191,24 @@ void NotifyMotionArgs::notify(const sp<InputListenerInterface>& listener) const
     listener->notifyMotion(this);
 }
 
+// Enough for the motion events that the reader queues in one loop, and that the classifier holds.
+static constexpr size_t NOTIFY_MOTION_ARGS_POOL_CAPACITY = 16;
+
+// The pool is never destroyed, since args may be released while static objects are destroyed.
+static ObjectPool<NotifyMotionArgs>& getNotifyMotionArgsPool() {
+    static ObjectPool<NotifyMotionArgs>* const sPool =
+            new ObjectPool<NotifyMotionArgs>(NOTIFY_MOTION_ARGS_POOL_CAPACITY);
+    return *sPool;
+}
+
+void* NotifyMotionArgs::operator new(size_t size) {
+    return getNotifyMotionArgsPool().allocate(size);
+}
+
+void NotifyMotionArgs::operator delete(void* ptr, size_t size) {
+    getNotifyMotionArgsPool().release(ptr, size);
+}
+
 
 // --- NotifySwitchArgs ---
 
@@ -28,6 +28,14 @@ static const int32_t DEVICE_ID = 1;
 static const int32_t INJECTOR_PID = 999;
 static const int32_t INJECTOR_UID = 1001;
 
+// The pid / uid pair of the apps owning the overlay windows.
+static const int32_t OVERLAY_PID = 1000;
+static const int32_t OVERLAY_UID = 1002;
+
+// The size of the display the windows are laid out on.
+static const int32_t DISPLAY_WIDTH = 1080;
+static const int32_t DISPLAY_HEIGHT = 2340;
+
 static constexpr std::chrono::duration INJECT_EVENT_TIMEOUT = 5s;
 static constexpr std::chrono::nanoseconds DISPATCHING_TIMEOUT = 100ms;
 
@@ -188,6 +196,66 @@ protected:
     Rect mFrame;
 };
 
+// A window without an input channel, which is never touched, covering part of the display.
+class FakeOverlayWindowHandle : public InputWindowHandle {
+public:
+    explicit FakeOverlayWindowHandle(const Rect& frame) : mId(sNextId++), mFrame(frame) {}
+
+    virtual bool updateInfo() override {
+        mInfo.id = mId;
+        mInfo.name = "FakeOverlayWindowHandle";
+        mInfo.layoutParamsFlags = InputWindowInfo::FLAG_NOT_TOUCH_MODAL;
+        mInfo.layoutParamsType = InputWindowInfo::TYPE_SYSTEM_OVERLAY;
+        mInfo.frameLeft = mFrame.left;
+        mInfo.frameTop = mFrame.top;
+        mInfo.frameRight = mFrame.right;
+        mInfo.frameBottom = mFrame.bottom;
+        mInfo.globalScaleFactor = 1.0;
+        mInfo.touchableRegion.clear();
+        mInfo.addTouchableRegion(mFrame);
+        mInfo.visible = true;
+        mInfo.ownerPid = OVERLAY_PID;
+        mInfo.ownerUid = OVERLAY_UID;
+        mInfo.inputFeatures = InputWindowInfo::INPUT_FEATURE_NO_INPUT_CHANNEL;
+        mInfo.displayId = ADISPLAY_ID_DEFAULT;
+
+        return true;
+    }
+
+private:
+    // Overlays must have distinct ids to be distinct windows for the dispatcher.
+    static inline int32_t sNextId = 1;
+
+    const int32_t mId;
+    const Rect mFrame;
+};
+
+/**
+ * Returns the given number of overlay windows, tiling the display but leaving the point (x, y)
+ * uncovered, followed by the given window, at the bottom, which is then the window touched at
+ * (x, y).
+ */
+static std::vector<sp<InputWindowHandle>> createWindowStack(size_t overlayCount, int32_t x,
+                                                            int32_t y,
+                                                            const sp<InputWindowHandle>& window) {
+    const int32_t columns = 10;
+    const int32_t rows = static_cast<int32_t>(overlayCount / columns) + 2;
+    const int32_t width = DISPLAY_WIDTH / columns;
+    const int32_t height = DISPLAY_HEIGHT / rows;
+
+    std::vector<sp<InputWindowHandle>> windowHandles;
+    for (int32_t i = 0; windowHandles.size() < overlayCount; i++) {
+        const int32_t left = (i % columns) * width;
+        const int32_t top = (i / columns) * height;
+        const Rect frame(left, top, left + width, top + height);
+        if (x < frame.left || x >= frame.right || y < frame.top || y >= frame.bottom) {
+            windowHandles.push_back(new FakeOverlayWindowHandle(frame));
+        }
+    }
+    windowHandles.push_back(window);
+    return windowHandles;
+}
+
 static MotionEvent generateMotionEvent() {
     PointerProperties pointerProperties[1];
     PointerCoords pointerCoords[1];
@@ -241,6 +309,32 @@ static NotifyMotionArgs generateMotionArgs() {
     return args;
 }
 
+static NotifyMotionArgs generateMotionArgs(int32_t action, uint32_t pointerCount, float offset) {
+    PointerProperties pointerProperties[MAX_POINTERS];
+    PointerCoords pointerCoords[MAX_POINTERS];
+
+    for (uint32_t i = 0; i < pointerCount; i++) {
+        pointerProperties[i].clear();
+        pointerProperties[i].id = i;
+        pointerProperties[i].toolType = AMOTION_EVENT_TOOL_TYPE_FINGER;
+
+        pointerCoords[i].clear();
+        pointerCoords[i].setAxisValue(AMOTION_EVENT_AXIS_X, 20 + 30 * i + offset);
+        pointerCoords[i].setAxisValue(AMOTION_EVENT_AXIS_Y, 100 + offset);
+    }
+
+    const nsecs_t currentTime = now();
+    return NotifyMotionArgs(/* id */ 0, currentTime, DEVICE_ID, AINPUT_SOURCE_TOUCHSCREEN,
+                            ADISPLAY_ID_DEFAULT, POLICY_FLAG_PASS_TO_USER, action,
+                            /* actionButton */ 0, /* flags */ 0, AMETA_NONE, /* buttonState */ 0,
+                            MotionClassification::NONE, AMOTION_EVENT_EDGE_FLAG_NONE,
+                            pointerCount, pointerProperties, pointerCoords,
+                            /* xPrecision */ 0, /* yPrecision */ 0,
+                            AMOTION_EVENT_INVALID_CURSOR_POSITION,
+                            AMOTION_EVENT_INVALID_CURSOR_POSITION, currentTime,
+                            /* videoFrames */ {});
+}
+
 static void benchmarkNotifyMotion(benchmark::State& state) {
     // Create dispatcher
     sp<FakeInputDispatcherPolicy> fakePolicy = new FakeInputDispatcherPolicy();
@@ -310,8 +404,132 @@ static void benchmarkInjectMotion(benchmark::State& state) {
     dispatcher->stop();
 }
 
+/**
+ * Measures the dispatching of touches with many windows on the display, all above the touched
+ * window, which must be found among them, and checked for occlusion by them.
+ */
+static void benchmarkNotifyMotionManyWindows(benchmark::State& state) {
+    // Create dispatcher
+    sp<FakeInputDispatcherPolicy> fakePolicy = new FakeInputDispatcherPolicy();
+    sp<InputDispatcher> dispatcher = new InputDispatcher(fakePolicy);
+    dispatcher->setInputDispatchMode(/*enabled*/ true, /*frozen*/ false);
+    dispatcher->start();
+
+    // Create a window that will receive motion events, below the overlays
+    sp<FakeApplicationHandle> application = new FakeApplicationHandle();
+    sp<FakeWindowHandle> window = new FakeWindowHandle(application, dispatcher, "Fake Window");
+
+    NotifyMotionArgs motionArgs = generateMotionArgs();
+    const PointerCoords& coords = motionArgs.pointerCoords[0];
+    dispatcher->setInputWindows(
+            {{ADISPLAY_ID_DEFAULT,
+              createWindowStack(state.range(0), static_cast<int32_t>(coords.getX()),
+                                static_cast<int32_t>(coords.getY()), window)}});
+
+    for (auto _ : state) {
+        // Send ACTION_DOWN
+        motionArgs.action = AMOTION_EVENT_ACTION_DOWN;
+        motionArgs.id = 0;
+        motionArgs.downTime = now();
+        motionArgs.eventTime = motionArgs.downTime;
+        dispatcher->notifyMotion(&motionArgs);
+
+        // Send ACTION_UP
+        motionArgs.action = AMOTION_EVENT_ACTION_UP;
+        motionArgs.id = 1;
+        motionArgs.eventTime = now();
+        dispatcher->notifyMotion(&motionArgs);
+
+        window->consumeEvent();
+        window->consumeEvent();
+    }
+
+    dispatcher->stop();
+}
+
+/**
+ * Measures the update of many windows, as when any window of the display changes.
+ */
+static void benchmarkSetInputWindows(benchmark::State& state) {
+    sp<FakeInputDispatcherPolicy> fakePolicy = new FakeInputDispatcherPolicy();
+    sp<InputDispatcher> dispatcher = new InputDispatcher(fakePolicy);
+
+    sp<FakeApplicationHandle> application = new FakeApplicationHandle();
+    sp<FakeWindowHandle> window = new FakeWindowHandle(application, dispatcher, "Fake Window");
+    const std::unordered_map<int32_t, std::vector<sp<InputWindowHandle>>> windowHandles =
+            {{ADISPLAY_ID_DEFAULT, createWindowStack(state.range(0), 0, 0, window)}};
+
+    for (auto _ : state) {
+        dispatcher->setInputWindows(windowHandles);
+    }
+}
+
+/**
+ * Measures the latency from notifyMotion to the consumption of the event by the window, for the
+ * moves of a gesture with the given number of pointers. Also reports the heap allocations of
+ * entries per event, which are avoided once the entry pools are warm.
+ */
+static void benchmarkNotifyMotionToPublish(benchmark::State& state) {
+    const uint32_t pointerCount = static_cast<uint32_t>(state.range(0));
+
+    // Create dispatcher
+    sp<FakeInputDispatcherPolicy> fakePolicy = new FakeInputDispatcherPolicy();
+    sp<InputDispatcher> dispatcher = new InputDispatcher(fakePolicy);
+    dispatcher->setInputDispatchMode(/*enabled*/ true, /*frozen*/ false);
+    dispatcher->start();
+
+    // Create a window that will receive motion events
+    sp<FakeApplicationHandle> application = new FakeApplicationHandle();
+    sp<FakeWindowHandle> window = new FakeWindowHandle(application, dispatcher, "Fake Window");
+
+    dispatcher->setInputWindows({{ADISPLAY_ID_DEFAULT, {window}}});
+
+    int32_t id = 0;
+    NotifyMotionArgs downArgs =
+            generateMotionArgs(AMOTION_EVENT_ACTION_DOWN, pointerCount, /* offset */ 0);
+    downArgs.id = id++;
+    dispatcher->notifyMotion(&downArgs);
+    window->consumeEvent();
+
+    const ObjectPoolStats motionStatsBefore = MotionEntry::getPoolStats();
+    const ObjectPoolStats dispatchStatsBefore = DispatchEntry::getPoolStats();
+    float offset = 0;
+    for (auto _ : state) {
+        NotifyMotionArgs moveArgs =
+                generateMotionArgs(AMOTION_EVENT_ACTION_MOVE, pointerCount, offset);
+        moveArgs.id = id++;
+        moveArgs.downTime = downArgs.downTime;
+        offset = offset < 50 ? offset + 1 : 0;
+
+        const nsecs_t startTime = now();
+        dispatcher->notifyMotion(&moveArgs);
+        window->consumeEvent();
+        state.SetIterationTime((now() - startTime) / 1E9);
+    }
+    const ObjectPoolStats motionStatsAfter = MotionEntry::getPoolStats();
+    const ObjectPoolStats dispatchStatsAfter = DispatchEntry::getPoolStats();
+    state.counters["heap_allocs_per_event"] =
+            benchmark::Counter(motionStatsAfter.heapAllocations -
+                                       motionStatsBefore.heapAllocations +
+                                       dispatchStatsAfter.heapAllocations -
+                                       dispatchStatsBefore.heapAllocations,
+                               benchmark::Counter::kAvgIterations);
+
+    NotifyMotionArgs upArgs =
+            generateMotionArgs(AMOTION_EVENT_ACTION_UP, pointerCount, /* offset */ 0);
+    upArgs.id = id++;
+    upArgs.downTime = downArgs.downTime;
+    dispatcher->notifyMotion(&upArgs);
+    window->consumeEvent();
+
+    dispatcher->stop();
+}
+
 BENCHMARK(benchmarkNotifyMotion);
 BENCHMARK(benchmarkInjectMotion);
+BENCHMARK(benchmarkNotifyMotionToPublish)->Arg(1)->Arg(5)->UseManualTime();
+BENCHMARK(benchmarkNotifyMotionManyWindows)->Arg(10)->Arg(100)->Arg(250);
+BENCHMARK(benchmarkSetInputWindows)->Arg(10)->Arg(100)->Arg(250);
 
 } // namespace android::inputdispatcher
 
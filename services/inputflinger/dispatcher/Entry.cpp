@@ -28,6 +28,32 @@ using android::base::StringPrintf;
 
 namespace android::inputdispatcher {
 
+// The number of released entries of each type kept for reuse. Entries stay alive while they are
+// queued, in the recent queue, and until every connection they were dispatched to has finished
+// them, so a few dozen are in use during a fast gesture.
+static constexpr size_t KEY_ENTRY_POOL_CAPACITY = 16;
+static constexpr size_t MOTION_ENTRY_POOL_CAPACITY = 32;
+static constexpr size_t DISPATCH_ENTRY_POOL_CAPACITY = 64;
+
+// Pools are never destroyed, since entries may be released while static objects are destroyed.
+template <typename T, size_t capacity>
+static ObjectPool<T>& getPool() {
+    static ObjectPool<T>* const sPool = new ObjectPool<T>(capacity);
+    return *sPool;
+}
+
+static ObjectPool<KeyEntry>& getKeyEntryPool() {
+    return getPool<KeyEntry, KEY_ENTRY_POOL_CAPACITY>();
+}
+
+static ObjectPool<MotionEntry>& getMotionEntryPool() {
+    return getPool<MotionEntry, MOTION_ENTRY_POOL_CAPACITY>();
+}
+
+static ObjectPool<DispatchEntry>& getDispatchEntryPool() {
+    return getPool<DispatchEntry, DISPATCH_ENTRY_POOL_CAPACITY>();
+}
+
 VerifiedKeyEvent verifiedKeyEventFromKeyEntry(const KeyEntry& entry) {
     return {{VerifiedInputEvent::Type::KEY, entry.deviceId, entry.eventTime, entry.source,
              entry.displayId},
@@ -163,6 +189,18 @@ void KeyEntry::appendDescription(std::string& msg) const {
                         keyCode, scanCode, metaState, repeatCount, policyFlags);
 }
 
+void* KeyEntry::operator new(size_t size) {
+    return getKeyEntryPool().allocate(size);
+}
+
+void KeyEntry::operator delete(void* ptr, size_t size) {
+    getKeyEntryPool().release(ptr, size);
+}
+
+ObjectPoolStats KeyEntry::getPoolStats() {
+    return getKeyEntryPool().getStats();
+}
+
 void KeyEntry::recycle() {
     releaseInjectionState();
 
@@ -236,6 +274,18 @@ void MotionEntry::appendDescription(std::string& msg) const {
     msg += StringPrintf("]), policyFlags=0x%08x", policyFlags);
 }
 
+void* MotionEntry::operator new(size_t size) {
+    return getMotionEntryPool().allocate(size);
+}
+
+void MotionEntry::operator delete(void* ptr, size_t size) {
+    getMotionEntryPool().release(ptr, size);
+}
+
+ObjectPoolStats MotionEntry::getPoolStats() {
+    return getMotionEntryPool().getStats();
+}
+
 // --- DispatchEntry ---
 
 volatile int32_t DispatchEntry::sNextSeqAtomic;
@@ -261,6 +311,18 @@ DispatchEntry::~DispatchEntry() {
     eventEntry->release();
 }
 
+void* DispatchEntry::operator new(size_t size) {
+    return getDispatchEntryPool().allocate(size);
+}
+
+void DispatchEntry::operator delete(void* ptr, size_t size) {
+    getDispatchEntryPool().release(ptr, size);
+}
+
+ObjectPoolStats DispatchEntry::getPoolStats() {
+    return getDispatchEntryPool().getStats();
+}
+
 uint32_t DispatchEntry::nextSeq() {
     // Sequence number 0 is reserved and will never be returned.
     uint32_t seq;
@@ -20,6 +20,7 @@
 #include "InjectionState.h"
 #include "InputTarget.h"
 
+#include <ObjectPool.h>
 #include <input/Input.h>
 #include <input/InputApplication.h>
 #include <stdint.h>
@@ -149,6 +150,11 @@ struct KeyEntry : EventEntry {
     virtual void appendDescription(std::string& msg) const;
     void recycle();
 
+    // Key entries are allocated from a pool.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+    static ObjectPoolStats getPoolStats();
+
 protected:
     virtual ~KeyEntry();
 };
@@ -183,6 +189,11 @@ struct MotionEntry : EventEntry {
                 float xOffset, float yOffset);
     virtual void appendDescription(std::string& msg) const;
 
+    // Motion entries are allocated from a pool.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+    static ObjectPoolStats getPoolStats();
+
 protected:
     virtual ~MotionEntry();
 };
@@ -217,6 +228,11 @@ struct DispatchEntry {
 
     inline bool isSplit() const { return targetFlags & InputTarget::FLAG_SPLIT; }
 
+    // Dispatch entries are allocated from a pool.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+    static ObjectPoolStats getPoolStats();
+
 private:
     static volatile int32_t sNextSeqAtomic;
 
@@ -187,6 +187,14 @@ static bool validateMotionEvent(int32_t action, int32_t actionButton, size_t poi
     return true;
 }
 
+static void dumpObjectPoolStats(std::string& dump, const char* name,
+                                const ObjectPoolStats& stats) {
+    dump += StringPrintf(INDENT2 "%s: live=%zu, pooled=%zu, heapAllocations=%zu, "
+                                 "reusedAllocations=%zu\n",
+                         name, stats.live, stats.pooled, stats.heapAllocations,
+                         stats.reusedAllocations);
+}
+
 static void dumpRegion(std::string& dump, const Region& region) {
     if (region.isEmpty()) {
         dump += "<empty>";
@@ -807,9 +815,12 @@ sp<InputWindowHandle> InputDispatcher::findTouchedWindowAtLocked(int32_t display
         LOG_ALWAYS_FATAL(
                 "Must provide a valid touch state if adding portal windows or outside targets");
     }
-    // Traverse windows from front to back to find touched window.
-    const std::vector<sp<InputWindowHandle>> windowHandles = getWindowHandlesLocked(displayId);
-    for (const sp<InputWindowHandle>& windowHandle : windowHandles) {
+    // Traverse windows from front to back to find touched window. Only the windows that may be
+    // touched at (x, y), or that watch outside touches, need to be considered.
+    const WindowHitIndex& hitIndex = getWindowHitIndexLocked(displayId);
+    const std::vector<sp<InputWindowHandle>>& windowHandles = hitIndex.getWindowHandles();
+    for (size_t position : hitIndex.getCandidatesAt(x, y)) {
+        const sp<InputWindowHandle>& windowHandle = windowHandles[position];
         const InputWindowInfo* windowInfo = windowHandle->getInfo();
         if (windowInfo->displayId == displayId) {
             int32_t flags = windowInfo->layoutParamsFlags;
@@ -2121,13 +2132,16 @@ static bool canBeObscuredBy(const sp<InputWindowHandle>& windowHandle,
 bool InputDispatcher::isWindowObscuredAtPointLocked(const sp<InputWindowHandle>& windowHandle,
                                                     int32_t x, int32_t y) const {
     int32_t displayId = windowHandle->getInfo()->displayId;
-    const std::vector<sp<InputWindowHandle>> windowHandles = getWindowHandlesLocked(displayId);
-    for (const sp<InputWindowHandle>& otherHandle : windowHandles) {
-        if (windowHandle == otherHandle) {
+    const WindowHitIndex& hitIndex = getWindowHitIndexLocked(displayId);
+    const std::vector<sp<InputWindowHandle>>& windowHandles = hitIndex.getWindowHandles();
+    const size_t position = hitIndex.getPosition(windowHandle);
+    for (size_t otherPosition : hitIndex.getCandidatesAt(x, y)) {
+        if (otherPosition >= position) {
             break; // All future windows are below us. Exit early.
         }
+        const sp<InputWindowHandle>& otherHandle = windowHandles[otherPosition];
         const InputWindowInfo* otherInfo = otherHandle->getInfo();
-          if (canBeObscuredBy(windowHandle, otherHandle) &&
+        if (canBeObscuredBy(windowHandle, otherHandle) &&
             otherInfo->frameContainsPoint(x, y)) {
             return true;
         }
@@ -2137,13 +2151,13 @@ bool InputDispatcher::isWindowObscuredAtPointLocked(const sp<InputWindowHandle>&
 
 bool InputDispatcher::isWindowObscuredLocked(const sp<InputWindowHandle>& windowHandle) const {
     int32_t displayId = windowHandle->getInfo()->displayId;
-    const std::vector<sp<InputWindowHandle>> windowHandles = getWindowHandlesLocked(displayId);
+    const WindowHitIndex& hitIndex = getWindowHitIndexLocked(displayId);
+    const std::vector<sp<InputWindowHandle>>& windowHandles = hitIndex.getWindowHandles();
     const InputWindowInfo* windowInfo = windowHandle->getInfo();
-    for (const sp<InputWindowHandle>& otherHandle : windowHandles) {
-        if (windowHandle == otherHandle) {
-            break; // All future windows are below us. Exit early.
-        }
-
+    // All windows from this one on are below us.
+    const size_t position = hitIndex.getPosition(windowHandle);
+    for (size_t otherPosition = 0; otherPosition < position; otherPosition++) {
+        const sp<InputWindowHandle>& otherHandle = windowHandles[otherPosition];
         const InputWindowInfo* otherInfo = otherHandle->getInfo();
         if (canBeObscuredBy(windowHandle, otherHandle) &&
             otherInfo->overlaps(windowInfo)) {
@@ -3585,6 +3599,12 @@ std::vector<sp<InputWindowHandle>> InputDispatcher::getWindowHandlesLocked(
     return getValueByKey(mWindowHandlesByDisplay, displayId);
 }
 
+const WindowHitIndex& InputDispatcher::getWindowHitIndexLocked(int32_t displayId) const {
+    static const WindowHitIndex sEmptyIndex;
+    auto it = mWindowHitIndexesByDisplay.find(displayId);
+    return it != mWindowHitIndexesByDisplay.end() ? it->second : sEmptyIndex;
+}
+
 sp<InputWindowHandle> InputDispatcher::getWindowHandleLocked(
         const sp<IBinder>& windowHandleToken) const {
     if (windowHandleToken == nullptr) {
@@ -3592,7 +3612,7 @@ sp<InputWindowHandle> InputDispatcher::getWindowHandleLocked(
     }
 
     for (auto& it : mWindowHandlesByDisplay) {
-        const std::vector<sp<InputWindowHandle>> windowHandles = it.second;
+        const std::vector<sp<InputWindowHandle>>& windowHandles = it.second;
         for (const sp<InputWindowHandle>& windowHandle : windowHandles) {
             if (windowHandle->getToken() == windowHandleToken) {
                 return windowHandle;
@@ -3604,7 +3624,7 @@ sp<InputWindowHandle> InputDispatcher::getWindowHandleLocked(
 
 bool InputDispatcher::hasWindowHandleLocked(const sp<InputWindowHandle>& windowHandle) const {
     for (auto& it : mWindowHandlesByDisplay) {
-        const std::vector<sp<InputWindowHandle>> windowHandles = it.second;
+        const std::vector<sp<InputWindowHandle>>& windowHandles = it.second;
         for (const sp<InputWindowHandle>& handle : windowHandles) {
             if (handle->getId() == windowHandle->getId() &&
                 handle->getToken() == windowHandle->getToken()) {
@@ -3634,6 +3654,7 @@ void InputDispatcher::updateWindowHandlesForDisplayLocked(
     if (inputWindowHandles.empty()) {
         // Remove all handles on a display if there are no windows left.
         mWindowHandlesByDisplay.erase(displayId);
+        mWindowHitIndexesByDisplay.erase(displayId);
         return;
     }
 
@@ -3684,7 +3705,8 @@ void InputDispatcher::updateWindowHandlesForDisplayLocked(
     }
 
     // Insert or replace
-    mWindowHandlesByDisplay[displayId] = newHandles;
+    mWindowHitIndexesByDisplay[displayId].rebuild(newHandles);
+    mWindowHandlesByDisplay[displayId] = std::move(newHandles);
 }
 
 void InputDispatcher::setInputWindows(
@@ -4298,6 +4320,12 @@ void InputDispatcher::dumpDispatchStateLocked(std::string& dump) {
         dump += INDENT "AppSwitch: not pending\n";
     }
 
+    // Entries that stay live while the queues above are empty have leaked.
+    dump += INDENT "EntryPools:\n";
+    dumpObjectPoolStats(dump, "KeyEntry", KeyEntry::getPoolStats());
+    dumpObjectPoolStats(dump, "MotionEntry", MotionEntry::getPoolStats());
+    dumpObjectPoolStats(dump, "DispatchEntry", DispatchEntry::getPoolStats());
+
     dump += INDENT "Configuration:\n";
     dump += StringPrintf(INDENT2 "KeyRepeatDelay: %" PRId64 "ms\n", ns2ms(mConfig.keyRepeatDelay));
     dump += StringPrintf(INDENT2 "KeyRepeatTimeout: %" PRId64 "ms\n",
@@ -30,6 +30,7 @@
 #include "Monitor.h"
 #include "TouchState.h"
 #include "TouchedWindow.h"
+#include "WindowHitIndex.h"
 
 #include <input/Input.h>
 #include <input/InputApplication.h>
@@ -293,6 +294,8 @@ private:
 
     std::unordered_map<int32_t, std::vector<sp<InputWindowHandle>>> mWindowHandlesByDisplay
             GUARDED_BY(mLock);
+    // Spatial indexes of mWindowHandlesByDisplay, for hit tests and occlusion queries.
+    std::unordered_map<int32_t, WindowHitIndex> mWindowHitIndexesByDisplay GUARDED_BY(mLock);
     void setInputWindowsLocked(const std::vector<sp<InputWindowHandle>>& inputWindowHandles,
                                int32_t displayId) REQUIRES(mLock);
     // Get window handles by display, return an empty vector if not found.
@@ -302,6 +305,8 @@ private:
             REQUIRES(mLock);
     sp<InputChannel> getInputChannelLocked(const sp<IBinder>& windowToken) const REQUIRES(mLock);
     bool hasWindowHandleLocked(const sp<InputWindowHandle>& windowHandle) const REQUIRES(mLock);
+    // Get the spatial index of the windows of a display, which is empty if there are none.
+    const WindowHitIndex& getWindowHitIndexLocked(int32_t displayId) const REQUIRES(mLock);
 
     /*
      * Validate and update InputWindowHandles for a given display.
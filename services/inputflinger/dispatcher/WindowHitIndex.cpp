@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WindowHitIndex.h"
+
+#include <algorithm>
+
+namespace android::inputdispatcher {
+
+static Rect unionOf(const Rect& a, const Rect& b) {
+    if (a.isEmpty()) {
+        return b;
+    }
+    if (b.isEmpty()) {
+        return a;
+    }
+    return Rect(std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right),
+                std::max(a.bottom, b.bottom));
+}
+
+// Returns the number of cells, of at least minCellSize, along an axis of the given length, and
+// sets outCellSize to their size.
+static int32_t getCellCount(int64_t length, int32_t minCellSize, int32_t maxCells,
+                            int32_t* outCellSize) {
+    const int64_t count = std::clamp<int64_t>(length / minCellSize, 1, maxCells);
+    *outCellSize = static_cast<int32_t>((length + count - 1) / count);
+    return static_cast<int32_t>(count);
+}
+
+bool WindowHitIndex::isHitAnywhere(const InputWindowInfo& info) {
+    const int32_t flags = info.layoutParamsFlags;
+    const bool isTouchModal =
+            (flags & (InputWindowInfo::FLAG_NOT_FOCUSABLE | InputWindowInfo::FLAG_NOT_TOUCH_MODAL)) ==
+            0;
+    return (isTouchModal && !(flags & InputWindowInfo::FLAG_NOT_TOUCHABLE)) ||
+            (flags & InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH);
+}
+
+Rect WindowHitIndex::getHitBounds(const InputWindowInfo& info) {
+    const Rect frame(info.frameLeft, info.frameTop, info.frameRight, info.frameBottom);
+    return unionOf(frame, info.touchableRegion.getBounds());
+}
+
+void WindowHitIndex::clear() {
+    mWindowHandles.clear();
+    mPositions.clear();
+    mBounds = Rect::EMPTY_RECT;
+    mColumns = 0;
+    mRows = 0;
+    mCells.clear();
+    mHitAnywhere.clear();
+}
+
+void WindowHitIndex::rebuild(const std::vector<sp<InputWindowHandle>>& windowHandles) {
+    clear();
+    mWindowHandles = windowHandles;
+
+    std::vector<Rect> hitBounds(mWindowHandles.size(), Rect::EMPTY_RECT);
+    for (size_t i = 0; i < mWindowHandles.size(); i++) {
+        mPositions.emplace(mWindowHandles[i].get(), i);
+        const InputWindowInfo* info = mWindowHandles[i]->getInfo();
+        // Invisible windows are neither touched nor obscure other windows.
+        if (!info->visible) {
+            continue;
+        }
+        if (isHitAnywhere(*info)) {
+            mHitAnywhere.push_back(i);
+            continue;
+        }
+        hitBounds[i] = getHitBounds(*info);
+        mBounds = unionOf(mBounds, hitBounds[i]);
+    }
+    if (mBounds.isEmpty()) {
+        return;
+    }
+
+    mColumns = getCellCount(int64_t(mBounds.right) - mBounds.left, kMinCellSize, kMaxCellsPerAxis,
+                            &mCellWidth);
+    mRows = getCellCount(int64_t(mBounds.bottom) - mBounds.top, kMinCellSize, kMaxCellsPerAxis,
+                         &mCellHeight);
+    mCells.resize(mColumns * mRows);
+
+    // Windows are added front to back, so that each cell is sorted. The windows hit anywhere are
+    // merged in, since they must keep their place in the z order.
+    auto hitAnywhere = mHitAnywhere.begin();
+    for (size_t i = 0; i < mWindowHandles.size(); i++) {
+        if (hitAnywhere != mHitAnywhere.end() && *hitAnywhere == i) {
+            for (std::vector<size_t>& cell : mCells) {
+                cell.push_back(i);
+            }
+            hitAnywhere++;
+            continue;
+        }
+        const Rect& bounds = hitBounds[i];
+        if (bounds.isEmpty()) {
+            continue;
+        }
+        const int32_t lastRow = getRow(bounds.bottom - 1);
+        const int32_t lastColumn = getColumn(bounds.right - 1);
+        for (int32_t row = getRow(bounds.top); row <= lastRow; row++) {
+            for (int32_t column = getColumn(bounds.left); column <= lastColumn; column++) {
+                mCells[row * mColumns + column].push_back(i);
+            }
+        }
+    }
+}
+
+int32_t WindowHitIndex::getColumn(int32_t x) const {
+    return static_cast<int32_t>((int64_t(x) - mBounds.left) / mCellWidth);
+}
+
+int32_t WindowHitIndex::getRow(int32_t y) const {
+    return static_cast<int32_t>((int64_t(y) - mBounds.top) / mCellHeight);
+}
+
+const std::vector<size_t>& WindowHitIndex::getCandidatesAt(int32_t x, int32_t y) const {
+    if (x < mBounds.left || x >= mBounds.right || y < mBounds.top || y >= mBounds.bottom) {
+        return mHitAnywhere;
+    }
+    return mCells[getRow(y) * mColumns + getColumn(x)];
+}
+
+size_t WindowHitIndex::getPosition(const sp<InputWindowHandle>& windowHandle) const {
+    auto it = mPositions.find(windowHandle.get());
+    return it != mPositions.end() ? it->second : mWindowHandles.size();
+}
+
+} // namespace android::inputdispatcher
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UI_INPUT_INPUTDISPATCHER_WINDOWHITINDEX_H
+#define _UI_INPUT_INPUTDISPATCHER_WINDOWHITINDEX_H
+
+#include <input/InputWindow.h>
+#include <ui/Rect.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace android::inputdispatcher {
+
+/**
+ * A spatial index over the windows of a display, to find the windows that may be touched or
+ * obscure a point without walking through all of them.
+ *
+ * The bounds of the windows are split into a grid. Each cell lists, front to back, the visible
+ * windows whose frame or touchable region overlaps it, which are the only ones that can contain a
+ * point of the cell. The visible windows that may be touched anywhere, because they are touch
+ * modal, or that watch outside touches, are listed in every cell, and outside of the grid.
+ *
+ * The index is a snapshot of the window handles and their info: it must be rebuilt whenever they
+ * are updated.
+ */
+class WindowHitIndex {
+public:
+    void rebuild(const std::vector<sp<InputWindowHandle>>& windowHandles);
+    void clear();
+
+    // Returns the indexed windows, front to back.
+    const std::vector<sp<InputWindowHandle>>& getWindowHandles() const { return mWindowHandles; }
+
+    // Returns the positions in getWindowHandles(), in increasing order, of the windows that may
+    // contain (x, y), or may be touched at (x, y).
+    const std::vector<size_t>& getCandidatesAt(int32_t x, int32_t y) const;
+
+    // Returns the position of windowHandle in getWindowHandles(), or the number of windows if it
+    // is not indexed. Either way, the windows above it are those at lower positions.
+    size_t getPosition(const sp<InputWindowHandle>& windowHandle) const;
+
+private:
+    // The number of cells along each axis is at most kMaxCellsPerAxis, and is reduced so that
+    // cells are at least kMinCellSize pixels wide and high.
+    static constexpr int32_t kMaxCellsPerAxis = 16;
+    static constexpr int32_t kMinCellSize = 64;
+
+    // Whether the window must be listed in every cell.
+    static bool isHitAnywhere(const InputWindowInfo& info);
+    // Returns the bounds of the points at which the window may be touched or obscure others.
+    static Rect getHitBounds(const InputWindowInfo& info);
+
+    int32_t getColumn(int32_t x) const;
+    int32_t getRow(int32_t y) const;
+
+    std::vector<sp<InputWindowHandle>> mWindowHandles;
+    std::unordered_map<const InputWindowHandle*, size_t> mPositions;
+
+    Rect mBounds;
+    int32_t mColumns = 0;
+    int32_t mRows = 0;
+    int32_t mCellWidth = 0;
+    int32_t mCellHeight = 0;
+    // The cells, row by row.
+    std::vector<std::vector<size_t>> mCells;
+    // The candidates outside of the grid, and of every cell.
+    std::vector<size_t> mHitAnywhere;
+};
+
+} // namespace android::inputdispatcher
+
+#endif // _UI_INPUT_INPUTDISPATCHER_WINDOWHITINDEX_H
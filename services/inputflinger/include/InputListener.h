@@ -139,6 +139,10 @@ struct NotifyMotionArgs : public NotifyArgs {
     bool operator==(const NotifyMotionArgs& rhs) const;
 
     virtual void notify(const sp<InputListenerInterface>& listener) const;
+
+    // Motion args are queued at the rate of the touchscreen, so their copies are pooled.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
 };
 
 
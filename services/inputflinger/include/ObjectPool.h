@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UI_INPUT_OBJECT_POOL_H
+#define _UI_INPUT_OBJECT_POOL_H
+
+#include <android-base/thread_annotations.h>
+#include <stddef.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace android {
+
+struct ObjectPoolStats {
+    // Objects allocated from the pool and not yet released.
+    size_t live;
+    // Released storage, kept to allocate the next objects.
+    size_t pooled;
+    // Allocations that had to fall back to the heap.
+    size_t heapAllocations;
+    // Allocations that reused pooled storage.
+    size_t reusedAllocations;
+};
+
+/**
+ * Recycles the storage of objects of type T, which are allocated and released at a high rate by
+ * the input pipeline, to avoid a heap allocation for each of them. Classes use it by forwarding
+ * their operator new and operator delete to a pool, so that their users are unaffected.
+ *
+ * At most 'capacity' released objects are kept: beyond that, storage is returned to the heap.
+ * Objects of classes derived from T, which are larger, always come from the heap.
+ *
+ * The pool is thread-safe, since objects are often allocated and released on different threads.
+ */
+template <typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(size_t capacity) : mCapacity(capacity) { mFree.reserve(capacity); }
+
+    ~ObjectPool() {
+        for (void* ptr : mFree) {
+            ::operator delete(ptr);
+        }
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    void* allocate(size_t size) {
+        if (size == sizeof(T)) {
+            std::scoped_lock _l(mLock);
+            mLive++;
+            if (!mFree.empty()) {
+                void* ptr = mFree.back();
+                mFree.pop_back();
+                mReusedAllocations++;
+                return ptr;
+            }
+            mHeapAllocations++;
+        }
+        return ::operator new(size);
+    }
+
+    void release(void* ptr, size_t size) {
+        if (ptr == nullptr) {
+            return;
+        }
+        if (size == sizeof(T)) {
+            std::scoped_lock _l(mLock);
+            mLive--;
+            if (mFree.size() < mCapacity) {
+                mFree.push_back(ptr);
+                return;
+            }
+        }
+        ::operator delete(ptr);
+    }
+
+    ObjectPoolStats getStats() const {
+        std::scoped_lock _l(mLock);
+        return {mLive, mFree.size(), mHeapAllocations, mReusedAllocations};
+    }
+
+private:
+    const size_t mCapacity;
+
+    mutable std::mutex mLock;
+    std::vector<void*> mFree GUARDED_BY(mLock);
+    size_t mLive GUARDED_BY(mLock) = 0;
+    size_t mHeapAllocations GUARDED_BY(mLock) = 0;
+    size_t mReusedAllocations GUARDED_BY(mLock) = 0;
+};
+
+} // namespace android
+
+#endif // _UI_INPUT_OBJECT_POOL_H
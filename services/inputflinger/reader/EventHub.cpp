@@ -51,6 +51,11 @@
 
 #include <linux/vt.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
 /* this macro is used to tell if "bit" is set in "array"
  * it selects a byte from the array, and does a boolean AND
  * operation with a byte that only has the relevant bit set.
@@ -75,10 +80,45 @@ static const char* DEVICE_PATH = "/dev/input";
 // v4l2 devices go directly into /dev
 static const char* VIDEO_DEVICE_PATH = "/dev";
 
+// Maximum number of threads, including the calling one, that open and probe devices at once.
+static constexpr size_t MAX_PROBE_THREADS = 4;
+
 static inline const char* toString(bool value) {
     return value ? "true" : "false";
 }
 
+/**
+ * Call work(i) for each i in [0, count), on up to MAX_PROBE_THREADS threads including the
+ * calling one, and return once all of them have returned.
+ */
+static void runInParallel(size_t count, const std::function<void(size_t)>& work) {
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(count, MAX_PROBE_THREADS); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+static status_t loadPropertyMap(const std::string& path,
+                                std::shared_ptr<const PropertyMap>* outMap) {
+    PropertyMap* map;
+    status_t status = PropertyMap::load(String8(path.c_str()), &map);
+    if (status) {
+        return status;
+    }
+    outMap->reset(map);
+    return OK;
+}
+
 static std::string sha1(const std::string& in) {
     SHA_CTX ctx;
     SHA1_Init(&ctx);
@@ -194,6 +234,8 @@ EventHub::Device::Device(int fd, int32_t id, const std::string& path,
         ffEffectPlaying(false),
         ffEffectId(-1),
         controllerNumber(0),
+        readBufferStart(0),
+        readBufferEnd(0),
         enabled(true),
         isVirtual(fd < 0) {
     memset(keyBitmask, 0, sizeof(keyBitmask));
@@ -813,37 +855,19 @@ EventHub::Device* EventHub::getDeviceLocked(int32_t deviceId) const {
 }
 
 EventHub::Device* EventHub::getDeviceByPathLocked(const char* devicePath) const {
-    for (size_t i = 0; i < mDevices.size(); i++) {
-        Device* device = mDevices.valueAt(i);
-        if (device->path == devicePath) {
-            return device;
-        }
-    }
-    return nullptr;
+    auto it = mDevicesByPath.find(devicePath);
+    return it != mDevicesByPath.end() ? it->second : nullptr;
 }
 
 /**
  * The file descriptor could be either input device, or a video device (associated with a
- * specific input device). Check both cases here, and return the device that this event
- * belongs to. Caller can compare the fd's once more to determine event type.
- * Looks through all input devices, and only attached video devices. Unattached video
- * devices are ignored.
+ * specific input device). Both are mapped to the device that their events belong to when they
+ * are registered for epoll. Caller can compare the fd's once more to determine event type.
+ * Unattached video devices are not mapped, because they should not participate in epoll.
  */
 EventHub::Device* EventHub::getDeviceByFdLocked(int fd) const {
-    for (size_t i = 0; i < mDevices.size(); i++) {
-        Device* device = mDevices.valueAt(i);
-        if (device->fd == fd) {
-            // This is an input device event
-            return device;
-        }
-        if (device->videoDevice && device->videoDevice->getFd() == fd) {
-            // This is a video device event
-            return device;
-        }
-    }
-    // We do not check mUnattachedVideoDevices here because they should not participate in epoll,
-    // and therefore should never be looked up by fd.
-    return nullptr;
+    auto it = mDevicesByFd.find(fd);
+    return it != mDevicesByFd.end() ? it->second : nullptr;
 }
 
 size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSize) {
@@ -851,8 +875,6 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
 
     AutoMutex _l(mLock);
 
-    struct input_event readBuffer[bufferSize];
-
     RawEvent* event = buffer;
     size_t capacity = bufferSize;
     bool awoken = false;
@@ -984,47 +1006,44 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
             }
             // This must be an input event
             if (eventItem.events & EPOLLIN) {
-                int32_t readSize =
-                        read(device->fd, readBuffer, sizeof(struct input_event) * capacity);
-                if (readSize == 0 || (readSize < 0 && errno == ENODEV)) {
-                    // Device was removed before INotify noticed.
-                    ALOGW("could not get event, removed? (fd: %d size: %" PRId32
-                          " bufferSize: %zu capacity: %zu errno: %d)\n",
-                          device->fd, readSize, bufferSize, capacity, errno);
+                if (device->readBufferStart == device->readBufferEnd &&
+                    drainDeviceLocked(device) == DEAD_OBJECT &&
+                    device->readBufferStart == device->readBufferEnd) {
+                    // Device was removed before INotify noticed. Had events been read before the
+                    // removal, they would be returned first, and the device closed when epoll
+                    // reports it again.
+                    ALOGW("could not get event, removed? (fd: %d bufferSize: %zu capacity: %zu "
+                          "errno: %d)\n",
+                          device->fd, bufferSize, capacity, errno);
                     deviceChanged = true;
                     closeDeviceLocked(device);
-                } else if (readSize < 0) {
-                    if (errno != EAGAIN && errno != EINTR) {
-                        ALOGW("could not get event (errno=%d)", errno);
-                    }
-                } else if ((readSize % sizeof(struct input_event)) != 0) {
-                    ALOGE("could not get event (wrong size: %d)", readSize);
-                } else {
+                    continue;
+                }
 #ifdef CONSOLE_MANAGER
-                    if (vs.v_active != ANDROID_VT) {
-                        ALOGV("Skip a non Android VT event");
-                        continue;
-                    }
+                if (vs.v_active != ANDROID_VT) {
+                    ALOGV("Skip a non Android VT event");
+                    device->readBufferStart = device->readBufferEnd;
+                    continue;
+                }
 #endif
-                    int32_t deviceId = device->id == mBuiltInKeyboardId ? 0 : device->id;
-
-                    size_t count = size_t(readSize) / sizeof(struct input_event);
-                    for (size_t i = 0; i < count; i++) {
-                        struct input_event& iev = readBuffer[i];
-                        event->when = processEventTimestamp(iev);
-                        event->deviceId = deviceId;
-                        event->type = iev.type;
-                        event->code = iev.code;
-                        event->value = iev.value;
-                        event += 1;
-                        capacity -= 1;
-                    }
-                    if (capacity == 0) {
-                        // The result buffer is full.  Reset the pending event index
-                        // so we will try to read the device again on the next iteration.
-                        mPendingEventIndex -= 1;
-                        break;
-                    }
+                int32_t deviceId = device->id == mBuiltInKeyboardId ? 0 : device->id;
+
+                while (device->readBufferStart < device->readBufferEnd && capacity > 0) {
+                    const struct input_event& iev = device->readBuffer[device->readBufferStart++];
+                    event->when = processEventTimestamp(iev);
+                    event->deviceId = deviceId;
+                    event->type = iev.type;
+                    event->code = iev.code;
+                    event->value = iev.value;
+                    event += 1;
+                    capacity -= 1;
+                }
+                if (capacity == 0) {
+                    // The result buffer is full.  Reset the pending event index
+                    // so we will return the rest of the events read from the device,
+                    // and try to read it again, on the next iteration.
+                    mPendingEventIndex -= 1;
+                    break;
                 }
             } else if (eventItem.events & EPOLLHUP) {
                 ALOGI("Removing device %s due to epoll hang-up event.",
@@ -1092,8 +1111,21 @@ size_t EventHub::getEvents(int timeoutMillis, RawEvent* buffer, size_t bufferSiz
                 usleep(100000);
             }
         } else {
-            // Some events occurred.
+            // Some events occurred. Drain all the ready devices before handling any of them,
+            // so that the events of one device do not wait in the kernel while those of another
+            // are returned.
             mPendingEventCount = size_t(pollResult);
+            for (size_t i = 0; i < mPendingEventCount; i++) {
+                const struct epoll_event& eventItem = mPendingEventItems[i];
+                if (!(eventItem.events & EPOLLIN)) {
+                    continue;
+                }
+                Device* device = getDeviceByFdLocked(eventItem.data.fd);
+                if (device && eventItem.data.fd == device->fd &&
+                    device->readBufferStart == device->readBufferEnd) {
+                    drainDeviceLocked(device);
+                }
+            }
         }
     }
 
@@ -1194,21 +1226,32 @@ status_t EventHub::registerDeviceForEpollLocked(Device* device) {
         ALOGE("Could not add input device fd to epoll for device %" PRId32, device->id);
         return result;
     }
+    if (device->readBuffer.empty()) {
+        device->readBuffer.resize(DEVICE_READ_BUFFER_SIZE);
+    }
+    mDevicesByFd[device->fd] = device;
     if (device->videoDevice) {
-        registerVideoDeviceForEpollLocked(*device->videoDevice);
+        registerVideoDeviceForEpollLocked(device);
     }
     return result;
 }
 
-void EventHub::registerVideoDeviceForEpollLocked(const TouchVideoDevice& videoDevice) {
+void EventHub::registerVideoDeviceForEpollLocked(Device* device) {
+    const TouchVideoDevice& videoDevice = *device->videoDevice;
     status_t result = registerFdForEpoll(videoDevice.getFd());
     if (result != OK) {
         ALOGE("Could not add video device %s to epoll", videoDevice.getName().c_str());
+        return;
     }
+    mDevicesByFd[videoDevice.getFd()] = device;
 }
 
 status_t EventHub::unregisterDeviceFromEpollLocked(Device* device) {
     if (device->hasValidFd()) {
+        // Events read from the device but not yet returned are dropped along with it.
+        mDevicesByFd.erase(device->fd);
+        device->readBufferStart = 0;
+        device->readBufferEnd = 0;
         status_t result = unregisterFdFromEpoll(device->fd);
         if (result != OK) {
             ALOGW("Could not remove input device fd from epoll for device %" PRId32, device->id);
@@ -1223,6 +1266,7 @@ status_t EventHub::unregisterDeviceFromEpollLocked(Device* device) {
 
 void EventHub::unregisterVideoDeviceFromEpollLocked(const TouchVideoDevice& videoDevice) {
     if (videoDevice.hasValidFd()) {
+        mDevicesByFd.erase(videoDevice.getFd());
         status_t result = unregisterFdFromEpoll(videoDevice.getFd());
         if (result != OK) {
             ALOGW("Could not remove video device fd from epoll for device: %s",
@@ -1231,31 +1275,69 @@ void EventHub::unregisterVideoDeviceFromEpollLocked(const TouchVideoDevice& vide
     }
 }
 
-status_t EventHub::openDeviceLocked(const char *devicePath) {
-    return openDeviceLocked(devicePath, false);
-}
+/**
+ * Open the devices at the given paths, other than those already opened. Devices are opened and
+ * probed in parallel, since that involves many ioctls and parsing their configuration files,
+ * then added in path order.
+ */
+void EventHub::openDevicesLocked(const std::vector<std::string>& devicePaths) {
+    std::vector<std::string> paths;
+    for (const std::string& devicePath : devicePaths) {
+        if (getDeviceByPathLocked(devicePath.c_str()) != nullptr ||
+            std::find(paths.begin(), paths.end(), devicePath) != paths.end()) {
+            ALOGV("Ignoring device '%s' that has already been opened.", devicePath.c_str());
+            continue;
+        }
+        paths.push_back(devicePath);
+    }
+    // The paths come in directory or inotify order; sort them so that the device ids, and the
+    // descriptor nonces of identical devices, do not depend on it.
+    std::sort(paths.begin(), paths.end());
 
-status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOpened) {
-    char buffer[80];
+    std::vector<int> fds(paths.size(), -1);
+    std::vector<InputDeviceIdentifier> identifiers(paths.size());
+    runInParallel(paths.size(),
+                  [&](size_t i) { fds[i] = openDeviceNode(paths[i], &identifiers[i]); });
 
-    if (ignoreAlreadyOpened && (getDeviceByPathLocked(devicePath) != 0)) {
-        ALOGV("Ignoring device '%s' that has already been opened.", devicePath);
-        return 0;
+    // Allocate the devices.  (The device objects take ownership of the fds at this point.)
+    std::vector<Device*> devices;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (fds[i] >= 0) {
+            devices.push_back(new Device(fds[i], mNextDeviceId++, paths[i], identifiers[i]));
+        }
     }
 
-    ALOGV("Opening device: %s", devicePath);
+    runInParallel(devices.size(), [&](size_t i) { probeDevice(devices[i]); });
 
-    int fd = open(devicePath, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    for (Device* device : devices) {
+        addProbedDeviceLocked(device);
+    }
+}
+
+/**
+ * Open the device node and get its identifier, except for its descriptor.
+ * Returns the fd, or -1 if the device should not be opened.
+ * This runs on a worker thread that does not own mLock, while the thread that does waits for it.
+ * It must only touch the device node and its identifier, and read state that does not change
+ * while mLock is held.
+ */
+int EventHub::openDeviceNode(const std::string& devicePath,
+                             InputDeviceIdentifier* outIdentifier) const {
+    char buffer[80];
+
+    ALOGV("Opening device: %s", devicePath.c_str());
+
+    int fd = open(devicePath.c_str(), O_RDWR | O_CLOEXEC | O_NONBLOCK);
     if (fd < 0) {
-        ALOGE("could not open %s, %s\n", devicePath, strerror(errno));
+        ALOGE("could not open %s, %s\n", devicePath.c_str(), strerror(errno));
         return -1;
     }
 
-    InputDeviceIdentifier identifier;
+    InputDeviceIdentifier& identifier = *outIdentifier;
 
     // Get device name.
     if (ioctl(fd, EVIOCGNAME(sizeof(buffer) - 1), &buffer) < 1) {
-        ALOGE("Could not get device name for %s: %s", devicePath, strerror(errno));
+        ALOGE("Could not get device name for %s: %s", devicePath.c_str(), strerror(errno));
     } else {
         buffer[sizeof(buffer) - 1] = '\0';
         identifier.name = buffer;
@@ -1265,7 +1347,7 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
     for (size_t i = 0; i < mExcludedDevices.size(); i++) {
         const std::string& item = mExcludedDevices[i];
         if (identifier.name == item) {
-            ALOGI("ignoring event id %s driver %s\n", devicePath, item.c_str());
+            ALOGI("ignoring event id %s driver %s\n", devicePath.c_str(), item.c_str());
             close(fd);
             return -1;
         }
@@ -1274,7 +1356,7 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
     // Get device driver version.
     int driverVersion;
     if (ioctl(fd, EVIOCGVERSION, &driverVersion)) {
-        ALOGE("could not get driver version for %s, %s\n", devicePath, strerror(errno));
+        ALOGE("could not get driver version for %s, %s\n", devicePath.c_str(), strerror(errno));
         close(fd);
         return -1;
     }
@@ -1282,7 +1364,7 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
     // Get device identifier.
     struct input_id inputId;
     if (ioctl(fd, EVIOCGID, &inputId)) {
-        ALOGE("could not get device input id for %s, %s\n", devicePath, strerror(errno));
+        ALOGE("could not get device input id for %s, %s\n", devicePath.c_str(), strerror(errno));
         close(fd);
         return -1;
     }
@@ -1307,37 +1389,29 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
         identifier.uniqueId = buffer;
     }
 
-    // Fill in the descriptor.
-    assignDescriptorLocked(identifier);
-
-    // Allocate device.  (The device object takes ownership of the fd at this point.)
-    int32_t deviceId = mNextDeviceId++;
-    Device* device = new Device(fd, deviceId, devicePath, identifier);
-
-    ALOGV("add device %d: %s\n", deviceId, devicePath);
-    ALOGV("  bus:        %04x\n"
-          "  vendor      %04x\n"
-          "  product     %04x\n"
-          "  version     %04x\n",
-          identifier.bus, identifier.vendor, identifier.product, identifier.version);
-    ALOGV("  name:       \"%s\"\n", identifier.name.c_str());
-    ALOGV("  location:   \"%s\"\n", identifier.location.c_str());
-    ALOGV("  unique id:  \"%s\"\n", identifier.uniqueId.c_str());
-    ALOGV("  descriptor: \"%s\"\n", identifier.descriptor.c_str());
     ALOGV("  driver:     v%d.%d.%d\n", driverVersion >> 16, (driverVersion >> 8) & 0xff,
           driverVersion & 0xff);
+    return fd;
+}
 
+/**
+ * Load the configuration and key maps of the device, and figure out its classes.
+ * This runs on a worker thread that does not own mLock, like openDeviceNode. It must only touch
+ * the given device, which is not yet visible to other threads. The *Locked helpers it calls only
+ * do that too, apart from mConfigurationCache, which is thread-safe.
+ */
+void EventHub::probeDevice(Device* device) {
     // Load the configuration file for the device.
     loadConfigurationLocked(device);
 
     // Figure out the kinds of events the device reports.
-    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
-    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
-    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
-    ioctl(fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
-    ioctl(fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
-    ioctl(fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
-    ioctl(fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
+    ioctl(device->fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
 
     // See if this is a keyboard.  Ignore everything in the button range except for
     // joystick and gamepad buttons which are handled like keyboards for the most part.
@@ -1438,20 +1512,13 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
 
     // Load the key map.
     // We need to do this for joysticks too because the key layout may specify axes.
-    status_t keyMapStatus = NAME_NOT_FOUND;
     if (device->classes & (INPUT_DEVICE_CLASS_KEYBOARD | INPUT_DEVICE_CLASS_JOYSTICK)) {
         // Load the keymap for the device.
-        keyMapStatus = loadKeyMapLocked(device);
+        loadKeyMapLocked(device);
     }
 
     // Configure the keyboard, gamepad or virtual keyboard.
     if (device->classes & INPUT_DEVICE_CLASS_KEYBOARD) {
-        // Register the keyboard as a built-in keyboard if it is eligible.
-        if (!keyMapStatus && mBuiltInKeyboardId == NO_BUILT_IN_KEYBOARD &&
-            isEligibleBuiltInKeyboard(device->identifier, device->configuration, &device->keyMap)) {
-            mBuiltInKeyboardId = device->id;
-        }
-
         // 'Q' key support = cheap test of whether this is an alpha-capable kbd
         if (hasKeycodeLocked(device, AKEYCODE_Q)) {
             if ((device->identifier.name != "AT Translated Set 2 keyboard") ||
@@ -1478,14 +1545,6 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
         }
     }
 
-    // If the device isn't recognized as something we handle, don't monitor it.
-    if (device->classes == 0) {
-        ALOGV("Dropping device: id=%d, path='%s', name='%s'", deviceId, devicePath,
-              device->identifier.name.c_str());
-        delete device;
-        return -1;
-    }
-
     // Determine whether the device has a mic.
     if (deviceHasMicLocked(device)) {
         device->classes |= INPUT_DEVICE_CLASS_MIC;
@@ -1495,6 +1554,46 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
     if (isExternalDeviceLocked(device)) {
         device->classes |= INPUT_DEVICE_CLASS_EXTERNAL;
     }
+}
+
+/**
+ * Add a device that has been probed, unless it isn't recognized as something we handle, in which
+ * case it is deleted.
+ */
+void EventHub::addProbedDeviceLocked(Device* device) {
+    const int32_t deviceId = device->id;
+    const char* devicePath = device->path.c_str();
+
+    // If the device isn't recognized as something we handle, don't monitor it.
+    if (device->classes == 0) {
+        ALOGV("Dropping device: id=%d, path='%s', name='%s'", deviceId, devicePath,
+              device->identifier.name.c_str());
+        delete device;
+        return;
+    }
+
+    // Fill in the descriptor, which must be unique among the devices that have been added.
+    assignDescriptorLocked(device->identifier);
+
+    ALOGV("add device %d: %s\n", deviceId, devicePath);
+    ALOGV("  bus:        %04x\n"
+          "  vendor      %04x\n"
+          "  product     %04x\n"
+          "  version     %04x\n",
+          device->identifier.bus, device->identifier.vendor, device->identifier.product,
+          device->identifier.version);
+    ALOGV("  name:       \"%s\"\n", device->identifier.name.c_str());
+    ALOGV("  location:   \"%s\"\n", device->identifier.location.c_str());
+    ALOGV("  unique id:  \"%s\"\n", device->identifier.uniqueId.c_str());
+    ALOGV("  descriptor: \"%s\"\n", device->identifier.descriptor.c_str());
+
+    // Register the keyboard as a built-in keyboard if it is eligible, which requires its key map
+    // to have been loaded.
+    if ((device->classes & INPUT_DEVICE_CLASS_KEYBOARD) && device->keyMap.isComplete() &&
+        mBuiltInKeyboardId == NO_BUILT_IN_KEYBOARD &&
+        isEligibleBuiltInKeyboard(device->identifier, device->configuration, &device->keyMap)) {
+        mBuiltInKeyboardId = device->id;
+    }
 
     if (device->classes & (INPUT_DEVICE_CLASS_JOYSTICK | INPUT_DEVICE_CLASS_DPAD) &&
         device->classes & INPUT_DEVICE_CLASS_GAMEPAD) {
@@ -1519,19 +1618,18 @@ status_t EventHub::openDeviceLocked(const char *devicePath, bool ignoreAlreadyOp
 
     if (registerDeviceForEpollLocked(device) != OK) {
         delete device;
-        return -1;
+        return;
     }
 
     configureFd(device);
 
     ALOGI("New device: id=%d, fd=%d, path='%s', name='%s', classes=0x%x, "
           "configuration='%s', keyLayout='%s', keyCharacterMap='%s', builtinKeyboard=%s, ",
-          deviceId, fd, devicePath, device->identifier.name.c_str(), device->classes,
+          deviceId, device->fd, devicePath, device->identifier.name.c_str(), device->classes,
           device->configurationFile.c_str(), device->keyMap.keyLayoutFile.c_str(),
           device->keyMap.keyCharacterMapFile.c_str(), toString(mBuiltInKeyboardId == deviceId));
 
     addDeviceLocked(device);
-    return OK;
 }
 
 void EventHub::configureFd(Device* device) {
@@ -1566,7 +1664,7 @@ void EventHub::openVideoDeviceLocked(const std::string& devicePath) {
         if (videoDevice->getName() == device->identifier.name) {
             device->videoDevice = std::move(videoDevice);
             if (device->enabled) {
-                registerVideoDeviceForEpollLocked(*device->videoDevice);
+                registerVideoDeviceForEpollLocked(device);
             }
             return;
         }
@@ -1642,6 +1740,7 @@ void EventHub::createVirtualKeyboardLocked() {
 
 void EventHub::addDeviceLocked(Device* device) {
     mDevices.add(device->id, device);
+    mDevicesByPath[device->path] = device;
     device->next = mOpeningDevices;
     mOpeningDevices = device;
 }
@@ -1653,12 +1752,15 @@ void EventHub::loadConfigurationLocked(Device* device) {
         ALOGD("No input device configuration file found for device '%s'.",
               device->identifier.name.c_str());
     } else {
-        status_t status = PropertyMap::load(String8(device->configurationFile.c_str()),
-                                            &device->configuration);
+        std::shared_ptr<const PropertyMap> configuration;
+        status_t status = mConfigurationCache.load(device->configurationFile, loadPropertyMap,
+                                                   &configuration);
         if (status) {
             ALOGE("Error loading input device configuration file for device '%s'.  "
                   "Using default configuration.",
                   device->identifier.name.c_str());
+        } else {
+            device->configuration = new PropertyMap(*configuration);
         }
     }
 }
@@ -1818,6 +1920,10 @@ void EventHub::closeDeviceLocked(Device* device) {
     releaseControllerNumberLocked(device);
 
     mDevices.removeItem(device->id);
+    auto it = mDevicesByPath.find(device->path);
+    if (it != mDevicesByPath.end() && it->second == device) {
+        mDevicesByPath.erase(it);
+    }
     device->close();
 
     // Unlink for opening devices list if it is present.
@@ -1850,6 +1956,42 @@ void EventHub::closeDeviceLocked(Device* device) {
     }
 }
 
+/**
+ * Read all the events queued by the kernel for the device into its read buffer, or as many as
+ * fit. Evdev returns as many whole events as it has queued, so a short read means that the device
+ * has been drained. Returns DEAD_OBJECT if the device was removed, in which case the events read
+ * before the removal are kept.
+ */
+status_t EventHub::drainDeviceLocked(Device* device) {
+    device->readBufferStart = 0;
+    device->readBufferEnd = 0;
+    const size_t bufferSize = device->readBuffer.size();
+    while (device->readBufferEnd < bufferSize) {
+        const size_t requestedSize =
+                sizeof(struct input_event) * (bufferSize - device->readBufferEnd);
+        ssize_t readSize =
+                read(device->fd, &device->readBuffer[device->readBufferEnd], requestedSize);
+        if (readSize == 0 || (readSize < 0 && errno == ENODEV)) {
+            return DEAD_OBJECT;
+        }
+        if (readSize < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ALOGW("could not get event (errno=%d)", errno);
+            }
+            break;
+        }
+        if ((readSize % sizeof(struct input_event)) != 0) {
+            ALOGE("could not get event (wrong size: %zd)", readSize);
+            break;
+        }
+        device->readBufferEnd += size_t(readSize) / sizeof(struct input_event);
+        if (size_t(readSize) < requestedSize) {
+            break;
+        }
+    }
+    return OK;
+}
+
 status_t EventHub::readNotifyLocked() {
     int res;
     char event_buf[512];
@@ -1865,14 +2007,21 @@ status_t EventHub::readNotifyLocked() {
         return -1;
     }
 
+    // The devices created by a burst of events, such as when a hub is plugged in, are opened
+    // together.
+    std::vector<std::string> createdDevicePaths;
     while (res >= (int)sizeof(*event)) {
         event = (struct inotify_event*)(event_buf + event_pos);
         if (event->len) {
             if (event->wd == mInputWd) {
                 std::string filename = StringPrintf("%s/%s", DEVICE_PATH, event->name);
                 if (event->mask & IN_CREATE) {
-                    openDeviceLocked(filename.c_str(), true);
+                    createdDevicePaths.push_back(filename);
                 } else {
+                    // Open the devices created before this one was removed, in case it was one
+                    // of them.
+                    openDevicesLocked(createdDevicePaths);
+                    createdDevicePaths.clear();
                     ALOGI("Removing device '%s' due to inotify event\n", filename.c_str());
                     closeDeviceByPathLocked(filename.c_str());
                 }
@@ -1894,6 +2043,7 @@ status_t EventHub::readNotifyLocked() {
         res -= event_size;
         event_pos += event_size;
     }
+    openDevicesLocked(createdDevicePaths);
     return 0;
 }
 
@@ -1907,14 +2057,16 @@ status_t EventHub::scanDirLocked(const char* dirname) {
     strcpy(devname, dirname);
     filename = devname + strlen(devname);
     *filename++ = '/';
+    std::vector<std::string> devicePaths;
     while ((de = readdir(dir))) {
         if (de->d_name[0] == '.' &&
             (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
             continue;
         strcpy(filename, de->d_name);
-        openDeviceLocked(devname);
+        devicePaths.push_back(devname);
     }
     closedir(dir);
+    openDevicesLocked(devicePaths);
     return 0;
 }
 
@@ -17,6 +17,8 @@
 #ifndef _RUNTIME_EVENT_HUB_H
 #define _RUNTIME_EVENT_HUB_H
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <input/Input.h>
@@ -24,6 +26,7 @@
 #include <input/KeyCharacterMap.h>
 #include <input/KeyLayoutMap.h>
 #include <input/Keyboard.h>
+#include <input/ParsedFileCache.h>
 #include <input/VirtualKeyMap.h>
 #include <utils/BitSet.h>
 #include <utils/Errors.h>
@@ -326,7 +329,7 @@ private:
         int fd; // may be -1 if device is closed
         const int32_t id;
         const std::string path;
-        const InputDeviceIdentifier identifier;
+        InputDeviceIdentifier identifier; // the descriptor is assigned when the device is added
 
         std::unique_ptr<TouchVideoDevice> videoDevice;
 
@@ -353,6 +356,13 @@ private:
 
         int32_t controllerNumber;
 
+        // Events read from fd, but not yet returned by getEvents, are those in
+        // [readBufferStart, readBufferEnd). The buffer is allocated when the device is first
+        // registered for epoll, so that draining the device does not allocate.
+        std::vector<struct input_event> readBuffer;
+        size_t readBufferStart;
+        size_t readBufferEnd;
+
         Device(int fd, int32_t id, const std::string& path,
                const InputDeviceIdentifier& identifier);
         ~Device();
@@ -373,8 +383,11 @@ private:
         }
     };
 
-    status_t openDeviceLocked(const char* devicePath);
-    status_t openDeviceLocked(const char *devicePath, bool ignoreAlreadyOpened);
+    void openDevicesLocked(const std::vector<std::string>& devicePaths);
+    // Run on worker threads during openDevicesLocked, without owning mLock.
+    int openDeviceNode(const std::string& devicePath, InputDeviceIdentifier* outIdentifier) const;
+    void probeDevice(Device* device);
+    void addProbedDeviceLocked(Device* device);
     void openVideoDeviceLocked(const std::string& devicePath);
     void createVirtualKeyboardLocked();
     void addDeviceLocked(Device* device);
@@ -393,7 +406,7 @@ private:
     status_t registerFdForEpoll(int fd);
     status_t unregisterFdFromEpoll(int fd);
     status_t registerDeviceForEpollLocked(Device* device);
-    void registerVideoDeviceForEpollLocked(const TouchVideoDevice& videoDevice);
+    void registerVideoDeviceForEpollLocked(Device* device);
     status_t unregisterDeviceFromEpollLocked(Device* device);
     void unregisterVideoDeviceFromEpollLocked(const TouchVideoDevice& videoDevice);
 
@@ -401,13 +414,14 @@ private:
     status_t scanVideoDirLocked(const std::string& dirname);
     void scanDevicesLocked();
     status_t readNotifyLocked();
+    status_t drainDeviceLocked(Device* device);
 
     Device* getDeviceByDescriptorLocked(const std::string& descriptor) const;
     Device* getDeviceLocked(int32_t deviceId) const;
     Device* getDeviceByPathLocked(const char* devicePath) const;
     /**
-     * Look through all available fd's (both for input devices and for video devices),
-     * and return the device pointer.
+     * Look up the fd among those registered for epoll (both for input devices and for video
+     * devices), and return the device pointer.
      */
     Device* getDeviceByFdLocked(int fd) const;
 
@@ -444,6 +458,10 @@ private:
     BitSet32 mControllerNumbers;
 
     KeyedVector<int32_t, Device*> mDevices;
+    // The open devices, by path.
+    std::unordered_map<std::string, Device*> mDevicesByPath;
+    // The devices registered for epoll, by the fd of the input device and of its video device.
+    std::unordered_map<int, Device*> mDevicesByFd;
     /**
      * Video devices that report touchscreen heatmap, but have not (yet) been paired
      * with a specific input device. Video device discovery is independent from input device
@@ -461,6 +479,10 @@ private:
     bool mNeedToScanDevices;
     std::vector<std::string> mExcludedDevices;
 
+    // The input device configuration files that have been loaded, shared by the devices that use
+    // the same file.
+    ParsedFileCache<std::shared_ptr<const PropertyMap>> mConfigurationCache;
+
     int mEpollFd;
     int mINotifyFd;
     int mWakeReadPipeFd;
@@ -469,6 +491,9 @@ private:
     int mInputWd;
     int mVideoWd;
 
+    // Maximum number of input_events read from a device before they are returned by getEvents.
+    static const size_t DEVICE_READ_BUFFER_SIZE = 256;
+
     // Maximum number of signalled FDs to handle at a time.
     static const int EPOLL_MAX_EVENTS = 16;
 
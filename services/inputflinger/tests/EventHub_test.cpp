@@ -23,6 +23,7 @@
 #include <linux/uinput.h>
 #include <log/log.h>
 #include <chrono>
+#include <set>
 
 #define TAG "EventHub_test"
 
@@ -84,6 +85,11 @@ protected:
      */
     int32_t waitForDeviceCreation();
     void waitForDeviceClose(int32_t deviceId);
+    /**
+     * Wait for the given number of devices to be added or removed, and return their ids.
+     * The changes may be reported across several device scans.
+     */
+    std::set<int32_t> waitForDeviceChanges(int32_t type, size_t deviceCount);
     void consumeInitialDeviceAddedEvents();
     void assertNoMoreEvents();
     /**
@@ -174,6 +180,30 @@ void EventHubTest::waitForDeviceClose(int32_t deviceId) {
               finishedDeviceScanEvent.type);
 }
 
+std::set<int32_t> EventHubTest::waitForDeviceChanges(int32_t type, size_t deviceCount) {
+    std::set<int32_t> deviceIds;
+    bool finishedDeviceScan = false;
+    while (deviceIds.size() < deviceCount || !finishedDeviceScan) {
+        std::vector<RawEvent> events = getEvents(1);
+        if (events.empty()) {
+            ADD_FAILURE() << "Only " << deviceIds.size() << " of " << deviceCount
+                          << " devices changed";
+            break;
+        }
+        for (const RawEvent& event : events) {
+            if (event.type == EventHubInterface::FINISHED_DEVICE_SCAN) {
+                finishedDeviceScan = true;
+                continue;
+            }
+            EXPECT_EQ(type, event.type);
+            EXPECT_TRUE(deviceIds.insert(event.deviceId).second)
+                    << "Device " << event.deviceId << " reported twice";
+            finishedDeviceScan = false;
+        }
+    }
+    return deviceIds;
+}
+
 void EventHubTest::assertNoMoreEvents() {
     std::vector<RawEvent> events = getEvents();
     ASSERT_TRUE(events.empty());
@@ -199,3 +229,76 @@ TEST_F(EventHubTest, InputEvent_TimestampIsMonotonic) {
         lastEventTime = event.when; // Ensure all returned events are monotonic
     }
 }
+
+/**
+ * Ensure that the events read from a device are all returned, in order, when they do not fit
+ * in the buffer passed to getEvents.
+ */
+TEST_F(EventHubTest, InputEvent_SmallBuffer_AllEventsReturnedInOrder) {
+    static constexpr size_t KEY_PRESS_COUNT = 8;
+    for (size_t i = 0; i < KEY_PRESS_COUNT; i++) {
+        ASSERT_NO_FATAL_FAILURE(mKeyboard->pressAndReleaseHomeKey());
+    }
+
+    static constexpr size_t EVENT_COUNT = 4 * KEY_PRESS_COUNT;
+    std::array<RawEvent, 3> eventBuffer;
+    std::vector<RawEvent> events;
+    while (events.size() < EVENT_COUNT) {
+        const size_t count =
+                mEventHub->getEvents(std::chrono::milliseconds(2s).count(), eventBuffer.data(),
+                                     eventBuffer.size());
+        ASSERT_GT(count, 0U) << "Received " << events.size() << " of " << EVENT_COUNT << " events";
+        events.insert(events.end(), eventBuffer.begin(), eventBuffer.begin() + count);
+    }
+    ASSERT_EQ(EVENT_COUNT, events.size());
+
+    for (size_t i = 0; i < events.size(); i++) {
+        const RawEvent& event = events[i];
+        EXPECT_EQ(mDeviceId, event.deviceId);
+        if (i % 2 == 0) {
+            EXPECT_EQ(EV_KEY, event.type);
+            EXPECT_EQ(KEY_HOME, event.code);
+            EXPECT_EQ(i % 4 == 0 ? 1 : 0, event.value);
+        } else {
+            EXPECT_EQ(EV_SYN, event.type);
+            EXPECT_EQ(SYN_REPORT, event.code);
+        }
+        if (i > 0) {
+            EXPECT_LE(events[i - 1].when, event.when);
+        }
+    }
+}
+
+/**
+ * Ensure that devices created together, which EventHub opens as one batch, are all added, and get
+ * unique descriptors even though they are identical.
+ */
+TEST_F(EventHubTest, DevicesCreatedTogether_AllAddedWithUniqueDescriptors) {
+    static constexpr size_t DEVICE_COUNT = 4;
+    std::vector<std::unique_ptr<UinputHomeKey>> keyboards;
+    for (size_t i = 0; i < DEVICE_COUNT; i++) {
+        keyboards.push_back(createUinputDevice<UinputHomeKey>());
+    }
+
+    std::set<int32_t> deviceIds;
+    ASSERT_NO_FATAL_FAILURE(
+            deviceIds = waitForDeviceChanges(EventHubInterface::DEVICE_ADDED, DEVICE_COUNT));
+    ASSERT_EQ(DEVICE_COUNT, deviceIds.size());
+    EXPECT_EQ(0U, deviceIds.count(mDeviceId));
+
+    std::set<std::string> descriptors;
+    descriptors.insert(mEventHub->getDeviceIdentifier(mDeviceId).descriptor);
+    for (int32_t deviceId : deviceIds) {
+        const InputDeviceIdentifier identifier = mEventHub->getDeviceIdentifier(deviceId);
+        EXPECT_EQ(mKeyboard->getName(), identifier.name);
+        EXPECT_TRUE(descriptors.insert(identifier.descriptor).second)
+                << "Device " << deviceId << " has a duplicate descriptor";
+    }
+
+    keyboards.clear();
+    std::set<int32_t> removedDeviceIds;
+    ASSERT_NO_FATAL_FAILURE(
+            removedDeviceIds =
+                    waitForDeviceChanges(EventHubInterface::DEVICE_REMOVED, DEVICE_COUNT));
+    EXPECT_EQ(deviceIds, removedDeviceIds);
+}
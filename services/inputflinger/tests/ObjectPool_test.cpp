@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../include/ObjectPool.h"
+
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace android {
+
+struct PooledObject {
+    int64_t values[4];
+};
+
+// --- ObjectPoolTest ---
+
+/**
+ * Released storage is reused by the next allocation.
+ */
+TEST(ObjectPoolTest, AllocateAfterRelease_ReusesStorage) {
+    ObjectPool<PooledObject> pool(2);
+
+    void* first = pool.allocate(sizeof(PooledObject));
+    pool.release(first, sizeof(PooledObject));
+    void* second = pool.allocate(sizeof(PooledObject));
+
+    ASSERT_EQ(first, second);
+    ObjectPoolStats stats = pool.getStats();
+    ASSERT_EQ(1u, stats.live);
+    ASSERT_EQ(0u, stats.pooled);
+    ASSERT_EQ(1u, stats.heapAllocations);
+    ASSERT_EQ(1u, stats.reusedAllocations);
+
+    pool.release(second, sizeof(PooledObject));
+}
+
+/**
+ * No more than 'capacity' released objects are kept.
+ */
+TEST(ObjectPoolTest, Release_KeepsAtMostCapacity) {
+    constexpr size_t capacity = 2;
+    ObjectPool<PooledObject> pool(capacity);
+
+    std::vector<void*> objects;
+    for (size_t i = 0; i < capacity + 3; i++) {
+        objects.push_back(pool.allocate(sizeof(PooledObject)));
+    }
+    ASSERT_EQ(capacity + 3, pool.getStats().live);
+
+    for (void* object : objects) {
+        pool.release(object, sizeof(PooledObject));
+    }
+    ObjectPoolStats stats = pool.getStats();
+    ASSERT_EQ(0u, stats.live);
+    ASSERT_EQ(capacity, stats.pooled);
+}
+
+/**
+ * Objects of another size, such as those of derived classes, are not pooled.
+ */
+TEST(ObjectPoolTest, OtherSize_NotPooled) {
+    ObjectPool<PooledObject> pool(2);
+
+    void* object = pool.allocate(sizeof(PooledObject) * 2);
+    ASSERT_EQ(0u, pool.getStats().live);
+    pool.release(object, sizeof(PooledObject) * 2);
+
+    ObjectPoolStats stats = pool.getStats();
+    ASSERT_EQ(0u, stats.pooled);
+    ASSERT_EQ(0u, stats.heapAllocations);
+}
+
+/**
+ * Objects can be allocated and released concurrently, as when an entry is allocated on the reader
+ * thread and released on the dispatcher thread.
+ */
+TEST(ObjectPoolTest, ConcurrentAllocateAndRelease_AllReleased) {
+    constexpr size_t count = 10000;
+    ObjectPool<PooledObject> pool(8);
+
+    auto allocateAndRelease = [&pool]() {
+        for (size_t i = 0; i < count; i++) {
+            PooledObject* object =
+                    static_cast<PooledObject*>(pool.allocate(sizeof(PooledObject)));
+            object->values[0] = i;
+            pool.release(object, sizeof(PooledObject));
+        }
+    };
+    std::thread thread(allocateAndRelease);
+    allocateAndRelease();
+    thread.join();
+
+    ObjectPoolStats stats = pool.getStats();
+    ASSERT_EQ(0u, stats.live);
+    ASSERT_EQ(2 * count, stats.heapAllocations + stats.reusedAllocations);
+}
+
+} // namespace android
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../dispatcher/WindowHitIndex.h"
+
+#include <gtest/gtest.h>
+
+namespace android::inputdispatcher {
+
+class FakeWindowHandle : public InputWindowHandle {
+public:
+    FakeWindowHandle(const Rect& frame, int32_t flags) {
+        mInfo.frameLeft = frame.left;
+        mInfo.frameTop = frame.top;
+        mInfo.frameRight = frame.right;
+        mInfo.frameBottom = frame.bottom;
+        mInfo.touchableRegion.clear();
+        mInfo.addTouchableRegion(frame);
+        mInfo.layoutParamsFlags = flags;
+        mInfo.visible = true;
+    }
+
+    bool updateInfo() override { return true; }
+
+    void setVisible(bool visible) { mInfo.visible = visible; }
+};
+
+static sp<FakeWindowHandle> createWindow(const Rect& frame,
+                                         int32_t flags = InputWindowInfo::FLAG_NOT_TOUCH_MODAL) {
+    return new FakeWindowHandle(frame, flags);
+}
+
+// --- WindowHitIndexTest ---
+
+TEST(WindowHitIndexTest, Empty_NoCandidates) {
+    WindowHitIndex index;
+    index.rebuild({});
+
+    ASSERT_TRUE(index.getCandidatesAt(0, 0).empty());
+    ASSERT_TRUE(index.getWindowHandles().empty());
+}
+
+TEST(WindowHitIndexTest, DisjointWindows_OnlyWindowAtPointIsCandidate) {
+    sp<FakeWindowHandle> left = createWindow(Rect(0, 0, 500, 1000));
+    sp<FakeWindowHandle> right = createWindow(Rect(500, 0, 1000, 1000));
+    WindowHitIndex index;
+    index.rebuild({left, right});
+
+    ASSERT_EQ(std::vector<size_t>{0}, index.getCandidatesAt(100, 100));
+    ASSERT_EQ(std::vector<size_t>{1}, index.getCandidatesAt(900, 900));
+    ASSERT_TRUE(index.getCandidatesAt(1500, 100).empty());
+}
+
+TEST(WindowHitIndexTest, OverlappingWindows_CandidatesAreFrontToBack) {
+    sp<FakeWindowHandle> top = createWindow(Rect(100, 100, 300, 300));
+    sp<FakeWindowHandle> middle = createWindow(Rect(0, 0, 1000, 1000));
+    sp<FakeWindowHandle> bottom = createWindow(Rect(200, 200, 400, 400));
+    WindowHitIndex index;
+    index.rebuild({top, middle, bottom});
+
+    const std::vector<size_t>& candidates = index.getCandidatesAt(250, 250);
+    ASSERT_EQ((std::vector<size_t>{0, 1, 2}), candidates);
+    ASSERT_EQ(2u, index.getPosition(bottom));
+}
+
+TEST(WindowHitIndexTest, TouchModalWindow_CandidateEverywhere) {
+    sp<FakeWindowHandle> window = createWindow(Rect(0, 0, 100, 100));
+    sp<FakeWindowHandle> modalWindow = createWindow(Rect(0, 0, 100, 100), 0 /*flags*/);
+    WindowHitIndex index;
+    index.rebuild({window, modalWindow});
+
+    ASSERT_EQ((std::vector<size_t>{0, 1}), index.getCandidatesAt(50, 50));
+    ASSERT_EQ(std::vector<size_t>{1}, index.getCandidatesAt(5000, 5000));
+}
+
+TEST(WindowHitIndexTest, WatchOutsideTouchWindow_CandidateEverywhere) {
+    sp<FakeWindowHandle> window =
+            createWindow(Rect(0, 0, 100, 100),
+                         InputWindowInfo::FLAG_NOT_TOUCH_MODAL |
+                                 InputWindowInfo::FLAG_WATCH_OUTSIDE_TOUCH);
+    sp<FakeWindowHandle> other = createWindow(Rect(1000, 1000, 1100, 1100));
+    WindowHitIndex index;
+    index.rebuild({window, other});
+
+    ASSERT_EQ((std::vector<size_t>{0, 1}), index.getCandidatesAt(1050, 1050));
+}
+
+TEST(WindowHitIndexTest, InvisibleWindow_NotCandidate) {
+    sp<FakeWindowHandle> window = createWindow(Rect(0, 0, 100, 100));
+    window->setVisible(false);
+    WindowHitIndex index;
+    index.rebuild({window});
+
+    ASSERT_TRUE(index.getCandidatesAt(50, 50).empty());
+    ASSERT_EQ(0u, index.getPosition(window));
+}
+
+TEST(WindowHitIndexTest, UnknownWindow_PositionIsWindowCount) {
+    sp<FakeWindowHandle> window = createWindow(Rect(0, 0, 100, 100));
+    WindowHitIndex index;
+    index.rebuild({window});
+
+    ASSERT_EQ(1u, index.getPosition(createWindow(Rect(0, 0, 100, 100))));
+}
+
+/**
+ * The candidates at every point must include all the windows that contain the point, for a grid
+ * of many cells.
+ */
+TEST(WindowHitIndexTest, ManyWindows_CandidatesContainAllWindowsAtPoint) {
+    std::vector<sp<InputWindowHandle>> windows;
+    for (int32_t i = 0; i < 100; i++) {
+        const int32_t left = (i % 10) * 100 - 50;
+        const int32_t top = (i / 10) * 200 - 50;
+        windows.push_back(createWindow(Rect(left, top, left + 250, top + 300)));
+    }
+    WindowHitIndex index;
+    index.rebuild(windows);
+
+    for (int32_t y = -100; y < 2200; y += 37) {
+        for (int32_t x = -100; x < 1100; x += 29) {
+            std::vector<size_t> expected;
+            for (size_t i = 0; i < windows.size(); i++) {
+                if (windows[i]->getInfo()->frameContainsPoint(x, y)) {
+                    expected.push_back(i);
+                }
+            }
+            std::vector<size_t> actual;
+            for (size_t i : index.getCandidatesAt(x, y)) {
+                if (windows[i]->getInfo()->frameContainsPoint(x, y)) {
+                    actual.push_back(i);
+                }
+            }
+            ASSERT_EQ(expected, actual) << "at (" << x << ", " << y << ")";
+        }
+    }
+}
+
+} // namespace android::inputdispatcher
@@ -79,6 +79,11 @@ struct CompositionRefreshArgs {
 
     // If set, causes the dirty regions to flash with the delay
     std::optional<std::chrono::microseconds> devOptFlashDirtyRegionsDelay;
+
+    // If true, the composition state of the outputs is computed concurrently
+    // when there is more than one output. Everything that talks to HWC or
+    // RenderEngine still runs on the calling thread, one output at a time.
+    bool updateOutputsConcurrently{false};
 };
 
 } // namespace android::compositionengine
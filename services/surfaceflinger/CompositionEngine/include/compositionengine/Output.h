@@ -176,6 +176,10 @@ public:
     // Sets the output color mode
     virtual void setColorProfile(const ColorProfile&) = 0;
 
+    // Enables (or disables) flattening runs of layers that do not change into
+    // a single buffer presented by the HWC
+    virtual void setLayerCachingEnabled(bool) = 0;
+
     // Outputs a string with a state dump
     virtual void dump(std::string&) const = 0;
 
@@ -248,6 +252,17 @@ public:
     // Presents the output, finalizing all composition details
     virtual void present(const CompositionRefreshArgs&) = 0;
 
+    // present() broken into steps, so that CompositionEngine can compute the
+    // composition state of several outputs concurrently. Calling
+    // updateColorProfile, updateCompositionState and presentUpdatedState in
+    // that order is equivalent to calling present(). Only
+    // updateCompositionState may run off the main thread: it only touches
+    // state owned by this output and its output layers, and never calls into
+    // HWC or RenderEngine.
+    virtual void updateColorProfile(const CompositionRefreshArgs&) = 0;
+    virtual void updateCompositionState(const CompositionRefreshArgs&) = 0;
+    virtual void presentUpdatedState(const CompositionRefreshArgs&) = 0;
+
     // Latches the front-end layer state for each output layer
     virtual void updateLayerStateFromFE(const CompositionRefreshArgs&) const = 0;
 
@@ -262,7 +277,6 @@ protected:
 
     virtual void updateAndWriteCompositionState(const CompositionRefreshArgs&) = 0;
     virtual void setColorTransform(const CompositionRefreshArgs&) = 0;
-    virtual void updateColorProfile(const CompositionRefreshArgs&) = 0;
     virtual void beginFrame() = 0;
     virtual void prepareFrame() = 0;
     virtual void devOptRepaintFlash(const CompositionRefreshArgs&) = 0;
@@ -57,11 +57,18 @@ public:
     void setNeedsAnotherUpdateForTest(bool);
 
 private:
+    // A small pool of threads used to compute the composition state of
+    // several outputs concurrently. Only defined in CompositionEngine.cpp.
+    class OutputWorkerPool;
+
+    void presentOutputsConcurrently(CompositionRefreshArgs& args);
+
     std::unique_ptr<HWComposer> mHwComposer;
     std::unique_ptr<renderengine::RenderEngine> mRenderEngine;
     std::shared_ptr<TimeStats> mTimeStats;
     bool mNeedsAnotherUpdate = false;
     nsecs_t mRefreshStartTime = 0;
+    std::unique_ptr<OutputWorkerPool> mOutputWorkers;
 };
 
 std::unique_ptr<compositionengine::CompositionEngine> createCompositionEngine();
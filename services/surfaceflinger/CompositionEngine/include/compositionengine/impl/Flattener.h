@@ -0,0 +1,177 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <compositionengine/LayerFE.h>
+#include <compositionengine/LayerFECompositionState.h>
+#include <math/vec4.h>
+#include <renderengine/DisplaySettings.h>
+#include <ui/Fence.h>
+#include <ui/FloatRect.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/GraphicTypes.h>
+#include <ui/Rect.h>
+#include <ui/Region.h>
+#include <ui/Size.h>
+
+namespace android {
+
+namespace renderengine {
+class RenderEngine;
+} // namespace renderengine
+
+namespace compositionengine {
+
+class OutputLayer;
+
+namespace impl {
+
+struct OutputCompositionState;
+
+// The Flattener collapses runs of layers that have not changed for a while
+// into a single buffer. Once such a run is found, its layers are rendered once
+// through RenderEngine into a cached buffer. From then on, the bottom layer of
+// the run presents the cached buffer to the HWC in place of its own content,
+// and the other layers of the run are hidden, so that a static stack (e.g. the
+// wallpaper under the status and navigation bars) costs a single HWC layer and
+// no GPU work per frame. As soon as any layer of the run changes, the run is
+// re-expanded and its layers are composed individually again.
+//
+// Only layers the HWC composes by itself, and whose content RenderEngine draws
+// exactly as the HWC would, are flattened: secure, protected, HDR, color
+// transformed and blurred layers never are.
+class Flattener {
+public:
+    // The number of consecutive frames a layer must be unchanged for before it
+    // can be flattened.
+    static constexpr uint32_t kUnchangedFrameThreshold = 60;
+
+    // The minimum number of adjacent layers worth flattening.
+    static constexpr size_t kMinLayersPerRun = 2;
+
+    // The maximum number of runs flattened at once on an output.
+    static constexpr size_t kMaxRuns = 2;
+
+    // Tracks |layers|, ordered by Z, for this frame: runs with a layer that
+    // changed are re-expanded, and new runs of unchanged layers are started.
+    // The override state of every layer is updated to match. Must be called
+    // once the layers' composition state is up to date, and before it is
+    // written to the HWC.
+    void plan(const std::vector<compositionengine::OutputLayer*>& layers,
+              const OutputCompositionState& outputState);
+
+    // Renders at most one started run into its cached buffer, which is used
+    // from the next frame on. |layers| must be the same as given to plan().
+    void renderCachedSets(const std::vector<compositionengine::OutputLayer*>& layers,
+                          const OutputCompositionState& outputState,
+                          renderengine::RenderEngine& renderEngine,
+                          const renderengine::DisplaySettings& displaySettings,
+                          const ui::Size& bufferSize);
+
+    // Re-expands every run, clearing the override state of |layers|.
+    void reset(const std::vector<compositionengine::OutputLayer*>& layers);
+
+    void dump(std::string& out) const;
+
+private:
+    // The state of a layer that, if different from the previous frame, means
+    // the layer changed.
+    struct LayerSnapshot {
+        const LayerFE* layerFE{nullptr};
+        const GraphicBuffer* buffer{nullptr};
+        const Fence* acquireFence{nullptr};
+        hal::Composition compositionType{hal::Composition::INVALID};
+        half4 color;
+        float alpha{1.f};
+        hal::BlendMode blendMode{hal::BlendMode::INVALID};
+        ui::Dataspace dataspace{ui::Dataspace::UNKNOWN};
+        Rect displayFrame;
+        FloatRect sourceCrop;
+        hal::Transform bufferTransform{static_cast<hal::Transform>(0)};
+        uint32_t z{0};
+        Region outputSpaceVisibleRegion;
+
+        bool operator==(const LayerSnapshot&) const;
+        bool operator!=(const LayerSnapshot& other) const { return !(*this == other); }
+    };
+
+    struct LayerHistory {
+        LayerSnapshot snapshot;
+        uint32_t framesUnchanged{0};
+        bool flattenable{false};
+    };
+
+    // A run of adjacent layers, and the buffer it is flattened into.
+    struct CachedSet {
+        // The layers of the run, ordered by Z. Only compared against the
+        // current layers, as they may have been destroyed since.
+        std::vector<const compositionengine::OutputLayer*> layers;
+        sp<GraphicBuffer> buffer;
+        sp<Fence> drawFence;
+        Rect displayFrame;
+        Region visibleRegion;
+        ui::Dataspace dataspace{ui::Dataspace::UNKNOWN};
+        // Whether the buffer has been presented yet, so that the HWC only
+        // needs to read it in full the first time.
+        bool presented{false};
+    };
+
+    // The parts of the output state a cached buffer depends on.
+    struct OutputKey {
+        Rect sourceClip;
+        Rect destinationClip;
+        uint32_t orientation{0};
+        ui::Dataspace dataspace{ui::Dataspace::UNKNOWN};
+
+        bool operator==(const OutputKey&) const;
+        bool operator!=(const OutputKey& other) const { return !(*this == other); }
+    };
+
+    static LayerSnapshot getSnapshot(const compositionengine::OutputLayer&);
+    static bool isFlattenable(const compositionengine::OutputLayer&);
+
+    // Returns the position of the first layer of |set| in |layers|, if all its
+    // layers are still there, adjacent and unchanged.
+    std::optional<size_t> findUnchangedSet(
+            const CachedSet& set, const std::vector<compositionengine::OutputLayer*>& layers) const;
+    void startNewSets(const std::vector<compositionengine::OutputLayer*>& layers);
+    // Drops |setIt| and clears the override state of its layers.
+    std::vector<CachedSet>::iterator expandSet(
+            std::vector<CachedSet>::iterator setIt,
+            const std::vector<compositionengine::OutputLayer*>& layers);
+    void applyOverride(CachedSet& set,
+                       const std::vector<compositionengine::OutputLayer*>& layers, size_t first);
+    static void clearOverride(compositionengine::OutputLayer&);
+
+    OutputKey mOutputKey;
+    std::unordered_map<const compositionengine::OutputLayer*, LayerHistory> mLayerHistory;
+    std::vector<CachedSet> mSets;
+
+    // Statistics for dumpsys.
+    uint64_t mRenderedSetCount{0};
+    uint64_t mExpandedSetCount{0};
+};
+
+} // namespace impl
+} // namespace compositionengine
+} // namespace android
@@ -47,6 +47,11 @@ namespace compositionengine::impl {
 // use HWComposerBufferCache to mirror the cache in SF.
 class HwcBufferCache {
 public:
+    // The slot the buffer of a flattened run of layers is cached in. It comes
+    // after every BufferQueue slot, so a producer can never evict it, and HWC
+    // layers are created with room for it (see kMaxLayerBufferCount).
+    static constexpr uint32_t FLATTENER_CACHING_SLOT = BufferQueue::NUM_BUFFER_SLOTS;
+
     HwcBufferCache();
     // Given a buffer, return the HWC cache slot and
     // buffer to be sent to HWC.
@@ -56,11 +61,18 @@ public:
     void getHwcBuffer(int slot, const sp<GraphicBuffer>& buffer, uint32_t* outSlot,
                       sp<GraphicBuffer>* outBuffer);
 
+    // Same as getHwcBuffer, for the buffer of a flattened run of layers,
+    // which is always cached in FLATTENER_CACHING_SLOT.
+    void getOverrideHwcBuffer(const sp<GraphicBuffer>& buffer, uint32_t* outSlot,
+                              sp<GraphicBuffer>* outBuffer);
+
 private:
+    void updateSlot(uint32_t slot, const sp<GraphicBuffer>& buffer, sp<GraphicBuffer>* outBuffer);
+
     // an array where the index corresponds to a slot and the value corresponds to a (counter,
     // buffer) pair. "counter" is a unique value that indicates the last time this slot was updated
     // or used and allows us to keep track of the least-recently used buffer.
-    wp<GraphicBuffer> mBuffers[BufferQueue::NUM_BUFFER_SLOTS];
+    wp<GraphicBuffer> mBuffers[BufferQueue::NUM_BUFFER_SLOTS + 1];
 };
 
 } // namespace compositionengine::impl
@@ -19,9 +19,11 @@
 #include <compositionengine/CompositionEngine.h>
 #include <compositionengine/Output.h>
 #include <compositionengine/impl/ClientCompositionRequestCache.h>
+#include <compositionengine/impl/Flattener.h>
 #include <compositionengine/impl/OutputCompositionState.h>
 #include <renderengine/DisplaySettings.h>
 #include <renderengine/LayerSettings.h>
+#include <ui/FloatRect.h>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -46,6 +48,7 @@ public:
 
     void setColorTransform(const compositionengine::CompositionRefreshArgs&) override;
     void setColorProfile(const ColorProfile&) override;
+    void setLayerCachingEnabled(bool) override;
 
     void dump(std::string&) const override;
 
@@ -68,6 +71,8 @@ public:
 
     void prepare(const CompositionRefreshArgs&, LayerFESet&) override;
     void present(const CompositionRefreshArgs&) override;
+    void updateCompositionState(const CompositionRefreshArgs&) override;
+    void presentUpdatedState(const CompositionRefreshArgs&) override;
 
     void rebuildLayerStacks(const CompositionRefreshArgs&, LayerFESet&) override;
     void collectVisibleLayers(const CompositionRefreshArgs&,
@@ -116,7 +121,59 @@ protected:
     virtual void dumpState(std::string& out) const = 0;
 
 private:
+    // The inputs of the visibility computation for one layer, besides the
+    // coverage of the layers above it.
+    struct VisibilityInputs {
+        bool belongsInOutput{false};
+        bool isVisible{false};
+        bool isOpaque{false};
+        ui::Transform transform;
+        FloatRect bounds;
+        float shadowRadius{0.f};
+        Region transparentRegionHint;
+
+        bool operator==(const VisibilityInputs&) const;
+    };
+
+    // The result of the visibility computation for one layer, cached in the
+    // order the layers were last processed (front to back) so that it can be
+    // reused while the layers above it are unchanged. See
+    // ensureOutputLayerIfVisible.
+    struct VisibilityCacheEntry {
+        wp<compositionengine::LayerFE> layerFE;
+        VisibilityInputs inputs;
+        bool hasOutputLayer{false};
+        Region visibleRegion;
+        Region visibleNonTransparentRegion;
+        Region coveredRegion;
+        Region outputSpaceVisibleRegion;
+        Region shadowRegion;
+        // The coverage of the output once this layer has been processed.
+        Region aboveCoveredLayers;
+        Region aboveOpaqueLayers;
+    };
+
+    // The parts of the output state the visibility computation depends on.
+    struct VisibilityCacheOutputKey {
+        ui::Transform transform;
+        Rect bounds;
+        Rect viewport;
+
+        bool operator==(const VisibilityCacheOutputKey&) const;
+    };
+
+    VisibilityInputs getVisibilityInputs(const sp<compositionengine::LayerFE>&) const;
+    bool reuseCachedVisibility(const sp<compositionengine::LayerFE>&, const VisibilityInputs&,
+                               compositionengine::Output::CoverageState&);
+    void computeVisibility(sp<compositionengine::LayerFE>&, const VisibilityInputs&,
+                           compositionengine::Output::CoverageState&, VisibilityCacheEntry&);
     void dirtyEntireOutput();
+    void writeCompositionState(const compositionengine::CompositionRefreshArgs&);
+    void presentFrame(const compositionengine::CompositionRefreshArgs&);
+    std::vector<compositionengine::OutputLayer*> getOutputLayersForFlattener() const;
+    void planComposition();
+    void renderCachedSets();
+    renderengine::DisplaySettings getClientCompositionDisplaySettings() const;
     compositionengine::OutputLayer* findLayerRequestingBackgroundComposition() const;
     ui::Dataspace getBestDataspace(ui::Dataspace*, bool*) const;
     compositionengine::Output::ColorProfile pickColorProfile(
@@ -130,6 +187,16 @@ private:
     ReleasedLayers mReleasedLayers;
     OutputLayer* mLayerRequestingBackgroundBlur = nullptr;
     std::unique_ptr<ClientCompositionRequestCache> mClientCompositionRequestCache;
+    std::unique_ptr<Flattener> mFlattener;
+
+    std::vector<VisibilityCacheEntry> mVisibilityCache;
+    VisibilityCacheOutputKey mVisibilityCacheOutputKey;
+    // The position in mVisibilityCache of the next layer to process, and
+    // whether every layer processed so far reused its cached result.
+    size_t mVisibilityCachePosition = 0;
+    bool mVisibilityCacheMatching = false;
+    uint32_t mRecomputedVisibilityLayerCount = 0;
+    uint32_t mReusedVisibilityLayerCount = 0;
 };
 
 // This template factory function standardizes the implementation details of the
@@ -98,6 +98,12 @@ struct OutputCompositionState {
     // updated every time the geometry changes.
     Region undefinedRegion;
 
+    // The number of layers whose visibility was recomputed, and the number of
+    // layers whose visibility was reused from the previous update, the last
+    // time the geometry was updated.
+    uint32_t recomputedVisibilityLayerCount{0};
+    uint32_t reusedVisibilityLayerCount{0};
+
     // True if the last composition frame had visible layers
     bool lastCompositionHadVisibleLayers{false};
 
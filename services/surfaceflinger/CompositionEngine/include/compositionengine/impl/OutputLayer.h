@@ -73,6 +73,8 @@ private:
     void writeSidebandStateToHWC(HWC2::Layer*, const LayerFECompositionState&);
     void writeBufferStateToHWC(HWC2::Layer*, const LayerFECompositionState&);
     void writeCompositionTypeToHWC(HWC2::Layer*, Hwc2::IComposerClient::Composition);
+    void writeOverrideStateToHWC(HWC2::Layer*, bool includeGeometry);
+    void writeSkippedStateToHWC(HWC2::Layer*, bool includeGeometry);
     void detectDisallowedCompositionTypeChange(Hwc2::IComposerClient::Composition from,
                                                Hwc2::IComposerClient::Composition to) const;
 };
@@ -22,7 +22,9 @@
 
 #include <compositionengine/impl/HwcBufferCache.h>
 #include <renderengine/Mesh.h>
+#include <ui/Fence.h>
 #include <ui/FloatRect.h>
+#include <ui/GraphicBuffer.h>
 #include <ui/GraphicTypes.h>
 #include <ui/Rect.h>
 #include <ui/Region.h>
@@ -83,6 +85,28 @@ struct OutputLayerCompositionState {
     // The Z order index of this layer on this output
     uint32_t z{0};
 
+    // Set while this layer is part of a run of layers flattened into a single
+    // buffer. See Flattener.
+    struct OverrideInfo {
+        // The buffer holding the flattened run, presented to the HWC instead of
+        // this layer's content. Only set on the bottom layer of the run.
+        sp<GraphicBuffer> buffer;
+        sp<Fence> acquireFence;
+        Rect displayFrame;
+        ui::Dataspace dataspace{ui::Dataspace::UNKNOWN};
+        Region visibleRegion;
+        Region damageRegion;
+
+        // Set on the other layers of the run, which are hidden from the HWC
+        // while the run is flattened.
+        bool skip{false};
+    };
+    OverrideInfo overrideInfo;
+
+    // Set when overrideInfo changes, so that the geometry of the layer is sent
+    // to the HWC again.
+    bool overrideInfoChanged{false};
+
     /*
      * HWC state
      */
@@ -21,9 +21,17 @@
 #include <compositionengine/impl/CompositionEngine.h>
 #include <compositionengine/impl/Display.h>
 
+#include <pthread.h>
 #include <renderengine/RenderEngine.h>
+#include <sched.h>
 #include <utils/Trace.h>
 
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 // TODO(b/129481165): remove the #pragma below and fix conversion issues
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -43,6 +51,98 @@ std::unique_ptr<compositionengine::CompositionEngine> createCompositionEngine()
     return std::make_unique<CompositionEngine>();
 }
 
+namespace {
+
+// The number of threads, besides the main thread, used to compute the
+// composition state of outputs concurrently. Devices rarely drive more than
+// three outputs at once.
+constexpr size_t kOutputWorkerThreadCount = 2;
+
+} // namespace
+
+class CompositionEngine::OutputWorkerPool {
+public:
+    explicit OutputWorkerPool(size_t threadCount) {
+        for (size_t i = 0; i < threadCount; i++) {
+            mThreads.emplace_back(&OutputWorkerPool::threadMain, this);
+        }
+    }
+
+    ~OutputWorkerPool() {
+        {
+            std::lock_guard lock(mMutex);
+            mExiting = true;
+        }
+        mWorkAvailable.notify_all();
+        for (auto& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    // Calls task(i) for every i in [0, count), on the calling thread as well
+    // as on the worker threads, and returns once every call has returned.
+    void run(size_t count, const std::function<void(size_t)>& task) {
+        std::unique_lock lock(mMutex);
+        mTask = &task;
+        mNext = 0;
+        mCount = count;
+        mPending = count;
+        lock.unlock();
+        mWorkAvailable.notify_all();
+
+        lock.lock();
+        while (mNext < mCount) {
+            runNextLocked(lock);
+        }
+        mWorkDone.wait(lock, [this] { return mPending == 0; });
+        mTask = nullptr;
+    }
+
+private:
+    void threadMain() {
+        // Run at the same priority as the main thread, which waits for us.
+        struct sched_param param = {0};
+        param.sched_priority = 2;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            ALOGW("Failed to set SCHED_FIFO on output worker thread");
+        }
+
+        if (pthread_setname_np(pthread_self(), "OutputWorker")) {
+            ALOGW("Failed to set thread name on output worker thread");
+        }
+
+        std::unique_lock lock(mMutex);
+        while (true) {
+            mWorkAvailable.wait(lock, [this] { return mExiting || mNext < mCount; });
+            if (mExiting) {
+                return;
+            }
+            runNextLocked(lock);
+        }
+    }
+
+    void runNextLocked(std::unique_lock<std::mutex>& lock) {
+        const size_t index = mNext++;
+        const auto& task = *mTask;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        if (--mPending == 0) {
+            mWorkDone.notify_one();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mWorkDone;
+    const std::function<void(size_t)>* mTask = nullptr;
+    size_t mNext = 0;
+    size_t mCount = 0;
+    size_t mPending = 0;
+    bool mExiting = false;
+    std::vector<std::thread> mThreads;
+};
+
 CompositionEngine::CompositionEngine() = default;
 CompositionEngine::~CompositionEngine() = default;
 
@@ -107,11 +207,43 @@ void CompositionEngine::present(CompositionRefreshArgs& args) {
 
     updateLayerStateFromFE(args);
 
+    if (args.updateOutputsConcurrently && args.outputs.size() > 1) {
+        presentOutputsConcurrently(args);
+        return;
+    }
+
     for (const auto& output : args.outputs) {
         output->present(args);
     }
 }
 
+void CompositionEngine::presentOutputsConcurrently(CompositionRefreshArgs& args) {
+    ATRACE_CALL();
+    ALOGV(__FUNCTION__);
+
+    // Setting the color profile of a display may change its HWC color mode,
+    // so this is done here, one output at a time.
+    for (const auto& output : args.outputs) {
+        output->updateColorProfile(args);
+    }
+
+    // The per-layer composition state only depends on the front-end state
+    // latched by updateLayerStateFromFE() and on the output itself, so the
+    // outputs can compute theirs concurrently.
+    if (!mOutputWorkers) {
+        mOutputWorkers = std::make_unique<OutputWorkerPool>(kOutputWorkerThreadCount);
+    }
+    mOutputWorkers->run(args.outputs.size(), [&args](size_t index) {
+        args.outputs[index]->updateCompositionState(args);
+    });
+
+    // Neither HWC nor RenderEngine can be driven from several threads, so the
+    // rest of the work is done here, one output at a time.
+    for (const auto& output : args.outputs) {
+        output->presentUpdatedState(args);
+    }
+}
+
 void CompositionEngine::updateCursorAsync(CompositionRefreshArgs& args) {
     std::unordered_map<compositionengine::LayerFE*, compositionengine::LayerFECompositionState*>
             uniqueVisibleLayers;
@@ -0,0 +1,379 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+
+#include <android-base/stringprintf.h>
+#include <compositionengine/LayerFE.h>
+#include <compositionengine/LayerFECompositionState.h>
+#include <compositionengine/OutputLayer.h>
+#include <compositionengine/impl/Flattener.h>
+#include <compositionengine/impl/OutputCompositionState.h>
+#include <compositionengine/impl/OutputLayerCompositionState.h>
+
+// TODO(b/129481165): remove the #pragma below and fix conversion issues
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wconversion"
+
+#include <renderengine/RenderEngine.h>
+
+// TODO(b/129481165): remove the #pragma below and fix conversion issues
+#pragma clang diagnostic pop // ignored "-Wconversion"
+
+#include <utils/Trace.h>
+
+namespace android::compositionengine::impl {
+
+namespace {
+
+bool isHdrDataspace(ui::Dataspace dataspace) {
+    const auto transfer = static_cast<ui::Dataspace>(
+            static_cast<int32_t>(dataspace) & static_cast<int32_t>(ui::Dataspace::TRANSFER_MASK));
+    return transfer == ui::Dataspace::TRANSFER_ST2084 || transfer == ui::Dataspace::TRANSFER_HLG;
+}
+
+} // namespace
+
+bool Flattener::LayerSnapshot::operator==(const LayerSnapshot& other) const {
+    return layerFE == other.layerFE && buffer == other.buffer &&
+            acquireFence == other.acquireFence && compositionType == other.compositionType &&
+            color == other.color && alpha == other.alpha && blendMode == other.blendMode &&
+            dataspace == other.dataspace && displayFrame == other.displayFrame &&
+            sourceCrop == other.sourceCrop && bufferTransform == other.bufferTransform &&
+            z == other.z && outputSpaceVisibleRegion.hasSameRects(other.outputSpaceVisibleRegion);
+}
+
+bool Flattener::OutputKey::operator==(const OutputKey& other) const {
+    return sourceClip == other.sourceClip && destinationClip == other.destinationClip &&
+            orientation == other.orientation && dataspace == other.dataspace;
+}
+
+Flattener::LayerSnapshot Flattener::getSnapshot(const compositionengine::OutputLayer& layer) {
+    const auto& state = layer.getState();
+    const auto* layerFEState = layer.getLayerFE().getCompositionState();
+
+    LayerSnapshot snapshot;
+    snapshot.layerFE = &layer.getLayerFE();
+    if (layerFEState) {
+        // A new frame comes with a new acquire fence, even when the producer
+        // renders into the buffer it queued last.
+        snapshot.buffer = layerFEState->buffer.get();
+        snapshot.acquireFence = layerFEState->acquireFence.get();
+        snapshot.compositionType = layerFEState->compositionType;
+        snapshot.color = layerFEState->color;
+        snapshot.alpha = layerFEState->alpha;
+        snapshot.blendMode = layerFEState->blendMode;
+    }
+    snapshot.dataspace = state.dataspace;
+    snapshot.displayFrame = state.displayFrame;
+    snapshot.sourceCrop = state.sourceCrop;
+    snapshot.bufferTransform = state.bufferTransform;
+    snapshot.z = state.z;
+    snapshot.outputSpaceVisibleRegion = state.outputSpaceVisibleRegion;
+    return snapshot;
+}
+
+bool Flattener::isFlattenable(const compositionengine::OutputLayer& layer) {
+    const auto& state = layer.getState();
+    const auto* layerFEState = layer.getLayerFE().getCompositionState();
+    if (!layerFEState || !state.hwc || !state.hwc->hwcLayer || state.forceClientComposition) {
+        return false;
+    }
+
+    const auto isComposedByDevice = [](hal::Composition type) {
+        return type == hal::Composition::DEVICE || type == hal::Composition::SOLID_COLOR;
+    };
+    // The HWC composition type is the one the HWC settled on last frame, which
+    // catches the layers it sends back to client composition.
+    if (!isComposedByDevice(layerFEState->compositionType) ||
+        !isComposedByDevice(state.hwc->hwcCompositionType)) {
+        return false;
+    }
+
+    return !layerFEState->isSecure && !layerFEState->hasProtectedContent &&
+            layerFEState->colorTransformIsIdentity && layerFEState->backgroundBlurRadius == 0 &&
+            !isHdrDataspace(state.dataspace);
+}
+
+void Flattener::plan(const std::vector<compositionengine::OutputLayer*>& layers,
+                     const OutputCompositionState& outputState) {
+    ATRACE_CALL();
+
+    const OutputKey outputKey{outputState.sourceClip, outputState.destinationClip,
+                              outputState.orientation, outputState.dataspace};
+    if (outputKey != mOutputKey) {
+        reset(layers);
+        mOutputKey = outputKey;
+    }
+
+    std::unordered_map<const compositionengine::OutputLayer*, LayerHistory> layerHistory;
+    layerHistory.reserve(layers.size());
+    for (const auto* layer : layers) {
+        LayerHistory history;
+        history.snapshot = getSnapshot(*layer);
+        history.flattenable = isFlattenable(*layer);
+        if (auto it = mLayerHistory.find(layer);
+            it != mLayerHistory.end() && it->second.snapshot == history.snapshot) {
+            history.framesUnchanged = it->second.framesUnchanged + 1;
+        }
+        layerHistory.emplace(layer, std::move(history));
+    }
+    mLayerHistory = std::move(layerHistory);
+
+    for (auto it = mSets.begin(); it != mSets.end();) {
+        if (const auto first = findUnchangedSet(*it, layers)) {
+            if (it->buffer) {
+                applyOverride(*it, layers, *first);
+            }
+            ++it;
+            continue;
+        }
+
+        if (it->buffer) {
+            mExpandedSetCount++;
+        }
+        it = expandSet(it, layers);
+    }
+
+    startNewSets(layers);
+}
+
+std::optional<size_t> Flattener::findUnchangedSet(
+        const CachedSet& set, const std::vector<compositionengine::OutputLayer*>& layers) const {
+    const auto first = std::find(layers.begin(), layers.end(), set.layers.front());
+    if (first == layers.end() ||
+        static_cast<size_t>(layers.end() - first) < set.layers.size() ||
+        !std::equal(set.layers.begin(), set.layers.end(), first)) {
+        return std::nullopt;
+    }
+
+    for (const auto* layer : set.layers) {
+        const auto& history = mLayerHistory.at(layer);
+        if (!history.flattenable || history.framesUnchanged == 0) {
+            return std::nullopt;
+        }
+    }
+    return static_cast<size_t>(first - layers.begin());
+}
+
+void Flattener::startNewSets(const std::vector<compositionengine::OutputLayer*>& layers) {
+    const auto isInSet = [this](const compositionengine::OutputLayer* layer) {
+        return std::any_of(mSets.begin(), mSets.end(), [layer](const CachedSet& set) {
+            return std::find(set.layers.begin(), set.layers.end(), layer) != set.layers.end();
+        });
+    };
+
+    std::vector<const compositionengine::OutputLayer*> run;
+    for (size_t i = 0; i <= layers.size() && mSets.size() < kMaxRuns; i++) {
+        if (i < layers.size()) {
+            const auto* layer = layers[i];
+            const auto& history = mLayerHistory.at(layer);
+            if (history.flattenable && history.framesUnchanged >= kUnchangedFrameThreshold &&
+                !isInSet(layer)) {
+                run.push_back(layer);
+                continue;
+            }
+        }
+
+        if (run.size() >= kMinLayersPerRun) {
+            CachedSet set;
+            set.layers = std::move(run);
+            mSets.push_back(std::move(set));
+        }
+        run.clear();
+    }
+}
+
+void Flattener::applyOverride(CachedSet& set,
+                              const std::vector<compositionengine::OutputLayer*>& layers,
+                              size_t first) {
+    auto& bottomState = layers[first]->editState();
+    auto& bottomOverride = bottomState.overrideInfo;
+    if (bottomOverride.buffer != set.buffer) {
+        bottomOverride.buffer = set.buffer;
+        bottomOverride.acquireFence = set.drawFence;
+        bottomOverride.displayFrame = set.displayFrame;
+        bottomOverride.dataspace = set.dataspace;
+        bottomOverride.visibleRegion = set.visibleRegion;
+        bottomOverride.skip = false;
+        bottomState.overrideInfoChanged = true;
+    }
+    // The HWC reads the whole buffer the first time, and nothing after.
+    bottomOverride.damageRegion = set.presented ? Region() : Region::INVALID_REGION;
+    set.presented = true;
+
+    for (size_t i = first + 1; i < first + set.layers.size(); i++) {
+        auto& state = layers[i]->editState();
+        if (!state.overrideInfo.skip) {
+            state.overrideInfo = {};
+            state.overrideInfo.skip = true;
+            state.overrideInfoChanged = true;
+        }
+    }
+}
+
+std::vector<Flattener::CachedSet>::iterator Flattener::expandSet(
+        std::vector<CachedSet>::iterator setIt,
+        const std::vector<compositionengine::OutputLayer*>& layers) {
+    // Only the layers that are still on the output are touched, and those are
+    // found through |layers|. They must stay unchanged for another
+    // kUnchangedFrameThreshold frames before they are flattened again, so
+    // that a run the HWC cannot take is not rendered over and over.
+    for (auto* layer : layers) {
+        if (std::find(setIt->layers.begin(), setIt->layers.end(), layer) != setIt->layers.end()) {
+            clearOverride(*layer);
+            mLayerHistory.at(layer).framesUnchanged = 0;
+        }
+    }
+    return mSets.erase(setIt);
+}
+
+void Flattener::clearOverride(compositionengine::OutputLayer& layer) {
+    auto& state = layer.editState();
+    if (state.overrideInfo.buffer || state.overrideInfo.skip) {
+        state.overrideInfo = {};
+        state.overrideInfoChanged = true;
+    }
+}
+
+void Flattener::reset(const std::vector<compositionengine::OutputLayer*>& layers) {
+    for (auto* layer : layers) {
+        clearOverride(*layer);
+    }
+    for (const auto& set : mSets) {
+        if (set.buffer) {
+            mExpandedSetCount++;
+        }
+    }
+    mSets.clear();
+}
+
+void Flattener::renderCachedSets(const std::vector<compositionengine::OutputLayer*>& layers,
+                                 const OutputCompositionState& outputState,
+                                 renderengine::RenderEngine& renderEngine,
+                                 const renderengine::DisplaySettings& displaySettings,
+                                 const ui::Size& bufferSize) {
+    // The cached buffers are never protected, so they cannot be rendered
+    // while RenderEngine uses a protected context.
+    if (renderEngine.isProtected()) {
+        return;
+    }
+
+    auto setIt = std::find_if(mSets.begin(), mSets.end(),
+                              [](const CachedSet& set) { return set.buffer == nullptr; });
+    if (setIt == mSets.end()) {
+        return;
+    }
+    CachedSet& set = *setIt;
+
+    const auto first = findUnchangedSet(set, layers);
+    if (!first) {
+        return;
+    }
+
+    ATRACE_CALL();
+
+    const Region viewportRegion(outputState.viewport);
+    Region dummyRegion;
+    Region displayFrames;
+    Region visibleRegion;
+    std::vector<LayerFE::LayerSettings> layerSettings;
+    for (size_t i = *first; i < *first + set.layers.size(); i++) {
+        auto* layer = layers[i];
+        const auto& layerState = layer->getState();
+
+        const Region clip(viewportRegion.intersect(layerState.visibleRegion));
+        compositionengine::LayerFE::ClientCompositionTargetSettings targetSettings{
+                clip,
+                false, /* useIdentityTransform */
+                layer->needsFiltering() || outputState.needsFiltering,
+                outputState.isSecure,
+                false, /* supportsProtectedContent */
+                dummyRegion,
+                outputState.viewport,
+                displaySettings.outputDataspace,
+                true,  /* realContentIsVisible */
+                false, /* clearContent */
+        };
+        std::vector<LayerFE::LayerSettings> results =
+                layer->getLayerFE().prepareClientCompositionList(targetSettings);
+        layerSettings.insert(layerSettings.end(), std::make_move_iterator(results.begin()),
+                             std::make_move_iterator(results.end()));
+
+        displayFrames.orSelf(layerState.displayFrame);
+        visibleRegion.orSelf(layerState.outputSpaceVisibleRegion);
+    }
+
+    std::vector<const renderengine::LayerSettings*> layerSettingsPointers;
+    layerSettingsPointers.reserve(layerSettings.size());
+    for (const auto& settings : layerSettings) {
+        layerSettingsPointers.push_back(&settings);
+    }
+
+    const uint64_t usage = GraphicBuffer::USAGE_HW_RENDER | GraphicBuffer::USAGE_HW_COMPOSER |
+            GraphicBuffer::USAGE_HW_TEXTURE;
+    sp<GraphicBuffer> buffer =
+            new GraphicBuffer(static_cast<uint32_t>(bufferSize.getWidth()),
+                              static_cast<uint32_t>(bufferSize.getHeight()),
+                              HAL_PIXEL_FORMAT_RGBA_8888, 1, usage, "Flattener");
+    if (buffer->initCheck() != NO_ERROR) {
+        ALOGE("Failed to allocate a %dx%d buffer to flatten layers into", bufferSize.getWidth(),
+              bufferSize.getHeight());
+        expandSet(setIt, layers);
+        return;
+    }
+
+    // The buffer is composed by the HWC like any device layer, which is where
+    // the color transform of the output is applied.
+    renderengine::DisplaySettings flattenedDisplaySettings = displaySettings;
+    flattenedDisplaySettings.colorTransform = mat4();
+    flattenedDisplaySettings.clearRegion = Region();
+
+    base::unique_fd drawFence;
+    if (status_t status =
+                renderEngine.drawLayers(flattenedDisplaySettings, layerSettingsPointers,
+                                        buffer->getNativeBuffer(), /*useFramebufferCache=*/false,
+                                        base::unique_fd(), &drawFence);
+        status != NO_ERROR) {
+        ALOGE("Failed to flatten layers: %d", status);
+        expandSet(setIt, layers);
+        return;
+    }
+
+    set.buffer = std::move(buffer);
+    set.drawFence =
+            drawFence.get() >= 0 ? sp<Fence>(new Fence(drawFence.release())) : Fence::NO_FENCE;
+    set.displayFrame = displayFrames.getBounds();
+    set.visibleRegion = std::move(visibleRegion);
+    set.dataspace = outputState.dataspace;
+    mRenderedSetCount++;
+}
+
+void Flattener::dump(std::string& out) const {
+    using android::base::StringAppendF;
+
+    StringAppendF(&out, "    Flattener: %zu runs, %" PRIu64 " rendered, %" PRIu64 " expanded\n",
+                  mSets.size(), mRenderedSetCount, mExpandedSetCount);
+    for (const auto& set : mSets) {
+        StringAppendF(&out, "      - %zu layers, %s, display frame [%d, %d, %d, %d]\n",
+                      set.layers.size(), set.buffer ? "rendered" : "pending",
+                      set.displayFrame.left, set.displayFrame.top, set.displayFrame.right,
+                      set.displayFrame.bottom);
+    }
+}
+
+} // namespace android::compositionengine::impl
@@ -42,7 +42,18 @@ void HwcBufferCache::getHwcBuffer(int slot, const sp<GraphicBuffer>& buffer, uin
         *outSlot = static_cast<uint32_t>(slot);
     }
 
-    auto& currentBuffer = mBuffers[*outSlot];
+    updateSlot(*outSlot, buffer, outBuffer);
+}
+
+void HwcBufferCache::getOverrideHwcBuffer(const sp<GraphicBuffer>& buffer, uint32_t* outSlot,
+                                          sp<GraphicBuffer>* outBuffer) {
+    *outSlot = FLATTENER_CACHING_SLOT;
+    updateSlot(*outSlot, buffer, outBuffer);
+}
+
+void HwcBufferCache::updateSlot(uint32_t slot, const sp<GraphicBuffer>& buffer,
+                                sp<GraphicBuffer>* outBuffer) {
+    auto& currentBuffer = mBuffers[slot];
     wp<GraphicBuffer> weakCopy(buffer);
     if (currentBuffer == weakCopy) {
         // already cached in HWC, skip sending the buffer
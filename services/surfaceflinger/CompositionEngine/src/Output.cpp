@@ -175,6 +175,19 @@ void Output::setColorProfile(const ColorProfile& colorProfile) {
     dirtyEntireOutput();
 }
 
+void Output::setLayerCachingEnabled(bool enabled) {
+    if (enabled == (mFlattener != nullptr)) {
+        return;
+    }
+
+    if (enabled) {
+        mFlattener = std::make_unique<Flattener>();
+    } else {
+        mFlattener->reset(getOutputLayersForFlattener());
+        mFlattener.reset();
+    }
+}
+
 void Output::dump(std::string& out) const {
     using android::base::StringAppendF;
 
@@ -207,6 +220,11 @@ void Output::dumpBase(std::string& out) const {
         }
         outputLayer->dump(out);
     }
+
+    if (mFlattener) {
+        out.append("\n");
+        mFlattener->dump(out);
+    }
 }
 
 compositionengine::DisplayColorProfile* Output::getDisplayColorProfile() const {
@@ -310,12 +328,55 @@ void Output::present(const compositionengine::CompositionRefreshArgs& refreshArg
 
     updateColorProfile(refreshArgs);
     updateAndWriteCompositionState(refreshArgs);
+    presentFrame(refreshArgs);
+}
+
+void Output::presentUpdatedState(const compositionengine::CompositionRefreshArgs& refreshArgs) {
+    ATRACE_CALL();
+    ALOGV(__FUNCTION__);
+
+    planComposition();
+    writeCompositionState(refreshArgs);
+    presentFrame(refreshArgs);
+}
+
+void Output::presentFrame(const compositionengine::CompositionRefreshArgs& refreshArgs) {
     setColorTransform(refreshArgs);
     beginFrame();
     prepareFrame();
     devOptRepaintFlash(refreshArgs);
     finishFrame(refreshArgs);
     postFramebuffer();
+    renderCachedSets();
+}
+
+std::vector<compositionengine::OutputLayer*> Output::getOutputLayersForFlattener() const {
+    std::vector<compositionengine::OutputLayer*> layers;
+    layers.reserve(getOutputLayerCount());
+    for (auto* layer : getOutputLayersOrderedByZ()) {
+        layers.push_back(layer);
+    }
+    return layers;
+}
+
+void Output::planComposition() {
+    if (!mFlattener || !getState().isEnabled) {
+        return;
+    }
+
+    mFlattener->plan(getOutputLayersForFlattener(), getState());
+}
+
+void Output::renderCachedSets() {
+    if (!mFlattener || !getState().isEnabled) {
+        return;
+    }
+
+    // Rendering once the frame is presented keeps it off the critical path.
+    mFlattener->renderCachedSets(getOutputLayersForFlattener(), getState(),
+                                 getCompositionEngine().getRenderEngine(),
+                                 getClientCompositionDisplaySettings(),
+                                 mRenderSurface->getSize());
 }
 
 void Output::rebuildLayerStacks(const compositionengine::CompositionRefreshArgs& refreshArgs,
@@ -345,6 +406,17 @@ void Output::rebuildLayerStacks(const compositionengine::CompositionRefreshArgs&
 
 void Output::collectVisibleLayers(const compositionengine::CompositionRefreshArgs& refreshArgs,
                                   compositionengine::Output::CoverageState& coverage) {
+    // The visibility of the layers processed last time can be reused as long
+    // as the output projection has not changed.
+    const auto& outputState = getState();
+    const VisibilityCacheOutputKey outputKey{outputState.transform, outputState.bounds,
+                                             outputState.viewport};
+    mVisibilityCacheMatching = outputKey == mVisibilityCacheOutputKey;
+    mVisibilityCacheOutputKey = outputKey;
+    mVisibilityCachePosition = 0;
+    mRecomputedVisibilityLayerCount = 0;
+    mReusedVisibilityLayerCount = 0;
+
     // Evaluate the layers from front to back to determine what is visible. This
     // also incrementally calculates the coverage information for each layer as
     // well as the entire output.
@@ -356,6 +428,11 @@ void Output::collectVisibleLayers(const compositionengine::CompositionRefreshArg
         // no more layers could even be visible underneath the ones on top.
     }
 
+    // Forget about layers which are no longer processed
+    mVisibilityCache.resize(mVisibilityCachePosition);
+    editState().recomputedVisibilityLayerCount = mRecomputedVisibilityLayerCount;
+    editState().reusedVisibilityLayerCount = mReusedVisibilityLayerCount;
+
     setReleasedLayers(refreshArgs);
 
     finalizePendingOutputLayers();
@@ -377,22 +454,151 @@ void Output::ensureOutputLayerIfVisible(sp<compositionengine::LayerFE>& layerFE,
         layerFE->prepareCompositionState(compositionengine::LayerFE::StateSubset::BasicGeometry);
     }
 
-    // Only consider the layers on the given layer stack
-    if (!belongsInOutput(layerFE)) {
+    // Reuse the result of the previous update if neither this layer nor any
+    // layer above it has changed since.
+    const VisibilityInputs inputs = getVisibilityInputs(layerFE);
+    if (reuseCachedVisibility(layerFE, inputs, coverage)) {
+        mReusedVisibilityLayerCount++;
         return;
     }
+    mRecomputedVisibilityLayerCount++;
+
+    // The coverage of every layer below this one may change, so the cache is
+    // rebuilt from this point on.
+    mVisibilityCacheMatching = false;
+    mVisibilityCache.resize(mVisibilityCachePosition);
+    auto& entry = mVisibilityCache.emplace_back();
+    mVisibilityCachePosition++;
+    entry.layerFE = layerFE;
+    entry.inputs = inputs;
+
+    computeVisibility(layerFE, inputs, coverage, entry);
+
+    entry.aboveCoveredLayers = coverage.aboveCoveredLayers;
+    entry.aboveOpaqueLayers = coverage.aboveOpaqueLayers;
+}
+
+bool Output::VisibilityInputs::operator==(const VisibilityInputs& other) const {
+    return belongsInOutput == other.belongsInOutput && isVisible == other.isVisible &&
+            isOpaque == other.isOpaque && transform == other.transform &&
+            bounds == other.bounds && shadowRadius == other.shadowRadius &&
+            transparentRegionHint.hasSameRects(other.transparentRegionHint);
+}
+
+bool Output::VisibilityCacheOutputKey::operator==(const VisibilityCacheOutputKey& other) const {
+    return transform == other.transform && bounds == other.bounds && viewport == other.viewport;
+}
+
+Output::VisibilityInputs Output::getVisibilityInputs(
+        const sp<compositionengine::LayerFE>& layerFE) const {
+    VisibilityInputs inputs;
+
+    // Only consider the layers on the given layer stack
+    inputs.belongsInOutput = belongsInOutput(layerFE);
+    if (!inputs.belongsInOutput) {
+        return inputs;
+    }
 
-    // Obtain a read-only pointer to the front-end layer state
     const auto* layerFEState = layerFE->getCompositionState();
     if (CC_UNLIKELY(!layerFEState)) {
-        return;
+        return inputs;
+    }
+
+    inputs.isVisible = layerFEState->isVisible;
+    if (!inputs.isVisible) {
+        return inputs;
+    }
+
+    inputs.isOpaque = layerFEState->isOpaque;
+    inputs.transform = layerFEState->geomLayerTransform;
+    inputs.bounds = layerFEState->geomLayerBounds;
+    inputs.shadowRadius = layerFEState->shadowRadius;
+    inputs.transparentRegionHint = layerFEState->transparentRegionHint;
+    return inputs;
+}
+
+bool Output::reuseCachedVisibility(const sp<compositionengine::LayerFE>& layerFE,
+                                   const VisibilityInputs& inputs,
+                                   compositionengine::Output::CoverageState& coverage) {
+    if (!mVisibilityCacheMatching || mVisibilityCachePosition >= mVisibilityCache.size()) {
+        return false;
     }
 
-    // handle hidden surfaces by setting the visible region to empty
-    if (CC_UNLIKELY(!layerFEState->isVisible)) {
+    const auto& entry = mVisibilityCache[mVisibilityCachePosition];
+    if (entry.layerFE.promote() != layerFE || !(entry.inputs == inputs)) {
+        return false;
+    }
+
+    // The coverage of the layers above must be the one the entry was computed
+    // with.
+    if (mVisibilityCachePosition == 0) {
+        if (!coverage.aboveCoveredLayers.isEmpty() || !coverage.aboveOpaqueLayers.isEmpty()) {
+            return false;
+        }
+    } else {
+        const auto& above = mVisibilityCache[mVisibilityCachePosition - 1];
+        if (!coverage.aboveCoveredLayers.hasSameRects(above.aboveCoveredLayers) ||
+            !coverage.aboveOpaqueLayers.hasSameRects(above.aboveOpaqueLayers)) {
+            return false;
+        }
+    }
+
+    // The dirty region below relies on the output layer still holding the
+    // cached regions as its previous ones.
+    std::optional<size_t> prevOutputLayerIndex;
+    if (entry.hasOutputLayer) {
+        prevOutputLayerIndex = findCurrentOutputLayerForLayer(layerFE);
+        if (!prevOutputLayerIndex) {
+            return false;
+        }
+        const auto& prevState = getOutputLayerOrderedByZByIndex(*prevOutputLayerIndex)->getState();
+        if (!prevState.visibleRegion.hasSameRects(entry.visibleRegion) ||
+            !prevState.coveredRegion.hasSameRects(entry.coveredRegion)) {
+            return false;
+        }
+    }
+
+    // This is the dirty region computeVisibility() yields when the visible and
+    // covered regions are the same as last time.
+    if (!entry.visibleRegion.isEmpty()) {
+        if (layerFE->getCompositionState()->contentDirty) {
+            coverage.dirtyRegion.orSelf(entry.visibleRegion);
+        } else if (entry.hasOutputLayer) {
+            coverage.dirtyRegion.orSelf(entry.visibleRegion.intersect(entry.coveredRegion));
+        } else {
+            coverage.dirtyRegion.orSelf(entry.visibleRegion.subtract(entry.coveredRegion));
+        }
+    }
+
+    coverage.aboveCoveredLayers = entry.aboveCoveredLayers;
+    coverage.aboveOpaqueLayers = entry.aboveOpaqueLayers;
+
+    if (entry.hasOutputLayer) {
+        auto& outputLayerState = ensureOutputLayer(prevOutputLayerIndex, layerFE)->editState();
+        outputLayerState.visibleRegion = entry.visibleRegion;
+        outputLayerState.visibleNonTransparentRegion = entry.visibleNonTransparentRegion;
+        outputLayerState.coveredRegion = entry.coveredRegion;
+        outputLayerState.outputSpaceVisibleRegion = entry.outputSpaceVisibleRegion;
+        outputLayerState.shadowRegion = entry.shadowRegion;
+    }
+
+    mVisibilityCachePosition++;
+    return true;
+}
+
+void Output::computeVisibility(sp<compositionengine::LayerFE>& layerFE,
+                               const VisibilityInputs& inputs,
+                               compositionengine::Output::CoverageState& coverage,
+                               VisibilityCacheEntry& entry) {
+    // Only consider the layers on the given layer stack, and handle hidden
+    // surfaces by setting the visible region to empty
+    if (!inputs.belongsInOutput || CC_UNLIKELY(!inputs.isVisible)) {
         return;
     }
 
+    // Obtain a read-only pointer to the front-end layer state
+    const auto* layerFEState = layerFE->getCompositionState();
+
     /*
      * opaqueRegion: area of a surface that is fully opaque.
      */
@@ -526,6 +732,9 @@ void Output::ensureOutputLayerIfVisible(sp<compositionengine::LayerFE>& layerFE,
     }
     dirty.subtractSelf(coverage.aboveOpaqueLayers);
 
+    entry.visibleRegion = visibleRegion;
+    entry.coveredRegion = coveredRegion;
+
     // accumulate to the screen dirty region
     coverage.dirtyRegion.orSelf(dirty);
 
@@ -559,6 +768,11 @@ void Output::ensureOutputLayerIfVisible(sp<compositionengine::LayerFE>& layerFE,
     outputLayerState.outputSpaceVisibleRegion =
             outputState.transform.transform(visibleNonShadowRegion.intersect(outputState.viewport));
     outputLayerState.shadowRegion = shadowRegion;
+
+    entry.hasOutputLayer = true;
+    entry.visibleNonTransparentRegion = outputLayerState.visibleNonTransparentRegion;
+    entry.outputSpaceVisibleRegion = outputLayerState.outputSpaceVisibleRegion;
+    entry.shadowRegion = outputLayerState.shadowRegion;
 }
 
 void Output::setReleasedLayers(const compositionengine::CompositionRefreshArgs&) {
@@ -578,6 +792,15 @@ void Output::updateAndWriteCompositionState(
     ATRACE_CALL();
     ALOGV(__FUNCTION__);
 
+    updateCompositionState(refreshArgs);
+    planComposition();
+    writeCompositionState(refreshArgs);
+}
+
+void Output::updateCompositionState(const compositionengine::CompositionRefreshArgs& refreshArgs) {
+    ATRACE_CALL();
+    ALOGV(__FUNCTION__);
+
     if (!getState().isEnabled) {
         return;
     }
@@ -594,8 +817,19 @@ void Output::updateAndWriteCompositionState(
         if (mLayerRequestingBackgroundBlur == layer) {
             forceClientComposition = false;
         }
+    }
+}
+
+void Output::writeCompositionState(const compositionengine::CompositionRefreshArgs& refreshArgs) {
+    ATRACE_CALL();
+    ALOGV(__FUNCTION__);
+
+    if (!getState().isEnabled) {
+        return;
+    }
 
-        // Send the updated state to the HWC, if appropriate.
+    // Send the updated state to the HWC, if appropriate.
+    for (auto* layer : getOutputLayersOrderedByZ()) {
         layer->writeStateToHWC(refreshArgs.updatingGeometryThisFrame);
     }
 }
@@ -863,15 +1097,7 @@ std::optional<base::unique_fd> Output::composeSurfaces(
 
     ALOGV("hasClientComposition");
 
-    renderengine::DisplaySettings clientCompositionDisplay;
-    clientCompositionDisplay.physicalDisplay = outputState.destinationClip;
-    clientCompositionDisplay.clip = outputState.sourceClip;
-    clientCompositionDisplay.orientation = outputState.orientation;
-    clientCompositionDisplay.outputDataspace = mDisplayColorProfile->hasWideColorGamut()
-            ? outputState.dataspace
-            : ui::Dataspace::UNKNOWN;
-    clientCompositionDisplay.maxLuminance =
-            mDisplayColorProfile->getHdrCapabilities().getDesiredMaxLuminance();
+    renderengine::DisplaySettings clientCompositionDisplay = getClientCompositionDisplaySettings();
 
     // Compute the global color transform matrix.
     if (!outputState.usesDeviceComposition && !getSkipColorTransform()) {
@@ -944,6 +1170,21 @@ std::optional<base::unique_fd> Output::composeSurfaces(
     return readyFence;
 }
 
+renderengine::DisplaySettings Output::getClientCompositionDisplaySettings() const {
+    const auto& outputState = getState();
+
+    renderengine::DisplaySettings displaySettings;
+    displaySettings.physicalDisplay = outputState.destinationClip;
+    displaySettings.clip = outputState.sourceClip;
+    displaySettings.orientation = outputState.orientation;
+    displaySettings.outputDataspace = mDisplayColorProfile->hasWideColorGamut()
+            ? outputState.dataspace
+            : ui::Dataspace::UNKNOWN;
+    displaySettings.maxLuminance =
+            mDisplayColorProfile->getHdrCapabilities().getDesiredMaxLuminance();
+    return displaySettings;
+}
+
 std::vector<LayerFE::LayerSettings> Output::generateClientCompositionRequests(
         bool supportsProtectedContent, Region& clearRegion, ui::Dataspace outputDataspace) {
     std::vector<LayerFE::LayerSettings> clientCompositionLayers;
@@ -953,6 +1194,8 @@ std::vector<LayerFE::LayerSettings> Output::generateClientCompositionRequests(
     const Region viewportRegion(outputState.viewport);
     const bool useIdentityTransform = false;
     bool firstLayer = true;
+    // Whether the flattened run being iterated over is client composed.
+    bool flattenedRunUsesClientComposition = false;
     // Used when a layer clears part of the buffer.
     Region dummyRegion;
 
@@ -969,15 +1212,26 @@ std::vector<LayerFE::LayerSettings> Output::generateClientCompositionRequests(
             continue;
         }
 
-        const bool clientComposition = layer->requiresClientComposition();
+        // The layers hidden behind a flattened run are only drawn if the HWC
+        // sends the layer presenting the run back to client composition, in
+        // which case the whole run is drawn from its original layers.
+        const auto& overrideInfo = layerState.overrideInfo;
+        bool clientComposition = layer->requiresClientComposition();
+        if (overrideInfo.skip) {
+            clientComposition = flattenedRunUsesClientComposition;
+        } else {
+            flattenedRunUsesClientComposition = overrideInfo.buffer && clientComposition;
+        }
 
         // We clear the client target for non-client composed layers if
         // requested by the HWC. We skip this if the layer is not an opaque
         // rectangle, as by definition the layer must blend with whatever is
         // underneath. We also skip the first layer as the buffer target is
-        // guaranteed to start out cleared.
-        const bool clearClientComposition =
-                layerState.clearClientTarget && layerFEState->isOpaque && !firstLayer;
+        // guaranteed to start out cleared. A flattened run is never opaque as
+        // a whole.
+        const bool clearClientComposition = layerState.clearClientTarget &&
+                layerFEState->isOpaque && !firstLayer && !overrideInfo.buffer &&
+                !overrideInfo.skip;
 
         ALOGV("  Composition type: client %d clear %d", clientComposition, clearClientComposition);
 
@@ -47,6 +47,11 @@ void OutputCompositionState::dump(std::string& out) const {
 
     out.append("\n   ");
 
+    dumpVal(out, "recomputedVisibilityLayerCount", recomputedVisibilityLayerCount);
+    dumpVal(out, "reusedVisibilityLayerCount", reusedVisibilityLayerCount);
+
+    out.append("\n   ");
+
     dumpVal(out, "colorMode", toString(colorMode), colorMode);
     dumpVal(out, "renderIntent", toString(renderIntent), renderIntent);
     dumpVal(out, "dataspace", toString(dataspace), dataspace);
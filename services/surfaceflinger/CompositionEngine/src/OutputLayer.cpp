@@ -332,6 +332,18 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) {
         return;
     }
 
+    // The layer geometry is sent again when the layer joins or leaves a
+    // flattened run, see Flattener.
+    if (state.overrideInfoChanged) {
+        editState().overrideInfoChanged = false;
+        includeGeometry = true;
+    }
+
+    if (state.overrideInfo.buffer) {
+        writeOverrideStateToHWC(hwcLayer.get(), includeGeometry);
+        return;
+    }
+
     auto requestedCompositionType = outputIndependentState->compositionType;
 
     if (includeGeometry) {
@@ -346,6 +358,102 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) {
 
     // Always set the layer color after setting the composition type.
     writeSolidColorStateToHWC(hwcLayer.get(), *outputIndependentState);
+
+    if (state.overrideInfo.skip) {
+        writeSkippedStateToHWC(hwcLayer.get(), includeGeometry);
+    }
+}
+
+void OutputLayer::writeOverrideStateToHWC(HWC2::Layer* hwcLayer, bool includeGeometry) {
+    const auto& overrideInfo = getState().overrideInfo;
+
+    // The override buffer covers the output, so the display frame of the run
+    // is also its source crop.
+    if (includeGeometry) {
+        if (auto error = hwcLayer->setDisplayFrame(overrideInfo.displayFrame);
+            error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set override display frame [%d, %d, %d, %d]: %s (%d)",
+                  getLayerFE().getDebugName(), overrideInfo.displayFrame.left,
+                  overrideInfo.displayFrame.top, overrideInfo.displayFrame.right,
+                  overrideInfo.displayFrame.bottom, to_string(error).c_str(),
+                  static_cast<int32_t>(error));
+        }
+
+        if (auto error = hwcLayer->setSourceCrop(overrideInfo.displayFrame.toFloatRect());
+            error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set override source crop: %s (%d)", getLayerFE().getDebugName(),
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+
+        if (auto error = hwcLayer->setZOrder(getState().z); error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set Z %u: %s (%d)", getLayerFE().getDebugName(), getState().z,
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+
+        if (auto error = hwcLayer->setTransform(static_cast<hal::Transform>(0));
+            error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set override transform: %s (%d)", getLayerFE().getDebugName(),
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+
+        if (auto error = hwcLayer->setBlendMode(hal::BlendMode::PREMULTIPLIED);
+            error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set override blend mode: %s (%d)", getLayerFE().getDebugName(),
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+
+        if (auto error = hwcLayer->setPlaneAlpha(1.f); error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set override plane alpha: %s (%d)", getLayerFE().getDebugName(),
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+    }
+
+    if (auto error = hwcLayer->setVisibleRegion(overrideInfo.visibleRegion);
+        error != hal::Error::NONE) {
+        ALOGE("[%s] Failed to set override visible region: %s (%d)", getLayerFE().getDebugName(),
+              to_string(error).c_str(), static_cast<int32_t>(error));
+        overrideInfo.visibleRegion.dump(LOG_TAG);
+    }
+
+    if (auto error = hwcLayer->setDataspace(overrideInfo.dataspace); error != hal::Error::NONE) {
+        ALOGE("[%s] Failed to set override dataspace %d: %s (%d)", getLayerFE().getDebugName(),
+              overrideInfo.dataspace, to_string(error).c_str(), static_cast<int32_t>(error));
+    }
+
+    if (auto error = hwcLayer->setSurfaceDamage(overrideInfo.damageRegion);
+        error != hal::Error::NONE) {
+        ALOGE("[%s] Failed to set override surface damage: %s (%d)", getLayerFE().getDebugName(),
+              to_string(error).c_str(), static_cast<int32_t>(error));
+    }
+
+    uint32_t hwcSlot = 0;
+    sp<GraphicBuffer> hwcBuffer;
+    editState().hwc->hwcBufferCache.getOverrideHwcBuffer(overrideInfo.buffer, &hwcSlot,
+                                                         &hwcBuffer);
+
+    if (auto error = hwcLayer->setBuffer(hwcSlot, hwcBuffer, overrideInfo.acquireFence);
+        error != hal::Error::NONE) {
+        ALOGE("[%s] Failed to set override buffer %p: %s (%d)", getLayerFE().getDebugName(),
+              overrideInfo.buffer->handle, to_string(error).c_str(), static_cast<int32_t>(error));
+    }
+
+    writeCompositionTypeToHWC(hwcLayer, hal::Composition::DEVICE);
+}
+
+void OutputLayer::writeSkippedStateToHWC(HWC2::Layer* hwcLayer, bool includeGeometry) {
+    // HWC2 has no way to leave a layer out of a frame, so the layers a
+    // flattened run stands in for are made fully transparent instead.
+    if (includeGeometry) {
+        if (auto error = hwcLayer->setPlaneAlpha(0.f); error != hal::Error::NONE) {
+            ALOGE("[%s] Failed to set skipped plane alpha: %s (%d)", getLayerFE().getDebugName(),
+                  to_string(error).c_str(), static_cast<int32_t>(error));
+        }
+    }
+
+    if (auto error = hwcLayer->setVisibleRegion(Region()); error != hal::Error::NONE) {
+        ALOGE("[%s] Failed to set skipped visible region: %s (%d)", getLayerFE().getDebugName(),
+              to_string(error).c_str(), static_cast<int32_t>(error));
+    }
 }
 
 void OutputLayer::writeOutputDependentGeometryStateToHWC(
@@ -69,6 +69,15 @@ void OutputLayerCompositionState::dump(std::string& out) const {
     dumpVal(out, "dataspace", toString(dataspace), dataspace);
     dumpVal(out, "z-index", z);
 
+    if (overrideInfo.buffer) {
+        out.append("\n      override: ");
+        dumpVal(out, "buffer", overrideInfo.buffer.get());
+        dumpVal(out, "displayFrame", overrideInfo.displayFrame);
+        dumpVal(out, "dataspace", toString(overrideInfo.dataspace), overrideInfo.dataspace);
+    } else if (overrideInfo.skip) {
+        out.append("\n      override: skipped");
+    }
+
     if (hwc) {
         dumpHwc(*hwc, out);
     }
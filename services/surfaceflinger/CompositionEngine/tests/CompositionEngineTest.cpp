@@ -26,11 +26,14 @@
 #include "MockHWComposer.h"
 #include "TimeStats/TimeStats.h"
 
+#include <atomic>
+
 namespace android::compositionengine {
 namespace {
 
 using ::testing::_;
 using ::testing::InSequence;
+using ::testing::Invoke;
 using ::testing::Ref;
 using ::testing::Return;
 using ::testing::ReturnRef;
@@ -122,6 +125,42 @@ TEST_F(CompositionEnginePresentTest, worksAsExpected) {
     mEngine.present(mRefreshArgs);
 }
 
+TEST_F(CompositionEnginePresentTest, updatesOutputsConcurrentlyIfRequested) {
+    EXPECT_CALL(mEngine, preComposition(Ref(mRefreshArgs)));
+
+    // Every output must have its composition state updated before any of them
+    // is presented.
+    std::atomic<int> updatedOutputs = 0;
+    for (const auto& output : {mOutput1, mOutput2, mOutput3}) {
+        InSequence seq;
+        EXPECT_CALL(*output, prepare(Ref(mRefreshArgs), _));
+        EXPECT_CALL(*output, updateLayerStateFromFE(Ref(mRefreshArgs)));
+        EXPECT_CALL(*output, updateColorProfile(Ref(mRefreshArgs)));
+        EXPECT_CALL(*output, updateCompositionState(Ref(mRefreshArgs)))
+                .WillOnce(Invoke([&](const CompositionRefreshArgs&) { updatedOutputs++; }));
+        EXPECT_CALL(*output, presentUpdatedState(Ref(mRefreshArgs)))
+                .WillOnce(Invoke([&](const CompositionRefreshArgs&) {
+                    EXPECT_EQ(3, updatedOutputs);
+                }));
+    }
+
+    mRefreshArgs.outputs = {mOutput1, mOutput2, mOutput3};
+    mRefreshArgs.updateOutputsConcurrently = true;
+    mEngine.present(mRefreshArgs);
+}
+
+TEST_F(CompositionEnginePresentTest, presentsSingleOutputDirectlyEvenIfConcurrent) {
+    InSequence seq;
+    EXPECT_CALL(mEngine, preComposition(Ref(mRefreshArgs)));
+    EXPECT_CALL(*mOutput1, prepare(Ref(mRefreshArgs), _));
+    EXPECT_CALL(*mOutput1, updateLayerStateFromFE(Ref(mRefreshArgs)));
+    EXPECT_CALL(*mOutput1, present(Ref(mRefreshArgs)));
+
+    mRefreshArgs.outputs = {mOutput1};
+    mRefreshArgs.updateOutputsConcurrently = true;
+    mEngine.present(mRefreshArgs);
+}
+
 /*
  * CompositionEngine::updateCursorAsync
  */
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+
+#include <compositionengine/impl/Flattener.h>
+#include <compositionengine/impl/OutputCompositionState.h>
+#include <compositionengine/impl/OutputLayerCompositionState.h>
+#include <compositionengine/mock/LayerFE.h>
+#include <compositionengine/mock/OutputLayer.h>
+#include <gtest/gtest.h>
+#include <renderengine/mock/RenderEngine.h>
+
+#include "MockHWC2.h"
+
+namespace android::compositionengine {
+namespace {
+
+namespace hal = android::hardware::graphics::composer::hal;
+
+using impl::Flattener;
+using testing::_;
+using testing::Return;
+using testing::ReturnRef;
+using testing::StrictMock;
+
+const Rect kOutputBounds{0, 0, 1080, 2340};
+const ui::Size kOutputSize{1080, 2340};
+
+struct FlattenerTest : public testing::Test {
+    struct Layer {
+        Layer() {
+            EXPECT_CALL(outputLayer, getLayerFE()).WillRepeatedly(ReturnRef(*layerFE));
+            EXPECT_CALL(outputLayer, getState()).WillRepeatedly(ReturnRef(outputLayerState));
+            EXPECT_CALL(outputLayer, editState()).WillRepeatedly(ReturnRef(outputLayerState));
+            EXPECT_CALL(outputLayer, needsFiltering()).WillRepeatedly(Return(false));
+            EXPECT_CALL(*layerFE, getCompositionState()).WillRepeatedly(Return(&layerFEState));
+            EXPECT_CALL(*layerFE, getDebugName()).WillRepeatedly(Return("Test LayerFE"));
+
+            layerFEState.compositionType = hal::Composition::DEVICE;
+            layerFEState.buffer = new GraphicBuffer();
+            layerFEState.acquireFence = new Fence();
+            outputLayerState.hwc = impl::OutputLayerCompositionState::Hwc(hwcLayer);
+            outputLayerState.hwc->hwcCompositionType = hal::Composition::DEVICE;
+        }
+
+        StrictMock<mock::OutputLayer> outputLayer;
+        sp<StrictMock<mock::LayerFE>> layerFE = new StrictMock<mock::LayerFE>();
+        std::shared_ptr<HWC2::mock::Layer> hwcLayer = std::make_shared<HWC2::mock::Layer>();
+        LayerFECompositionState layerFEState;
+        impl::OutputLayerCompositionState outputLayerState;
+    };
+
+    FlattenerTest() {
+        mOutputState.viewport = kOutputBounds;
+        mOutputState.sourceClip = kOutputBounds;
+        mOutputState.destinationClip = kOutputBounds;
+
+        for (size_t i = 0; i < mLayers.size(); i++) {
+            auto& layer = mLayers[i];
+            layer.outputLayerState.z = static_cast<uint32_t>(i);
+            layer.outputLayerState.displayFrame = Rect(0, static_cast<int32_t>(100 * i), 1080,
+                                                       static_cast<int32_t>(100 * (i + 1)));
+            layer.outputLayerState.visibleRegion = Region(layer.outputLayerState.displayFrame);
+            layer.outputLayerState.outputSpaceVisibleRegion =
+                    Region(layer.outputLayerState.displayFrame);
+            mOutputLayers.push_back(&layer.outputLayer);
+        }
+
+        EXPECT_CALL(mRenderEngine, isProtected()).WillRepeatedly(Return(false));
+    }
+
+    void planFrames(uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            mFlattener.plan(mOutputLayers, mOutputState);
+        }
+    }
+
+    void expectRenderedLayers() {
+        for (auto& layer : mLayers) {
+            EXPECT_CALL(*layer.layerFE, prepareClientCompositionList(_))
+                    .WillOnce(Return(std::vector<LayerFE::LayerSettings>{LayerFE::LayerSettings{}}));
+        }
+        EXPECT_CALL(mRenderEngine, drawLayers(_, _, _, false, _, _))
+                .WillOnce(Return(NO_ERROR));
+    }
+
+    void renderCachedSets() {
+        mFlattener.renderCachedSets(mOutputLayers, mOutputState, mRenderEngine,
+                                    renderengine::DisplaySettings{}, kOutputSize);
+    }
+
+    void flattenAllLayers() {
+        planFrames(Flattener::kUnchangedFrameThreshold + 1);
+        expectRenderedLayers();
+        renderCachedSets();
+        mFlattener.plan(mOutputLayers, mOutputState);
+    }
+
+    impl::OutputCompositionState mOutputState;
+    StrictMock<renderengine::mock::RenderEngine> mRenderEngine;
+    std::array<Layer, 3> mLayers;
+    std::vector<compositionengine::OutputLayer*> mOutputLayers;
+    Flattener mFlattener;
+};
+
+TEST_F(FlattenerTest, doesNotFlattenLayersThatChangedRecently) {
+    planFrames(Flattener::kUnchangedFrameThreshold);
+    renderCachedSets();
+
+    for (const auto& layer : mLayers) {
+        EXPECT_EQ(nullptr, layer.outputLayerState.overrideInfo.buffer);
+        EXPECT_FALSE(layer.outputLayerState.overrideInfo.skip);
+    }
+}
+
+TEST_F(FlattenerTest, flattensUnchangedLayers) {
+    flattenAllLayers();
+
+    const auto& bottomOverride = mLayers[0].outputLayerState.overrideInfo;
+    EXPECT_NE(nullptr, bottomOverride.buffer);
+    EXPECT_EQ(Rect(0, 0, 1080, 300), bottomOverride.displayFrame);
+    EXPECT_TRUE(bottomOverride.visibleRegion.hasSameRects(Region(Rect(0, 0, 1080, 300))));
+    EXPECT_TRUE(mLayers[0].outputLayerState.overrideInfoChanged);
+    EXPECT_TRUE(mLayers[1].outputLayerState.overrideInfo.skip);
+    EXPECT_TRUE(mLayers[2].outputLayerState.overrideInfo.skip);
+}
+
+TEST_F(FlattenerTest, reportsDamageOnlyTheFirstTimeTheBufferIsPresented) {
+    flattenAllLayers();
+    EXPECT_TRUE(mLayers[0].outputLayerState.overrideInfo.damageRegion.hasSameRects(
+            Region::INVALID_REGION));
+
+    mFlattener.plan(mOutputLayers, mOutputState);
+    EXPECT_TRUE(mLayers[0].outputLayerState.overrideInfo.damageRegion.isEmpty());
+}
+
+TEST_F(FlattenerTest, expandsRunWhenALayerChanges) {
+    flattenAllLayers();
+    for (auto& layer : mLayers) {
+        layer.outputLayerState.overrideInfoChanged = false;
+    }
+
+    mLayers[1].layerFEState.acquireFence = new Fence();
+    mFlattener.plan(mOutputLayers, mOutputState);
+
+    for (const auto& layer : mLayers) {
+        EXPECT_EQ(nullptr, layer.outputLayerState.overrideInfo.buffer);
+        EXPECT_FALSE(layer.outputLayerState.overrideInfo.skip);
+        EXPECT_TRUE(layer.outputLayerState.overrideInfoChanged);
+    }
+}
+
+TEST_F(FlattenerTest, doesNotFlattenClientComposedLayers) {
+    mLayers[1].outputLayerState.hwc->hwcCompositionType = hal::Composition::CLIENT;
+
+    // Layers 0 and 2 are unchanged, but are not adjacent.
+    planFrames(Flattener::kUnchangedFrameThreshold + 1);
+    renderCachedSets();
+}
+
+TEST_F(FlattenerTest, doesNotFlattenSecureLayers) {
+    mLayers[0].layerFEState.isSecure = true;
+
+    // Only layers 1 and 2 are flattened.
+    planFrames(Flattener::kUnchangedFrameThreshold + 1);
+    EXPECT_CALL(*mLayers[1].layerFE, prepareClientCompositionList(_))
+            .WillOnce(Return(std::vector<LayerFE::LayerSettings>{}));
+    EXPECT_CALL(*mLayers[2].layerFE, prepareClientCompositionList(_))
+            .WillOnce(Return(std::vector<LayerFE::LayerSettings>{}));
+    EXPECT_CALL(mRenderEngine, drawLayers(_, _, _, false, _, _)).WillOnce(Return(NO_ERROR));
+    renderCachedSets();
+    mFlattener.plan(mOutputLayers, mOutputState);
+
+    EXPECT_EQ(nullptr, mLayers[0].outputLayerState.overrideInfo.buffer);
+    EXPECT_NE(nullptr, mLayers[1].outputLayerState.overrideInfo.buffer);
+    EXPECT_TRUE(mLayers[2].outputLayerState.overrideInfo.skip);
+}
+
+TEST_F(FlattenerTest, resetClearsOverrides) {
+    flattenAllLayers();
+
+    mFlattener.reset(mOutputLayers);
+
+    for (const auto& layer : mLayers) {
+        EXPECT_EQ(nullptr, layer.outputLayerState.overrideInfo.buffer);
+        EXPECT_FALSE(layer.outputLayerState.overrideInfo.skip);
+    }
+}
+
+} // namespace
+} // namespace android::compositionengine
@@ -82,5 +82,32 @@ TEST_F(HwcBufferCacheTest, cacheMapsNegativeSlotToZero) {
     testSlot(-123, 0);
 }
 
+TEST_F(HwcBufferCacheTest, overrideBufferDoesNotEvictProducerSlots) {
+    uint32_t outSlot;
+    sp<GraphicBuffer> outBuffer;
+
+    // A producer buffer in the last BufferQueue slot.
+    mCache.getHwcBuffer(BufferQueue::NUM_BUFFER_SLOTS - 1, mBuffer1, &outSlot, &outBuffer);
+    EXPECT_EQ(mBuffer1, outBuffer);
+
+    mCache.getOverrideHwcBuffer(mBuffer2, &outSlot, &outBuffer);
+    EXPECT_EQ(impl::HwcBufferCache::FLATTENER_CACHING_SLOT, outSlot);
+    EXPECT_EQ(mBuffer2, outBuffer);
+    mCache.getOverrideHwcBuffer(mBuffer2, &outSlot, &outBuffer);
+    EXPECT_EQ(nullptr, outBuffer.get());
+
+    // Switching back to the producer buffer does not resend it, and the
+    // override buffer is still cached afterwards.
+    mCache.getHwcBuffer(BufferQueue::NUM_BUFFER_SLOTS - 1, mBuffer1, &outSlot, &outBuffer);
+    EXPECT_EQ(static_cast<uint32_t>(BufferQueue::NUM_BUFFER_SLOTS - 1), outSlot);
+    EXPECT_EQ(nullptr, outBuffer.get());
+    mCache.getOverrideHwcBuffer(mBuffer2, &outSlot, &outBuffer);
+    EXPECT_EQ(nullptr, outBuffer.get());
+}
+
+TEST_F(HwcBufferCacheTest, outOfRangeSlotDoesNotUseOverrideSlot) {
+    testSlot(BufferQueue::NUM_BUFFER_SLOTS, 0);
+}
+
 } // namespace
 } // namespace android::compositionengine
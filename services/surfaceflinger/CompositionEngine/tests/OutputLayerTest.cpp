@@ -971,6 +971,63 @@ TEST_F(OutputLayerWriteStateToHWCTest, perFrameStateDoesNotIncludeMetadataIfPres
     mOutputLayer.writeStateToHWC(false);
 }
 
+TEST_F(OutputLayerWriteStateToHWCTest, overrideBufferReplacesLayerState) {
+    const sp<GraphicBuffer> overrideBuffer = new GraphicBuffer();
+    const sp<Fence> overrideFence = new Fence();
+    const Rect overrideDisplayFrame{0, 0, 1080, 300};
+    const Region overrideVisibleRegion{Rect{0, 0, 1080, 200}};
+    constexpr ui::Dataspace overrideDataspace = ui::Dataspace::SRGB;
+
+    mLayerFEState.compositionType = Hwc2::IComposerClient::Composition::SOLID_COLOR;
+    auto& outputLayerState = mOutputLayer.editState();
+    outputLayerState.overrideInfo.buffer = overrideBuffer;
+    outputLayerState.overrideInfo.acquireFence = overrideFence;
+    outputLayerState.overrideInfo.displayFrame = overrideDisplayFrame;
+    outputLayerState.overrideInfo.dataspace = overrideDataspace;
+    outputLayerState.overrideInfo.visibleRegion = overrideVisibleRegion;
+    outputLayerState.overrideInfo.damageRegion = Region::INVALID_REGION;
+    outputLayerState.overrideInfoChanged = true;
+
+    // The geometry is sent even though this frame does not update it, as the
+    // override state changed.
+    EXPECT_CALL(*mHwcLayer, setDisplayFrame(overrideDisplayFrame)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setSourceCrop(overrideDisplayFrame.toFloatRect()))
+            .WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setZOrder(kZOrder)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setTransform(static_cast<hal::Transform>(0)))
+            .WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setBlendMode(hal::BlendMode::PREMULTIPLIED)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setPlaneAlpha(1.f)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setVisibleRegion(RegionEq(overrideVisibleRegion)))
+            .WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setDataspace(overrideDataspace)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setSurfaceDamage(RegionEq(Region::INVALID_REGION)))
+            .WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer,
+                setBuffer(impl::HwcBufferCache::FLATTENER_CACHING_SLOT, overrideBuffer,
+                          overrideFence));
+    expectSetCompositionTypeCall(Hwc2::IComposerClient::Composition::DEVICE);
+
+    mOutputLayer.writeStateToHWC(false);
+
+    EXPECT_FALSE(mOutputLayer.getState().overrideInfoChanged);
+}
+
+TEST_F(OutputLayerWriteStateToHWCTest, skippedLayerIsHidden) {
+    mLayerFEState.compositionType = Hwc2::IComposerClient::Composition::DEVICE;
+    mOutputLayer.editState().overrideInfo.skip = true;
+    mOutputLayer.editState().overrideInfoChanged = true;
+
+    expectGeometryCommonCalls();
+    expectPerFrameCommonCalls();
+    expectSetHdrMetadataAndBufferCalls();
+    expectSetCompositionTypeCall(Hwc2::IComposerClient::Composition::DEVICE);
+    EXPECT_CALL(*mHwcLayer, setPlaneAlpha(0.f)).WillOnce(Return(kError));
+    EXPECT_CALL(*mHwcLayer, setVisibleRegion(RegionEq(Region()))).WillOnce(Return(kError));
+
+    mOutputLayer.writeStateToHWC(false);
+}
+
 /*
  * OutputLayer::writeCursorPositionToHWC()
  */
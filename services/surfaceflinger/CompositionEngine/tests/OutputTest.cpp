@@ -764,6 +764,23 @@ TEST_F(OutputUpdateAndWriteCompositionStateTest, forcesClientCompositionForAllLa
     mOutput->updateAndWriteCompositionState(args);
 }
 
+TEST_F(OutputUpdateAndWriteCompositionStateTest, updateCompositionStateDoesNotWriteToHWC) {
+    InjectedLayer layer1;
+    InjectedLayer layer2;
+
+    EXPECT_CALL(*layer1.outputLayer, updateCompositionState(true, false, ui::Transform::ROT_0));
+    EXPECT_CALL(*layer2.outputLayer, updateCompositionState(true, false, ui::Transform::ROT_0));
+
+    injectOutputLayer(layer1);
+    injectOutputLayer(layer2);
+
+    mOutput->editState().isEnabled = true;
+
+    CompositionRefreshArgs args;
+    args.updatingGeometryThisFrame = true;
+    mOutput->updateCompositionState(args);
+}
+
 /*
  * Output::prepareFrame()
  */
@@ -1534,6 +1551,41 @@ TEST_F(OutputEnsureOutputLayerIfVisibleTest, takesNotSoEarlyOutifLayerWithShadow
     ensureOutputLayerIfVisible();
 }
 
+TEST_F(OutputEnsureOutputLayerIfVisibleTest, reusesVisibilityOfUnchangedLayers) {
+    CompositionRefreshArgs args;
+    args.layers.push_back(mLayer.layerFE);
+
+    EXPECT_CALL(mOutput, ensureOutputLayer(Eq(0u), Eq(mLayer.layerFE)))
+            .Times(3)
+            .WillRepeatedly(Return(&mLayer.outputLayer));
+    EXPECT_CALL(mOutput, finalizePendingOutputLayers()).Times(3);
+
+    auto collectVisibleLayers = [&] {
+        Output::CoverageState coverage{mGeomSnapshots};
+        mOutput.collectVisibleLayers(args, coverage);
+        return coverage.dirtyRegion;
+    };
+
+    EXPECT_THAT(collectVisibleLayers(), RegionEq(kFullBoundsNoRotation));
+    EXPECT_EQ(1u, mOutput.getState().recomputedVisibilityLayerCount);
+    EXPECT_EQ(0u, mOutput.getState().reusedVisibilityLayerCount);
+
+    // Nothing changed, and the content is no longer dirty, so nothing needs
+    // to be redrawn.
+    mLayer.layerFEState.contentDirty = false;
+    EXPECT_THAT(collectVisibleLayers(), RegionEq(kEmptyRegion));
+    EXPECT_EQ(0u, mOutput.getState().recomputedVisibilityLayerCount);
+    EXPECT_EQ(1u, mOutput.getState().reusedVisibilityLayerCount);
+    EXPECT_THAT(mLayer.outputLayerState.visibleRegion, RegionEq(kFullBoundsNoRotation));
+
+    // A geometry change forces the layer to be recomputed.
+    mLayer.layerFEState.geomLayerBounds = FloatRect{0, 0, 100, 100};
+    collectVisibleLayers();
+    EXPECT_EQ(1u, mOutput.getState().recomputedVisibilityLayerCount);
+    EXPECT_EQ(0u, mOutput.getState().reusedVisibilityLayerCount);
+    EXPECT_THAT(mLayer.outputLayerState.visibleRegion, RegionEq(Region(Rect(0, 0, 100, 100))));
+}
+
 /*
  * Output::present()
  */
@@ -1572,6 +1624,20 @@ TEST_F(OutputPresentTest, justInvokesChildFunctionsInSequence) {
     mOutput.present(args);
 }
 
+TEST_F(OutputPresentTest, presentUpdatedStateInvokesRemainingChildFunctionsInSequence) {
+    CompositionRefreshArgs args;
+
+    InSequence seq;
+    EXPECT_CALL(mOutput, setColorTransform(Ref(args)));
+    EXPECT_CALL(mOutput, beginFrame());
+    EXPECT_CALL(mOutput, prepareFrame());
+    EXPECT_CALL(mOutput, devOptRepaintFlash(Ref(args)));
+    EXPECT_CALL(mOutput, finishFrame(Ref(args)));
+    EXPECT_CALL(mOutput, postFramebuffer());
+
+    mOutput.presentUpdatedState(args);
+}
+
 /*
  * Output::updateColorProfile()
  */
@@ -45,6 +45,10 @@ Composer::~Composer() = default;
 
 namespace {
 
+// Every BufferQueue slot, plus one that no producer can use, in which
+// CompositionEngine caches the buffer of a flattened run of layers.
+constexpr uint32_t kMaxLayerBufferCount = BufferQueue::NUM_BUFFER_SLOTS + 1;
+
 class BufferHandle {
 public:
     explicit BufferHandle(const native_handle_t* buffer) {
@@ -334,7 +338,7 @@ Error Composer::acceptDisplayChanges(Display display)
 Error Composer::createLayer(Display display, Layer* outLayer)
 {
     Error error = kDefaultError;
-    mClient->createLayer(display, BufferQueue::NUM_BUFFER_SLOTS,
+    mClient->createLayer(display, kMaxLayerBufferCount,
             [&](const auto& tmpError, const auto& tmpLayer) {
                 error = tmpError;
                 if (error != Error::NONE) {
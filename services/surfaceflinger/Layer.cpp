@@ -1691,6 +1691,12 @@ void Layer::dumpFrameEvents(std::string& result) {
     mFrameEventHistory.dump(result);
 }
 
+void Layer::dumpFrameLatencies(std::string& result) {
+    StringAppendF(&result, "- Layer %s (%s, %p)\n", getName().c_str(), getType(), this);
+    Mutex::Autolock lock(mFrameEventHistoryMutex);
+    mFrameEventHistory.getLatencies().dump(result);
+}
+
 void Layer::dumpCallingUidPid(std::string& result) const {
     StringAppendF(&result, "Layer %s (%s) pid:%d uid:%d\n", getName().c_str(), getType(),
                   mCallingPid, mCallingUid);
@@ -2220,165 +2226,254 @@ void Layer::setInputInfo(const InputWindowInfo& info) {
     setTransactionFlags(eTransactionNeeded);
 }
 
-LayerProto* Layer::writeToProto(LayersProto& layersProto, uint32_t traceFlags,
-                                const DisplayDevice* display) const {
-    LayerProto* layerProto = layersProto.add_layers();
-    writeToProtoDrawingState(layerProto, traceFlags, display);
-    writeToProtoCommonState(layerProto, LayerVector::StateSet::Drawing, traceFlags);
+void Layer::snapshotForProto(std::vector<LayerProtoSnapshot>& snapshots, uint32_t traceFlags,
+                             const DisplayDevice* display) const {
+    LayerProtoSnapshot& snapshot = snapshots.emplace_back();
+    snapshot.traceFlags = traceFlags;
+    snapshot.id = sequence;
+    snapshotDrawingState(snapshot, traceFlags, display);
+    snapshotCommonState(snapshot, LayerVector::StateSet::Drawing, traceFlags);
 
     if (traceFlags & SurfaceTracing::TRACE_COMPOSITION) {
         // Only populate for the primary display.
         if (display) {
-            const Hwc2::IComposerClient::Composition compositionType = getCompositionType(*display);
-            layerProto->set_hwc_composition_type(static_cast<HwcCompositionType>(compositionType));
+            snapshot.compositionType = getCompositionType(*display);
         }
     }
 
     for (const sp<Layer>& layer : mDrawingChildren) {
-        layer->writeToProto(layersProto, traceFlags, display);
+        layer->snapshotForProto(snapshots, traceFlags, display);
     }
-
-    return layerProto;
 }
 
-void Layer::writeToProtoDrawingState(LayerProto* layerInfo, uint32_t traceFlags,
-                                     const DisplayDevice* display) const {
-    ui::Transform transform = getTransform();
-
+void Layer::snapshotDrawingState(LayerProtoSnapshot& snapshot, uint32_t traceFlags,
+                                 const DisplayDevice* display) const {
     if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
         for (const auto& pendingState : mPendingStatesSnapshot) {
             auto barrierLayer = pendingState.barrierLayer_legacy.promote();
             if (barrierLayer != nullptr) {
-                BarrierLayerProto* barrierLayerProto = layerInfo->add_barrier_layer();
-                barrierLayerProto->set_id(barrierLayer->sequence);
-                barrierLayerProto->set_frame_number(pendingState.frameNumber_legacy);
+                snapshot.barrierLayers.emplace_back(barrierLayer->sequence,
+                                                    pendingState.frameNumber_legacy);
             }
         }
 
         auto buffer = getBuffer();
         if (buffer != nullptr) {
-            LayerProtoHelper::writeToProto(buffer,
-                                           [&]() { return layerInfo->mutable_active_buffer(); });
-            LayerProtoHelper::writeToProto(ui::Transform(getBufferTransform()),
-                                           layerInfo->mutable_buffer_transform());
+            snapshot.hasBuffer = true;
+            snapshot.bufferWidth = buffer->getWidth();
+            snapshot.bufferHeight = buffer->getHeight();
+            snapshot.bufferStride = buffer->getStride();
+            snapshot.bufferFormat = buffer->format;
+            snapshot.bufferTransform = getBufferTransform();
         }
-        layerInfo->set_invalidate(contentDirty);
-        layerInfo->set_is_protected(isProtected());
-        layerInfo->set_dataspace(dataspaceDetails(static_cast<android_dataspace>(getDataSpace())));
-        layerInfo->set_queued_frames(getQueuedFrameCount());
-        layerInfo->set_refresh_pending(isBufferLatched());
-        layerInfo->set_curr_frame(mCurrentFrameNumber);
-        layerInfo->set_effective_scaling_mode(getEffectiveScalingMode());
-
-        layerInfo->set_corner_radius(getRoundedCornerState().radius);
-        layerInfo->set_is_trusted_overlay(isTrustedOverlay());
-        LayerProtoHelper::writeToProto(transform, layerInfo->mutable_transform());
-        LayerProtoHelper::writePositionToProto(transform.tx(), transform.ty(),
-                                               [&]() { return layerInfo->mutable_position(); });
-        LayerProtoHelper::writeToProto(mBounds, [&]() { return layerInfo->mutable_bounds(); });
+        snapshot.invalidate = contentDirty;
+        snapshot.isProtected = isProtected();
+        snapshot.dataspace = getDataSpace();
+        snapshot.queuedFrames = getQueuedFrameCount();
+        snapshot.refreshPending = isBufferLatched();
+        snapshot.currFrame = mCurrentFrameNumber;
+        snapshot.effectiveScalingMode = getEffectiveScalingMode();
+
+        snapshot.cornerRadius = getRoundedCornerState().radius;
+        snapshot.isTrustedOverlay = isTrustedOverlay();
+        snapshot.transform = getTransform();
+        snapshot.bounds = mBounds;
         if (traceFlags & SurfaceTracing::TRACE_COMPOSITION) {
-            LayerProtoHelper::writeToProto(getVisibleRegion(display),
-                                           [&]() { return layerInfo->mutable_visible_region(); });
+            snapshot.visibleRegion = getVisibleRegion(display);
         }
-        LayerProtoHelper::writeToProto(surfaceDamageRegion,
-                                       [&]() { return layerInfo->mutable_damage_region(); });
+        snapshot.damageRegion = surfaceDamageRegion;
 
         if (hasColorTransform()) {
-            LayerProtoHelper::writeToProto(getColorTransform(),
-                                           layerInfo->mutable_color_transform());
+            snapshot.colorTransform = getColorTransform();
         }
     }
 
-    LayerProtoHelper::writeToProto(mSourceBounds,
-                                   [&]() { return layerInfo->mutable_source_bounds(); });
-    LayerProtoHelper::writeToProto(mScreenBounds,
-                                   [&]() { return layerInfo->mutable_screen_bounds(); });
-    LayerProtoHelper::writeToProto(getRoundedCornerState().cropRect,
-                                   [&]() { return layerInfo->mutable_corner_radius_crop(); });
-    layerInfo->set_shadow_radius(mEffectiveShadowRadius);
+    snapshot.sourceBounds = mSourceBounds;
+    snapshot.screenBounds = mScreenBounds;
+    snapshot.cornerRadiusCrop = getRoundedCornerState().cropRect;
+    snapshot.shadowRadius = mEffectiveShadowRadius;
 }
 
-void Layer::writeToProtoCommonState(LayerProto* layerInfo, LayerVector::StateSet stateSet,
-                                    uint32_t traceFlags) const {
+void Layer::snapshotCommonState(LayerProtoSnapshot& snapshot, LayerVector::StateSet stateSet,
+                                uint32_t traceFlags) const {
     const bool useDrawing = stateSet == LayerVector::StateSet::Drawing;
     const LayerVector& children = useDrawing ? mDrawingChildren : mCurrentChildren;
     const State& state = useDrawing ? mDrawingState : mCurrentState;
 
-    ui::Transform requestedTransform = state.active_legacy.transform;
-
     if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
-        layerInfo->set_id(sequence);
-        layerInfo->set_name(getName().c_str());
-        layerInfo->set_type(getType());
+        snapshot.name = getName();
+        snapshot.type = getType();
 
         for (const auto& child : children) {
-            layerInfo->add_children(child->sequence);
+            snapshot.children.push_back(child->sequence);
         }
 
         for (const wp<Layer>& weakRelative : state.zOrderRelatives) {
             sp<Layer> strongRelative = weakRelative.promote();
             if (strongRelative != nullptr) {
-                layerInfo->add_relatives(strongRelative->sequence);
+                snapshot.relatives.push_back(strongRelative->sequence);
             }
         }
 
-        LayerProtoHelper::writeToProto(state.activeTransparentRegion_legacy,
+        snapshot.transparentRegion = state.activeTransparentRegion_legacy;
+        snapshot.layerStack = getLayerStack();
+        snapshot.z = state.z;
+        snapshot.requestedTransform = state.active_legacy.transform;
+        snapshot.width = state.active_legacy.w;
+        snapshot.height = state.active_legacy.h;
+        snapshot.crop = state.crop_legacy;
+        snapshot.isOpaque = isOpaque(state);
+        snapshot.pixelFormat = getPixelFormat();
+        snapshot.color = getColor();
+        snapshot.requestedColor = state.color;
+        snapshot.flags = state.flags;
+
+        auto parent = useDrawing ? mDrawingParent.promote() : mCurrentParent.promote();
+        snapshot.parent = parent != nullptr ? parent->sequence : -1;
+
+        auto zOrderRelativeOf = state.zOrderRelativeOf.promote();
+        snapshot.zOrderRelativeOf = zOrderRelativeOf != nullptr ? zOrderRelativeOf->sequence : -1;
+
+        snapshot.isRelativeOf = state.isRelativeOf;
+    }
+
+    if (traceFlags & SurfaceTracing::TRACE_INPUT) {
+        snapshot.inputInfo = state.inputInfo;
+        auto cropLayer = state.touchableRegionCrop.promote();
+        if (cropLayer != nullptr) {
+            snapshot.touchableRegionCropId = cropLayer->sequence;
+            snapshot.touchableRegionCrop =
+                    cropLayer->getScreenBounds(false /* reduceTransparentRegion */);
+        }
+    }
+
+    if (traceFlags & SurfaceTracing::TRACE_EXTRA) {
+        snapshot.metadata = state.metadata;
+    }
+}
+
+LayerProto* Layer::writeToProto(const LayerProtoSnapshot& snapshot, LayersProto& layersProto) {
+    LayerProto* layerInfo = layersProto.add_layers();
+    const uint32_t traceFlags = snapshot.traceFlags;
+
+    if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
+        for (const auto& [barrierLayerId, frameNumber] : snapshot.barrierLayers) {
+            BarrierLayerProto* barrierLayerProto = layerInfo->add_barrier_layer();
+            barrierLayerProto->set_id(barrierLayerId);
+            barrierLayerProto->set_frame_number(frameNumber);
+        }
+
+        if (snapshot.hasBuffer) {
+            LayerProtoHelper::writeBufferToProto(snapshot.bufferWidth, snapshot.bufferHeight,
+                                                 snapshot.bufferStride, snapshot.bufferFormat,
+                                                 [&]() {
+                                                     return layerInfo->mutable_active_buffer();
+                                                 });
+            LayerProtoHelper::writeToProto(ui::Transform(snapshot.bufferTransform),
+                                           layerInfo->mutable_buffer_transform());
+        }
+        layerInfo->set_invalidate(snapshot.invalidate);
+        layerInfo->set_is_protected(snapshot.isProtected);
+        layerInfo->set_dataspace(
+                dataspaceDetails(static_cast<android_dataspace>(snapshot.dataspace)));
+        layerInfo->set_queued_frames(snapshot.queuedFrames);
+        layerInfo->set_refresh_pending(snapshot.refreshPending);
+        layerInfo->set_curr_frame(snapshot.currFrame);
+        layerInfo->set_effective_scaling_mode(snapshot.effectiveScalingMode);
+
+        layerInfo->set_corner_radius(snapshot.cornerRadius);
+        layerInfo->set_is_trusted_overlay(snapshot.isTrustedOverlay);
+        LayerProtoHelper::writeToProto(snapshot.transform, layerInfo->mutable_transform());
+        LayerProtoHelper::writePositionToProto(snapshot.transform.tx(), snapshot.transform.ty(),
+                                               [&]() { return layerInfo->mutable_position(); });
+        LayerProtoHelper::writeToProto(snapshot.bounds,
+                                       [&]() { return layerInfo->mutable_bounds(); });
+        if (traceFlags & SurfaceTracing::TRACE_COMPOSITION) {
+            LayerProtoHelper::writeToProto(snapshot.visibleRegion,
+                                           [&]() { return layerInfo->mutable_visible_region(); });
+        }
+        LayerProtoHelper::writeToProto(snapshot.damageRegion,
+                                       [&]() { return layerInfo->mutable_damage_region(); });
+
+        if (snapshot.colorTransform) {
+            LayerProtoHelper::writeToProto(*snapshot.colorTransform,
+                                           layerInfo->mutable_color_transform());
+        }
+    }
+
+    LayerProtoHelper::writeToProto(snapshot.sourceBounds,
+                                   [&]() { return layerInfo->mutable_source_bounds(); });
+    LayerProtoHelper::writeToProto(snapshot.screenBounds,
+                                   [&]() { return layerInfo->mutable_screen_bounds(); });
+    LayerProtoHelper::writeToProto(snapshot.cornerRadiusCrop,
+                                   [&]() { return layerInfo->mutable_corner_radius_crop(); });
+    layerInfo->set_shadow_radius(snapshot.shadowRadius);
+
+    if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
+        layerInfo->set_id(snapshot.id);
+        layerInfo->set_name(snapshot.name);
+        layerInfo->set_type(snapshot.type);
+
+        for (int32_t child : snapshot.children) {
+            layerInfo->add_children(child);
+        }
+        for (int32_t relative : snapshot.relatives) {
+            layerInfo->add_relatives(relative);
+        }
+
+        LayerProtoHelper::writeToProto(snapshot.transparentRegion,
                                        [&]() { return layerInfo->mutable_transparent_region(); });
 
-        layerInfo->set_layer_stack(getLayerStack());
-        layerInfo->set_z(state.z);
+        layerInfo->set_layer_stack(snapshot.layerStack);
+        layerInfo->set_z(snapshot.z);
 
+        const ui::Transform& requestedTransform = snapshot.requestedTransform;
         LayerProtoHelper::writePositionToProto(requestedTransform.tx(), requestedTransform.ty(),
                                                [&]() {
                                                    return layerInfo->mutable_requested_position();
                                                });
 
-        LayerProtoHelper::writeSizeToProto(state.active_legacy.w, state.active_legacy.h,
+        LayerProtoHelper::writeSizeToProto(snapshot.width, snapshot.height,
                                            [&]() { return layerInfo->mutable_size(); });
 
-        LayerProtoHelper::writeToProto(state.crop_legacy,
-                                       [&]() { return layerInfo->mutable_crop(); });
-
-        layerInfo->set_is_opaque(isOpaque(state));
+        LayerProtoHelper::writeToProto(snapshot.crop, [&]() { return layerInfo->mutable_crop(); });
 
+        layerInfo->set_is_opaque(snapshot.isOpaque);
 
-        layerInfo->set_pixel_format(decodePixelFormat(getPixelFormat()));
-        LayerProtoHelper::writeToProto(getColor(), [&]() { return layerInfo->mutable_color(); });
-        LayerProtoHelper::writeToProto(state.color,
+        layerInfo->set_pixel_format(decodePixelFormat(snapshot.pixelFormat));
+        LayerProtoHelper::writeToProto(snapshot.color,
+                                       [&]() { return layerInfo->mutable_color(); });
+        LayerProtoHelper::writeToProto(snapshot.requestedColor,
                                        [&]() { return layerInfo->mutable_requested_color(); });
-        layerInfo->set_flags(state.flags);
+        layerInfo->set_flags(snapshot.flags);
 
         LayerProtoHelper::writeToProto(requestedTransform,
                                        layerInfo->mutable_requested_transform());
 
-        auto parent = useDrawing ? mDrawingParent.promote() : mCurrentParent.promote();
-        if (parent != nullptr) {
-            layerInfo->set_parent(parent->sequence);
-        } else {
-            layerInfo->set_parent(-1);
-        }
-
-        auto zOrderRelativeOf = state.zOrderRelativeOf.promote();
-        if (zOrderRelativeOf != nullptr) {
-            layerInfo->set_z_order_relative_of(zOrderRelativeOf->sequence);
-        } else {
-            layerInfo->set_z_order_relative_of(-1);
-        }
-
-        layerInfo->set_is_relative_of(state.isRelativeOf);
+        layerInfo->set_parent(snapshot.parent);
+        layerInfo->set_z_order_relative_of(snapshot.zOrderRelativeOf);
+        layerInfo->set_is_relative_of(snapshot.isRelativeOf);
     }
 
     if (traceFlags & SurfaceTracing::TRACE_INPUT) {
-        LayerProtoHelper::writeToProto(state.inputInfo, state.touchableRegionCrop,
+        LayerProtoHelper::writeToProto(snapshot.inputInfo, snapshot.touchableRegionCropId,
+                                       snapshot.touchableRegionCrop,
                                        [&]() { return layerInfo->mutable_input_window_info(); });
     }
 
     if (traceFlags & SurfaceTracing::TRACE_EXTRA) {
         auto protoMap = layerInfo->mutable_metadata();
-        for (const auto& entry : state.metadata.mMap) {
+        for (const auto& entry : snapshot.metadata.mMap) {
             (*protoMap)[entry.first] = std::string(entry.second.cbegin(), entry.second.cend());
         }
     }
+
+    if (snapshot.compositionType) {
+        layerInfo->set_hwc_composition_type(
+                static_cast<HwcCompositionType>(*snapshot.compositionType));
+    }
+
+    return layerInfo;
 }
 
 bool Layer::isRemovedFromCurrentState() const  {
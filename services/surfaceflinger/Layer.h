@@ -39,6 +39,8 @@
 #include <cstdint>
 #include <list>
 #include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "Client.h"
@@ -93,6 +95,73 @@ struct LayerCreationArgs {
     uint32_t textureName;
 };
 
+// The state that Layer::writeToProto records for a layer, copied out so that the proto can be built
+// and serialized without holding the lock that guards the drawing state.
+struct LayerProtoSnapshot {
+    uint32_t traceFlags = 0;
+
+    // TRACE_CRITICAL
+    int32_t id = -1;
+    std::string name;
+    const char* type = "";
+    std::vector<int32_t> children;
+    std::vector<int32_t> relatives;
+    int32_t parent = -1;
+    int32_t zOrderRelativeOf = -1;
+    bool isRelativeOf = false;
+    // Barrier layer id and frame number of the pending states.
+    std::vector<std::pair<int32_t, uint64_t>> barrierLayers;
+    bool hasBuffer = false;
+    uint32_t bufferWidth = 0;
+    uint32_t bufferHeight = 0;
+    uint32_t bufferStride = 0;
+    PixelFormat bufferFormat = PIXEL_FORMAT_NONE;
+    uint32_t bufferTransform = 0;
+    bool invalidate = false;
+    bool isProtected = false;
+    ui::Dataspace dataspace = ui::Dataspace::UNKNOWN;
+    int32_t queuedFrames = 0;
+    bool refreshPending = false;
+    uint64_t currFrame = 0;
+    uint32_t effectiveScalingMode = 0;
+    float cornerRadius = 0.f;
+    bool isTrustedOverlay = false;
+    ui::Transform transform;
+    FloatRect bounds;
+    Region damageRegion;
+    std::optional<mat4> colorTransform;
+    Region transparentRegion;
+    uint32_t layerStack = 0;
+    int32_t z = 0;
+    ui::Transform requestedTransform;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    Rect crop;
+    bool isOpaque = false;
+    PixelFormat pixelFormat = PIXEL_FORMAT_NONE;
+    half4 color;
+    half4 requestedColor;
+    uint32_t flags = 0;
+
+    // TRACE_CRITICAL | TRACE_COMPOSITION
+    Region visibleRegion;
+    // TRACE_COMPOSITION, primary display only
+    std::optional<Hwc2::IComposerClient::Composition> compositionType;
+
+    // TRACE_INPUT
+    InputWindowInfo inputInfo;
+    int32_t touchableRegionCropId = -1;
+    Rect touchableRegionCrop;
+
+    // TRACE_EXTRA
+    LayerMetadata metadata;
+
+    FloatRect sourceBounds;
+    FloatRect screenBounds;
+    FloatRect cornerRadiusCrop;
+    float shadowRadius = 0.f;
+};
+
 class Layer : public virtual RefBase, compositionengine::LayerFE {
     static std::atomic<int32_t> sSequence;
     // The following constants represent priority of the window. SF uses this information when
@@ -537,19 +606,23 @@ public:
 
     bool isRemovedFromCurrentState() const;
 
-    LayerProto* writeToProto(LayersProto& layersProto, uint32_t traceFlags,
-                             const DisplayDevice*) const;
+    // Appends the snapshots of this layer and of its drawing children, depth first. This should
+    // be called in the main or tracing thread.
+    void snapshotForProto(std::vector<LayerProtoSnapshot>& snapshots, uint32_t traceFlags,
+                          const DisplayDevice*) const;
+    // Does not touch any layer, so it can be called from any thread.
+    static LayerProto* writeToProto(const LayerProtoSnapshot& snapshot, LayersProto& layersProto);
 
-    // Write states that are modified by the main thread. This includes drawing
+    // Snapshot states that are modified by the main thread. This includes drawing
     // state as well as buffer data. This should be called in the main or tracing
     // thread.
-    void writeToProtoDrawingState(LayerProto* layerInfo, uint32_t traceFlags,
-                                  const DisplayDevice*) const;
-    // Write drawing or current state. If writing current state, the caller should hold the
-    // external mStateLock. If writing drawing state, this function should be called on the
-    // main or tracing thread.
-    void writeToProtoCommonState(LayerProto* layerInfo, LayerVector::StateSet stateSet,
-                                 uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
+    void snapshotDrawingState(LayerProtoSnapshot& snapshot, uint32_t traceFlags,
+                              const DisplayDevice*) const;
+    // Snapshot drawing or current state. If snapshotting current state, the caller should hold
+    // the external mStateLock. If snapshotting drawing state, this function should be called on
+    // the main or tracing thread.
+    void snapshotCommonState(LayerProtoSnapshot& snapshot, LayerVector::StateSet stateSet,
+                             uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
 
     virtual Geometry getActiveGeometry(const Layer::State& s) const { return s.active_legacy; }
     virtual uint32_t getActiveWidth(const Layer::State& s) const { return s.active_legacy.w; }
@@ -731,6 +804,7 @@ public:
     void miniDump(std::string& result, const DisplayDevice&) const;
     void dumpFrameStats(std::string& result) const;
     void dumpFrameEvents(std::string& result);
+    void dumpFrameLatencies(std::string& result);
     void dumpCallingUidPid(std::string& result) const;
     void clearFrameStats();
     void logFrameStats();
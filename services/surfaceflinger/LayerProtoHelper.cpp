@@ -110,21 +110,21 @@ void LayerProtoHelper::writeToProto(const ui::Transform& transform,
     }
 }
 
-void LayerProtoHelper::writeToProto(const sp<GraphicBuffer>& buffer,
-                                    std::function<ActiveBufferProto*()> getActiveBufferProto) {
-    if (buffer->getWidth() != 0 || buffer->getHeight() != 0 || buffer->getStride() != 0 ||
-        buffer->format != 0) {
+void LayerProtoHelper::writeBufferToProto(
+        uint32_t width, uint32_t height, uint32_t stride, PixelFormat format,
+        std::function<ActiveBufferProto*()> getActiveBufferProto) {
+    if (width != 0 || height != 0 || stride != 0 || format != 0) {
         // Use a lambda do avoid writing the object header when the object is empty
         ActiveBufferProto* activeBufferProto = getActiveBufferProto();
-        activeBufferProto->set_width(buffer->getWidth());
-        activeBufferProto->set_height(buffer->getHeight());
-        activeBufferProto->set_stride(buffer->getStride());
-        activeBufferProto->set_format(buffer->format);
+        activeBufferProto->set_width(width);
+        activeBufferProto->set_height(height);
+        activeBufferProto->set_stride(stride);
+        activeBufferProto->set_format(format);
     }
 }
 
 void LayerProtoHelper::writeToProto(
-        const InputWindowInfo& inputInfo, const wp<Layer>& touchableRegionBounds,
+        const InputWindowInfo& inputInfo, int32_t cropLayerId, const Rect& cropLayerBounds,
         std::function<InputWindowInfoProto*()> getInputWindowInfoProto) {
     if (inputInfo.token == nullptr) {
         return;
@@ -150,11 +150,9 @@ void LayerProtoHelper::writeToProto(
     proto->set_window_x_scale(inputInfo.windowXScale);
     proto->set_window_y_scale(inputInfo.windowYScale);
     proto->set_replace_touchable_region_with_crop(inputInfo.replaceTouchableRegionWithCrop);
-    auto cropLayer = touchableRegionBounds.promote();
-    if (cropLayer != nullptr) {
-        proto->set_crop_layer_id(cropLayer->sequence);
-        LayerProtoHelper::writeToProto(cropLayer->getScreenBounds(
-                                               false /* reduceTransparentRegion */),
+    if (cropLayerId != -1) {
+        proto->set_crop_layer_id(cropLayerId);
+        LayerProtoHelper::writeToProto(cropLayerBounds,
                                        [&]() { return proto->mutable_touchable_region_crop(); });
     }
 }
@@ -38,10 +38,12 @@ public:
     static void writeToProto(const Region& region, std::function<RegionProto*()> getRegionProto);
     static void writeToProto(const half4 color, std::function<ColorProto*()> getColorProto);
     static void writeToProto(const ui::Transform& transform, TransformProto* transformProto);
-    static void writeToProto(const sp<GraphicBuffer>& buffer,
-                             std::function<ActiveBufferProto*()> getActiveBufferProto);
-    static void writeToProto(const InputWindowInfo& inputInfo,
-                             const wp<Layer>& touchableRegionBounds,
+    static void writeBufferToProto(uint32_t width, uint32_t height, uint32_t stride,
+                                   PixelFormat format,
+                                   std::function<ActiveBufferProto*()> getActiveBufferProto);
+    // Takes the id and screen bounds of the touchable region crop layer, or -1 if there is none.
+    static void writeToProto(const InputWindowInfo& inputInfo, int32_t cropLayerId,
+                             const Rect& cropLayerBounds,
                              std::function<InputWindowInfoProto*()> getInputWindowInfoProto);
     static void writeToProto(const mat4 matrix, ColorTransformProto* colorTransformProto);
 };
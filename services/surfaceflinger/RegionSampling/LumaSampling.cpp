@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#undef LOG_TAG
+#define LOG_TAG "LumaSampling"
+
+#include "LumaSampling.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <log/log.h>
+#include <ui/Transform.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LUMA_SAMPLING_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LUMA_SAMPLING_SSE2 1
+#endif
+
+namespace android {
+
+namespace {
+
+// Weights of the approximation of Rec. 709 primaries, in 1/32ths.
+constexpr uint32_t kRedWeight = 7;
+constexpr uint32_t kGreenWeight = 23;
+constexpr uint32_t kBlueWeight = 2;
+constexpr uint32_t kWeightShift = 5;
+
+inline uint32_t pixelLuma(uint32_t pixel) {
+    const uint32_t r = pixel & 0xFF;
+    const uint32_t g = (pixel >> 8) & 0xFF;
+    const uint32_t b = (pixel >> 16) & 0xFF;
+    return (r * kRedWeight + b * kBlueWeight + g * kGreenWeight) >> kWeightShift;
+}
+
+#if LUMA_SAMPLING_NEON
+
+// Sums 16 pixels per step. The weighted sum of a pixel is at most 32 * 255, so
+// it fits in 16-bit lanes, and is shifted there so that the result matches
+// pixelLuma exactly.
+uint32_t sumRowLumaVector(const uint32_t* pixels, int32_t count) {
+    const uint8x8_t redWeight = vdup_n_u8(kRedWeight);
+    const uint8x8_t greenWeight = vdup_n_u8(kGreenWeight);
+    const uint8x8_t blueWeight = vdup_n_u8(kBlueWeight);
+    uint32x4_t acc = vdupq_n_u32(0);
+
+    int32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // Deinterleaves the R, G, B and A bytes of 16 pixels.
+        const uint8x16x4_t rgba = vld4q_u8(reinterpret_cast<const uint8_t*>(pixels + i));
+
+        uint16x8_t low = vmull_u8(vget_low_u8(rgba.val[0]), redWeight);
+        low = vmlal_u8(low, vget_low_u8(rgba.val[1]), greenWeight);
+        low = vmlal_u8(low, vget_low_u8(rgba.val[2]), blueWeight);
+        acc = vpadalq_u16(acc, vshrq_n_u16(low, kWeightShift));
+
+        uint16x8_t high = vmull_u8(vget_high_u8(rgba.val[0]), redWeight);
+        high = vmlal_u8(high, vget_high_u8(rgba.val[1]), greenWeight);
+        high = vmlal_u8(high, vget_high_u8(rgba.val[2]), blueWeight);
+        acc = vpadalq_u16(acc, vshrq_n_u16(high, kWeightShift));
+    }
+
+    const uint64x2_t pairs = vpaddlq_u32(acc);
+    uint32_t sum = static_cast<uint32_t>(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+    for (; i < count; i++) {
+        sum += pixelLuma(pixels[i]);
+    }
+    return sum;
+}
+
+#elif LUMA_SAMPLING_SSE2
+
+// Sums 8 pixels per step. The channels are extracted in 32-bit lanes and packed
+// into 16-bit lanes, where the weighted sum of a pixel, at most 32 * 255, fits
+// and is shifted so that the result matches pixelLuma exactly.
+uint32_t sumRowLumaVector(const uint32_t* pixels, int32_t count) {
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i redWeight = _mm_set1_epi16(kRedWeight);
+    const __m128i greenWeight = _mm_set1_epi16(kGreenWeight);
+    const __m128i blueWeight = _mm_set1_epi16(kBlueWeight);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i + 4));
+
+        const __m128i r = _mm_packs_epi32(_mm_and_si128(p0, byteMask),
+                                          _mm_and_si128(p1, byteMask));
+        const __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), byteMask),
+                                          _mm_and_si128(_mm_srli_epi32(p1, 8), byteMask));
+        const __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), byteMask),
+                                          _mm_and_si128(_mm_srli_epi32(p1, 16), byteMask));
+
+        __m128i luma = _mm_mullo_epi16(r, redWeight);
+        luma = _mm_add_epi16(luma, _mm_mullo_epi16(g, greenWeight));
+        luma = _mm_add_epi16(luma, _mm_mullo_epi16(b, blueWeight));
+        luma = _mm_srli_epi16(luma, kWeightShift);
+
+        // Sums adjacent 16-bit lanes into 32-bit lanes.
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(luma, ones));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+    for (; i < count; i++) {
+        sum += pixelLuma(pixels[i]);
+    }
+    return sum;
+}
+
+#endif
+
+// Maps |area| to the buffer, and returns whether it lies within the buffer.
+bool mapArea(int32_t width, int32_t height, uint32_t orientation, Rect& area) {
+    if (!area.isValid() || area.getWidth() > width || area.getHeight() > height) {
+        return false;
+    }
+
+    // (b/133849373) ROT_90 screencap images produced upside down
+    if (orientation & ui::Transform::ROT_90) {
+        area.top = height - area.top;
+        area.bottom = height - area.bottom;
+        std::swap(area.top, area.bottom);
+
+        area.left = width - area.left;
+        area.right = width - area.right;
+        std::swap(area.left, area.right);
+    }
+
+    return area.left >= 0 && area.top >= 0 && area.right <= width && area.bottom <= height;
+}
+
+void sortUnique(std::vector<int32_t>& values) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+} // namespace
+
+uint32_t sumRowLumaScalar(const uint32_t* pixels, int32_t count) {
+    uint32_t sum = 0;
+    for (int32_t i = 0; i < count; i++) {
+        sum += pixelLuma(pixels[i]);
+    }
+    return sum;
+}
+
+uint32_t sumRowLuma(const uint32_t* pixels, int32_t count) {
+#if LUMA_SAMPLING_NEON || LUMA_SAMPLING_SSE2
+    return sumRowLumaVector(pixels, count);
+#else
+    return sumRowLumaScalar(pixels, count);
+#endif
+}
+
+std::vector<float> sampleAreas(const uint32_t* data, int32_t width, int32_t height,
+                               int32_t stride, uint32_t orientation,
+                               const std::vector<Rect>& areas) {
+    std::vector<Rect> mappedAreas;
+    // The indices in |areas| of the mapped areas.
+    std::vector<size_t> indices;
+    std::vector<int32_t> rowEdges;
+    for (size_t i = 0; i < areas.size(); i++) {
+        Rect area = areas[i];
+        if (!mapArea(width, height, orientation, area)) {
+            ALOGE("invalid sampling region requested");
+            continue;
+        }
+        if (area.isEmpty()) {
+            continue;
+        }
+        mappedAreas.push_back(area);
+        indices.push_back(i);
+        rowEdges.push_back(area.top);
+        rowEdges.push_back(area.bottom);
+    }
+    sortUnique(rowEdges);
+
+    // The pixels of the buffer are split into bands of rows, and the rows of a
+    // band into disjoint segments, such that an area covers either all or none
+    // of a segment. The luma of each segment is then summed once per row, and
+    // added to every area that covers it.
+    struct Segment {
+        int32_t left;
+        int32_t right;
+        std::vector<size_t> areas;
+    };
+    std::vector<uint64_t> sums(mappedAreas.size(), 0);
+    std::vector<int32_t> columnEdges;
+    std::vector<Segment> segments;
+    for (size_t band = 0; band + 1 < rowEdges.size(); band++) {
+        const int32_t top = rowEdges[band];
+        const int32_t bottom = rowEdges[band + 1];
+
+        columnEdges.clear();
+        for (const Rect& area : mappedAreas) {
+            if (area.top <= top && area.bottom >= bottom) {
+                columnEdges.push_back(area.left);
+                columnEdges.push_back(area.right);
+            }
+        }
+        sortUnique(columnEdges);
+
+        segments.clear();
+        for (size_t edge = 0; edge + 1 < columnEdges.size(); edge++) {
+            Segment segment{columnEdges[edge], columnEdges[edge + 1], {}};
+            for (size_t i = 0; i < mappedAreas.size(); i++) {
+                const Rect& area = mappedAreas[i];
+                if (area.top <= top && area.bottom >= bottom && area.left <= segment.left &&
+                    area.right >= segment.right) {
+                    segment.areas.push_back(i);
+                }
+            }
+            if (!segment.areas.empty()) {
+                segments.push_back(std::move(segment));
+            }
+        }
+
+        for (int32_t row = top; row < bottom; row++) {
+            const uint32_t* rowBase = data + row * stride;
+            for (const Segment& segment : segments) {
+                const uint32_t luma =
+                        sumRowLuma(rowBase + segment.left, segment.right - segment.left);
+                for (size_t i : segment.areas) {
+                    sums[i] += luma;
+                }
+            }
+        }
+    }
+
+    std::vector<float> lumas(areas.size(), 0.0f);
+    for (size_t i = 0; i < mappedAreas.size(); i++) {
+        const uint64_t pixelCount = static_cast<uint64_t>(mappedAreas[i].getWidth()) *
+                static_cast<uint64_t>(mappedAreas[i].getHeight());
+        lumas[indices[i]] = sums[i] / (255.0f * pixelCount);
+    }
+    return lumas;
+}
+
+float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
+                 uint32_t orientation, const Rect& area) {
+    return sampleAreas(data, width, height, stride, orientation, {area})[0];
+}
+
+} // namespace android
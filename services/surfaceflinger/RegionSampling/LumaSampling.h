@@ -0,0 +1,45 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <ui/Rect.h>
+
+namespace android {
+
+// Returns the sum of the luma of |count| consecutive RGBA_8888 pixels. The luma
+// of a pixel is (7 * r + 23 * g + 2 * b) >> 5, an approximation of the Rec. 709
+// luma with 8-bit results. Uses NEON or SSE2 when available.
+uint32_t sumRowLuma(const uint32_t* pixels, int32_t count);
+
+// The portable implementation of sumRowLuma, which the vectorized ones must
+// match exactly.
+uint32_t sumRowLumaScalar(const uint32_t* pixels, int32_t count);
+
+// Returns the mean luma, from 0 to 1, of each of |areas| in the RGBA_8888 image
+// |data|, in a single pass over the image: the pixels shared by several areas
+// are only read once. The luma of an area that does not fit in the image is 0.
+std::vector<float> sampleAreas(const uint32_t* data, int32_t width, int32_t height,
+                               int32_t stride, uint32_t orientation,
+                               const std::vector<Rect>& areas);
+
+float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
+                 uint32_t orientation, const Rect& area);
+
+} // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the cost of sampling the luma of a captured region, on synthetic
+// RGBA_8888 buffers the size of a navigation bar capture, scaled down by the
+// downsampling factor given as argument.
+
+#include <benchmark/benchmark.h>
+
+#include <LumaSampling.h>
+#include <ui/Transform.h>
+
+#include <cstdint>
+#include <vector>
+
+using namespace android;
+
+namespace {
+
+constexpr int32_t kWidth = 1080;
+constexpr int32_t kHeight = 132;
+
+struct Buffer {
+    explicit Buffer(int32_t downsampleFactor)
+          : width(kWidth / downsampleFactor),
+            height(kHeight / downsampleFactor),
+            stride((width + 63) / 64 * 64),
+            pixels(static_cast<size_t>(stride * height)) {
+        uint32_t n = 0;
+        for (uint32_t& pixel : pixels) {
+            n = n * 1664525u + 1013904223u;
+            pixel = n | 0xFF000000;
+        }
+    }
+
+    const int32_t width;
+    const int32_t height;
+    const int32_t stride;
+    std::vector<uint32_t> pixels;
+};
+
+// The areas of the listeners of a navigation bar: the whole bar, and each of
+// its three buttons.
+std::vector<Rect> getAreas(const Buffer& buffer) {
+    const int32_t third = buffer.width / 3;
+    return {Rect(0, 0, buffer.width, buffer.height), Rect(0, 0, third, buffer.height),
+            Rect(third, 0, 2 * third, buffer.height),
+            Rect(2 * third, 0, buffer.width, buffer.height)};
+}
+
+void BM_SumRowLumaScalar(benchmark::State& state) {
+    const Buffer buffer(static_cast<int32_t>(state.range(0)));
+    for (auto _ : state) {
+        uint64_t sum = 0;
+        for (int32_t row = 0; row < buffer.height; row++) {
+            sum += sumRowLumaScalar(buffer.pixels.data() + row * buffer.stride, buffer.width);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * buffer.width * buffer.height);
+}
+BENCHMARK(BM_SumRowLumaScalar)->Arg(1)->Arg(2)->Arg(4);
+
+void BM_SumRowLuma(benchmark::State& state) {
+    const Buffer buffer(static_cast<int32_t>(state.range(0)));
+    for (auto _ : state) {
+        uint64_t sum = 0;
+        for (int32_t row = 0; row < buffer.height; row++) {
+            sum += sumRowLuma(buffer.pixels.data() + row * buffer.stride, buffer.width);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * buffer.width * buffer.height);
+}
+BENCHMARK(BM_SumRowLuma)->Arg(1)->Arg(2)->Arg(4);
+
+// Samples each area separately, as RegionSamplingThread used to.
+void BM_SampleEachArea(benchmark::State& state) {
+    const Buffer buffer(static_cast<int32_t>(state.range(0)));
+    const std::vector<Rect> areas = getAreas(buffer);
+    for (auto _ : state) {
+        for (const Rect& area : areas) {
+            benchmark::DoNotOptimize(sampleArea(buffer.pixels.data(), buffer.width, buffer.height,
+                                                buffer.stride, ui::Transform::ROT_0, area));
+        }
+    }
+}
+BENCHMARK(BM_SampleEachArea)->Arg(1)->Arg(2)->Arg(4);
+
+void BM_SampleAreas(benchmark::State& state) {
+    const Buffer buffer(static_cast<int32_t>(state.range(0)));
+    const std::vector<Rect> areas = getAreas(buffer);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sampleAreas(buffer.pixels.data(), buffer.width, buffer.height,
+                                             buffer.stride, ui::Transform::ROT_0, areas));
+    }
+}
+BENCHMARK(BM_SampleAreas)->Arg(1)->Arg(2)->Arg(4);
+
+} // namespace
+
+BENCHMARK_MAIN();
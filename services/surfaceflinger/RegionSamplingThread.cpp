@@ -68,6 +68,15 @@ inline std::string toNsString(std::chrono::duration<Rep, Per> t) {
     return std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(t).count());
 }
 
+static int32_t getDownsampleFactor() {
+    const int32_t factor = property_get_int32("debug.sf.region_sampling_downsample", 1);
+    if (factor < 1) {
+        ALOGW("User-specified sampling downsample factor %d nonsensical. Using 1", factor);
+        return 1;
+    }
+    return factor;
+}
+
 RegionSamplingThread::EnvironmentTimingTunables::EnvironmentTimingTunables() {
     char value[PROPERTY_VALUE_MAX] = {};
 
@@ -168,6 +177,7 @@ RegionSamplingThread::RegionSamplingThread(SurfaceFlinger& flinger, Scheduler& s
       : mFlinger(flinger),
         mScheduler(scheduler),
         mTunables(tunables),
+        mDownsampleFactor(getDownsampleFactor()),
         mIdleTimer(std::chrono::duration_cast<std::chrono::milliseconds>(
                            mTunables.mSamplingTimerTimeout),
                    [] {}, [this] { checkForStaleLuma(); }),
@@ -268,45 +278,6 @@ void RegionSamplingThread::binderDied(const wp<IBinder>& who) {
     mDescriptors.erase(who);
 }
 
-float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
-                 uint32_t orientation, const Rect& sample_area) {
-    if (!sample_area.isValid() || (sample_area.getWidth() > width) ||
-        (sample_area.getHeight() > height)) {
-        ALOGE("invalid sampling region requested");
-        return 0.0f;
-    }
-
-    // (b/133849373) ROT_90 screencap images produced upside down
-    auto area = sample_area;
-    if (orientation & ui::Transform::ROT_90) {
-        area.top = height - area.top;
-        area.bottom = height - area.bottom;
-        std::swap(area.top, area.bottom);
-
-        area.left = width - area.left;
-        area.right = width - area.right;
-        std::swap(area.left, area.right);
-    }
-
-    const uint32_t pixelCount = (area.bottom - area.top) * (area.right - area.left);
-    uint32_t accumulatedLuma = 0;
-
-    // Calculates luma with approximation of Rec. 709 primaries
-    for (int32_t row = area.top; row < area.bottom; ++row) {
-        const uint32_t* rowBase = data + row * stride;
-        for (int32_t column = area.left; column < area.right; ++column) {
-            uint32_t pixel = rowBase[column];
-            const uint32_t r = pixel & 0xFF;
-            const uint32_t g = (pixel >> 8) & 0xFF;
-            const uint32_t b = (pixel >> 16) & 0xFF;
-            const uint32_t luma = (r * 7 + b * 2 + g * 23) >> 5;
-            accumulatedLuma += luma;
-        }
-    }
-
-    return accumulatedLuma / (255.0f * pixelCount);
-}
-
 std::vector<float> RegionSamplingThread::sampleBuffer(
         const sp<GraphicBuffer>& buffer, const Point& leftTop,
         const std::vector<RegionSamplingThread::Descriptor>& descriptors, uint32_t orientation) {
@@ -319,13 +290,16 @@ std::vector<float> RegionSamplingThread::sampleBuffer(
     const int32_t width = buffer->getWidth();
     const int32_t height = buffer->getHeight();
     const int32_t stride = buffer->getStride();
-    std::vector<float> lumas(descriptors.size());
-    std::transform(descriptors.begin(), descriptors.end(), lumas.begin(),
+    const int32_t factor = mDownsampleFactor;
+    std::vector<Rect> areas(descriptors.size());
+    std::transform(descriptors.begin(), descriptors.end(), areas.begin(),
                    [&](auto const& descriptor) {
-                       return sampleArea(data.get(), width, height, stride, orientation,
-                                         descriptor.area - leftTop);
+                       const Rect area = descriptor.area - leftTop;
+                       return Rect(area.left / factor, area.top / factor,
+                                   (area.right + factor - 1) / factor,
+                                   (area.bottom + factor - 1) / factor);
                    });
-    return lumas;
+    return sampleAreas(data.get(), width, height, stride, orientation, areas);
 }
 
 void RegionSamplingThread::captureSample() {
@@ -368,8 +342,13 @@ void RegionSamplingThread::captureSample() {
     ui::Transform t(orientation);
     auto screencapRegion = t.transform(sampleRegion);
     screencapRegion = screencapRegion.translate(dx, dy);
-    DisplayRenderArea renderArea(device, screencapRegion.bounds(), sampledArea.getWidth(),
-                                 sampledArea.getHeight(), ui::Dataspace::V0_SRGB, orientation);
+    // When downsampling, the capture is scaled down by the GPU as it is rendered.
+    const int32_t captureWidth =
+            (sampledArea.getWidth() + mDownsampleFactor - 1) / mDownsampleFactor;
+    const int32_t captureHeight =
+            (sampledArea.getHeight() + mDownsampleFactor - 1) / mDownsampleFactor;
+    DisplayRenderArea renderArea(device, screencapRegion.bounds(), captureWidth, captureHeight,
+                                 ui::Dataspace::V0_SRGB, orientation);
 
     std::unordered_set<sp<IRegionSamplingListener>, SpHash<IRegionSamplingListener>> listeners;
 
@@ -415,13 +394,13 @@ void RegionSamplingThread::captureSample() {
     };
 
     sp<GraphicBuffer> buffer = nullptr;
-    if (mCachedBuffer && mCachedBuffer->getWidth() == sampledArea.getWidth() &&
-        mCachedBuffer->getHeight() == sampledArea.getHeight()) {
+    if (mCachedBuffer && mCachedBuffer->getWidth() == static_cast<uint32_t>(captureWidth) &&
+        mCachedBuffer->getHeight() == static_cast<uint32_t>(captureHeight)) {
         buffer = mCachedBuffer;
     } else {
         const uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_HW_RENDER;
-        buffer = new GraphicBuffer(sampledArea.getWidth(), sampledArea.getHeight(),
-                                   PIXEL_FORMAT_RGBA_8888, 1, usage, "RegionSamplingThread");
+        buffer = new GraphicBuffer(captureWidth, captureHeight, PIXEL_FORMAT_RGBA_8888, 1, usage,
+                                   "RegionSamplingThread");
     }
 
     bool ignored;
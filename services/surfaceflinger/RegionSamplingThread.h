@@ -27,6 +27,7 @@
 #include <ui/GraphicBuffer.h>
 #include <ui/Rect.h>
 #include <utils/StrongPointer.h>
+#include "RegionSampling/LumaSampling.h"
 #include "Scheduler/OneShotTimer.h"
 
 namespace android {
@@ -37,9 +38,6 @@ class Scheduler;
 class SurfaceFlinger;
 struct SamplingOffsetCallback;
 
-float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
-                 uint32_t orientation, const Rect& area);
-
 class RegionSamplingThread : public IBinder::DeathRecipient {
 public:
     struct TimingTunables {
@@ -107,6 +105,10 @@ private:
     SurfaceFlinger& mFlinger;
     Scheduler& mScheduler;
     const TimingTunables mTunables;
+    // debug.sf.region_sampling_downsample
+    // The factor by which the sampled region is scaled down when captured, so that the GPU
+    // averages blocks of pixels and fewer of them are read back. 1 captures at full resolution.
+    const int32_t mDownsampleFactor;
     scheduler::OneShotTimer mIdleTimer;
 
     std::unique_ptr<SamplingOffsetCallback> const mPhaseCallback;
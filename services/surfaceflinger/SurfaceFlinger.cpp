@@ -124,6 +124,7 @@
 #include "SurfaceFlingerProperties.h"
 #include "SurfaceInterceptor.h"
 #include "TimeStats/TimeStats.h"
+#include "TransactionRings.h"
 #include "android-base/parseint.h"
 #include "android-base/stringprintf.h"
 
@@ -232,6 +233,9 @@ struct SCOPED_CAPABILITY UnnecessaryLock {
     ~UnnecessaryLock() RELEASE() {}
 };
 
+// Id of the fake root that the offscreen layers are parented to in layer protos.
+constexpr int32_t kOffscreenRootLayerId = INT32_MAX - 2;
+
 // TODO(b/141333600): Consolidate with HWC2::Display::Config::Builder::getDefaultDensity.
 constexpr float FALLBACK_DENSITY = ACONFIGURATION_DENSITY_TV;
 
@@ -481,6 +485,13 @@ SurfaceFlinger::SurfaceFlinger(Factory& factory) : SurfaceFlinger(factory, SkipI
     property_get("debug.sf.disable_client_composition_cache", value, "0");
     mDisableClientCompositionCache = atoi(value);
 
+    property_get("debug.sf.enable_layer_caching", value, "0");
+    mEnableLayerCaching = atoi(value);
+
+    property_get("debug.sf.parallel_output_composition", value, "0");
+    mParallelOutputComposition = atoi(value);
+    ALOGI_IF(mParallelOutputComposition, "Enabling parallel output composition");
+
     // We should be reading 'persist.sys.sf.color_saturation' here
     // but since /data may be encrypted, we need to wait until after vold
     // comes online to attempt to read the property. The property is
@@ -1510,7 +1521,7 @@ status_t SurfaceFlinger::getLayerDebugInfo(std::vector<LayerDebugInfo>* outLayer
     outLayers->clear();
     schedule([=] {
         const auto display = ON_MAIN_THREAD(getDefaultDisplayDeviceLocked());
-        mDrawingState.traverseInZOrder([&](Layer* layer) {
+        traverseDrawingLayersInZOrder([&](Layer* layer) {
             outLayers->push_back(layer->getLayerDebugInfo(display.get()));
         });
     }).wait();
@@ -2117,10 +2128,12 @@ void SurfaceFlinger::onMessageRefresh() {
     for (const auto& [_, display] : displays) {
         refreshArgs.outputs.push_back(display->getCompositionDisplay());
     }
-    mDrawingState.traverseInZOrder([&refreshArgs](Layer* layer) {
+    const auto& drawingLayers = getDrawingLayersInZOrder();
+    refreshArgs.layers.reserve(drawingLayers.size());
+    for (Layer* layer : drawingLayers) {
         if (auto layerFE = layer->getCompositionEngineLayerFE())
             refreshArgs.layers.push_back(layerFE);
-    });
+    }
     refreshArgs.layersWithQueuedFrames.reserve(mLayersWithQueuedFrames.size());
     for (sp<Layer> layer : mLayersWithQueuedFrames) {
         if (auto layerFE = layer->getCompositionEngineLayerFE())
@@ -2138,6 +2151,7 @@ void SurfaceFlinger::onMessageRefresh() {
     refreshArgs.updatingGeometryThisFrame = mGeometryInvalid || mVisibleRegionsDirty;
     refreshArgs.blursAreExpensive = mBlursAreExpensive;
     refreshArgs.internalDisplayRotationFlags = DisplayDevice::getPrimaryDisplayRotationFlags();
+    refreshArgs.updateOutputsConcurrently = mParallelOutputComposition;
 
     if (CC_UNLIKELY(mDrawingState.colorMatrixChanged)) {
         refreshArgs.colorTransformMatrix = mDrawingState.colorMatrix;
@@ -3005,7 +3019,7 @@ void SurfaceFlinger::updateInputFlinger() {
 void SurfaceFlinger::updateInputWindowInfo() {
     std::vector<InputWindowInfo> inputHandles;
 
-    mDrawingState.traverseInReverseZOrder([&](Layer* layer) {
+    traverseDrawingLayersInReverseZOrder([&](Layer* layer) {
         if (layer->needsInputInfo()) {
             // When calculating the screen bounds we ignore the transparent region since it may
             // result in an unwanted offset.
@@ -3146,6 +3160,9 @@ void SurfaceFlinger::commitTransactionLocked() {
 
     commitOffscreenLayers();
     mDrawingState.traverse([&](Layer* layer) { layer->updateMirrorInfo(); });
+
+    // Layers may have been added, removed, reparented or reordered.
+    mDrawingLayersInZOrderValid = false;
 }
 
 void SurfaceFlinger::commitOffscreenLayers() {
@@ -3244,7 +3261,15 @@ bool SurfaceFlinger::handlePageFlip()
         mBootStage = BootStage::BOOTANIMATION;
     }
 
-    mDrawingState.traverse([&](Layer* layer) { layer->updateCloneBufferInfo(); });
+    bool hasClones = false;
+    mDrawingState.traverse([&](Layer* layer) {
+        layer->updateCloneBufferInfo();
+        hasClones |= layer->isClone();
+    });
+    // Clones copy the drawing state of the layer they mirror, Z order included.
+    if (hasClones) {
+        mDrawingLayersInZOrderValid = false;
+    }
 
     // Only continue with the refresh if there is actually new work to do
     return !mLayersWithQueuedFrames.empty() && newDataLatched;
@@ -3359,17 +3384,24 @@ bool SurfaceFlinger::flushTransactionQueues() {
     {
         Mutex::Autolock _l(mStateLock);
 
+        mTransactionQueuesNeedPolling = false;
         auto it = mTransactionQueues.begin();
         while (it != mTransactionQueues.end()) {
             auto& [applyToken, transactionQueue] = *it;
 
             while (!transactionQueue.empty()) {
                 auto& transaction = transactionQueue.front();
+                // Fences the readiness thread is still polling need not be queried again.
+                if (mTransactionReadinessThread.isWaitingForFences(applyToken)) {
+                    break;
+                }
                 if (!transactionIsReadyToBeApplied(transaction.desiredPresentTime,
                                                    transaction.states)) {
-                    setTransactionFlags(eTransactionFlushNeeded);
+                    scheduleTransactionReadiness(applyToken, transaction);
                     break;
                 }
+                mTransactionReadinessThread.remove(applyToken);
+                mTransactionReadinessThread.recordWaitTime(systemTime() - transaction.postTime);
                 transactions.push_back(transaction);
                 applyTransactionState(transaction.states, transaction.displays, transaction.flags,
                                       mPendingInputWindowCommands, transaction.desiredPresentTime,
@@ -3392,7 +3424,47 @@ bool SurfaceFlinger::flushTransactionQueues() {
 }
 
 bool SurfaceFlinger::transactionFlushNeeded() {
-    return !mTransactionQueues.empty();
+    return mTransactionQueuesNeedPolling;
+}
+
+void SurfaceFlinger::scheduleTransactionReadiness(const sp<IBinder>& applyToken,
+                                                  const TransactionState& transaction) {
+    mTransactionReadinessThread.run([this] {
+        Mutex::Autolock lock(mStateLock);
+        setTransactionFlags(eTransactionFlushNeeded);
+    });
+
+    const nsecs_t expectedPresentTime = mExpectedPresentTime.load();
+    const int64_t desiredPresentTime = transaction.desiredPresentTime;
+    if (desiredPresentTime >= 0 && desiredPresentTime >= expectedPresentTime &&
+        desiredPresentTime < expectedPresentTime + s2ns(1)) {
+        // The transaction becomes ready on the first frame expected to be presented after its
+        // desired present time, so wake up as far ahead of that time as the current frame is
+        // ahead of its expected present time.
+        const nsecs_t now = systemTime();
+        const nsecs_t wakeupTime = desiredPresentTime - (expectedPresentTime - now);
+        if (wakeupTime > now) {
+            mTransactionReadinessThread.scheduleWakeup(applyToken, wakeupTime);
+        } else {
+            mTransactionQueuesNeedPolling = true;
+        }
+        return;
+    }
+
+    std::vector<sp<Fence>> fences;
+    for (const ComposerState& state : transaction.states) {
+        const layer_state_t& s = state.state;
+        if ((s.what & layer_state_t::eAcquireFenceChanged) && s.acquireFence &&
+            s.acquireFence->getStatus() == Fence::Status::Unsignaled) {
+            fences.push_back(s.acquireFence);
+        }
+    }
+    if (fences.empty()) {
+        // Signaled since transactionIsReadyToBeApplied looked at it.
+        mTransactionQueuesNeedPolling = true;
+        return;
+    }
+    mTransactionReadinessThread.waitForFences(applyToken, std::move(fences));
 }
 
 
@@ -3473,6 +3545,26 @@ void SurfaceFlinger::setTransactionState(
                           listenerCallbacks);
 }
 
+status_t SurfaceFlinger::registerTransactionRing(const sp<IBinder>& applyToken,
+                                                 const sp<IMemoryHeap>& heap) {
+    return TransactionRings::getInstance().add(applyToken, heap);
+}
+
+status_t SurfaceFlinger::setTransactionStateFromRing(
+        const sp<IBinder>& applyToken, uint64_t begin, uint64_t end,
+        const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces, uint32_t flags,
+        int64_t desiredPresentTime) {
+    ATRACE_CALL();
+    Vector<ComposerState> states;
+    status_t err =
+            TransactionRings::getInstance().read(applyToken, begin, end, newSurfaces, &states);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    setTransactionState(states, {}, flags, applyToken, {}, desiredPresentTime, {}, false, {});
+    return NO_ERROR;
+}
+
 void SurfaceFlinger::applyTransactionState(
         const Vector<ComposerState>& states, Vector<DisplayState>& displays, uint32_t flags,
         const InputWindowCommands& inputWindowCommands, const int64_t desiredPresentTime,
@@ -4433,6 +4525,7 @@ status_t SurfaceFlinger::doDump(int fd, const DumpArgs& args, bool asProto) {
                  dumper([this](std::string& s) { mScheduler->getPrimaryDispSync().dump(s); })},
                 {"--edid"s, argsDumper(&SurfaceFlinger::dumpRawDisplayIdentificationData)},
                 {"--frame-events"s, dumper(&SurfaceFlinger::dumpFrameEventsLocked)},
+                {"--frame-latency"s, dumper(&SurfaceFlinger::dumpFrameLatenciesLocked)},
                 {"--latency"s, argsDumper(&SurfaceFlinger::dumpStatsLocked)},
                 {"--latency-clear"s, argsDumper(&SurfaceFlinger::clearStatsLocked)},
                 {"--list"s, dumper(&SurfaceFlinger::listLayersLocked)},
@@ -4623,6 +4716,25 @@ void SurfaceFlinger::dumpFrameEventsLocked(std::string& result) {
     }
 }
 
+void SurfaceFlinger::dumpFrameLatenciesLocked(std::string& result) {
+    result.append("Layer frame latencies:\n");
+
+    mCurrentState.traverseInZOrder(
+            [&](Layer* layer) { layer->dumpFrameLatencies(result); });
+}
+
+void SurfaceFlinger::dumpTransactionQueues(std::string& result) const {
+    size_t pendingCount = 0;
+    for (const auto& [applyToken, transactionQueue] : mTransactionQueues) {
+        pendingCount += transactionQueue.size();
+    }
+    result.append("Transaction queues:\n");
+    StringAppendF(&result, "  %zu pending transactions in %zu queues%s\n", pendingCount,
+                  mTransactionQueues.size(), mTransactionQueuesNeedPolling ? ", polling" : "");
+    mTransactionReadinessThread.dump(result);
+    result.append("\n");
+}
+
 void SurfaceFlinger::dumpBufferingStats(std::string& result) const {
     result.append("Buffering stats:\n");
     result.append("  [Layer name] <Active time> <Two buffer> "
@@ -4733,15 +4845,25 @@ void SurfaceFlinger::dumpWideColorInfo(std::string& result) const {
 }
 
 LayersProto SurfaceFlinger::dumpDrawingStateProto(uint32_t traceFlags) const {
+    LayersProto layersProto;
+    for (const LayerProtoSnapshot& snapshot : snapshotDrawingStateForProto(traceFlags)) {
+        Layer::writeToProto(snapshot, layersProto);
+    }
+
+    return layersProto;
+}
+
+std::vector<LayerProtoSnapshot> SurfaceFlinger::snapshotDrawingStateForProto(
+        uint32_t traceFlags) const {
     // If context is SurfaceTracing thread, mTracingLock blocks display transactions on main thread.
     const auto display = ON_MAIN_THREAD(getDefaultDisplayDeviceLocked());
 
-    LayersProto layersProto;
+    std::vector<LayerProtoSnapshot> snapshots;
     for (const sp<Layer>& layer : mDrawingState.layersSortedByZ) {
-        layer->writeToProto(layersProto, traceFlags, display.get());
+        layer->snapshotForProto(snapshots, traceFlags, display.get());
     }
 
-    return layersProto;
+    return snapshots;
 }
 
 void SurfaceFlinger::dumpHwc(std::string& result) const {
@@ -4749,22 +4871,35 @@ void SurfaceFlinger::dumpHwc(std::string& result) const {
 }
 
 void SurfaceFlinger::dumpOffscreenLayersProto(LayersProto& layersProto, uint32_t traceFlags) const {
+    writeOffscreenLayersProto(snapshotOffscreenLayersForProto(traceFlags), layersProto);
+}
+
+std::vector<LayerProtoSnapshot> SurfaceFlinger::snapshotOffscreenLayersForProto(
+        uint32_t traceFlags) const {
+    std::vector<LayerProtoSnapshot> snapshots;
+    for (Layer* offscreenLayer : mOffscreenLayers) {
+        // Parent the layer to the fake root that writeOffscreenLayersProto adds.
+        const size_t index = snapshots.size();
+        offscreenLayer->snapshotForProto(snapshots, traceFlags, nullptr /*device*/);
+        snapshots[index].parent = kOffscreenRootLayerId;
+    }
+    return snapshots;
+}
+
+void SurfaceFlinger::writeOffscreenLayersProto(const std::vector<LayerProtoSnapshot>& snapshots,
+                                               LayersProto& layersProto) {
     // Add a fake invisible root layer to the proto output and parent all the offscreen layers to
     // it.
     LayerProto* rootProto = layersProto.add_layers();
-    const int32_t offscreenRootLayerId = INT32_MAX - 2;
-    rootProto->set_id(offscreenRootLayerId);
+    rootProto->set_id(kOffscreenRootLayerId);
     rootProto->set_name("Offscreen Root");
     rootProto->set_parent(-1);
 
-    for (Layer* offscreenLayer : mOffscreenLayers) {
-        // Add layer as child of the fake root
-        rootProto->add_children(offscreenLayer->sequence);
-
-        // Add layer
-        LayerProto* layerProto =
-                offscreenLayer->writeToProto(layersProto, traceFlags, nullptr /*device*/);
-        layerProto->set_parent(offscreenRootLayerId);
+    for (const LayerProtoSnapshot& snapshot : snapshots) {
+        if (snapshot.parent == kOffscreenRootLayerId) {
+            rootProto->add_children(snapshot.id);
+        }
+        Layer::writeToProto(snapshot, layersProto);
     }
 }
 
@@ -4834,6 +4969,8 @@ void SurfaceFlinger::dumpAllLocked(const DumpArgs& args, std::string& result) co
 
     dumpBufferingStats(result);
 
+    dumpTransactionQueues(result);
+
     /*
      * Dump the visible layer list
      */
@@ -5055,6 +5192,10 @@ status_t SurfaceFlinger::CheckTransactCodeCredentials(uint32_t code) {
         // Calling setTransactionState is safe, because you need to have been
         // granted a reference to Client* and Handle* to do anything with it.
         case SET_TRANSACTION_STATE:
+        // The ring only carries what setTransactionState accepts, and only
+        // for surfaces whose handles the caller has sent.
+        case REGISTER_TRANSACTION_RING:
+        case SET_TRANSACTION_STATE_FROM_RING:
         case CREATE_CONNECTION:
         case GET_COLOR_MANAGEMENT:
         case GET_COMPOSITION_PREFERENCE:
@@ -5100,9 +5241,9 @@ status_t SurfaceFlinger::CheckTransactCodeCredentials(uint32_t code) {
         code == IBinder::SYSPROPS_TRANSACTION) {
         return OK;
     }
-    // Numbers from 1000 to 1036 are currently used for backdoors. The code
+    // Numbers from 1000 to 1037 are currently used for backdoors. The code
     // in onTransact verifies that the user is root, and has access to use SF.
-    if (code >= 1000 && code <= 1036) {
+    if (code >= 1000 && code <= 1037) {
         ALOGV("Accessing SurfaceFlinger through backdoor code: %u", code);
         return OK;
     }
@@ -5443,6 +5584,20 @@ status_t SurfaceFlinger::onTransact(uint32_t code, const Parcel& data, Parcel* r
                 }
                 return NO_ERROR;
             }
+            // Set buffer size for SF tracing (value in frames, 0 to size it in bytes again)
+            case 1037: {
+                n = data.readInt32();
+                if (n < 0) {
+                    ALOGW("Invalid buffer size: %d frames", n);
+                    reply->writeInt32(BAD_VALUE);
+                    return BAD_VALUE;
+                }
+
+                ALOGD("Updating trace buffer to %d frames", n);
+                mTracing.setBufferSizeInFrames(n);
+                reply->writeInt32(NO_ERROR);
+                return NO_ERROR;
+            }
         }
     }
     return err;
@@ -6057,6 +6212,30 @@ void SurfaceFlinger::State::traverseInReverseZOrder(const LayerVector::Visitor&
     layersSortedByZ.traverseInReverseZOrder(stateSet, visitor);
 }
 
+const std::vector<Layer*>& SurfaceFlinger::getDrawingLayersInZOrder() {
+    if (!mDrawingLayersInZOrderValid) {
+        ATRACE_NAME("rebuildDrawingLayersInZOrder");
+        mDrawingLayersInZOrder.clear();
+        mDrawingState.traverseInZOrder(
+                [&](Layer* layer) { mDrawingLayersInZOrder.push_back(layer); });
+        mDrawingLayersInZOrderValid = true;
+    }
+    return mDrawingLayersInZOrder;
+}
+
+void SurfaceFlinger::traverseDrawingLayersInZOrder(const LayerVector::Visitor& visitor) {
+    for (Layer* layer : getDrawingLayersInZOrder()) {
+        visitor(layer);
+    }
+}
+
+void SurfaceFlinger::traverseDrawingLayersInReverseZOrder(const LayerVector::Visitor& visitor) {
+    const auto& layers = getDrawingLayersInZOrder();
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+        visitor(*it);
+    }
+}
+
 void SurfaceFlinger::traverseLayersInDisplay(const sp<const DisplayDevice>& display,
                                              const LayerVector::Visitor& visitor) {
     // We loop through the first level of layers without traversing,
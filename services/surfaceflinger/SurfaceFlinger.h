@@ -64,6 +64,7 @@
 #include "SurfaceTracing.h"
 #include "TracedOrdinal.h"
 #include "TransactionCompletedThread.h"
+#include "TransactionReadinessThread.h"
 
 #include <atomic>
 #include <cstdint>
@@ -97,6 +98,7 @@ class RefreshRateOverlay;
 class RegionSamplingThread;
 class TimeStats;
 class FrameTracer;
+struct LayerProtoSnapshot;
 
 namespace compositionengine {
 class DisplaySurface;
@@ -339,6 +341,10 @@ public:
     // debug.sf.disable_client_composition_cache
     bool mDisableClientCompositionCache = false;
 
+    // If set, flattens runs of layers that do not change into a single buffer
+    // presented by the HWC. This can be set by debug.sf.enable_layer_caching
+    bool mEnableLayerCaching = false;
+
 private:
     friend class BufferLayer;
     friend class BufferQueueLayer;
@@ -423,6 +429,12 @@ private:
                              int64_t desiredPresentTime, const client_cache_t& uncacheBuffer,
                              bool hasListenerCallbacks,
                              const std::vector<ListenerCallbacks>& listenerCallbacks) override;
+    status_t registerTransactionRing(const sp<IBinder>& applyToken,
+                                     const sp<IMemoryHeap>& heap) override;
+    status_t setTransactionStateFromRing(
+            const sp<IBinder>& applyToken, uint64_t begin, uint64_t end,
+            const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces, uint32_t flags,
+            int64_t desiredPresentTime) override;
     void bootFinished() override;
     bool authenticateSurfaceTexture(
             const sp<IGraphicBufferProducer>& bufferProducer) const override;
@@ -630,7 +642,8 @@ private:
                                bool isMainThread = false) REQUIRES(mStateLock);
     // Returns true if at least one transaction was flushed
     bool flushTransactionQueues();
-    // Returns true if there is at least one transaction that needs to be flushed
+    // Returns true if there is at least one blocked transaction that has to be checked again
+    // on the next frame, because no wakeup could be scheduled for it
     bool transactionFlushNeeded();
     uint32_t getTransactionFlags(uint32_t flags);
     uint32_t peekTransactionFlags();
@@ -647,6 +660,11 @@ private:
     void commitOffscreenLayers();
     bool transactionIsReadyToBeApplied(int64_t desiredPresentTime,
                                        const Vector<ComposerState>& states);
+    struct TransactionState;
+    // Arranges for mTransactionReadinessThread to wake the main thread up when the transaction
+    // blocked at the front of |applyToken|'s queue may have become ready.
+    void scheduleTransactionReadiness(const sp<IBinder>& applyToken,
+                                      const TransactionState& transaction) REQUIRES(mStateLock);
     uint32_t setDisplayStateLocked(const DisplayState& s) REQUIRES(mStateLock);
     uint32_t addInputWindowCommands(const InputWindowCommands& inputWindowCommands)
             REQUIRES(mStateLock);
@@ -740,6 +758,13 @@ private:
     void traverseLayersInDisplay(const sp<const DisplayDevice>& display,
                                  const LayerVector::Visitor& visitor);
 
+    // Same as mDrawingState.traverseInZOrder and traverseInReverseZOrder, but
+    // iterate over mDrawingLayersInZOrder instead of walking the layer tree.
+    // Must be called from the main thread.
+    void traverseDrawingLayersInZOrder(const LayerVector::Visitor& visitor);
+    void traverseDrawingLayersInReverseZOrder(const LayerVector::Visitor& visitor);
+    const std::vector<Layer*>& getDrawingLayersInZOrder();
+
 
     bool canAllocateHwcDisplayIdForVDS(uint64_t usage);
     sp<StartPropertySetThread> mStartPropertySetThread;
@@ -957,16 +982,24 @@ private:
     void dumpStaticScreenStats(std::string& result) const;
     // Not const because each Layer needs to query Fences and cache timestamps.
     void dumpFrameEventsLocked(std::string& result);
+    void dumpFrameLatenciesLocked(std::string& result);
 
     void recordBufferingStats(const std::string& layerName,
                               std::vector<OccupancyTracker::Segment>&& history);
     void dumpBufferingStats(std::string& result) const;
+    void dumpTransactionQueues(std::string& result) const REQUIRES(mStateLock);
     void dumpDisplayIdentificationData(std::string& result) const REQUIRES(mStateLock);
     void dumpRawDisplayIdentificationData(const DumpArgs&, std::string& result) const;
     void dumpWideColorInfo(std::string& result) const REQUIRES(mStateLock);
     LayersProto dumpDrawingStateProto(uint32_t traceFlags) const;
     void dumpOffscreenLayersProto(LayersProto& layersProto,
                                   uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
+    // Copy out what dumpDrawingStateProto and dumpOffscreenLayersProto write, so that the protos
+    // can be built later without holding mTracingLock.
+    std::vector<LayerProtoSnapshot> snapshotDrawingStateForProto(uint32_t traceFlags) const;
+    std::vector<LayerProtoSnapshot> snapshotOffscreenLayersForProto(uint32_t traceFlags) const;
+    static void writeOffscreenLayersProto(const std::vector<LayerProtoSnapshot>& snapshots,
+                                          LayersProto& layersProto);
     // Dumps state from HW Composer
     void dumpHwc(std::string& result) const;
     LayersProto dumpProtoFromMainThread(uint32_t traceFlags = SurfaceTracing::TRACE_ALL)
@@ -1038,6 +1071,11 @@ private:
     // Can only accessed from the main thread, these members
     // don't need synchronization
     State mDrawingState{LayerVector::StateSet::Drawing};
+    // The layers of mDrawingState flattened in Z order. Only rebuilt when
+    // mDrawingLayersInZOrderValid is cleared, which happens whenever the
+    // drawing state hierarchy or Z order may have changed.
+    std::vector<Layer*> mDrawingLayersInZOrder;
+    bool mDrawingLayersInZOrderValid = false;
     bool mVisibleRegionsDirty = false;
     // Set during transaction commit stage to track if the input info for a layer has changed.
     bool mInputInfoChanged = false;
@@ -1103,6 +1141,8 @@ private:
     std::atomic<bool> mDisableBlurs = false;
     // If blurs are considered expensive and should require high GPU frequency.
     bool mBlursAreExpensive = false;
+    // If the composition state of multiple outputs should be computed concurrently.
+    bool mParallelOutputComposition = false;
     std::atomic<uint32_t> mFrameMissedCount = 0;
     std::atomic<uint32_t> mHwcFrameMissedCount = 0;
     std::atomic<uint32_t> mGpuFrameMissedCount = 0;
@@ -1158,6 +1198,8 @@ private:
         std::vector<ListenerCallbacks> listenerCallbacks;
     };
     std::unordered_map<sp<IBinder>, std::queue<TransactionState>, IListenerHash> mTransactionQueues;
+    // Set by flushTransactionQueues when a blocked transaction could not be given a wakeup
+    bool mTransactionQueuesNeedPolling = false;
 
     /* ------------------------------------------------------------------------
      * Feature prototyping
@@ -1300,6 +1342,9 @@ private:
     int mFrameRateFlexibilityTokenCount = 0;
 
     sp<IBinder> mDebugFrameRateFlexibilityToken;
+
+    // Declared last so that its thread is joined before the state its callback uses is destroyed.
+    TransactionReadinessThread mTransactionReadinessThread;
 };
 
 } // namespace android
@@ -22,6 +22,7 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
 #include "SurfaceTracing.h"
+#include <Layer.h>
 #include <SurfaceFlinger.h>
 
 #include <android-base/file.h>
@@ -32,40 +33,69 @@
 
 namespace android {
 
+// What traceLayersLocked copies out under mSfLock; the entry is built from it afterwards.
+struct SurfaceTracing::LayersTraceSnapshot {
+    int64_t elapsedRealtimeNanos = 0;
+    std::string where;
+    uint32_t traceFlags = 0;
+    uint32_t missedEntries = 0;
+    std::vector<LayerProtoSnapshot> layers;
+    // Only with TRACE_EXTRA.
+    std::vector<LayerProtoSnapshot> offscreenLayers;
+    // Only with TRACE_HWC.
+    std::string hwcDump;
+};
+
 SurfaceTracing::SurfaceTracing(SurfaceFlinger& flinger)
       : mFlinger(flinger), mSfLock(flinger.mTracingLock) {}
 
 void SurfaceTracing::mainLoop() {
     bool enabled = addFirstEntry();
     while (enabled) {
-        LayersTraceProto entry = traceWhenNotified();
-        enabled = addTraceToBuffer(entry);
+        enabled = addTraceToBuffer(traceWhenNotified());
     }
 }
 
 bool SurfaceTracing::addFirstEntry() {
-    LayersTraceProto entry;
+    LayersTraceSnapshot snapshot;
     {
         std::scoped_lock lock(mSfLock);
-        entry = traceLayersLocked("tracing.enable");
+        snapshot = traceLayersLocked("tracing.enable");
     }
-    return addTraceToBuffer(entry);
+    return addTraceToBuffer(snapshot);
 }
 
-LayersTraceProto SurfaceTracing::traceWhenNotified() {
+SurfaceTracing::LayersTraceSnapshot SurfaceTracing::traceWhenNotified() {
     std::unique_lock<std::mutex> lock(mSfLock);
     mCanStartTrace.wait(lock);
     android::base::ScopedLockAssertion assumeLock(mSfLock);
-    LayersTraceProto entry = traceLayersLocked(mWhere);
+    LayersTraceSnapshot snapshot = traceLayersLocked(mWhere);
     mTracingInProgress = false;
     mMissedTraceEntries = 0;
     lock.unlock();
-    return entry;
+    return snapshot;
 }
 
-bool SurfaceTracing::addTraceToBuffer(LayersTraceProto& entry) {
+bool SurfaceTracing::addTraceToBuffer(const LayersTraceSnapshot& snapshot) {
+    // The entry is built and encoded here rather than in traceLayersLocked so
+    // that the main thread, which takes mSfLock to notify us, only waits for the
+    // layer state to be copied, and before taking mTraceLock so that dump and
+    // the tracing controls are not held up either.
+    LayersTraceProto entry = buildEntry(snapshot);
+    bool restartDeltaEncoding;
+    {
+        std::scoped_lock lock(mTraceLock);
+        restartDeltaEncoding = std::exchange(mRestartDeltaEncoding, false);
+    }
+    if (restartDeltaEncoding) {
+        mDeltaEncoder.reset();
+    }
+    mDeltaEncoder.encode(entry);
+
     std::scoped_lock lock(mTraceLock);
-    mBuffer.emplace(std::move(entry));
+    if (!mBuffer.emplace(std::move(entry))) {
+        mRestartDeltaEncoding = true;
+    }
     if (mWriteToFile) {
         writeProtoFileLocked();
         mWriteToFile = false;
@@ -98,20 +128,46 @@ void SurfaceTracing::LayersTraceBuffer::reset(size_t newSize) {
     std::queue<LayersTraceProto>().swap(mStorage);
     mSizeInBytes = newSize;
     mUsedInBytes = 0U;
+    mKeyframeCount = 0U;
 }
 
-void SurfaceTracing::LayersTraceBuffer::emplace(LayersTraceProto&& proto) {
-    auto protoSize = proto.ByteSize();
-    while (mUsedInBytes + protoSize > mSizeInBytes) {
-        if (mStorage.empty()) {
-            return;
+bool SurfaceTracing::LayersTraceBuffer::isFull(size_t protoSize) const {
+    if (mSizeInFrames) {
+        return mStorage.size() >= mSizeInFrames;
+    }
+    return mUsedInBytes + protoSize > mSizeInBytes;
+}
+
+void SurfaceTracing::LayersTraceBuffer::popKeyframeGroup() {
+    do {
+        if (!mStorage.front().is_delta()) {
+            mKeyframeCount--;
         }
         mUsedInBytes -= mStorage.front().ByteSize();
         mStorage.pop();
+    } while (!mStorage.empty() && mStorage.front().is_delta());
+}
+
+bool SurfaceTracing::LayersTraceBuffer::emplace(LayersTraceProto&& proto) {
+    auto protoSize = proto.ByteSize();
+    while (!mStorage.empty() && isFull(protoSize)) {
+        if (proto.is_delta() && mKeyframeCount == 1) {
+            // Making room would evict the keyframe this delta depends on. Drop
+            // the delta instead; the caller starts over with a keyframe.
+            return false;
+        }
+        popKeyframeGroup();
+    }
+    if (mStorage.empty() && (proto.is_delta() || isFull(protoSize))) {
+        return false;
     }
     mUsedInBytes += protoSize;
+    if (!proto.is_delta()) {
+        mKeyframeCount++;
+    }
     mStorage.emplace();
     mStorage.back().Swap(&proto);
+    return true;
 }
 
 void SurfaceTracing::LayersTraceBuffer::flush(LayersTraceFileProto* fileProto) {
@@ -122,6 +178,57 @@ void SurfaceTracing::LayersTraceBuffer::flush(LayersTraceFileProto* fileProto) {
         entry->Swap(&mStorage.front());
         mStorage.pop();
     }
+    mUsedInBytes = 0U;
+    mKeyframeCount = 0U;
+}
+
+void SurfaceTracing::LayersDeltaEncoder::encode(LayersTraceProto& entry) {
+    if (!entry.is_delta()) {
+        // Delta tracing is off; start over with a keyframe if it is turned on.
+        if (!mLayers.empty()) {
+            reset();
+        }
+        return;
+    }
+
+    ATRACE_CALL();
+    const bool keyframe = mNeedsKeyframe || mEntriesSinceKeyframe + 1 >= kKeyframeInterval;
+
+    std::unordered_map<int32_t, std::string> layers;
+    layers.reserve(entry.layers().layers_size());
+    LayersProto changedLayers;
+    for (LayerProto& layer : *entry.mutable_layers()->mutable_layers()) {
+        const int32_t id = layer.id();
+        std::string serialized = layer.SerializeAsString();
+        if (!keyframe) {
+            const auto it = mLayers.find(id);
+            if (it == mLayers.end() || it->second != serialized) {
+                changedLayers.add_layers()->Swap(&layer);
+            }
+        }
+        layers.emplace(id, std::move(serialized));
+    }
+
+    if (keyframe) {
+        entry.set_is_delta(false);
+        mEntriesSinceKeyframe = 0U;
+        mNeedsKeyframe = false;
+    } else {
+        for (const auto& [id, serialized] : mLayers) {
+            if (layers.count(id) == 0) {
+                entry.add_removed_layers(id);
+            }
+        }
+        entry.mutable_layers()->Swap(&changedLayers);
+        mEntriesSinceKeyframe++;
+    }
+    mLayers = std::move(layers);
+}
+
+void SurfaceTracing::LayersDeltaEncoder::reset() {
+    mLayers.clear();
+    mEntriesSinceKeyframe = 0U;
+    mNeedsKeyframe = true;
 }
 
 bool SurfaceTracing::enable() {
@@ -132,6 +239,8 @@ bool SurfaceTracing::enable() {
     }
 
     mBuffer.reset(mBufferSize);
+    mBuffer.setSizeInFrames(mBufferSizeInFrames);
+    mRestartDeltaEncoding = true;
     mEnabled = true;
     mThread = std::thread(&SurfaceTracing::mainLoop, this);
     return true;
@@ -171,33 +280,63 @@ void SurfaceTracing::setBufferSize(size_t bufferSizeInByte) {
     mBuffer.setSize(bufferSizeInByte);
 }
 
+void SurfaceTracing::setBufferSizeInFrames(size_t bufferSizeInFrames) {
+    std::scoped_lock lock(mTraceLock);
+    mBufferSizeInFrames = bufferSizeInFrames;
+    mBuffer.setSizeInFrames(bufferSizeInFrames);
+}
+
 void SurfaceTracing::setTraceFlags(uint32_t flags) {
     std::scoped_lock lock(mSfLock);
     mTraceFlags = flags;
 }
 
-LayersTraceProto SurfaceTracing::traceLayersLocked(const char* where) {
+SurfaceTracing::LayersTraceSnapshot SurfaceTracing::traceLayersLocked(const char* where) {
     ATRACE_CALL();
 
-    LayersTraceProto entry;
-    entry.set_elapsed_realtime_nanos(elapsedRealtimeNano());
-    entry.set_where(where);
-    LayersProto layers(mFlinger.dumpDrawingStateProto(mTraceFlags));
+    LayersTraceSnapshot snapshot;
+    snapshot.elapsedRealtimeNanos = elapsedRealtimeNano();
+    snapshot.where = where;
+    snapshot.traceFlags = mTraceFlags;
+    snapshot.missedEntries = mMissedTraceEntries;
+    snapshot.layers = mFlinger.snapshotDrawingStateForProto(mTraceFlags);
 
     if (flagIsSetLocked(SurfaceTracing::TRACE_EXTRA)) {
-        mFlinger.dumpOffscreenLayersProto(layers);
+        snapshot.offscreenLayers = mFlinger.snapshotOffscreenLayersForProto(TRACE_ALL);
     }
-    entry.mutable_layers()->Swap(&layers);
-
     if (mTraceFlags & SurfaceTracing::TRACE_HWC) {
-        std::string hwcDump;
-        mFlinger.dumpHwc(hwcDump);
-        entry.set_hwc_blob(hwcDump);
+        mFlinger.dumpHwc(snapshot.hwcDump);
     }
-    if (!flagIsSetLocked(SurfaceTracing::TRACE_COMPOSITION)) {
+
+    return snapshot;
+}
+
+LayersTraceProto SurfaceTracing::buildEntry(const LayersTraceSnapshot& snapshot) {
+    ATRACE_CALL();
+
+    LayersTraceProto entry;
+    entry.set_elapsed_realtime_nanos(snapshot.elapsedRealtimeNanos);
+    entry.set_where(snapshot.where);
+    LayersProto* layers = entry.mutable_layers();
+    for (const LayerProtoSnapshot& layer : snapshot.layers) {
+        Layer::writeToProto(layer, *layers);
+    }
+
+    if (snapshot.traceFlags & SurfaceTracing::TRACE_EXTRA) {
+        SurfaceFlinger::writeOffscreenLayersProto(snapshot.offscreenLayers, *layers);
+    }
+    if (snapshot.traceFlags & SurfaceTracing::TRACE_HWC) {
+        entry.set_hwc_blob(snapshot.hwcDump);
+    }
+    if (!(snapshot.traceFlags & SurfaceTracing::TRACE_COMPOSITION)) {
         entry.set_excludes_composition_state(true);
     }
-    entry.set_missed_entries(mMissedTraceEntries);
+    entry.set_missed_entries(snapshot.missedEntries);
+    // Every layer is recorded; LayersDeltaEncoder strips the unchanged ones,
+    // unless the entry has to be a keyframe.
+    if (snapshot.traceFlags & SurfaceTracing::TRACE_DELTA) {
+        entry.set_is_delta(true);
+    }
 
     return entry;
 }
@@ -212,6 +351,7 @@ void SurfaceTracing::writeProtoFileLocked() {
                                LayersTraceFileProto_MagicNumber_MAGIC_NUMBER_L);
     mBuffer.flush(&fileProto);
     mBuffer.reset(mBufferSize);
+    mRestartDeltaEncoding = true;
 
     if (!fileProto.SerializeToString(&output)) {
         ALOGE("Could not save the proto file! Permission denied");
@@ -232,9 +372,16 @@ void SurfaceTracing::writeProtoFileLocked() {
 void SurfaceTracing::dump(std::string& result) const {
     std::scoped_lock lock(mTraceLock);
     base::StringAppendF(&result, "Tracing state: %s\n", mEnabled ? "enabled" : "disabled");
-    base::StringAppendF(&result, "  number of entries: %zu (%.2fMB / %.2fMB)\n",
-                        mBuffer.frameCount(), float(mBuffer.used()) / float(1_MB),
-                        float(mBuffer.size()) / float(1_MB));
+    if (mBuffer.sizeInFrames()) {
+        base::StringAppendF(&result, "  number of entries: %zu / %zu (%.2fMB)\n",
+                            mBuffer.frameCount(), mBuffer.sizeInFrames(),
+                            float(mBuffer.used()) / float(1_MB));
+    } else {
+        base::StringAppendF(&result, "  number of entries: %zu (%.2fMB / %.2fMB)\n",
+                            mBuffer.frameCount(), float(mBuffer.used()) / float(1_MB),
+                            float(mBuffer.size()) / float(1_MB));
+    }
+    base::StringAppendF(&result, "  number of keyframes: %zu\n", mBuffer.keyframeCount());
 }
 
 } // namespace android
@@ -25,7 +25,10 @@
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
 
 using namespace android::surfaceflinger;
 
@@ -50,6 +53,8 @@ public:
     void notifyLocked(const char* where) NO_THREAD_SAFETY_ANALYSIS /* REQUIRES(mSfLock) */;
 
     void setBufferSize(size_t bufferSizeInByte);
+    // Sizes the buffer in entries rather than in bytes, or in bytes again if 0.
+    void setBufferSizeInFrames(size_t bufferSizeInFrames);
     void writeToFileAsync();
     void dump(std::string& result) const;
 
@@ -59,6 +64,9 @@ public:
         TRACE_COMPOSITION = 1 << 2,
         TRACE_EXTRA = 1 << 3,
         TRACE_HWC = 1 << 4,
+        // Only record the layers that changed since the previous entry, with a keyframe
+        // holding every layer at regular intervals.
+        TRACE_DELTA = 1 << 5,
         TRACE_ALL = 0xffffffff
     };
     void setTraceFlags(uint32_t flags);
@@ -67,6 +75,8 @@ public:
     }
 
 private:
+    friend class SurfaceTracingTest;
+
     static constexpr auto kDefaultBufferCapInByte = 5_MB;
     static constexpr auto kDefaultFileName = "/data/misc/wmtrace/layers_trace.pb";
 
@@ -75,31 +85,68 @@ private:
         size_t size() const { return mSizeInBytes; }
         size_t used() const { return mUsedInBytes; }
         size_t frameCount() const { return mStorage.size(); }
+        size_t sizeInFrames() const { return mSizeInFrames; }
+        size_t keyframeCount() const { return mKeyframeCount; }
 
         void setSize(size_t newSize) { mSizeInBytes = newSize; }
+        void setSizeInFrames(size_t newSize) { mSizeInFrames = newSize; }
         void reset(size_t newSize);
-        void emplace(LayersTraceProto&& proto);
+        // Returns false if the entry was dropped, which happens to a delta
+        // that would need its own keyframe evicted to fit.
+        bool emplace(LayersTraceProto&& proto);
         void flush(LayersTraceFileProto* fileProto);
 
     private:
+        bool isFull(size_t protoSize) const;
+        // Drops the oldest keyframe along with the deltas that depend on it, so
+        // that the buffer always starts with a keyframe.
+        void popKeyframeGroup();
+
         size_t mUsedInBytes = 0U;
         size_t mSizeInBytes = 0U;
+        // When non-zero, the buffer holds this many entries whatever their size.
+        size_t mSizeInFrames = 0U;
+        size_t mKeyframeCount = 0U;
         std::queue<LayersTraceProto> mStorage;
     };
 
+    // Strips the layers that did not change since the previous entry from the
+    // entries traced with TRACE_DELTA, except for every kKeyframeInterval-th
+    // entry, which is kept whole.
+    class LayersDeltaEncoder {
+    public:
+        static constexpr size_t kKeyframeInterval = 60;
+
+        void encode(LayersTraceProto& entry);
+        // Makes the next entry a keyframe.
+        void reset();
+
+    private:
+        // The serialized layers of the previous entry, by layer id.
+        std::unordered_map<int32_t, std::string> mLayers;
+        size_t mEntriesSinceKeyframe = 0U;
+        bool mNeedsKeyframe = true;
+    };
+
+    struct LayersTraceSnapshot;
+
     void mainLoop();
     bool addFirstEntry();
-    LayersTraceProto traceWhenNotified();
-    LayersTraceProto traceLayersLocked(const char* where) REQUIRES(mSfLock);
+    LayersTraceSnapshot traceWhenNotified();
+    // Only copies the layer state, so that mSfLock is held as briefly as possible.
+    LayersTraceSnapshot traceLayersLocked(const char* where) REQUIRES(mSfLock);
+    static LayersTraceProto buildEntry(const LayersTraceSnapshot& snapshot);
 
     // Returns true if trace is enabled.
-    bool addTraceToBuffer(LayersTraceProto& entry);
+    bool addTraceToBuffer(const LayersTraceSnapshot& snapshot);
     void writeProtoFileLocked() REQUIRES(mTraceLock);
 
     SurfaceFlinger& mFlinger;
     status_t mLastErr = NO_ERROR;
     std::thread mThread;
     std::condition_variable mCanStartTrace;
+    // Only used by the tracing thread, outside of mTraceLock.
+    LayersDeltaEncoder mDeltaEncoder;
 
     std::mutex& mSfLock;
     uint32_t mTraceFlags GUARDED_BY(mSfLock) = TRACE_CRITICAL | TRACE_INPUT;
@@ -109,7 +156,11 @@ private:
 
     mutable std::mutex mTraceLock;
     LayersTraceBuffer mBuffer GUARDED_BY(mTraceLock);
+    // Set when the buffer no longer holds the entry the next delta would be
+    // relative to, so that the tracing thread starts over with a keyframe.
+    bool mRestartDeltaEncoding GUARDED_BY(mTraceLock) = true;
     size_t mBufferSize GUARDED_BY(mTraceLock) = kDefaultBufferCapInByte;
+    size_t mBufferSizeInFrames GUARDED_BY(mTraceLock) = 0U;
     bool mEnabled GUARDED_BY(mTraceLock) = false;
     bool mWriteToFile GUARDED_BY(mTraceLock) = false;
 };
@@ -123,6 +123,7 @@ AStatsManager_PullAtomCallbackReturn TimeStats::populateGlobalAtom(AStatsEventLi
 
 AStatsManager_PullAtomCallbackReturn TimeStats::populateLayerAtom(AStatsEventList* data) {
     std::lock_guard<std::mutex> lock(mMutex);
+    flushPendingLayerStatsLocked();
 
     std::vector<TimeStatsHelper::TimeStatsLayer const*> dumpStats;
     for (const auto& ele : mTimeStats.stats) {
@@ -239,7 +240,7 @@ std::string TimeStats::miniDump() {
     std::string result = "TimeStats miniDump:\n";
     std::lock_guard<std::mutex> lock(mMutex);
     android::base::StringAppendF(&result, "Number of layers currently being tracked is %zu\n",
-                                 mTimeStatsTracker.size());
+                                 mLayerRecordCount.load());
     android::base::StringAppendF(&result, "Number of layers in the stats pool is %zu\n",
                                  mTimeStats.stats.size());
     return result;
@@ -385,72 +386,133 @@ bool TimeStats::recordReadyLocked(int32_t layerId, TimeRecord* timeRecord) {
     return true;
 }
 
-void TimeStats::flushAvailableRecordsToStatsLocked(int32_t layerId) {
+void TimeStats::eraseLayerRecordLocked(LayerShard& shard,
+                                       std::unordered_map<int32_t, LayerRecord>::iterator it) {
+    LayerRecord& layerRecord = it->second;
+    if (!layerRecord.pendingStats.frames.empty()) {
+        shard.erasedLayerStats.emplace_back(std::move(layerRecord.layerName),
+                                            std::move(layerRecord.pendingStats));
+    }
+    shard.layerRecords.erase(it);
+    mLayerRecordCount--;
+}
+
+bool TimeStats::flushAvailableRecordsToStatsLocked(LayerShard& shard, int32_t layerId,
+                                                   LayerRecord& layerRecord) {
     ATRACE_CALL();
 
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
     TimeRecord& prevTimeRecord = layerRecord.prevTimeRecord;
     std::deque<TimeRecord>& timeRecords = layerRecord.timeRecords;
+    PendingLayerStats& pendingStats = layerRecord.pendingStats;
     while (!timeRecords.empty()) {
         if (!recordReadyLocked(layerId, &timeRecords[0])) break;
         ALOGV("[%d]-[%" PRIu64 "]-presentFenceTime[%" PRId64 "]", layerId,
               timeRecords[0].frameTime.frameNumber, timeRecords[0].frameTime.presentTime);
 
         if (prevTimeRecord.ready) {
-            const std::string& layerName = layerRecord.layerName;
-            if (!mTimeStats.stats.count(layerName)) {
-                mTimeStats.stats[layerName].layerName = layerName;
-            }
-            TimeStatsHelper::TimeStatsLayer& timeStatsLayer = mTimeStats.stats[layerName];
-            timeStatsLayer.totalFrames++;
-            timeStatsLayer.droppedFrames += layerRecord.droppedFrames;
-            timeStatsLayer.lateAcquireFrames += layerRecord.lateAcquireFrames;
-            timeStatsLayer.badDesiredPresentFrames += layerRecord.badDesiredPresentFrames;
+            pendingStats.droppedFrames += layerRecord.droppedFrames;
+            pendingStats.lateAcquireFrames += layerRecord.lateAcquireFrames;
+            pendingStats.badDesiredPresentFrames += layerRecord.badDesiredPresentFrames;
 
             layerRecord.droppedFrames = 0;
             layerRecord.lateAcquireFrames = 0;
             layerRecord.badDesiredPresentFrames = 0;
 
-            const int32_t postToAcquireMs = msBetween(timeRecords[0].frameTime.postTime,
-                                                      timeRecords[0].frameTime.acquireTime);
-            ALOGV("[%d]-[%" PRIu64 "]-post2acquire[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, postToAcquireMs);
-            timeStatsLayer.deltas["post2acquire"].insert(postToAcquireMs);
-
-            const int32_t postToPresentMs = msBetween(timeRecords[0].frameTime.postTime,
-                                                      timeRecords[0].frameTime.presentTime);
-            ALOGV("[%d]-[%" PRIu64 "]-post2present[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, postToPresentMs);
-            timeStatsLayer.deltas["post2present"].insert(postToPresentMs);
-
-            const int32_t acquireToPresentMs = msBetween(timeRecords[0].frameTime.acquireTime,
-                                                         timeRecords[0].frameTime.presentTime);
-            ALOGV("[%d]-[%" PRIu64 "]-acquire2present[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, acquireToPresentMs);
-            timeStatsLayer.deltas["acquire2present"].insert(acquireToPresentMs);
-
-            const int32_t latchToPresentMs = msBetween(timeRecords[0].frameTime.latchTime,
-                                                       timeRecords[0].frameTime.presentTime);
-            ALOGV("[%d]-[%" PRIu64 "]-latch2present[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, latchToPresentMs);
-            timeStatsLayer.deltas["latch2present"].insert(latchToPresentMs);
-
-            const int32_t desiredToPresentMs = msBetween(timeRecords[0].frameTime.desiredTime,
-                                                         timeRecords[0].frameTime.presentTime);
-            ALOGV("[%d]-[%" PRIu64 "]-desired2present[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, desiredToPresentMs);
-            timeStatsLayer.deltas["desired2present"].insert(desiredToPresentMs);
-
-            const int32_t presentToPresentMs = msBetween(prevTimeRecord.frameTime.presentTime,
-                                                         timeRecords[0].frameTime.presentTime);
-            ALOGV("[%d]-[%" PRIu64 "]-present2present[%d]", layerId,
-                  timeRecords[0].frameTime.frameNumber, presentToPresentMs);
-            timeStatsLayer.deltas["present2present"].insert(presentToPresentMs);
+            const FrameTime& frameTime = timeRecords[0].frameTime;
+            const FrameDeltas deltas = {
+                    .postToAcquire = msBetween(frameTime.postTime, frameTime.acquireTime),
+                    .postToPresent = msBetween(frameTime.postTime, frameTime.presentTime),
+                    .acquireToPresent = msBetween(frameTime.acquireTime, frameTime.presentTime),
+                    .latchToPresent = msBetween(frameTime.latchTime, frameTime.presentTime),
+                    .desiredToPresent = msBetween(frameTime.desiredTime, frameTime.presentTime),
+                    .presentToPresent =
+                            msBetween(prevTimeRecord.frameTime.presentTime, frameTime.presentTime),
+            };
+            ALOGV("[%d]-[%" PRIu64 "]-post2acquire[%d]-post2present[%d]-acquire2present[%d]"
+                  "-latch2present[%d]-desired2present[%d]-present2present[%d]",
+                  layerId, frameTime.frameNumber, deltas.postToAcquire, deltas.postToPresent,
+                  deltas.acquireToPresent, deltas.latchToPresent, deltas.desiredToPresent,
+                  deltas.presentToPresent);
+            pendingStats.frames.push_back(deltas);
+            shard.pendingFrameCount++;
         }
         prevTimeRecord = timeRecords[0];
         timeRecords.pop_front();
         layerRecord.waitData--;
     }
+    return shard.pendingFrameCount >= MAX_NUM_PENDING_FRAMES;
+}
+
+uint32_t TimeStats::takePendingLayerStats(
+        LayerShard& shard, std::vector<std::pair<std::string, PendingLayerStats>>* out) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    *out = std::move(shard.erasedLayerStats);
+    shard.erasedLayerStats.clear();
+    for (auto& [layerId, layerRecord] : shard.layerRecords) {
+        if (!layerRecord.pendingStats.frames.empty()) {
+            out->emplace_back(layerRecord.layerName, std::move(layerRecord.pendingStats));
+            layerRecord.pendingStats = {};
+        }
+    }
+    shard.pendingFrameCount = 0;
+    return mLayerStatsGeneration.load();
+}
+
+void TimeStats::addPendingLayerStatsLocked(
+        const std::vector<std::pair<std::string, PendingLayerStats>>& pendingStats) {
+    ATRACE_CALL();
+
+    for (const auto& [layerName, layerStats] : pendingStats) {
+        auto it = mTimeStats.stats.find(layerName);
+        if (it == mTimeStats.stats.end()) {
+            if (mTimeStats.stats.size() >= MAX_NUM_LAYER_STATS) {
+                continue;
+            }
+            it = mTimeStats.stats.emplace(layerName, TimeStatsHelper::TimeStatsLayer()).first;
+            it->second.layerName = layerName;
+            mLayerStatsFull = mTimeStats.stats.size() >= MAX_NUM_LAYER_STATS;
+        }
+        TimeStatsHelper::TimeStatsLayer& timeStatsLayer = it->second;
+        timeStatsLayer.totalFrames += layerStats.frames.size();
+        timeStatsLayer.droppedFrames += layerStats.droppedFrames;
+        timeStatsLayer.lateAcquireFrames += layerStats.lateAcquireFrames;
+        timeStatsLayer.badDesiredPresentFrames += layerStats.badDesiredPresentFrames;
+
+        TimeStatsHelper::Histogram& postToAcquire = timeStatsLayer.deltas["post2acquire"];
+        TimeStatsHelper::Histogram& postToPresent = timeStatsLayer.deltas["post2present"];
+        TimeStatsHelper::Histogram& acquireToPresent = timeStatsLayer.deltas["acquire2present"];
+        TimeStatsHelper::Histogram& latchToPresent = timeStatsLayer.deltas["latch2present"];
+        TimeStatsHelper::Histogram& desiredToPresent = timeStatsLayer.deltas["desired2present"];
+        TimeStatsHelper::Histogram& presentToPresent = timeStatsLayer.deltas["present2present"];
+        for (const FrameDeltas& deltas : layerStats.frames) {
+            postToAcquire.insert(deltas.postToAcquire);
+            postToPresent.insert(deltas.postToPresent);
+            acquireToPresent.insert(deltas.acquireToPresent);
+            latchToPresent.insert(deltas.latchToPresent);
+            desiredToPresent.insert(deltas.desiredToPresent);
+            presentToPresent.insert(deltas.presentToPresent);
+        }
+    }
+}
+
+void TimeStats::flushPendingLayerStats(LayerShard& shard) {
+    ATRACE_CALL();
+
+    std::vector<std::pair<std::string, PendingLayerStats>> pendingStats;
+    const uint32_t generation = takePendingLayerStats(shard, &pendingStats);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (generation == mLayerStatsGeneration.load()) {
+        addPendingLayerStatsLocked(pendingStats);
+    }
+}
+
+void TimeStats::flushPendingLayerStatsLocked() {
+    std::vector<std::pair<std::string, PendingLayerStats>> pendingStats;
+    for (LayerShard& shard : mLayerShards) {
+        takePendingLayerStats(shard, &pendingStats);
+        addPendingLayerStatsLocked(pendingStats);
+    }
 }
 
 static constexpr const char* kPopupWindowPrefix = "PopupWindow";
@@ -470,20 +532,30 @@ void TimeStats::setPostTime(int32_t layerId, uint64_t frameNumber, const std::st
     ALOGV("[%d]-[%" PRIu64 "]-[%s]-PostTime[%" PRId64 "]", layerId, frameNumber, layerName.c_str(),
           postTime);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStats.stats.count(layerName) && mTimeStats.stats.size() >= MAX_NUM_LAYER_STATS) {
-        return;
+    if (mLayerStatsFull.load()) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mTimeStats.stats.count(layerName)) {
+            return;
+        }
     }
-    if (!mTimeStatsTracker.count(layerId) && mTimeStatsTracker.size() < MAX_NUM_LAYER_RECORDS &&
-        layerNameIsValid(layerName)) {
-        mTimeStatsTracker[layerId].layerName = layerName;
+
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) {
+        if (!layerNameIsValid(layerName)) return;
+        if (mLayerRecordCount.fetch_add(1) >= MAX_NUM_LAYER_RECORDS) {
+            mLayerRecordCount--;
+            return;
+        }
+        it = shard.layerRecords.emplace(layerId, LayerRecord()).first;
+        it->second.layerName = layerName;
     }
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerRecord& layerRecord = it->second;
     if (layerRecord.timeRecords.size() == MAX_NUM_TIME_RECORDS) {
         ALOGE("[%d]-[%s]-timeRecords is at its maximum size[%zu]. Ignore this when unittesting.",
               layerId, layerRecord.layerName.c_str(), MAX_NUM_TIME_RECORDS);
-        mTimeStatsTracker.erase(layerId);
+        eraseLayerRecordLocked(shard, it);
         return;
     }
     // For most media content, the acquireFence is invalid because the buffer is
@@ -511,9 +583,11 @@ void TimeStats::setLatchTime(int32_t layerId, uint64_t frameNumber, nsecs_t latc
     ATRACE_CALL();
     ALOGV("[%d]-[%" PRIu64 "]-LatchTime[%" PRId64 "]", layerId, frameNumber, latchTime);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     if (layerRecord.waitData < 0 ||
         layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
         return;
@@ -530,9 +604,11 @@ void TimeStats::incrementLatchSkipped(int32_t layerId, LatchSkipReason reason) {
     ALOGV("[%d]-LatchSkipped-Reason[%d]", layerId,
           static_cast<std::underlying_type<LatchSkipReason>::type>(reason));
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
 
     switch (reason) {
         case LatchSkipReason::LateAcquire:
@@ -547,9 +623,11 @@ void TimeStats::incrementBadDesiredPresent(int32_t layerId) {
     ATRACE_CALL();
     ALOGV("[%d]-BadDesiredPresent", layerId);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     layerRecord.badDesiredPresentFrames++;
 }
 
@@ -559,9 +637,11 @@ void TimeStats::setDesiredTime(int32_t layerId, uint64_t frameNumber, nsecs_t de
     ATRACE_CALL();
     ALOGV("[%d]-[%" PRIu64 "]-DesiredTime[%" PRId64 "]", layerId, frameNumber, desiredTime);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     if (layerRecord.waitData < 0 ||
         layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
         return;
@@ -577,9 +657,11 @@ void TimeStats::setAcquireTime(int32_t layerId, uint64_t frameNumber, nsecs_t ac
     ATRACE_CALL();
     ALOGV("[%d]-[%" PRIu64 "]-AcquireTime[%" PRId64 "]", layerId, frameNumber, acquireTime);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     if (layerRecord.waitData < 0 ||
         layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
         return;
@@ -597,9 +679,11 @@ void TimeStats::setAcquireFence(int32_t layerId, uint64_t frameNumber,
     ALOGV("[%d]-[%" PRIu64 "]-AcquireFenceTime[%" PRId64 "]", layerId, frameNumber,
           acquireFence->getSignalTime());
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     if (layerRecord.waitData < 0 ||
         layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
         return;
@@ -615,20 +699,29 @@ void TimeStats::setPresentTime(int32_t layerId, uint64_t frameNumber, nsecs_t pr
     ATRACE_CALL();
     ALOGV("[%d]-[%" PRIu64 "]-PresentTime[%" PRId64 "]", layerId, frameNumber, presentTime);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
-    if (layerRecord.waitData < 0 ||
-        layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
-        return;
-    TimeRecord& timeRecord = layerRecord.timeRecords[layerRecord.waitData];
-    if (timeRecord.frameTime.frameNumber == frameNumber) {
-        timeRecord.frameTime.presentTime = presentTime;
-        timeRecord.ready = true;
-        layerRecord.waitData++;
+    LayerShard& shard = getLayerShard(layerId);
+    bool needsFlush = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.layerRecords.find(layerId);
+        if (it == shard.layerRecords.end()) return;
+        LayerRecord& layerRecord = it->second;
+        if (layerRecord.waitData < 0 ||
+            layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
+            return;
+        TimeRecord& timeRecord = layerRecord.timeRecords[layerRecord.waitData];
+        if (timeRecord.frameTime.frameNumber == frameNumber) {
+            timeRecord.frameTime.presentTime = presentTime;
+            timeRecord.ready = true;
+            layerRecord.waitData++;
+        }
+
+        needsFlush = flushAvailableRecordsToStatsLocked(shard, layerId, layerRecord);
     }
 
-    flushAvailableRecordsToStatsLocked(layerId);
+    if (needsFlush) {
+        flushPendingLayerStats(shard);
+    }
 }
 
 void TimeStats::setPresentFence(int32_t layerId, uint64_t frameNumber,
@@ -639,27 +732,40 @@ void TimeStats::setPresentFence(int32_t layerId, uint64_t frameNumber,
     ALOGV("[%d]-[%" PRIu64 "]-PresentFenceTime[%" PRId64 "]", layerId, frameNumber,
           presentFence->getSignalTime());
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
-    if (layerRecord.waitData < 0 ||
-        layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
-        return;
-    TimeRecord& timeRecord = layerRecord.timeRecords[layerRecord.waitData];
-    if (timeRecord.frameTime.frameNumber == frameNumber) {
-        timeRecord.presentFence = presentFence;
-        timeRecord.ready = true;
-        layerRecord.waitData++;
+    LayerShard& shard = getLayerShard(layerId);
+    bool needsFlush = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.layerRecords.find(layerId);
+        if (it == shard.layerRecords.end()) return;
+        LayerRecord& layerRecord = it->second;
+        if (layerRecord.waitData < 0 ||
+            layerRecord.waitData >= static_cast<int32_t>(layerRecord.timeRecords.size()))
+            return;
+        TimeRecord& timeRecord = layerRecord.timeRecords[layerRecord.waitData];
+        if (timeRecord.frameTime.frameNumber == frameNumber) {
+            timeRecord.presentFence = presentFence;
+            timeRecord.ready = true;
+            layerRecord.waitData++;
+        }
+
+        needsFlush = flushAvailableRecordsToStatsLocked(shard, layerId, layerRecord);
     }
 
-    flushAvailableRecordsToStatsLocked(layerId);
+    if (needsFlush) {
+        flushPendingLayerStats(shard);
+    }
 }
 
 void TimeStats::onDestroy(int32_t layerId) {
     ATRACE_CALL();
     ALOGV("[%d]-onDestroy", layerId);
-    std::lock_guard<std::mutex> lock(mMutex);
-    mTimeStatsTracker.erase(layerId);
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it != shard.layerRecords.end()) {
+        eraseLayerRecordLocked(shard, it);
+    }
 }
 
 void TimeStats::removeTimeRecord(int32_t layerId, uint64_t frameNumber) {
@@ -668,9 +774,11 @@ void TimeStats::removeTimeRecord(int32_t layerId, uint64_t frameNumber) {
     ATRACE_CALL();
     ALOGV("[%d]-[%" PRIu64 "]-removeTimeRecord", layerId, frameNumber);
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!mTimeStatsTracker.count(layerId)) return;
-    LayerRecord& layerRecord = mTimeStatsTracker[layerId];
+    LayerShard& shard = getLayerShard(layerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.layerRecords.find(layerId);
+    if (it == shard.layerRecords.end()) return;
+    LayerRecord& layerRecord = it->second;
     size_t removeAt = 0;
     for (const TimeRecord& record : layerRecord.timeRecords) {
         if (record.frameTime.frameNumber == frameNumber) break;
@@ -870,8 +978,16 @@ void TimeStats::clearGlobalLocked() {
 void TimeStats::clearLayersLocked() {
     ATRACE_CALL();
 
-    mTimeStatsTracker.clear();
+    for (LayerShard& shard : mLayerShards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.layerRecords.clear();
+        shard.erasedLayerStats.clear();
+        shard.pendingFrameCount = 0;
+    }
+    mLayerStatsGeneration++;
+    mLayerRecordCount = 0;
     mTimeStats.stats.clear();
+    mLayerStatsFull = false;
     ALOGD("Cleared layer stats");
 }
 
@@ -890,6 +1006,7 @@ void TimeStats::dump(bool asProto, std::optional<uint32_t> maxLayers, std::strin
     mTimeStats.statsEnd = static_cast<int64_t>(std::time(0));
 
     flushPowerTimeLocked();
+    flushPendingLayerStatsLocked();
 
     if (asProto) {
         ALOGD("Dumping TimeStats as proto");
@@ -34,11 +34,15 @@
 #include <utils/String16.h>
 #include <utils/Vector.h>
 
+#include <array>
+#include <atomic>
 #include <deque>
 #include <mutex>
 #include <optional>
+#include <string>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 
 using namespace android::surfaceflinger;
 
@@ -141,6 +145,24 @@ class TimeStats : public android::TimeStats {
         std::shared_ptr<FenceTime> presentFence;
     };
 
+    // The deltas of a frame whose timestamps are all known, in milliseconds,
+    // waiting to be added to the histograms.
+    struct FrameDeltas {
+        int32_t postToAcquire;
+        int32_t postToPresent;
+        int32_t acquireToPresent;
+        int32_t latchToPresent;
+        int32_t desiredToPresent;
+        int32_t presentToPresent;
+    };
+
+    struct PendingLayerStats {
+        std::vector<FrameDeltas> frames;
+        uint32_t droppedFrames = 0;
+        uint32_t lateAcquireFrames = 0;
+        uint32_t badDesiredPresentFrames = 0;
+    };
+
     struct LayerRecord {
         std::string layerName;
         // This is the index in timeRecords, at which the timestamps for that
@@ -152,6 +174,20 @@ class TimeStats : public android::TimeStats {
         uint32_t badDesiredPresentFrames = 0;
         TimeRecord prevTimeRecord;
         std::deque<TimeRecord> timeRecords;
+        PendingLayerStats pendingStats;
+    };
+
+    // The layers are spread over shards by layer id, each with its own lock,
+    // so that recording timestamps for a layer neither contends with other
+    // layers nor with the global stats. Completed frames are only added to
+    // mTimeStats in batches, by flushPendingLayerStats().
+    struct LayerShard {
+        std::mutex mutex;
+        std::unordered_map<int32_t, LayerRecord> layerRecords;
+        // The pending stats of the layers whose record was erased before
+        // they were flushed.
+        std::vector<std::pair<std::string, PendingLayerStats>> erasedLayerStats;
+        size_t pendingFrameCount = 0;
     };
 
     struct PowerTime {
@@ -273,7 +309,24 @@ private:
     AStatsManager_PullAtomCallbackReturn populateGlobalAtom(AStatsEventList* data);
     AStatsManager_PullAtomCallbackReturn populateLayerAtom(AStatsEventList* data);
     bool recordReadyLocked(int32_t layerId, TimeRecord* timeRecord);
-    void flushAvailableRecordsToStatsLocked(int32_t layerId);
+    LayerShard& getLayerShard(int32_t layerId) {
+        return mLayerShards[static_cast<uint32_t>(layerId) % NUM_LAYER_SHARDS];
+    }
+    // Requires the lock of |shard|.
+    void eraseLayerRecordLocked(LayerShard& shard,
+                                std::unordered_map<int32_t, LayerRecord>::iterator it);
+    // Requires the lock of |shard|. Returns whether the shard should be flushed.
+    bool flushAvailableRecordsToStatsLocked(LayerShard& shard, int32_t layerId,
+                                            LayerRecord& layerRecord);
+    // Moves the pending stats out of |shard|, which must not be locked. The
+    // returned generation is the one of the layer stats at the time.
+    uint32_t takePendingLayerStats(LayerShard& shard,
+                                   std::vector<std::pair<std::string, PendingLayerStats>>* out);
+    void addPendingLayerStatsLocked(
+            const std::vector<std::pair<std::string, PendingLayerStats>>& pendingStats);
+    // Called without mMutex held, from the threads recording timestamps.
+    void flushPendingLayerStats(LayerShard& shard);
+    void flushPendingLayerStatsLocked();
     void flushPowerTimeLocked();
     void flushAvailableGlobalRecordsToStatsLocked();
 
@@ -285,13 +338,23 @@ private:
     void dump(bool asProto, std::optional<uint32_t> maxLayers, std::string& result);
 
     std::atomic<bool> mEnabled = false;
+    // mMutex is acquired before the lock of any LayerShard, never after.
     std::mutex mMutex;
     TimeStatsHelper::TimeStatsGlobal mTimeStats;
-    // Hashmap for LayerRecord with layerId as the hash key
-    std::unordered_map<int32_t, LayerRecord> mTimeStatsTracker;
     PowerTime mPowerTime;
     GlobalRecord mGlobalRecord;
 
+    static const size_t NUM_LAYER_SHARDS = 8;
+    // The number of completed frames a shard holds before they are flushed.
+    static const size_t MAX_NUM_PENDING_FRAMES = 256;
+    std::array<LayerShard, NUM_LAYER_SHARDS> mLayerShards;
+    std::atomic<size_t> mLayerRecordCount = 0;
+    // Set once mTimeStats.stats has room for no more layers.
+    std::atomic<bool> mLayerStatsFull = false;
+    // Incremented when the layer stats are cleared, so that the stats taken
+    // from a shard just before are dropped rather than flushed.
+    std::atomic<uint32_t> mLayerStatsGeneration = 0;
+
     static const size_t MAX_NUM_LAYER_RECORDS = 200;
     static const size_t MAX_NUM_LAYER_STATS = 200;
     std::unique_ptr<StatsEventDelegate> mStatsDelegate = std::make_unique<StatsEventDelegate>();
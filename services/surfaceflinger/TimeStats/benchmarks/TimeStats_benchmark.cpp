@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures what recording TimeStats costs per layer per frame: the
+// timestamps of a frame as SurfaceFlinger records them when it latches and
+// presents a buffer, for a number of layers updating on every frame.
+
+#include <benchmark/benchmark.h>
+
+#include <TimeStats/TimeStats.h>
+#include <utils/String16.h>
+#include <utils/Vector.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace android;
+
+namespace {
+
+constexpr nsecs_t kFramePeriod = 16666666;
+
+std::unique_ptr<impl::TimeStats> createEnabledTimeStats() {
+    auto timeStats = std::make_unique<impl::TimeStats>();
+    Vector<String16> args;
+    args.push_back(String16("-enable"));
+    std::string result;
+    timeStats->parseArgs(false, args, result);
+    return timeStats;
+}
+
+// Records one frame of each layer in [firstLayerId, firstLayerId + layerCount).
+void recordFrame(TimeStats& timeStats, int32_t firstLayerId, int32_t layerCount,
+                 const std::vector<std::string>& layerNames, uint64_t frameNumber) {
+    const nsecs_t frameTime = static_cast<nsecs_t>(frameNumber) * kFramePeriod;
+    for (int32_t i = 0; i < layerCount; i++) {
+        const int32_t layerId = firstLayerId + i;
+        timeStats.setPostTime(layerId, frameNumber, layerNames[i], frameTime);
+        timeStats.setDesiredTime(layerId, frameNumber, frameTime);
+        timeStats.setAcquireFence(layerId, frameNumber,
+                                  std::make_shared<FenceTime>(frameTime + 1000000));
+        timeStats.setLatchTime(layerId, frameNumber, frameTime + 2000000);
+        timeStats.setPresentFence(layerId, frameNumber,
+                                  std::make_shared<FenceTime>(frameTime + kFramePeriod));
+    }
+}
+
+std::vector<std::string> generateLayerNames(int32_t firstLayerId, int32_t layerCount) {
+    std::vector<std::string> layerNames;
+    for (int32_t i = 0; i < layerCount; i++) {
+        layerNames.push_back("com.example.app/com.example.app.Activity#" +
+                             std::to_string(firstLayerId + i));
+    }
+    return layerNames;
+}
+
+void BM_RecordFrame(benchmark::State& state) {
+    const auto timeStats = createEnabledTimeStats();
+    const int32_t layerCount = static_cast<int32_t>(state.range(0));
+    const std::vector<std::string> layerNames = generateLayerNames(0, layerCount);
+    uint64_t frameNumber = 1;
+    for (auto _ : state) {
+        recordFrame(*timeStats, 0, layerCount, layerNames, frameNumber++);
+    }
+    state.SetItemsProcessed(state.iterations() * layerCount);
+}
+BENCHMARK(BM_RecordFrame)->Arg(1)->Arg(10)->Arg(50);
+
+// Several threads recording frames of their own layers at once, as binder
+// threads and the main thread do.
+std::unique_ptr<impl::TimeStats> gSharedTimeStats;
+
+void BM_RecordFrameContended(benchmark::State& state) {
+    constexpr int32_t kLayersPerThread = 10;
+    if (state.thread_index == 0) {
+        gSharedTimeStats = createEnabledTimeStats();
+    }
+    const int32_t firstLayerId = state.thread_index * kLayersPerThread;
+    const std::vector<std::string> layerNames =
+            generateLayerNames(firstLayerId, kLayersPerThread);
+    uint64_t frameNumber = 1;
+    for (auto _ : state) {
+        recordFrame(*gSharedTimeStats, firstLayerId, kLayersPerThread, layerNames, frameNumber++);
+    }
+    state.SetItemsProcessed(state.iterations() * kLayersPerThread);
+    if (state.thread_index == 0) {
+        gSharedTimeStats.reset();
+    }
+}
+BENCHMARK(BM_RecordFrameContended)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#undef LOG_TAG
+#define LOG_TAG "TransactionReadinessThread"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include "TransactionReadinessThread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cinttypes>
+#include <unordered_set>
+
+#include <android-base/stringprintf.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+using base::StringAppendF;
+
+static constexpr size_t kReadPipe = 0;
+static constexpr size_t kWritePipe = 1;
+
+TransactionReadinessThread::~TransactionReadinessThread() {
+    {
+        std::lock_guard lock(mMutex);
+        mKeepRunning = false;
+        wake();
+    }
+
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+
+    std::lock_guard lock(mMutex);
+    for (int& fd : mPipe) {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+void TransactionReadinessThread::run(Callback callback) {
+    std::lock_guard lock(mMutex);
+    if (mRunning || !mKeepRunning) {
+        return;
+    }
+    if (pipe2(mPipe.data(), O_CLOEXEC | O_NONBLOCK)) {
+        ALOGE("could not create wake pipe: %s", strerror(errno));
+        return;
+    }
+    mCallback = std::move(callback);
+    mRunning = true;
+    mThread = std::thread(&TransactionReadinessThread::threadMain, this);
+}
+
+void TransactionReadinessThread::waitForFences(const sp<IBinder>& applyToken,
+                                               std::vector<sp<Fence>> fences) {
+    std::lock_guard lock(mMutex);
+    if (fences.empty()) {
+        mFenceWaits.erase(applyToken);
+        return;
+    }
+    mFenceWaits[applyToken] = std::move(fences);
+    wake();
+}
+
+void TransactionReadinessThread::scheduleWakeup(const sp<IBinder>& applyToken, nsecs_t when) {
+    std::lock_guard lock(mMutex);
+    auto [it, inserted] = mWakeupTimes.emplace(applyToken, when);
+    if (!inserted) {
+        if (it->second <= when) {
+            return;
+        }
+        it->second = when;
+    }
+    const bool earliest = mWakeups.empty() || when < mWakeups.top().when;
+    mWakeups.push({when, applyToken});
+    if (earliest) {
+        wake();
+    }
+}
+
+bool TransactionReadinessThread::isWaitingForFences(const sp<IBinder>& applyToken) {
+    std::lock_guard lock(mMutex);
+    return mFenceWaits.count(applyToken) != 0;
+}
+
+void TransactionReadinessThread::remove(const sp<IBinder>& applyToken) {
+    std::lock_guard lock(mMutex);
+    // The entry in mWakeups goes stale and is dropped once it is due.
+    mWakeupTimes.erase(applyToken);
+    if (mFenceWaits.erase(applyToken)) {
+        wake();
+    }
+}
+
+void TransactionReadinessThread::recordWaitTime(nsecs_t waitTime) {
+    std::lock_guard lock(mMutex);
+    mAppliedCount++;
+    mTotalWaitTime += waitTime;
+    mMaxWaitTime = std::max(mMaxWaitTime, waitTime);
+}
+
+void TransactionReadinessThread::dump(std::string& result) const {
+    std::lock_guard lock(mMutex);
+    size_t fenceCount = 0;
+    for (const auto& [applyToken, fences] : mFenceWaits) {
+        fenceCount += fences.size();
+    }
+    StringAppendF(&result, "  Waiting on %zu fences for %zu tokens, %zu scheduled wakeups\n",
+                  fenceCount, mFenceWaits.size(), mWakeupTimes.size());
+    StringAppendF(&result, "  Wakeups: %" PRIu64 " on fence signal, %" PRIu64 " on timer\n",
+                  mFenceWakeupCount, mTimerWakeupCount);
+    StringAppendF(&result,
+                  "  Queued transactions applied: %" PRIu64 ", wait time mean %.3fms max %.3fms\n",
+                  mAppliedCount,
+                  mAppliedCount ? ns2us(mTotalWaitTime / mAppliedCount) / 1000.0 : 0.0,
+                  ns2us(mMaxWaitTime) / 1000.0);
+}
+
+void TransactionReadinessThread::wake() {
+    static constexpr unsigned char wake = 'w';
+    if (mPipe[kWritePipe] != -1) {
+        write(mPipe[kWritePipe], &wake, sizeof(wake));
+    }
+}
+
+bool TransactionReadinessThread::processSignaledFences(
+        const std::vector<pollfd>& pollFds, const std::vector<sp<Fence>>& polledFences) {
+    std::unordered_set<Fence*> signaled;
+    // pollFds[0] is the wake pipe, and the fences follow in order.
+    for (size_t i = 0; i < polledFences.size(); i++) {
+        if (pollFds[i + 1].revents) {
+            signaled.insert(polledFences[i].get());
+        }
+    }
+    if (signaled.empty()) {
+        return false;
+    }
+
+    bool ready = false;
+    for (auto it = mFenceWaits.begin(); it != mFenceWaits.end();) {
+        auto& fences = it->second;
+        fences.erase(std::remove_if(fences.begin(), fences.end(),
+                                    [&](const sp<Fence>& fence) {
+                                        return signaled.count(fence.get()) != 0;
+                                    }),
+                     fences.end());
+        if (fences.empty()) {
+            it = mFenceWaits.erase(it);
+            mFenceWakeupCount++;
+            ready = true;
+        } else {
+            ++it;
+        }
+    }
+    return ready;
+}
+
+bool TransactionReadinessThread::processDueWakeups(nsecs_t now) {
+    bool ready = false;
+    while (!mWakeups.empty() && mWakeups.top().when <= now) {
+        const Wakeup wakeup = mWakeups.top();
+        mWakeups.pop();
+        auto it = mWakeupTimes.find(wakeup.applyToken);
+        if (it == mWakeupTimes.end() || it->second != wakeup.when) {
+            continue;
+        }
+        mWakeupTimes.erase(it);
+        mTimerWakeupCount++;
+        ready = true;
+    }
+    return ready;
+}
+
+void TransactionReadinessThread::threadMain() {
+    if (pthread_setname_np(pthread_self(), "TxnReadiness")) {
+        ALOGW("Failed to set thread name");
+    }
+
+    std::vector<pollfd> pollFds;
+    // Holding the fences for the duration of the poll keeps their file
+    // descriptors open, even if the token stops waiting on them meanwhile.
+    std::vector<sp<Fence>> polledFences;
+
+    std::unique_lock lock(mMutex);
+    while (mKeepRunning) {
+        pollFds.clear();
+        polledFences.clear();
+        pollFds.push_back({mPipe[kReadPipe], POLLIN, 0});
+        for (const auto& [applyToken, fences] : mFenceWaits) {
+            for (const sp<Fence>& fence : fences) {
+                pollFds.push_back({fence->get(), POLLIN, 0});
+                polledFences.push_back(fence);
+            }
+        }
+
+        timespec timeout;
+        timespec* timeoutPtr = nullptr;
+        if (!mWakeups.empty()) {
+            const nsecs_t delay = std::max<nsecs_t>(0, mWakeups.top().when - systemTime());
+            timeout.tv_sec = static_cast<time_t>(delay / 1000000000);
+            timeout.tv_nsec = static_cast<long>(delay % 1000000000);
+            timeoutPtr = &timeout;
+        }
+
+        lock.unlock();
+        const int ret = ppoll(pollFds.data(), pollFds.size(), timeoutPtr, nullptr);
+        lock.lock();
+
+        if (ret < 0) {
+            if (errno != EINTR) {
+                ALOGE("ppoll failed: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        if (pollFds[0].revents) {
+            unsigned char buffer[16];
+            while (read(mPipe[kReadPipe], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+
+        bool ready = processSignaledFences(pollFds, polledFences);
+        ready |= processDueWakeups(systemTime());
+        if (ready) {
+            ATRACE_NAME("TransactionReady");
+            lock.unlock();
+            mCallback();
+            lock.lock();
+        }
+    }
+}
+
+} // namespace android
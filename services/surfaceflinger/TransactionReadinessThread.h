@@ -0,0 +1,123 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <poll.h>
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/thread_annotations.h>
+
+#include <binder/IBinder.h>
+#include <gui/ITransactionCompletedListener.h>
+#include <ui/Fence.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// TransactionReadinessThread wakes SurfaceFlinger up when a transaction that
+// is blocked at the front of its apply token's queue may have become ready,
+// instead of SurfaceFlinger re-checking every blocked transaction on every
+// frame.
+//
+// A transaction is blocked either on its desired present time or on acquire
+// fences that have not signaled. For the former, SurfaceFlinger schedules a
+// wakeup, kept in a min-heap ordered by time; for the latter, the thread
+// polls the fences and fires once all the fences of a token have signaled.
+// Each time a wakeup or a fence wait completes, the callback passed to run()
+// is invoked, which is expected to schedule a transaction flush.
+class TransactionReadinessThread {
+public:
+    using Callback = std::function<void()>;
+
+    ~TransactionReadinessThread();
+
+    void run(Callback callback);
+
+    // Fires the callback once every fence in |fences| has signaled. Replaces
+    // any fences previously waited on for |applyToken|.
+    void waitForFences(const sp<IBinder>& applyToken, std::vector<sp<Fence>> fences);
+
+    // Fires the callback at |when|, unless a wakeup no later than |when| is
+    // already scheduled for |applyToken|.
+    void scheduleWakeup(const sp<IBinder>& applyToken, nsecs_t when);
+
+    // Returns whether |applyToken| still has fences that have not signaled,
+    // without querying the fences themselves.
+    bool isWaitingForFences(const sp<IBinder>& applyToken);
+
+    // Forgets the fences and wakeup of |applyToken|, once its queue is empty.
+    void remove(const sp<IBinder>& applyToken);
+
+    // Records how long a transaction was queued before it was applied.
+    void recordWaitTime(nsecs_t waitTime);
+
+    void dump(std::string& result) const;
+
+private:
+    struct Wakeup {
+        nsecs_t when;
+        sp<IBinder> applyToken;
+        bool operator>(const Wakeup& other) const { return when > other.when; }
+    };
+
+    void threadMain();
+    void wake() REQUIRES(mMutex);
+
+    // Drops the fences in |polledFences| whose entry in |pollFds| reports an
+    // event, and returns whether a token saw its last fence signal.
+    bool processSignaledFences(const std::vector<pollfd>& pollFds,
+                               const std::vector<sp<Fence>>& polledFences) REQUIRES(mMutex);
+    // Pops the wakeups that are due and returns whether any was still wanted.
+    bool processDueWakeups(nsecs_t now) REQUIRES(mMutex);
+
+    std::thread mThread;
+    Callback mCallback;
+
+    mutable std::mutex mMutex;
+    bool mRunning GUARDED_BY(mMutex) = false;
+    bool mKeepRunning GUARDED_BY(mMutex) = true;
+
+    // Written to wake the thread up when the fences or wakeups change.
+    std::array<int, 2> mPipe GUARDED_BY(mMutex) = {-1, -1};
+
+    // The fences each token is still waiting on.
+    std::unordered_map<sp<IBinder>, std::vector<sp<Fence>>, IListenerHash> mFenceWaits
+            GUARDED_BY(mMutex);
+
+    // The earliest wakeup wanted by each token. mWakeups may hold stale
+    // entries, which are skipped when they no longer match.
+    std::unordered_map<sp<IBinder>, nsecs_t, IListenerHash> mWakeupTimes GUARDED_BY(mMutex);
+    std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup>> mWakeups
+            GUARDED_BY(mMutex);
+
+    // Statistics for dumpsys.
+    uint64_t mFenceWakeupCount GUARDED_BY(mMutex) = 0;
+    uint64_t mTimerWakeupCount GUARDED_BY(mMutex) = 0;
+    uint64_t mAppliedCount GUARDED_BY(mMutex) = 0;
+    nsecs_t mTotalWaitTime GUARDED_BY(mMutex) = 0;
+    nsecs_t mMaxWaitTime GUARDED_BY(mMutex) = 0;
+};
+
+} // namespace android
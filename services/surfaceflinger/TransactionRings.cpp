@@ -0,0 +1,90 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#undef LOG_TAG
+#define LOG_TAG "TransactionRings"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include "TransactionRings.h"
+
+#include <utils/Log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+ANDROID_SINGLETON_STATIC_INSTANCE(TransactionRings);
+
+TransactionRings::TransactionRings() : mDeathRecipient(new RingDeathRecipient) {}
+
+status_t TransactionRings::add(const sp<IBinder>& processToken, const sp<IMemoryHeap>& heap) {
+    if (processToken == nullptr) {
+        ALOGE("failed to add transaction ring: invalid process token");
+        return BAD_VALUE;
+    }
+
+    auto reader = std::make_unique<SharedTransactionRing::Reader>(heap);
+    if (!reader->isValid()) {
+        ALOGE("failed to add transaction ring: invalid heap");
+        return BAD_VALUE;
+    }
+
+    std::lock_guard lock(mMutex);
+    auto it = mRings.find(processToken);
+    if (it != mRings.end()) {
+        // The process is starting over, e.g. because it lost track of the ring.
+        it->second.second = std::move(reader);
+        return NO_ERROR;
+    }
+
+    // If the client process dies, we will get a callback through binderDied.
+    status_t err = processToken->linkToDeath(mDeathRecipient);
+    if (err != NO_ERROR) {
+        ALOGE("failed to add transaction ring: could not link to death");
+        return err;
+    }
+    mRings.emplace(processToken, std::make_pair(processToken, std::move(reader)));
+    return NO_ERROR;
+}
+
+status_t TransactionRings::read(
+        const sp<IBinder>& processToken, uint64_t begin, uint64_t end,
+        const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces,
+        Vector<ComposerState>* outStates) {
+    ATRACE_CALL();
+    if (processToken == nullptr) {
+        return BAD_VALUE;
+    }
+
+    std::lock_guard lock(mMutex);
+    auto it = mRings.find(processToken);
+    if (it == mRings.end()) {
+        ALOGE("failed to read transaction ring: no ring registered");
+        return NAME_NOT_FOUND;
+    }
+    return it->second.second->read(begin, end, newSurfaces, outStates);
+}
+
+void TransactionRings::removeProcess(const wp<IBinder>& processToken) {
+    std::lock_guard lock(mMutex);
+    mRings.erase(processToken);
+}
+
+void TransactionRings::RingDeathRecipient::binderDied(const wp<IBinder>& who) {
+    TransactionRings::getInstance().removeProcess(who);
+}
+
+}; // namespace android
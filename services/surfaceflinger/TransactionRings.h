@@ -0,0 +1,66 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/thread_annotations.h>
+#include <binder/IBinder.h>
+#include <binder/IMemory.h>
+#include <gui/LayerState.h>
+#include <gui/SharedTransactionRing.h>
+#include <utils/RefBase.h>
+#include <utils/Singleton.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace android {
+
+// The SharedTransactionRing of every client process, keyed by the process's
+// apply token. A ring is dropped when its process dies.
+class TransactionRings : public Singleton<TransactionRings> {
+public:
+    TransactionRings();
+
+    status_t add(const sp<IBinder>& processToken, const sp<IMemoryHeap>& heap);
+
+    // Copies the states with sequence numbers [begin, end) out of the ring
+    // of |processToken|. See SharedTransactionRing::Reader::read.
+    status_t read(const sp<IBinder>& processToken, uint64_t begin, uint64_t end,
+                  const std::vector<SharedTransactionRing::SurfaceBinding>& newSurfaces,
+                  Vector<ComposerState>* outStates);
+
+    void removeProcess(const wp<IBinder>& processToken);
+
+private:
+    std::mutex mMutex;
+
+    std::map<wp<IBinder> /*process*/,
+             std::pair<sp<IBinder> /*strong ref to process*/,
+                       std::unique_ptr<SharedTransactionRing::Reader>>>
+            mRings GUARDED_BY(mMutex);
+
+    class RingDeathRecipient : public IBinder::DeathRecipient {
+    public:
+        void binderDied(const wp<IBinder>& who) override;
+    };
+
+    sp<RingDeathRecipient> mDeathRecipient;
+};
+
+}; // namespace android
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "LibSurfaceFlingerUnittests"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <gui/LayerMetadata.h>
+
+#include "EffectLayer.h"
+#include "Layer.h"
+#include "TestableSurfaceFlinger.h"
+#include "mock/DisplayHardware/MockComposer.h"
+#include "mock/MockDispSync.h"
+#include "mock/MockEventControlThread.h"
+#include "mock/MockEventThread.h"
+
+namespace android {
+
+using testing::_;
+using testing::ElementsAre;
+using testing::IsEmpty;
+using testing::Mock;
+using testing::Return;
+
+using FakeHwcDisplayInjector = TestableSurfaceFlinger::FakeHwcDisplayInjector;
+
+/**
+ * Covers the flattened Z order SurfaceFlinger keeps for its drawing state,
+ * and when it is rebuilt.
+ */
+class DrawingLayersInZOrderTest : public testing::Test {
+public:
+    DrawingLayersInZOrderTest();
+
+protected:
+    static constexpr uint32_t WIDTH = 100;
+    static constexpr uint32_t HEIGHT = 100;
+    static constexpr uint32_t LAYER_FLAGS = 0;
+
+    void setupScheduler();
+    void setupComposer();
+    sp<Layer> createLayer(const char* name);
+
+    // Adds a root layer to the current state at |z|, or moves it there.
+    void setRootLayerZ(const sp<Layer>& layer, int32_t z);
+    void removeRootLayer(const sp<Layer>& layer);
+    // Commits the current state of SurfaceFlinger and of every layer in it.
+    void commitTransaction();
+
+    std::vector<Layer*> drawingLayers() { return mFlinger.getDrawingLayersInZOrder(); }
+
+    TestableSurfaceFlinger mFlinger;
+    Hwc2::mock::Composer* mComposer = nullptr;
+};
+
+DrawingLayersInZOrderTest::DrawingLayersInZOrderTest() {
+    setupScheduler();
+    setupComposer();
+}
+
+sp<Layer> DrawingLayersInZOrderTest::createLayer(const char* name) {
+    sp<Client> client;
+    LayerCreationArgs args(mFlinger.flinger(), client, name, WIDTH, HEIGHT, LAYER_FLAGS,
+                           LayerMetadata());
+    return new EffectLayer(args);
+}
+
+void DrawingLayersInZOrderTest::setRootLayerZ(const sp<Layer>& layer, int32_t z) {
+    // Like setClientStateLocked, re-sort the layer in the current state.
+    auto& layers = mFlinger.mutableCurrentState().layersSortedByZ;
+    const ssize_t index = layers.indexOf(layer);
+    if (index >= 0) {
+        layers.removeAt(index);
+    }
+    layer->setLayer(z);
+    layers.add(layer);
+}
+
+void DrawingLayersInZOrderTest::removeRootLayer(const sp<Layer>& layer) {
+    mFlinger.mutableCurrentState().layersSortedByZ.remove(layer);
+}
+
+void DrawingLayersInZOrderTest::commitTransaction() {
+    mFlinger.mutableCurrentState().traverse(
+            [](Layer* layer) { layer->commitTransaction(layer->getCurrentState()); });
+    mFlinger.commitTransaction();
+}
+
+void DrawingLayersInZOrderTest::setupScheduler() {
+    auto eventThread = std::make_unique<mock::EventThread>();
+    auto sfEventThread = std::make_unique<mock::EventThread>();
+
+    EXPECT_CALL(*eventThread, registerDisplayEventConnection(_));
+    EXPECT_CALL(*eventThread, createEventConnection(_, _))
+            .WillOnce(Return(new EventThreadConnection(eventThread.get(), ResyncCallback(),
+                                                       ISurfaceComposer::eConfigChangedSuppress)));
+
+    EXPECT_CALL(*sfEventThread, registerDisplayEventConnection(_));
+    EXPECT_CALL(*sfEventThread, createEventConnection(_, _))
+            .WillOnce(Return(new EventThreadConnection(sfEventThread.get(), ResyncCallback(),
+                                                       ISurfaceComposer::eConfigChangedSuppress)));
+
+    auto primaryDispSync = std::make_unique<mock::DispSync>();
+
+    EXPECT_CALL(*primaryDispSync, computeNextRefresh(0, _)).WillRepeatedly(Return(0));
+    EXPECT_CALL(*primaryDispSync, getPeriod())
+            .WillRepeatedly(Return(FakeHwcDisplayInjector::DEFAULT_REFRESH_RATE));
+    EXPECT_CALL(*primaryDispSync, expectedPresentTime(_)).WillRepeatedly(Return(0));
+    mFlinger.setupScheduler(std::move(primaryDispSync),
+                            std::make_unique<mock::EventControlThread>(), std::move(eventThread),
+                            std::move(sfEventThread));
+}
+
+void DrawingLayersInZOrderTest::setupComposer() {
+    mComposer = new Hwc2::mock::Composer();
+    EXPECT_CALL(*mComposer, getMaxVirtualDisplayCount()).WillOnce(Return(0));
+    mFlinger.setupComposer(std::unique_ptr<Hwc2::Composer>(mComposer));
+
+    Mock::VerifyAndClear(mComposer);
+}
+
+namespace {
+
+TEST_F(DrawingLayersInZOrderTest, rebuiltWhenLayersAreAdded) {
+    EXPECT_THAT(drawingLayers(), IsEmpty());
+
+    sp<Layer> bottom = createLayer("bottom");
+    sp<Layer> top = createLayer("top");
+    setRootLayerZ(top, 2);
+    setRootLayerZ(bottom, 1);
+    // Nothing is drawn until the transaction is committed.
+    EXPECT_THAT(drawingLayers(), IsEmpty());
+
+    commitTransaction();
+    EXPECT_THAT(drawingLayers(), ElementsAre(bottom.get(), top.get()));
+}
+
+TEST_F(DrawingLayersInZOrderTest, rebuiltWhenLayersAreRemoved) {
+    sp<Layer> bottom = createLayer("bottom");
+    sp<Layer> top = createLayer("top");
+    setRootLayerZ(bottom, 1);
+    setRootLayerZ(top, 2);
+    commitTransaction();
+    ASSERT_THAT(drawingLayers(), ElementsAre(bottom.get(), top.get()));
+
+    removeRootLayer(bottom);
+    EXPECT_THAT(drawingLayers(), ElementsAre(bottom.get(), top.get()));
+    commitTransaction();
+    EXPECT_THAT(drawingLayers(), ElementsAre(top.get()));
+}
+
+TEST_F(DrawingLayersInZOrderTest, rebuiltWhenZOrderChanges) {
+    sp<Layer> first = createLayer("first");
+    sp<Layer> second = createLayer("second");
+    setRootLayerZ(first, 1);
+    setRootLayerZ(second, 2);
+    commitTransaction();
+    ASSERT_THAT(drawingLayers(), ElementsAre(first.get(), second.get()));
+
+    setRootLayerZ(first, 3);
+    EXPECT_THAT(drawingLayers(), ElementsAre(first.get(), second.get()));
+    commitTransaction();
+    EXPECT_THAT(drawingLayers(), ElementsAre(second.get(), first.get()));
+}
+
+TEST_F(DrawingLayersInZOrderTest, rebuiltWhenLayerIsReparented) {
+    sp<Layer> left = createLayer("left");
+    sp<Layer> right = createLayer("right");
+    sp<Layer> child = createLayer("child");
+    setRootLayerZ(left, 1);
+    setRootLayerZ(right, 2);
+    left->addChild(child);
+    commitTransaction();
+    ASSERT_THAT(drawingLayers(), ElementsAre(left.get(), child.get(), right.get()));
+
+    left->removeChild(child);
+    right->addChild(child);
+    EXPECT_THAT(drawingLayers(), ElementsAre(left.get(), child.get(), right.get()));
+    commitTransaction();
+    EXPECT_THAT(drawingLayers(), ElementsAre(left.get(), right.get(), child.get()));
+}
+
+TEST_F(DrawingLayersInZOrderTest, noStalePointerAfterLayerIsDestroyed) {
+    sp<Layer> kept = createLayer("kept");
+    sp<Layer> destroyed = createLayer("destroyed");
+    setRootLayerZ(kept, 1);
+    setRootLayerZ(destroyed, 2);
+    commitTransaction();
+    ASSERT_THAT(drawingLayers(), ElementsAre(kept.get(), destroyed.get()));
+
+    // The drawing state keeps the layer alive until the removal is committed.
+    wp<Layer> weakDestroyed = destroyed;
+    removeRootLayer(destroyed);
+    destroyed.clear();
+    EXPECT_NE(nullptr, weakDestroyed.promote());
+
+    commitTransaction();
+    EXPECT_EQ(nullptr, weakDestroyed.promote());
+    EXPECT_THAT(drawingLayers(), ElementsAre(kept.get()));
+}
+
+} // namespace
+} // namespace android
@@ -140,6 +140,61 @@ TEST_F(RegionSamplingTest, orientation_90) {
                 testing::Eq(1.0));
 }
 
+TEST_F(RegionSamplingTest, row_sum_matches_scalar) {
+    std::generate(buffer.begin(), buffer.end(), [n = 0u]() mutable {
+        n = n * 1664525u + 1013904223u;
+        return n;
+    });
+
+    for (int count = 0; count <= kWidth; ++count) {
+        for (int offset = 0; offset < 4; ++offset) {
+            EXPECT_EQ(sumRowLumaScalar(buffer.data() + offset, count),
+                      sumRowLuma(buffer.data() + offset, count))
+                    << "count " << count << " offset " << offset;
+        }
+    }
+}
+
+TEST_F(RegionSamplingTest, sample_areas_overlapping) {
+    std::generate(buffer.begin(), buffer.end(), [n = 0]() mutable {
+        uint32_t const pixel = (n % std::numeric_limits<uint8_t>::max()) << ((n % 3) * CHAR_BIT);
+        n++;
+        return pixel;
+    });
+
+    std::vector<Rect> const areas = {whole_area,         {3, 2, 40, 20},  {10, 0, 60, 29},
+                                     {10, 0, 60, 29},    {0, 15, 98, 16}, {50, 5, 51, 6},
+                                     {kWidth - 7, 3, kWidth, kHeight - 1}};
+    for (auto orientation : {ui::Transform::ROT_0, ui::Transform::ROT_90}) {
+        std::vector<float> const lumas =
+                sampleAreas(buffer.data(), kWidth, kHeight, kStride, orientation, areas);
+        ASSERT_EQ(areas.size(), lumas.size());
+        for (size_t i = 0; i < areas.size(); ++i) {
+            Rect area = areas[i];
+            if (orientation & ui::Transform::ROT_90) {
+                area = Rect(kWidth - area.right, kHeight - area.bottom, kWidth - area.left,
+                            kHeight - area.top);
+            }
+            uint32_t sum = 0;
+            for (int row = area.top; row < area.bottom; ++row) {
+                sum += sumRowLumaScalar(buffer.data() + row * kStride + area.left,
+                                        area.getWidth());
+            }
+            EXPECT_THAT(lumas[i], testing::FloatEq(sum / (255.0f * area.getWidth() *
+                                                           area.getHeight())));
+        }
+    }
+}
+
+TEST_F(RegionSamplingTest, sample_areas_bounds_checking) {
+    std::fill(buffer.begin(), buffer.end(), kWhite);
+
+    std::vector<Rect> const areas = {{0, 0, 4, kHeight + 1}, whole_area, {3, 0, 2, 0},
+                                     {kWidth - 2, 0, kWidth + 2, 4}};
+    EXPECT_THAT(sampleAreas(buffer.data(), kWidth, kHeight, kStride, kOrientation, areas),
+                testing::ElementsAre(0.0f, 1.0f, 0.0f, 0.0f));
+}
+
 } // namespace android
 
 // TODO(b/129481165): remove the #pragma below and fix conversion issues
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "LibSurfaceFlingerUnittests"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SurfaceTracing.h"
+
+namespace android {
+
+// Layer id to layer name; the name stands in for the rest of the layer state.
+using Layers = std::map<int32_t, std::string>;
+
+class SurfaceTracingTest : public testing::Test {
+protected:
+    using LayersTraceBuffer = SurfaceTracing::LayersTraceBuffer;
+    using LayersDeltaEncoder = SurfaceTracing::LayersDeltaEncoder;
+
+    static constexpr size_t kKeyframeInterval = LayersDeltaEncoder::kKeyframeInterval;
+
+    // Returns an entry holding every layer, as traceLayersLocked does with TRACE_DELTA.
+    static LayersTraceProto makeEntry(const Layers& layers) {
+        LayersTraceProto entry;
+        for (const auto& [id, name] : layers) {
+            LayerProto* layer = entry.mutable_layers()->add_layers();
+            layer->set_id(id);
+            layer->set_name(name);
+        }
+        entry.set_is_delta(true);
+        return entry;
+    }
+
+    static LayersTraceProto makeKeyframe(const Layers& layers) {
+        LayersTraceProto entry = makeEntry(layers);
+        entry.set_is_delta(false);
+        return entry;
+    }
+
+    // Applies an encoded entry to the layers reconstructed from the previous ones.
+    static void apply(const LayersTraceProto& entry, Layers& layers) {
+        if (!entry.is_delta()) {
+            layers.clear();
+        }
+        for (int32_t id : entry.removed_layers()) {
+            layers.erase(id);
+        }
+        for (const LayerProto& layer : entry.layers().layers()) {
+            layers[layer.id()] = layer.name();
+        }
+    }
+
+    static std::vector<LayersTraceProto> flush(LayersTraceBuffer& buffer) {
+        LayersTraceFileProto fileProto;
+        buffer.flush(&fileProto);
+        return {fileProto.entry().begin(), fileProto.entry().end()};
+    }
+};
+
+namespace {
+
+TEST_F(SurfaceTracingTest, deltaEncoderReconstructsEveryEntry) {
+    const std::vector<Layers> states = {
+            {{1, "a"}, {2, "b"}},
+            {{1, "a"}, {2, "b"}},
+            {{1, "a"}, {2, "b2"}},
+            {{1, "a"}, {2, "b2"}, {3, "c"}},
+            {{2, "b2"}, {3, "c"}},
+            {},
+            {{4, "d"}},
+    };
+
+    LayersDeltaEncoder encoder;
+    Layers reconstructed;
+    for (size_t i = 0; i < states.size(); i++) {
+        LayersTraceProto entry = makeEntry(states[i]);
+        encoder.encode(entry);
+        EXPECT_EQ(i != 0, entry.is_delta()) << "entry " << i;
+        apply(entry, reconstructed);
+        EXPECT_EQ(states[i], reconstructed) << "entry " << i;
+    }
+}
+
+TEST_F(SurfaceTracingTest, deltaEncoderOnlyRecordsChangedLayers) {
+    LayersDeltaEncoder encoder;
+    LayersTraceProto keyframe = makeEntry({{1, "a"}, {2, "b"}, {3, "c"}});
+    encoder.encode(keyframe);
+    ASSERT_FALSE(keyframe.is_delta());
+    EXPECT_EQ(3, keyframe.layers().layers_size());
+
+    LayersTraceProto unchanged = makeEntry({{1, "a"}, {2, "b"}, {3, "c"}});
+    encoder.encode(unchanged);
+    ASSERT_TRUE(unchanged.is_delta());
+    EXPECT_EQ(0, unchanged.layers().layers_size());
+    EXPECT_EQ(0, unchanged.removed_layers_size());
+
+    LayersTraceProto delta = makeEntry({{1, "a"}, {2, "b2"}});
+    encoder.encode(delta);
+    ASSERT_TRUE(delta.is_delta());
+    ASSERT_EQ(1, delta.layers().layers_size());
+    EXPECT_EQ(2, delta.layers().layers(0).id());
+    ASSERT_EQ(1, delta.removed_layers_size());
+    EXPECT_EQ(3, delta.removed_layers(0));
+}
+
+TEST_F(SurfaceTracingTest, deltaEncoderEmitsKeyframesAtInterval) {
+    LayersDeltaEncoder encoder;
+    for (size_t i = 0; i < 3 * kKeyframeInterval; i++) {
+        LayersTraceProto entry = makeEntry({{1, std::to_string(i)}});
+        encoder.encode(entry);
+        EXPECT_EQ(i % kKeyframeInterval != 0, entry.is_delta()) << "entry " << i;
+    }
+}
+
+TEST_F(SurfaceTracingTest, deltaEncoderResetForcesKeyframe) {
+    LayersDeltaEncoder encoder;
+    LayersTraceProto entry = makeEntry({{1, "a"}});
+    encoder.encode(entry);
+    entry = makeEntry({{1, "a"}});
+    encoder.encode(entry);
+    ASSERT_TRUE(entry.is_delta());
+
+    encoder.reset();
+    entry = makeEntry({{1, "a"}});
+    encoder.encode(entry);
+    EXPECT_FALSE(entry.is_delta());
+    EXPECT_EQ(1, entry.layers().layers_size());
+}
+
+TEST_F(SurfaceTracingTest, bufferEvictsWholeKeyframeGroups) {
+    LayersTraceBuffer buffer;
+    buffer.reset(1_MB);
+    buffer.setSizeInFrames(5);
+
+    EXPECT_TRUE(buffer.emplace(makeKeyframe({{1, "k1"}})));
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d1"}})));
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d2"}})));
+    EXPECT_TRUE(buffer.emplace(makeKeyframe({{1, "k2"}})));
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d3"}})));
+    EXPECT_EQ(5U, buffer.frameCount());
+    EXPECT_EQ(2U, buffer.keyframeCount());
+
+    // Making room for one more entry evicts the first keyframe and both of its deltas.
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d4"}})));
+    EXPECT_EQ(3U, buffer.frameCount());
+    EXPECT_EQ(1U, buffer.keyframeCount());
+
+    const auto entries = flush(buffer);
+    ASSERT_EQ(3U, entries.size());
+    EXPECT_FALSE(entries[0].is_delta());
+    EXPECT_EQ("k2", entries[0].layers().layers(0).name());
+    EXPECT_EQ("d3", entries[1].layers().layers(0).name());
+    EXPECT_EQ("d4", entries[2].layers().layers(0).name());
+    EXPECT_EQ(0U, buffer.used());
+    EXPECT_EQ(0U, buffer.keyframeCount());
+}
+
+TEST_F(SurfaceTracingTest, bufferDropsDeltaThatWouldEvictItsKeyframe) {
+    LayersTraceBuffer buffer;
+    buffer.reset(1_MB);
+    buffer.setSizeInFrames(3);
+
+    EXPECT_TRUE(buffer.emplace(makeKeyframe({{1, "k1"}})));
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d1"}})));
+    EXPECT_TRUE(buffer.emplace(makeEntry({{1, "d2"}})));
+
+    EXPECT_FALSE(buffer.emplace(makeEntry({{1, "d3"}})));
+    EXPECT_EQ(3U, buffer.frameCount());
+    EXPECT_EQ(1U, buffer.keyframeCount());
+
+    // The keyframe that follows replaces the whole group.
+    EXPECT_TRUE(buffer.emplace(makeKeyframe({{1, "k2"}})));
+    EXPECT_EQ(1U, buffer.frameCount());
+    EXPECT_EQ(1U, buffer.keyframeCount());
+}
+
+TEST_F(SurfaceTracingTest, bufferDropsDeltaWithoutKeyframe) {
+    LayersTraceBuffer buffer;
+    buffer.reset(1_MB);
+
+    EXPECT_FALSE(buffer.emplace(makeEntry({{1, "d1"}})));
+    EXPECT_EQ(0U, buffer.frameCount());
+}
+
+TEST_F(SurfaceTracingTest, bufferCapHoldsUnderLongRunOfDeltas) {
+    // Large enough for a keyframe and a few deltas, but far from a whole keyframe interval.
+    const size_t capacity =
+            static_cast<size_t>(makeKeyframe({{1, "0"}, {2, "0"}, {3, "0"}}).ByteSize()) * 4;
+    LayersTraceBuffer buffer;
+    buffer.reset(capacity);
+
+    // Traces the way SurfaceTracing::addTraceToBuffer does.
+    LayersDeltaEncoder encoder;
+    Layers lastAdded;
+    size_t dropped = 0;
+    for (size_t i = 0; i < 10 * kKeyframeInterval; i++) {
+        const Layers layers = {{1, "0"}, {2, std::to_string(i % 7)}, {3, std::to_string(i)}};
+        LayersTraceProto entry = makeEntry(layers);
+        encoder.encode(entry);
+        if (buffer.emplace(std::move(entry))) {
+            lastAdded = layers;
+        } else {
+            encoder.reset();
+            dropped++;
+        }
+        ASSERT_LE(buffer.used(), capacity) << "entry " << i;
+        ASSERT_GE(buffer.keyframeCount(), 1U) << "entry " << i;
+    }
+    EXPECT_GT(dropped, 0U);
+
+    const auto entries = flush(buffer);
+    ASSERT_FALSE(entries.empty());
+    EXPECT_FALSE(entries.front().is_delta());
+    Layers reconstructed;
+    for (const auto& entry : entries) {
+        apply(entry, reconstructed);
+    }
+    EXPECT_EQ(lastAdded, reconstructed);
+}
+
+TEST_F(SurfaceTracingTest, bufferCapInFramesHoldsUnderLongRunOfDeltas) {
+    constexpr size_t kCapacityInFrames = 8;
+    LayersTraceBuffer buffer;
+    buffer.reset(1_MB);
+    buffer.setSizeInFrames(kCapacityInFrames);
+
+    LayersDeltaEncoder encoder;
+    for (size_t i = 0; i < 10 * kKeyframeInterval; i++) {
+        LayersTraceProto entry = makeEntry({{1, std::to_string(i)}});
+        encoder.encode(entry);
+        if (!buffer.emplace(std::move(entry))) {
+            encoder.reset();
+        }
+        ASSERT_LE(buffer.frameCount(), kCapacityInFrames) << "entry " << i;
+    }
+
+    const auto entries = flush(buffer);
+    ASSERT_FALSE(entries.empty());
+    EXPECT_FALSE(entries.front().is_delta());
+}
+
+} // namespace
+} // namespace android
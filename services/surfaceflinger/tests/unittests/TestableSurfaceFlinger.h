@@ -185,6 +185,11 @@ public:
     // Extend this as needed for accessing SurfaceFlinger private (and public)
     // functions.
 
+    void setupCompositionEngine(
+            std::unique_ptr<compositionengine::CompositionEngine> compositionEngine) {
+        mFlinger->mCompositionEngine = std::move(compositionEngine);
+    }
+
     void setupRenderEngine(std::unique_ptr<renderengine::RenderEngine> renderEngine) {
         mFlinger->mCompositionEngine->setRenderEngine(std::move(renderEngine));
     }
@@ -301,6 +306,13 @@ public:
                                                        dispSurface, producer);
     }
 
+    auto commitTransaction() {
+        Mutex::Autolock _l(mFlinger->mStateLock);
+        return mFlinger->commitTransaction();
+    }
+
+    auto& getDrawingLayersInZOrder() { return mFlinger->getDrawingLayersInZOrder(); }
+
     auto handleTransactionLocked(uint32_t transactionFlags) {
         Mutex::Autolock _l(mFlinger->mStateLock);
         return mFlinger->handleTransactionLocked(transactionFlags);
@@ -329,6 +341,20 @@ public:
 
     auto onMessageReceived(int32_t what) { return mFlinger->onMessageReceived(what, systemTime()); }
 
+    auto handleMessageTransaction() { return mFlinger->handleMessageTransaction(); }
+    auto handleMessageInvalidate() { return mFlinger->handleMessageInvalidate(); }
+    auto onMessageRefresh() { return mFlinger->onMessageRefresh(); }
+
+    auto addClientLayer(const sp<Client>& client, const sp<IBinder>& handle, const sp<Layer>& layer,
+                        const sp<Layer>& parentLayer) {
+        return mFlinger->addClientLayer(client, handle, nullptr /* gbc */, layer,
+                                        nullptr /* parentHandle */, parentLayer,
+                                        true /* addToCurrentState */,
+                                        nullptr /* outTransformHint */);
+    }
+
+    auto setTransactionFlags(uint32_t flags) { return mFlinger->setTransactionFlags(flags); }
+
     auto captureScreenImplLocked(const RenderArea& renderArea,
                                  SurfaceFlinger::TraverseLayersFunction traverseLayers,
                                  ANativeWindowBuffer* buffer, bool useIdentityTransform,
@@ -390,7 +416,11 @@ public:
     auto& mutableCurrentState() { return mFlinger->mCurrentState; }
     auto& mutableDisplayColorSetting() { return mFlinger->mDisplayColorSetting; }
     auto& mutableDisplays() { return mFlinger->mDisplays; }
-    auto& mutableDrawingState() { return mFlinger->mDrawingState; }
+    auto& mutableDrawingState() {
+        // The caller may change the drawing state hierarchy behind our back.
+        mFlinger->mDrawingLayersInZOrderValid = false;
+        return mFlinger->mDrawingState;
+    }
     auto& mutableEventQueue() { return mFlinger->mEventQueue; }
     auto& mutableGeometryInvalid() { return mFlinger->mGeometryInvalid; }
     auto& mutableInterceptor() { return mFlinger->mInterceptor; }
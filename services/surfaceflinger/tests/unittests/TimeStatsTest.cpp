@@ -31,6 +31,7 @@
 
 #include <chrono>
 #include <random>
+#include <thread>
 #include <unordered_set>
 
 #include "libsurfaceflinger_unittest_main.h"
@@ -1186,6 +1187,56 @@ TEST_F(TimeStatsTest, layerStatsCallback_limitsLayers) {
                                               mDelegate->mCookie));
 }
 
+TEST_F(TimeStatsTest, canInsertManyFramesTimeStats) {
+    EXPECT_TRUE(inputCommand(InputCommand::ENABLE, FMT_STRING).empty());
+
+    // Enough frames for the completed frames to be flushed a few times
+    // before the dump.
+    constexpr uint64_t kNumFrames = 1000;
+    for (uint64_t frameNumber = 1; frameNumber <= kNumFrames; frameNumber++) {
+        insertTimeRecord(NORMAL_SEQUENCE, LAYER_ID_0, frameNumber, frameNumber * 1000000);
+        insertTimeRecord(NORMAL_SEQUENCE, LAYER_ID_1, frameNumber, frameNumber * 1000000);
+    }
+
+    SFTimeStatsGlobalProto globalProto;
+    ASSERT_TRUE(globalProto.ParseFromString(inputCommand(InputCommand::DUMP_ALL, FMT_PROTO)));
+
+    ASSERT_EQ(2, globalProto.stats_size());
+    for (const SFTimeStatsLayerProto& layerProto : globalProto.stats()) {
+        EXPECT_EQ(kNumFrames - 1, layerProto.total_frames());
+        for (const SFTimeStatsDeltaProto& deltaProto : layerProto.deltas()) {
+            ASSERT_EQ(1, deltaProto.histograms_size());
+            EXPECT_EQ(kNumFrames - 1, deltaProto.histograms().Get(0).frame_count());
+        }
+    }
+}
+
+TEST_F(TimeStatsTest, canInsertLayerTimeStatsConcurrently) {
+    EXPECT_TRUE(inputCommand(InputCommand::ENABLE, FMT_STRING).empty());
+
+    constexpr int32_t kNumThreads = 4;
+    constexpr uint64_t kNumFrames = 500;
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i < kNumThreads; i++) {
+        threads.emplace_back([this, layerId = i]() {
+            for (uint64_t frameNumber = 1; frameNumber <= kNumFrames; frameNumber++) {
+                insertTimeRecord(NORMAL_SEQUENCE, layerId, frameNumber, frameNumber * 1000000);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    SFTimeStatsGlobalProto globalProto;
+    ASSERT_TRUE(globalProto.ParseFromString(inputCommand(InputCommand::DUMP_ALL, FMT_PROTO)));
+
+    ASSERT_EQ(kNumThreads, globalProto.stats_size());
+    for (const SFTimeStatsLayerProto& layerProto : globalProto.stats()) {
+        EXPECT_EQ(kNumFrames - 1, layerProto.total_frames());
+    }
+}
+
 TEST_F(TimeStatsTest, canSurviveMonkey) {
     if (g_noSlowTests) {
         GTEST_SKIP();
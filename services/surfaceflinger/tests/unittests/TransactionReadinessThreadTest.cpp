@@ -0,0 +1,94 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "TransactionReadinessThreadTest"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <binder/Binder.h>
+#include <utils/Timers.h>
+
+#include "AsyncCallRecorder.h"
+#include "TransactionReadinessThread.h"
+
+using namespace std::chrono_literals;
+
+namespace android {
+namespace {
+
+class TransactionReadinessThreadTest : public testing::Test {
+protected:
+    TransactionReadinessThreadTest() { mThread.run(mReadyCallback.getInvocable()); }
+
+    // A pipe stands in for a sync fence: its read end polls readable once
+    // something is written to it.
+    sp<Fence> makeFence(int* outSignalFd) {
+        int fds[2];
+        EXPECT_EQ(0, pipe(fds));
+        *outSignalFd = fds[1];
+        return new Fence(fds[0]);
+    }
+
+    void signal(int fd) {
+        const char c = 's';
+        EXPECT_EQ(1, write(fd, &c, 1));
+        close(fd);
+    }
+
+    AsyncCallRecorder<void (*)()> mReadyCallback;
+    TransactionReadinessThread mThread;
+    const sp<IBinder> mToken = new BBinder();
+};
+
+TEST_F(TransactionReadinessThreadTest, firesAtScheduledWakeup) {
+    mThread.scheduleWakeup(mToken, systemTime() + ms2ns(5));
+    EXPECT_FALSE(mReadyCallback.waitForCall(1ms).has_value());
+    EXPECT_TRUE(mReadyCallback.waitForCall(100ms).has_value());
+}
+
+TEST_F(TransactionReadinessThreadTest, doesNotFireForRemovedToken) {
+    mThread.scheduleWakeup(mToken, systemTime() + ms2ns(5));
+    mThread.remove(mToken);
+    EXPECT_FALSE(mReadyCallback.waitForCall(20ms).has_value());
+}
+
+TEST_F(TransactionReadinessThreadTest, firesOnceAllFencesSignal) {
+    int signalFd1, signalFd2;
+    mThread.waitForFences(mToken, {makeFence(&signalFd1), makeFence(&signalFd2)});
+    EXPECT_TRUE(mThread.isWaitingForFences(mToken));
+
+    signal(signalFd1);
+    EXPECT_FALSE(mReadyCallback.waitForCall(20ms).has_value());
+    EXPECT_TRUE(mThread.isWaitingForFences(mToken));
+
+    signal(signalFd2);
+    EXPECT_TRUE(mReadyCallback.waitForCall(100ms).has_value());
+    EXPECT_FALSE(mThread.isWaitingForFences(mToken));
+}
+
+TEST_F(TransactionReadinessThreadTest, dumpsWaitTimes) {
+    mThread.recordWaitTime(ms2ns(2));
+    mThread.recordWaitTime(ms2ns(4));
+
+    std::string result;
+    mThread.dump(result);
+    EXPECT_NE(std::string::npos, result.find("applied: 2, wait time mean 3.000ms max 4.000ms"));
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,496 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the CPU cost of SurfaceFlinger's main thread per frame, for
+// synthetic scenes, without a GPU or a display: the HWC and RenderEngine are
+// mocks that accept every frame, so only the work of SurfaceFlinger and
+// CompositionEngine themselves is measured.
+//
+// Each iteration is a frame. First, a number of transactions, each setting a
+// new buffer and position on one layer, are applied as clients would apply
+// them from binder threads. Then the main thread stages run, as
+// onMessageInvalidate and onMessageRefresh run them. The time and allocations
+// of each stage are reported per frame:
+//
+//   handleMessageTransaction  applying queued transactions, committing state
+//   handlePageFlip            latching buffers, computing layer bounds
+//   composition               CompositionEngine::present
+//   postComposition           the rest of onMessageRefresh, mostly postComposition
+//
+// The reported time of an iteration is the sum of the main thread stages.
+
+#undef LOG_TAG
+#define LOG_TAG "SurfaceFlingerBenchmark"
+
+#include <benchmark/benchmark.h>
+
+#include <compositionengine/Display.h>
+#include <compositionengine/DisplayCreationArgs.h>
+#include <compositionengine/impl/CompositionEngine.h>
+#include <compositionengine/mock/DisplaySurface.h>
+#include <cutils/native_handle.h>
+#include <gmock/gmock.h>
+#include <gui/LayerMetadata.h>
+#include <gui/LayerState.h>
+#include <log/log.h>
+#include <renderengine/mock/RenderEngine.h>
+#include <ui/GraphicBuffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BufferStateLayer.h"
+#include "Client.h"
+#include "TestableSurfaceFlinger.h"
+#include "mock/DisplayHardware/MockComposer.h"
+#include "mock/DisplayHardware/MockPowerAdvisor.h"
+#include "mock/MockDispSync.h"
+#include "mock/MockEventControlThread.h"
+#include "mock/MockEventThread.h"
+#include "mock/MockMessageQueue.h"
+#include "mock/system/window/MockNativeWindow.h"
+
+namespace {
+
+// Counts the allocations made by any thread, so that each stage can report the
+// allocations made while it runs.
+std::atomic<uint64_t> gAllocationCount{0};
+
+} // namespace
+
+void* operator new(size_t size) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size ? size : 1);
+    LOG_ALWAYS_FATAL_IF(!ptr, "Failed to allocate %zu bytes", size);
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace android {
+namespace {
+
+namespace hal = android::hardware::graphics::composer::hal;
+
+using testing::_;
+using testing::DoAll;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+using testing::ReturnRef;
+using testing::SetArgPointee;
+
+using FakeHwcDisplayInjector = TestableSurfaceFlinger::FakeHwcDisplayInjector;
+using FakeDisplayDeviceInjector = TestableSurfaceFlinger::FakeDisplayDeviceInjector;
+
+constexpr PhysicalDisplayId kFirstDisplayId = 42;
+constexpr hal::HWDisplayId kFirstHwcDisplayId = FakeHwcDisplayInjector::DEFAULT_HWC_DISPLAY_ID;
+constexpr int32_t kDisplayWidth = 1080;
+constexpr int32_t kDisplayHeight = 2340;
+constexpr uint32_t kLayerStack = 0;
+// Only an internal and an external display can be connected at once.
+constexpr size_t kMaxDisplays = 2;
+
+constexpr uint32_t kLayerSize = 200;
+// The buffers each layer cycles through, as a triple buffered client does.
+constexpr size_t kBuffersPerLayer = 3;
+constexpr uint64_t kBufferUsage =
+        GraphicBuffer::USAGE_HW_TEXTURE | GraphicBuffer::USAGE_HW_COMPOSER;
+// Frames run before measuring, for the HWC layers and caches to be set up.
+constexpr int kWarmUpFrames = 10;
+
+struct StageStats {
+    nsecs_t duration = 0;
+    uint64_t allocations = 0;
+
+    StageStats& operator+=(const StageStats& other) {
+        duration += other.duration;
+        allocations += other.allocations;
+        return *this;
+    }
+};
+
+// Adds the time and allocations of its scope to |stats|.
+class StageTimer {
+public:
+    explicit StageTimer(StageStats& stats)
+          : mStats(stats),
+            mStartTime(systemTime()),
+            mStartAllocations(gAllocationCount.load(std::memory_order_relaxed)) {}
+
+    ~StageTimer() {
+        mStats.duration += systemTime() - mStartTime;
+        mStats.allocations += gAllocationCount.load(std::memory_order_relaxed) - mStartAllocations;
+    }
+
+private:
+    StageStats& mStats;
+    const nsecs_t mStartTime;
+    const uint64_t mStartAllocations;
+};
+
+struct FrameStats {
+    StageStats handleMessageTransaction;
+    StageStats handlePageFlip;
+    StageStats composition;
+    StageStats postComposition;
+
+    nsecs_t duration() const {
+        return handleMessageTransaction.duration + handlePageFlip.duration +
+                composition.duration + postComposition.duration;
+    }
+
+    FrameStats& operator+=(const FrameStats& other) {
+        handleMessageTransaction += other.handleMessageTransaction;
+        handlePageFlip += other.handlePageFlip;
+        composition += other.composition;
+        postComposition += other.postComposition;
+        return *this;
+    }
+};
+
+// Times CompositionEngine::present, which onMessageRefresh calls before
+// postComposition.
+class TimedCompositionEngine : public compositionengine::impl::CompositionEngine {
+public:
+    void present(compositionengine::CompositionRefreshArgs& args) override {
+        StageTimer timer(mPresentStats);
+        compositionengine::impl::CompositionEngine::present(args);
+    }
+
+    StageStats takePresentStats() { return std::exchange(mPresentStats, {}); }
+
+private:
+    StageStats mPresentStats;
+};
+
+struct SceneConfig {
+    size_t layerCount;
+    size_t transactionsPerFrame;
+    // The layers are nested in chains of |depth| layers, each a child of the
+    // previous one.
+    size_t depth;
+    size_t displayCount;
+};
+
+// A SurfaceFlinger instance on fake displays, composing a synthetic scene.
+class Scene {
+public:
+    explicit Scene(const SceneConfig& config) : mConfig(config) {
+        LOG_ALWAYS_FATAL_IF(mConfig.displayCount == 0 || mConfig.displayCount > kMaxDisplays,
+                            "Unsupported display count %zu", mConfig.displayCount);
+        LOG_ALWAYS_FATAL_IF(mConfig.depth == 0, "Depth must be at least 1");
+
+        mFlinger.mutableEventQueue().reset(new NiceMock<mock::MessageQueue>());
+        mFlinger.setupCompositionEngine(std::unique_ptr<TimedCompositionEngine>(mCompositionEngine));
+        setupScheduler();
+        setupComposer();
+        mFlinger.setupRenderEngine(std::unique_ptr<renderengine::RenderEngine>(
+                new NiceMock<renderengine::mock::RenderEngine>()));
+
+        for (size_t i = 0; i < mConfig.displayCount; i++) {
+            addDisplay(i);
+        }
+
+        mClient = new Client(mFlinger.flinger());
+        for (size_t i = 0; i < kBuffersPerLayer; i++) {
+            mBuffers.push_back(createBuffer());
+        }
+        for (size_t i = 0; i < std::max<size_t>(mConfig.transactionsPerFrame, 1); i++) {
+            mApplyTokens.push_back(new BBinder());
+        }
+        addLayers();
+    }
+
+    ~Scene() {
+        // Destroying the handles removes the layers, which the next
+        // transaction commits.
+        mHandles.clear();
+        mLayers.clear();
+        mFlinger.handleMessageTransaction();
+        for (const auto& display : mDisplays) {
+            display->getCompositionDisplay()->clearOutputLayers();
+        }
+        mFlinger.mutableCurrentState().layersSortedByZ.clear();
+        mFlinger.mutableDrawingState().layersSortedByZ.clear();
+    }
+
+    FrameStats runFrame() {
+        // Applied as by a client, outside of the main thread.
+        for (size_t i = 0; i < mConfig.transactionsPerFrame; i++) {
+            updateLayer(mNextLayer, mApplyTokens[i]);
+            mNextLayer = (mNextLayer + 1) % mLayers.size();
+        }
+
+        FrameStats stats;
+        {
+            StageTimer timer(stats.handleMessageTransaction);
+            mFlinger.handleMessageTransaction();
+        }
+        {
+            StageTimer timer(stats.handlePageFlip);
+            mFlinger.handleMessageInvalidate();
+        }
+        StageStats refresh;
+        {
+            StageTimer timer(refresh);
+            mFlinger.onMessageRefresh();
+        }
+        stats.composition = mCompositionEngine->takePresentStats();
+        stats.postComposition.duration = refresh.duration - stats.composition.duration;
+        stats.postComposition.allocations = refresh.allocations - stats.composition.allocations;
+        return stats;
+    }
+
+private:
+    static std::unique_ptr<mock::EventThread> createEventThread() {
+        auto eventThread = std::make_unique<NiceMock<mock::EventThread>>();
+        const sp<EventThreadConnection> connection =
+                new EventThreadConnection(eventThread.get(), ResyncCallback(),
+                                          ISurfaceComposer::eConfigChangedSuppress);
+        ON_CALL(*eventThread, createEventConnection(_, _)).WillByDefault(Return(connection));
+        return eventThread;
+    }
+
+    void setupScheduler() {
+        auto primaryDispSync = std::make_unique<NiceMock<mock::DispSync>>();
+        ON_CALL(*primaryDispSync, computeNextRefresh(_, _)).WillByDefault(Return(0));
+        ON_CALL(*primaryDispSync, getPeriod())
+                .WillByDefault(Return(FakeHwcDisplayInjector::DEFAULT_REFRESH_RATE));
+        ON_CALL(*primaryDispSync, expectedPresentTime(_)).WillByDefault(Return(0));
+
+        mFlinger.setupScheduler(std::move(primaryDispSync),
+                                std::make_unique<NiceMock<mock::EventControlThread>>(),
+                                createEventThread(), createEventThread());
+    }
+
+    void setupComposer() {
+        mComposer = new NiceMock<Hwc2::mock::Composer>();
+        ON_CALL(*mComposer, createLayer(_, _))
+                .WillByDefault(Invoke([this](hal::HWDisplayId, hal::HWLayerId* outLayer) {
+                    *outLayer = mNextHwcLayerId++;
+                    return hal::Error::NONE;
+                }));
+        // Accepts every layer as requested, as a HWC with enough planes would.
+        ON_CALL(*mComposer, presentOrValidateDisplay(_, _, _, _, _))
+                .WillByDefault(DoAll(SetArgPointee<1>(0u), SetArgPointee<2>(0u),
+                                     SetArgPointee<3>(-1), SetArgPointee<4>(0u),
+                                     Return(hal::Error::NONE)));
+        mFlinger.setupComposer(std::unique_ptr<Hwc2::Composer>(mComposer));
+    }
+
+    void addDisplay(size_t index) {
+        const bool isPrimary = index == 0;
+        const DisplayId displayId{kFirstDisplayId + index};
+        const hal::HWDisplayId hwcDisplayId = kFirstHwcDisplayId + index;
+        const auto connectionType =
+                isPrimary ? DisplayConnectionType::Internal : DisplayConnectionType::External;
+
+        FakeHwcDisplayInjector(displayId, hal::DisplayType::PHYSICAL, isPrimary)
+                .setHwcDisplayId(hwcDisplayId)
+                .setWidth(kDisplayWidth)
+                .setHeight(kDisplayHeight)
+                .inject(&mFlinger, mComposer);
+
+        sp<NiceMock<mock::NativeWindow>> nativeWindow = new NiceMock<mock::NativeWindow>();
+        ON_CALL(*nativeWindow, query(NATIVE_WINDOW_WIDTH, _))
+                .WillByDefault(DoAll(SetArgPointee<1>(kDisplayWidth), Return(0)));
+        ON_CALL(*nativeWindow, query(NATIVE_WINDOW_HEIGHT, _))
+                .WillByDefault(DoAll(SetArgPointee<1>(kDisplayHeight), Return(0)));
+
+        sp<NiceMock<compositionengine::mock::DisplaySurface>> displaySurface =
+                new NiceMock<compositionengine::mock::DisplaySurface>();
+        ON_CALL(*displaySurface, getClientTargetAcquireFence())
+                .WillByDefault(ReturnRef(mClientTargetAcquireFence));
+
+        auto compositionDisplay = compositionengine::impl::
+                createDisplay(mFlinger.getCompositionEngine(),
+                              compositionengine::DisplayCreationArgsBuilder()
+                                      .setPhysical({displayId, connectionType})
+                                      .setPixels({kDisplayWidth, kDisplayHeight})
+                                      .setLayerStackId(kLayerStack)
+                                      .setPowerAdvisor(&mPowerAdvisor)
+                                      .setName("Benchmark display " + std::to_string(index))
+                                      .build());
+
+        sp<DisplayDevice> display = FakeDisplayDeviceInjector(mFlinger, compositionDisplay,
+                                                              connectionType, hwcDisplayId,
+                                                              isPrimary)
+                                            .setDisplaySurface(displaySurface)
+                                            .setNativeWindow(nativeWindow)
+                                            .setPowerMode(hal::PowerMode::ON)
+                                            .inject();
+        display->setLayerStack(kLayerStack);
+        mDisplays.push_back(display);
+    }
+
+    // Returns a buffer with the metadata of a real one, but no memory behind
+    // it, which neither the mock HWC nor the mock RenderEngine read.
+    static sp<GraphicBuffer> createBuffer() {
+        static native_handle_t* const sHandle = native_handle_create(0, 0);
+        return new GraphicBuffer(sHandle, GraphicBuffer::WRAP_HANDLE, kLayerSize, kLayerSize,
+                                 PIXEL_FORMAT_RGBA_8888, 1, kBufferUsage, kLayerSize);
+    }
+
+    void addLayers() {
+        Vector<ComposerState> states;
+        for (size_t i = 0; i < mConfig.layerCount; i++) {
+            LayerCreationArgs args(mFlinger.flinger(), mClient, "BenchmarkLayer#" + std::to_string(i),
+                                   kLayerSize, kLayerSize, 0 /* flags */, LayerMetadata());
+            args.textureName = static_cast<uint32_t>(i + 1);
+            sp<Layer> layer = new BufferStateLayer(args);
+            sp<IBinder> handle = layer->getHandle();
+
+            const sp<Layer> parent = (i % mConfig.depth) ? mLayers.back() : nullptr;
+            mFlinger.addClientLayer(mClient, handle, layer, parent);
+            mLayers.push_back(layer);
+            mHandles.push_back(handle);
+            mLayerUpdateCounts.push_back(0);
+
+            ComposerState state;
+            state.state.surface = handle;
+            state.state.what = layer_state_t::eLayerChanged | layer_state_t::eFrameChanged;
+            state.state.z = static_cast<int32_t>(i);
+            state.state.frame = Rect(0, 0, kLayerSize, kLayerSize);
+            states.add(state);
+        }
+        mFlinger.setTransactionFlags(eTransactionNeeded);
+        applyTransaction(states, new BBinder());
+
+        for (size_t i = 0; i < mLayers.size(); i++) {
+            updateLayer(i, mApplyTokens[0]);
+        }
+    }
+
+    // Sets the next buffer and a new position on the layer at |index|.
+    void updateLayer(size_t index, const sp<IBinder>& applyToken) {
+        const uint64_t updateCount = mLayerUpdateCounts[index]++;
+
+        ComposerState state;
+        state.state.surface = mHandles[index];
+        state.state.what = layer_state_t::eBufferChanged | layer_state_t::eAcquireFenceChanged |
+                layer_state_t::ePositionChanged;
+        state.state.buffer = mBuffers[updateCount % mBuffers.size()];
+        state.state.acquireFence = Fence::NO_FENCE;
+        // Layers of a chain are laid out diagonally, and move a little with
+        // every update, so that their geometry changes.
+        state.state.x = static_cast<float>(index % 5 * 10 + updateCount % 8);
+        state.state.y = static_cast<float>(index % 20 * 10);
+
+        Vector<ComposerState> states;
+        states.add(state);
+        applyTransaction(states, applyToken);
+    }
+
+    void applyTransaction(const Vector<ComposerState>& states, const sp<IBinder>& applyToken) {
+        std::vector<ListenerCallbacks> listenerCallbacks;
+        mFlinger.setTransactionState(states, {}, 0 /* flags */, applyToken, {},
+                                     -1 /* desiredPresentTime */, {},
+                                     false /* hasListenerCallbacks */, listenerCallbacks);
+    }
+
+    const SceneConfig mConfig;
+
+    // Used by the displays, so they must outlive mFlinger.
+    NiceMock<Hwc2::mock::PowerAdvisor> mPowerAdvisor;
+    sp<Fence> mClientTargetAcquireFence = Fence::NO_FENCE;
+
+    TestableSurfaceFlinger mFlinger;
+    // Owned by mFlinger.
+    TimedCompositionEngine* const mCompositionEngine = new TimedCompositionEngine();
+    NiceMock<Hwc2::mock::Composer>* mComposer = nullptr;
+    hal::HWLayerId mNextHwcLayerId = 1;
+
+    std::vector<sp<DisplayDevice>> mDisplays;
+    sp<Client> mClient;
+    std::vector<sp<GraphicBuffer>> mBuffers;
+    std::vector<sp<Layer>> mLayers;
+    std::vector<sp<IBinder>> mHandles;
+    std::vector<uint64_t> mLayerUpdateCounts;
+    // One per transaction of a frame, as each comes from a different client.
+    std::vector<sp<IBinder>> mApplyTokens;
+    size_t mNextLayer = 0;
+};
+
+void reportStage(benchmark::State& state, const std::string& name, const StageStats& stats) {
+    state.counters[name + "_us"] =
+            benchmark::Counter(static_cast<double>(stats.duration) / 1000.0,
+                               benchmark::Counter::kAvgIterations);
+    state.counters[name + "_allocs"] =
+            benchmark::Counter(static_cast<double>(stats.allocations),
+                               benchmark::Counter::kAvgIterations);
+}
+
+void BM_Frame(benchmark::State& state) {
+    Scene scene({static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)),
+                 static_cast<size_t>(state.range(2)), static_cast<size_t>(state.range(3))});
+    for (int i = 0; i < kWarmUpFrames; i++) {
+        scene.runFrame();
+    }
+
+    FrameStats total;
+    for (auto _ : state) {
+        const FrameStats frame = scene.runFrame();
+        state.SetIterationTime(static_cast<double>(frame.duration()) / 1e9);
+        total += frame;
+    }
+
+    reportStage(state, "handleMessageTransaction", total.handleMessageTransaction);
+    reportStage(state, "handlePageFlip", total.handlePageFlip);
+    reportStage(state, "composition", total.composition);
+    reportStage(state, "postComposition", total.postComposition);
+}
+BENCHMARK(BM_Frame)
+        ->ArgNames({"layers", "transactions", "depth", "displays"})
+        // A static scene.
+        ->Args({10, 0, 1, 1})
+        // A few apps updating at once.
+        ->Args({10, 1, 1, 1})
+        ->Args({50, 5, 1, 1})
+        ->Args({100, 20, 1, 1})
+        // Deep hierarchies, as in apps made of many surfaces.
+        ->Args({50, 5, 5, 1})
+        ->Args({50, 5, 25, 1})
+        // Mirrored on an external display.
+        ->Args({50, 5, 1, 2})
+        ->UseManualTime();
+
+} // namespace
+} // namespace android
+
+BENCHMARK_MAIN();